@@ -1577,6 +1577,7 @@ AC_SUBST(INSTALL_KAUTH)
 AC_CHECK_FUNCS([ \
 	arc4random \
 	fcntl \
+	fdatasync \
 	fseeko64 \
 	ftello64 \
 	getcwd \
@@ -1594,9 +1595,12 @@ AC_CHECK_FUNCS([ \
 	pwrite \
 	pwritev \
 	pwritev64 \
+	recvmmsg \
 	regcomp \
 	regerror \
 	regexec \
+	sched_getcpu \
+	sendmmsg \
 	setitimer \
 	setvbuf \
 	sigaction \
@@ -1747,16 +1751,43 @@ case $AFS_SYSNAME in
      AC_MSG_RESULT(no)
    fi
    AC_MSG_CHECKING([for vectored positional I/O])
+   dnl The 64 bit variants are only needed where O_LARGEFILE is defined;
+   dnl elsewhere off_t is already 64 bits wide (see ihandle.h)
+   openafs_piov=no
    AS_IF([test "$ac_cv_func_preadv" = "yes" -a \
-               "$ac_cv_func_pwritev" = "yes" -a \
-	       "$ac_cv_func_preadv64" = "yes" -a \
-	       "$ac_cv_func_pwritev64" = "yes"],
+               "$ac_cv_func_pwritev" = "yes"],
+	 [AS_IF([test "$ac_cv_func_preadv64" = "yes" -a \
+		      "$ac_cv_func_pwritev64" = "yes"],
+		[openafs_piov=yes],
+		[AC_COMPILE_IFELSE(
+		    [AC_LANG_PROGRAM([[#include <fcntl.h>]],
+				     [[#ifdef O_LARGEFILE
+				       #error preadv64 is required
+				       #endif]])],
+		    [openafs_piov=yes])])])
+   AS_IF([test "$openafs_piov" = "yes"],
 	 [AC_DEFINE(HAVE_PIOV, 1, [define if you have preadv() and pwritev()])
   	  AC_MSG_RESULT(yes)],
 	 [AC_MSG_RESULT(no)])
    ;;
 esac
 
+dnl The io_uring backend for the ihandle package drives the rings through
+dnl the raw system calls, so it only needs the kernel headers.
+AC_MSG_CHECKING([for io_uring])
+AC_COMPILE_IFELSE(
+    [AC_LANG_PROGRAM([[#include <unistd.h>
+		       #include <sys/syscall.h>
+		       #include <linux/io_uring.h>]],
+		     [[struct io_uring_params p;
+		       struct io_uring_probe probe;
+		       return syscall(__NR_io_uring_setup, 1, &p) +
+			   IORING_OP_READ + IORING_REGISTER_PROBE;]])],
+    [AC_DEFINE(HAVE_IO_URING, 1,
+	       [define if the kernel headers provide io_uring])
+     AC_MSG_RESULT(yes)],
+    [AC_MSG_RESULT(no)])
+
 AC_MSG_CHECKING([for POSIX regex library])
 if test "$ac_cv_header_regex_h" = "yes" && \
 	test "$ac_cv_func_regcomp" = "yes" && \
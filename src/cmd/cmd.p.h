@@ -21,7 +21,7 @@
 #define CMD_HIDDEN      4	/* A hidden command - similar to CMD_HIDE */
 
 #define CMD_HELPPARM	(CMD_MAXPARMS-1)	/* last one is used by -help switch */
-#define	CMD_MAXPARMS	64	/* max number of parm types to a cmd line */
+#define	CMD_MAXPARMS	100	/* max number of parm types to a cmd line */
 
 /* parse items are here */
 struct cmd_item {
@@ -223,9 +223,29 @@ struct opr_queue rx_idleServerQueue;
 afs_kmutex_t rx_atomic_mutex;
 #endif
 
+/* Number of times we've had to wait for a connection or peer hash chain
+ * lock; reported by rxdebug. */
+rx_atomic_t rx_connHashWaits = RX_ATOMIC_INIT(0);
+rx_atomic_t rx_peerHashWaits = RX_ATOMIC_INIT(0);
+
 /* Forward prototypes */
 static struct rx_call * rxi_NewCall(struct rx_connection *, int);
 
+#ifdef RX_ENABLE_LOCKS
+static void
+rxi_InitHashLocks(void)
+{
+    int i;
+
+    for (i = 0; i < RX_HASH_LOCKS; i++) {
+	MUTEX_INIT(&rx_connHashLocks[i], "rx_connHashLocks", MUTEX_DEFAULT,
+		   0);
+	MUTEX_INIT(&rx_peerHashLocks[i], "rx_peerHashLocks", MUTEX_DEFAULT,
+		   0);
+    }
+}
+#endif
+
 static_inline void
 putConnection (struct rx_connection *conn) {
     MUTEX_ENTER(&rx_refcnt_mutex);
@@ -303,8 +323,7 @@ rxi_InitPthread(void)
 	       0);
     CV_INIT(&rx_waitingForPackets_cv, "rx_waitingForPackets_cv", CV_DEFAULT,
 	    0);
-    MUTEX_INIT(&rx_peerHashTable_lock, "rx_peerHashTable_lock", MUTEX_DEFAULT,
-	       0);
+    rxi_InitHashLocks();
     MUTEX_INIT(&rx_connHashTable_lock, "rx_connHashTable_lock", MUTEX_DEFAULT,
 	       0);
     MUTEX_INIT(&rx_serverPool_lock, "rx_serverPool_lock", MUTEX_DEFAULT, 0);
@@ -386,15 +405,16 @@ static afs_kmutex_t rx_rpc_stats;
 /* We keep a "last conn pointer" in rxi_FindConnection. The odds are
 ** pretty good that the next packet coming in is from the same connection
 ** as the last packet, since we're send multiple packets in a transmit window.
+** There is one for each hash chain lock, protected by that lock.
 */
-struct rx_connection *rxLastConn = 0;
+static struct rx_connection *rxLastConn[RX_HASH_LOCKS];
 
 #ifdef RX_ENABLE_LOCKS
 /* The locking hierarchy for rx fine grain locking is composed of these
  * tiers:
  *
- * rx_connHashTable_lock - synchronizes conn creation, rx_connHashTable access
- *                         also protects updates to rx_nextCid
+ * rx_connHashLocks - synchronize conn creation and lookup, each protects
+ *                    the rx_connHashTable chains which hash to it
  * conn_call_lock - used to synchonize rx_EndCall and rx_NewCall
  * call->lock - locks call data fields.
  * These are independent of each other:
@@ -404,12 +424,16 @@ struct rx_connection *rxLastConn = 0;
  * freeSQEList_lock
  *
  * serverQueueEntry->lock
- * rx_peerHashTable_lock - locked under rx_connHashTable_lock
+ * rx_peerHashLocks - locked under rx_connHashLocks; each protects the
+ *                    rx_peerHashTable chains which hash to it, and the
+ *                    refCount of the peers on them
+ * rx_connHashTable_lock - protects rx_nextCid and rx_connCleanup_list
  * rx_rpc_stats
  * peer->lock - locks peer data fields.
  * conn_data_lock - that more than one thread is not updating a conn data
  *		    field at the same time.
  * rx_freePktQ_lock
+ * rx_packetDepots[].lock - each protects one of the per-CPU packet depots
  *
  * lowest level:
  *	multi_handle->lock
@@ -508,8 +532,7 @@ rx_InitHost(u_int host, u_int port)
 	       0);
     CV_INIT(&rx_waitingForPackets_cv, "rx_waitingForPackets_cv", CV_DEFAULT,
 	    0);
-    MUTEX_INIT(&rx_peerHashTable_lock, "rx_peerHashTable_lock", MUTEX_DEFAULT,
-	       0);
+    rxi_InitHashLocks();
     MUTEX_INIT(&rx_connHashTable_lock, "rx_connHashTable_lock", MUTEX_DEFAULT,
 	       0);
     MUTEX_INIT(&rx_serverPool_lock, "rx_serverPool_lock", MUTEX_DEFAULT, 0);
@@ -533,6 +556,9 @@ rx_InitHost(u_int host, u_int port)
     /* Malloc up a bunch of packets & buffers */
     rx_nFreePackets = 0;
     opr_queue_Init(&rx_freePacketQueue);
+#ifdef RX_ENABLE_TSFPQ
+    rxi_InitPacketDepots();
+#endif
     rxi_NeedMorePackets = FALSE;
     rx_nPackets = 0;	/* rx_nPackets is managed by rxi_MorePackets* */
 
@@ -547,6 +573,9 @@ rx_InitHost(u_int host, u_int port)
     rxi_MorePackets(rx_extraPackets + RX_MAX_QUOTA + 2);        /* fudge */
 #endif /* RX_ENABLE_TSFPQ */
     rx_CheckPackets();
+#ifdef RX_ENABLE_TSFPQ
+    rx_minPackets = rx_nPackets;
+#endif
 
     NETPRI;
 
@@ -1021,10 +1050,11 @@ rx_NewConnection(afs_uint32 shost, u_short sport, u_short sservice,
 #endif
     NETPRI;
     MUTEX_ENTER(&rx_connHashTable_lock);
-    conn->type = RX_CLIENT_CONNECTION;
-    conn->epoch = rx_epoch;
     conn->cid = rx_nextCid;
     update_nextCid();
+    MUTEX_EXIT(&rx_connHashTable_lock);
+    conn->type = RX_CLIENT_CONNECTION;
+    conn->epoch = rx_epoch;
     conn->peer = rxi_FindPeer(shost, sport, 1);
     conn->serviceId = sservice;
     conn->securityObject = securityObject;
@@ -1050,11 +1080,12 @@ rx_NewConnection(afs_uint32 shost, u_short sport, u_short sservice,
 	CONN_HASH(shost, sport, conn->cid, conn->epoch, RX_CLIENT_CONNECTION);
 
     conn->refCount++;		/* no lock required since only this thread knows... */
+    CONN_HASH_LOCK(hashindex);
     conn->next = rx_connHashTable[hashindex];
     rx_connHashTable[hashindex] = conn;
+    CONN_HASH_UNLOCK(hashindex);
     if (rx_stats_active)
 	rx_atomic_inc(&rx_stats.nClientConns);
-    MUTEX_EXIT(&rx_connHashTable_lock);
     USERPRI;
     return conn;
 }
@@ -1121,11 +1152,13 @@ int rxi_lowConnRefCount = 0;
 
 /*
  * Cleanup a connection that was destroyed in rxi_DestroyConnectioNoLock.
- * NOTE: must not be called with rx_connHashTable_lock held.
+ * NOTE: must not be called with any of the rx_connHashLocks held.
  */
 static void
 rxi_CleanupConnection(struct rx_connection *conn)
 {
+    int peerindex;
+
     /* Notify the service exporter, if requested, that this connection
      * is being destroyed */
     if (conn->type == RX_SERVER_CONNECTION && conn->service->destroyConnProc)
@@ -1138,7 +1171,8 @@ rxi_CleanupConnection(struct rx_connection *conn)
      * idle time to now. rxi_ReapConnections will reap it if it's still
      * idle (refCount == 0) after rx_idlePeerTime (60 seconds) have passed.
      */
-    MUTEX_ENTER(&rx_peerHashTable_lock);
+    peerindex = PEER_HASH_INDEX(conn->peer);
+    PEER_HASH_LOCK(peerindex);
     if (conn->peer->refCount < 2) {
 	conn->peer->idleWhen = clock_Sec();
 	if (conn->peer->refCount < 1) {
@@ -1151,7 +1185,7 @@ rxi_CleanupConnection(struct rx_connection *conn)
 	}
     }
     conn->peer->refCount--;
-    MUTEX_EXIT(&rx_peerHashTable_lock);
+    PEER_HASH_UNLOCK(peerindex);
 
     if (rx_stats_active)
     {
@@ -1181,23 +1215,34 @@ rxi_CleanupConnection(struct rx_connection *conn)
     rxi_FreeConnection(conn);
 }
 
-/* Destroy the specified connection */
-void
-rxi_DestroyConnection(struct rx_connection *conn)
+/* Clean up every connection on the list of destroyed connections */
+static void
+rxi_CleanupConnections(void)
 {
+    struct rx_connection *conn;
+
     MUTEX_ENTER(&rx_connHashTable_lock);
-    rxi_DestroyConnectionNoLock(conn);
-    /* conn should be at the head of the cleanup list */
-    if (conn == rx_connCleanup_list) {
+    while (rx_connCleanup_list) {
+	conn = rx_connCleanup_list;
 	rx_connCleanup_list = rx_connCleanup_list->next;
 	MUTEX_EXIT(&rx_connHashTable_lock);
 	rxi_CleanupConnection(conn);
+	MUTEX_ENTER(&rx_connHashTable_lock);
     }
-#ifdef RX_ENABLE_LOCKS
-    else {
-	MUTEX_EXIT(&rx_connHashTable_lock);
-    }
-#endif /* RX_ENABLE_LOCKS */
+    MUTEX_EXIT(&rx_connHashTable_lock);
+}
+
+/* Destroy the specified connection */
+void
+rxi_DestroyConnection(struct rx_connection *conn)
+{
+    int hashindex = CONN_HASH(conn->peer->host, conn->peer->port, conn->cid,
+			      conn->epoch, conn->type);
+
+    CONN_HASH_LOCK(hashindex);
+    rxi_DestroyConnectionNoLock(conn);
+    CONN_HASH_UNLOCK(hashindex);
+    rxi_CleanupConnections();
 }
 
 static void
@@ -1206,6 +1251,7 @@ rxi_DestroyConnectionNoLock(struct rx_connection *conn)
     struct rx_connection **conn_ptr;
     int havecalls = 0;
     struct rx_packet *packet;
+    int hashindex;
     int i;
     SPLVAR;
 
@@ -1308,11 +1354,10 @@ rxi_DestroyConnectionNoLock(struct rx_connection *conn)
     }
 
     /* Remove from connection hash table before proceeding */
-    conn_ptr =
-	&rx_connHashTable[CONN_HASH
-			  (peer->host, peer->port, conn->cid, conn->epoch,
-			   conn->type)];
-    for (; *conn_ptr; conn_ptr = &(*conn_ptr)->next) {
+    hashindex = CONN_HASH(conn->peer->host, conn->peer->port, conn->cid,
+			  conn->epoch, conn->type);
+    for (conn_ptr = &rx_connHashTable[hashindex]; *conn_ptr;
+	 conn_ptr = &(*conn_ptr)->next) {
 	if (*conn_ptr == conn) {
 	    *conn_ptr = conn->next;
 	    break;
@@ -1320,8 +1365,8 @@ rxi_DestroyConnectionNoLock(struct rx_connection *conn)
     }
     /* if the conn that we are destroying was the last connection, then we
      * clear rxLastConn as well */
-    if (rxLastConn == conn)
-	rxLastConn = 0;
+    if (rxLastConn[hashindex % RX_HASH_LOCKS] == conn)
+	rxLastConn[hashindex % RX_HASH_LOCKS] = 0;
 
     /* Make sure the connection is completely reset before deleting it. */
     /* get rid of pending events that could zap us later */
@@ -1333,8 +1378,10 @@ rxi_DestroyConnectionNoLock(struct rx_connection *conn)
      * need to be cleaned up. This is necessary to avoid deadlocks
      * in the routines we call to inform others that this connection is
      * being destroyed. */
+    MUTEX_ENTER(&rx_connHashTable_lock);
     conn->next = rx_connCleanup_list;
     rx_connCleanup_list = conn;
+    MUTEX_EXIT(&rx_connHashTable_lock);
 }
 
 /* Externally available version */
@@ -1780,6 +1827,7 @@ rx_NewServiceHost(afs_uint32 host, u_short port, u_short serviceId,
 	    service->connDeadTime = rx_connDeadTime;
 	    service->executeRequestProc = serviceProc;
 	    service->checkReach = 0;
+	    service->ccAlgorithm = RX_CC_DEFAULT;
 	    service->nSpecific = 0;
 	    service->specific = NULL;
 	    rx_services[i] = service;	/* not visible until now */
@@ -2085,6 +2133,9 @@ rx_GetCall(int tno, struct rx_service *cur_service, osi_socket * socketp)
 #ifndef AFS_AIX41_ENV
 	    rx_waitForPacket = sq;
 #endif /* AFS_AIX41_ENV */
+#ifdef RX_ENABLE_TSFPQ
+	    rxi_IdleLocalPacketsTSFPQ();
+#endif
 	    do {
 		CV_WAIT(&sq->cv, &rx_serverPool_lock);
 #ifdef	KERNEL
@@ -2495,7 +2546,7 @@ rx_EndCall(struct rx_call *call, afs_int32 rc)
 void
 rx_Finalize(void)
 {
-    struct rx_connection **conn_ptr, **conn_end;
+    int hashindex;
 
     INIT_PTHREAD_LOCKS;
     if (rx_atomic_test_and_set_bit(&rxinit_status, 0))
@@ -2503,12 +2554,11 @@ rx_Finalize(void)
 
     rxi_DeleteCachedConnections();
     if (rx_connHashTable) {
-	MUTEX_ENTER(&rx_connHashTable_lock);
-	for (conn_ptr = &rx_connHashTable[0], conn_end =
-	     &rx_connHashTable[rx_hashTableSize]; conn_ptr < conn_end;
-	     conn_ptr++) {
+	for (hashindex = 0; hashindex < rx_hashTableSize; hashindex++) {
 	    struct rx_connection *conn, *next;
-	    for (conn = *conn_ptr; conn; conn = next) {
+
+	    CONN_HASH_LOCK(hashindex);
+	    for (conn = rx_connHashTable[hashindex]; conn; conn = next) {
 		next = conn->next;
 		if (conn->type == RX_CLIENT_CONNECTION) {
                     MUTEX_ENTER(&rx_refcnt_mutex);
@@ -2521,17 +2571,10 @@ rx_Finalize(void)
 #endif /* RX_ENABLE_LOCKS */
 		}
 	    }
+	    CONN_HASH_UNLOCK(hashindex);
 	}
 #ifdef RX_ENABLE_LOCKS
-	while (rx_connCleanup_list) {
-	    struct rx_connection *conn;
-	    conn = rx_connCleanup_list;
-	    rx_connCleanup_list = rx_connCleanup_list->next;
-	    MUTEX_EXIT(&rx_connHashTable_lock);
-	    rxi_CleanupConnection(conn);
-	    MUTEX_ENTER(&rx_connHashTable_lock);
-	}
-	MUTEX_EXIT(&rx_connHashTable_lock);
+	rxi_CleanupConnections();
 #endif /* RX_ENABLE_LOCKS */
     }
     rxi_flushtrace();
@@ -2666,6 +2709,8 @@ rxi_NewCall(struct rx_connection *conn, int channel)
 	opr_queue_Init(&call->tq);
 	opr_queue_Init(&call->rq);
 	opr_queue_Init(&call->app.iovq);
+	call->rqCount = 0;
+	call->tsend = NULL;
 #ifdef RXDEBUG_PACKET
         call->rqc = call->tqc = call->iovqc = 0;
 #endif /* RXDEBUG_PACKET */
@@ -2822,68 +2867,65 @@ rxi_Free(void *addr, size_t size)
     osi_Free(addr, size);
 }
 
+/* Lower the MTU of a peer.  Called with the peer's hash chain lock held;
+ * the lock is dropped while the peer is being updated. */
+static void
+rxi_AdjustPeerMtu(struct rx_peer *peer, int hashIndex, int mtu)
+{
+    peer->refCount++;
+    PEER_HASH_UNLOCK(hashIndex);
+
+    MUTEX_ENTER(&peer->peer_lock);
+    /* We don't handle dropping below min, so don't */
+    mtu = MAX(mtu, RX_MIN_PACKET_SIZE);
+    peer->ifMTU=MIN(mtu, peer->ifMTU);
+    peer->natMTU = rxi_AdjustIfMTU(peer->ifMTU);
+    /* if we tweaked this down, need to tune our peer MTU too */
+    peer->MTU = MIN(peer->MTU, peer->natMTU);
+    /* if we discovered a sub-1500 mtu, degrade */
+    if (peer->ifMTU < OLD_MAX_PACKET_SIZE)
+	peer->maxDgramPackets = 1;
+    /* We no longer have valid peer packet information */
+    if (peer->maxPacketSize + RX_HEADER_SIZE > peer->ifMTU)
+	peer->maxPacketSize = 0;
+    MUTEX_EXIT(&peer->peer_lock);
+
+    PEER_HASH_LOCK(hashIndex);
+    peer->refCount--;
+}
+
 void
 rxi_SetPeerMtu(struct rx_peer *peer, afs_uint32 host, afs_uint32 port, int mtu)
 {
-    struct rx_peer **peer_ptr = NULL, **peer_end = NULL;
-    struct rx_peer *next = NULL;
     int hashIndex;
 
-    if (!peer) {
-	MUTEX_ENTER(&rx_peerHashTable_lock);
-	if (port == 0) {
-	    peer_ptr = &rx_peerHashTable[0];
-	    peer_end = &rx_peerHashTable[rx_hashTableSize];
-	    next = NULL;
-	resume:
-	    for ( ; peer_ptr < peer_end; peer_ptr++) {
-		if (!peer)
-		    peer = *peer_ptr;
-		for ( ; peer; peer = next) {
-		    next = peer->next;
-		    if (host == peer->host)
-			break;
-		}
-	    }
-	} else {
-	    hashIndex = PEER_HASH(host, port);
+    if (peer) {
+	hashIndex = PEER_HASH_INDEX(peer);
+	PEER_HASH_LOCK(hashIndex);
+	rxi_AdjustPeerMtu(peer, hashIndex, mtu);
+	PEER_HASH_UNLOCK(hashIndex);
+    } else if (port == 0) {
+	/* Every peer on this host.  The reference held by rxi_AdjustPeerMtu
+	 * keeps the peer on its chain while the lock is dropped. */
+	for (hashIndex = 0; hashIndex < rx_hashTableSize; hashIndex++) {
+	    PEER_HASH_LOCK(hashIndex);
 	    for (peer = rx_peerHashTable[hashIndex]; peer; peer = peer->next) {
-		if ((peer->host == host) && (peer->port == port))
-		    break;
+		if (host == peer->host)
+		    rxi_AdjustPeerMtu(peer, hashIndex, mtu);
 	    }
+	    PEER_HASH_UNLOCK(hashIndex);
 	}
     } else {
-	MUTEX_ENTER(&rx_peerHashTable_lock);
-    }
-
-    if (peer) {
-        peer->refCount++;
-        MUTEX_EXIT(&rx_peerHashTable_lock);
-
-        MUTEX_ENTER(&peer->peer_lock);
-	/* We don't handle dropping below min, so don't */
-	mtu = MAX(mtu, RX_MIN_PACKET_SIZE);
-        peer->ifMTU=MIN(mtu, peer->ifMTU);
-        peer->natMTU = rxi_AdjustIfMTU(peer->ifMTU);
-	/* if we tweaked this down, need to tune our peer MTU too */
-	peer->MTU = MIN(peer->MTU, peer->natMTU);
-	/* if we discovered a sub-1500 mtu, degrade */
-	if (peer->ifMTU < OLD_MAX_PACKET_SIZE)
-	    peer->maxDgramPackets = 1;
-	/* We no longer have valid peer packet information */
-	if (peer->maxPacketSize + RX_HEADER_SIZE > peer->ifMTU)
-	    peer->maxPacketSize = 0;
-        MUTEX_EXIT(&peer->peer_lock);
-
-        MUTEX_ENTER(&rx_peerHashTable_lock);
-        peer->refCount--;
-        if (host && !port) {
-            peer = next;
-	    /* pick up where we left off */
-            goto resume;
-        }
+	hashIndex = PEER_HASH(host, port);
+	PEER_HASH_LOCK(hashIndex);
+	for (peer = rx_peerHashTable[hashIndex]; peer; peer = peer->next) {
+	    if ((peer->host == host) && (peer->port == port)) {
+		rxi_AdjustPeerMtu(peer, hashIndex, mtu);
+		break;
+	    }
+	}
+	PEER_HASH_UNLOCK(hashIndex);
     }
-    MUTEX_EXIT(&rx_peerHashTable_lock);
 }
 
 #ifdef AFS_RXERRQ_ENV
@@ -2893,7 +2935,7 @@ rxi_SetPeerDead(struct sock_extended_err *err, afs_uint32 host, afs_uint16 port)
     int hashIndex = PEER_HASH(host, port);
     struct rx_peer *peer;
 
-    MUTEX_ENTER(&rx_peerHashTable_lock);
+    PEER_HASH_LOCK(hashIndex);
 
     for (peer = rx_peerHashTable[hashIndex]; peer; peer = peer->next) {
 	if (peer->host == host && peer->port == port) {
@@ -2902,7 +2944,7 @@ rxi_SetPeerDead(struct sock_extended_err *err, afs_uint32 host, afs_uint16 port)
 	}
     }
 
-    MUTEX_EXIT(&rx_peerHashTable_lock);
+    PEER_HASH_UNLOCK(hashIndex);
 
     if (peer) {
 	rx_atomic_inc(&peer->neterrs);
@@ -2912,9 +2954,9 @@ rxi_SetPeerDead(struct sock_extended_err *err, afs_uint32 host, afs_uint16 port)
 	peer->last_err_code = err->ee_code;
 	MUTEX_EXIT(&peer->peer_lock);
 
-	MUTEX_ENTER(&rx_peerHashTable_lock);
+	PEER_HASH_LOCK(hashIndex);
 	peer->refCount--;
-	MUTEX_EXIT(&rx_peerHashTable_lock);
+	PEER_HASH_UNLOCK(hashIndex);
     }
 }
 
@@ -3025,7 +3067,7 @@ rxi_FindPeer(afs_uint32 host, u_short port, int create)
     struct rx_peer *pp;
     int hashIndex;
     hashIndex = PEER_HASH(host, port);
-    MUTEX_ENTER(&rx_peerHashTable_lock);
+    PEER_HASH_LOCK(hashIndex);
     for (pp = rx_peerHashTable[hashIndex]; pp; pp = pp->next) {
 	if ((pp->host == host) && (pp->port == port))
 	    break;
@@ -3050,7 +3092,7 @@ rxi_FindPeer(afs_uint32 host, u_short port, int create)
     if (pp && create) {
 	pp->refCount++;
     }
-    MUTEX_EXIT(&rx_peerHashTable_lock);
+    PEER_HASH_UNLOCK(hashIndex);
     return pp;
 }
 
@@ -3074,13 +3116,14 @@ rxi_FindConnection(osi_socket socket, afs_uint32 host,
                    int *unknownService)
 {
     int hashindex, flag, i;
-    struct rx_connection *conn;
+    struct rx_connection *conn, *lastConn;
     *unknownService = 0;
     hashindex = CONN_HASH(host, port, cid, epoch, type);
-    MUTEX_ENTER(&rx_connHashTable_lock);
-    rxLastConn ? (conn = rxLastConn, flag = 0) : (conn =
-						  rx_connHashTable[hashindex],
-						  flag = 1);
+    CONN_HASH_LOCK(hashindex);
+    lastConn = rxLastConn[hashindex % RX_HASH_LOCKS];
+    lastConn ? (conn = lastConn, flag = 0) : (conn =
+					      rx_connHashTable[hashindex],
+					      flag = 1);
     for (; conn;) {
 	if ((conn->type == type) && ((cid & RX_CIDMASK) == conn->cid)
 	    && (epoch == conn->epoch)) {
@@ -3090,7 +3133,7 @@ rxi_FindConnection(osi_socket socket, afs_uint32 host,
 		 * like this, and there seems to be some CM bug that makes this
 		 * happen from time to time -- in which case, the fileserver
 		 * asserts. */
-		MUTEX_EXIT(&rx_connHashTable_lock);
+		CONN_HASH_UNLOCK(hashindex);
 		return (struct rx_connection *)0;
 	    }
 	    if (pp->host == host && pp->port == port)
@@ -3103,7 +3146,7 @@ rxi_FindConnection(osi_socket socket, afs_uint32 host,
 		break;
 	}
 	if (!flag) {
-	    /* the connection rxLastConn that was used the last time is not the
+	    /* the connection lastConn that was used the last time is not the
 	     ** one we are looking for now. Hence, start searching in the hash */
 	    flag = 1;
 	    conn = rx_connHashTable[hashindex];
@@ -3113,13 +3156,13 @@ rxi_FindConnection(osi_socket socket, afs_uint32 host,
     if (!conn) {
 	struct rx_service *service;
 	if (type == RX_CLIENT_CONNECTION) {
-	    MUTEX_EXIT(&rx_connHashTable_lock);
+	    CONN_HASH_UNLOCK(hashindex);
 	    return (struct rx_connection *)0;
 	}
 	service = rxi_FindService(socket, serviceId);
 	if (!service || (securityIndex >= service->nSecurityObjects)
 	    || (service->securityObjects[securityIndex] == 0)) {
-	    MUTEX_EXIT(&rx_connHashTable_lock);
+	    CONN_HASH_UNLOCK(hashindex);
             *unknownService = 1;
 	    return (struct rx_connection *)0;
 	}
@@ -3160,8 +3203,9 @@ rxi_FindConnection(osi_socket socket, afs_uint32 host,
     conn->refCount++;
     MUTEX_EXIT(&rx_refcnt_mutex);
 
-    rxLastConn = conn;		/* store this connection as the last conn used */
-    MUTEX_EXIT(&rx_connHashTable_lock);
+    /* store this connection as the last conn used */
+    rxLastConn[hashindex % RX_HASH_LOCKS] = conn;
+    CONN_HASH_UNLOCK(hashindex);
     return conn;
 }
 
@@ -3868,6 +3912,7 @@ rxi_ReceiveDataPacket(struct rx_call *call,
 	    np->flags |= RX_PKTFLAG_RQ;
 #endif
 	    opr_queue_Prepend(&call->rq, &np->entry);
+	    call->rqCount++;
 #ifdef RXDEBUG_PACKET
             call->rqc++;
 #endif /* RXDEBUG_PACKET */
@@ -3938,6 +3983,7 @@ rxi_ReceiveDataPacket(struct rx_call *call,
 	    afs_uint32 prev;	/* "Previous packet" sequence number */
 	    struct opr_queue *cursor;
 	    int missing;	/* Are any predecessors missing? */
+	    int later;		/* Queued packets which follow this one */
 
 	    /* If the new packet's sequence number has been sent to the
 	     * application already, then this is a duplicate */
@@ -3963,10 +4009,13 @@ rxi_ReceiveDataPacket(struct rx_call *call,
 		continue;
 	    }
 
-	    /* Look for the packet in the queue of old received packets */
+	    /* Look for the packet in the queue of old received packets.
+	     * Packets usually arrive in order, even once one has been lost,
+	     * so search from the end of the queue, to keep this cheap when
+	     * the window is large. */
 	    prev = call->rnext - 1;
-	    missing = 0;
-	    for (opr_queue_Scan(&call->rq, cursor)) {
+	    later = 0;
+	    for (opr_queue_ScanBackwards(&call->rq, cursor)) {
 		struct rx_packet *tp
 		    = opr_queue_Entry(cursor, struct rx_packet, entry);
 
@@ -3981,35 +4030,37 @@ rxi_ReceiveDataPacket(struct rx_call *call,
 		    call->rprev = seq;
 		    goto nextloop;
 		}
-		/* If we find a higher sequence packet, break out and
-		 * insert the new packet here. */
-		if (seq < tp->header.seq)
+		/* If we find a lower sequence packet, break out and
+		 * insert the new packet after it. */
+		if (tp->header.seq < seq) {
+		    prev = tp->header.seq;
 		    break;
-		/* Check for missing packet */
-		if (tp->header.seq != prev + 1) {
-		    missing = 1;
 		}
-
-		prev = tp->header.seq;
+		later++;
 	    }
 
+	    /* Predecessors are missing unless every packet from rnext to
+	     * prev is in the queue */
+	    missing = (call->rqCount - later != prev + 1 - call->rnext);
+
 	    /* Keep track of whether we have received the last packet. */
 	    if (flags & RX_LAST_PACKET) {
 		call->flags |= RX_CALL_HAVE_LAST;
 	    }
 
 	    /* It's within the window: add it to the the receive queue.
-	     * tp is left by the previous loop either pointing at the
-	     * packet before which to insert the new packet, or at the
+	     * cursor is left by the previous loop either pointing at the
+	     * packet after which to insert the new packet, or at the
 	     * queue head if the queue is empty or the packet should be
-	     * appended. */
+	     * prepended. */
 #ifdef RX_TRACK_PACKETS
             np->flags |= RX_PKTFLAG_RQ;
 #endif
 #ifdef RXDEBUG_PACKET
             call->rqc++;
 #endif /* RXDEBUG_PACKET */
-	    opr_queue_InsertBefore(cursor, &np->entry);
+	    opr_queue_InsertAfter(cursor, &np->entry);
+	    call->rqCount++;
 	    call->nSoftAcks++;
 	    np = NULL;
 
@@ -4186,6 +4237,9 @@ rxi_ReceiveAckPacket(struct rx_call *call, struct rx_packet *np,
     int maxDgramPackets = 0;	/* Set if peer supports AFS 3.5 jumbo datagrams */
     int pktsize = 0;            /* Set if we need to update the peer mtu */
     int conn_data_locked = 0;
+    int nRanges = 0;		/* Extended ack ranges following the trailer */
+    afs_uint32 range, start, end;
+    int i;
 
     if (rx_stats_active)
         rx_atomic_inc(&rx_stats.ackPacketsRead);
@@ -4305,6 +4359,26 @@ rxi_ReceiveAckPacket(struct rx_call *call, struct rx_packet *np,
 
     clock_GetTime(&now);
 
+    /* An extended ack says that the peer understands them, and may carry
+     * ranges describing packets beyond the acks array. Padded MTU probes
+     * overwrite the extended ack word, so don't let those clear the flag */
+    if (np->length >= rx_AckDataSize(ap->nAcks) + 5 * sizeof(afs_int32)) {
+	rx_packetread(np, rx_AckDataSize(ap->nAcks) + 4 * sizeof(afs_int32),
+		      sizeof(afs_int32), &range);
+	range = ntohl(range);
+	if ((range & RX_ACKEXT_MAGICMASK) == RX_ACKEXT_MAGIC) {
+	    peer->extAcks = 1;
+	    nRanges = MIN(range & RX_ACKEXT_COUNTMASK,
+			  (np->length - rx_AckDataSize(ap->nAcks))
+			  / sizeof(afs_int32) - 5);
+	} else if (ap->reason != RX_ACK_PING) {
+	    peer->extAcks = 0;
+	}
+    } else if (np->length >= rx_AckDataSize(ap->nAcks)
+			     + 4 * sizeof(afs_int32)) {
+	peer->extAcks = 0;
+    }
+
     /* The transmit queue splits into 4 sections.
      *
      * The first section is packets which have now been acknowledged
@@ -4318,8 +4392,10 @@ rxi_ReceiveAckPacket(struct rx_call *call, struct rx_packet *np,
      * packets are acknowledged or not.
      *
      * The third section is packets which fall above the range
-     * addressed in the ack packet. These have not yet been received
-     * by the peer.
+     * addressed in the ack packet's acks array. If the peer sends
+     * extended acks, these may be described by the ranges that follow
+     * the trailer, otherwise they have not yet been received by the
+     * peer.
      *
      * The four section is packets which have not yet been transmitted.
      * These packets will have a header.serial of 0.
@@ -4357,6 +4433,8 @@ rxi_ReceiveAckPacket(struct rx_call *call, struct rx_packet *np,
 	} else
 #endif /* RX_ENABLE_LOCKS */
 	{
+	    if (tp == call->tsend)
+		call->tsend = NULL;
 	    opr_queue_Remove(&tp->entry);
 #ifdef RX_TRACK_PACKETS
 	    tp->flags &= ~RX_PKTFLAG_TQ;
@@ -4411,8 +4489,45 @@ rxi_ReceiveAckPacket(struct rx_call *call, struct rx_packet *np,
 	tp = opr_queue_Next(&tp->entry, struct rx_packet, entry);
     }
 
-    /* We don't need to take any action with the 3rd or 4th section in the
-     * queue - they're not addressed by the contents of this ACK packet.
+    /* Third section of the queue - packets described by extended ack
+     * ranges. Packets within a range have been received, and those before
+     * it are missing. We only walk as far as the end of the last range,
+     * so this costs no more than the acks array would for the same
+     * packets. */
+    for (i = 0; i < nRanges; i++) {
+	rx_packetread(np, rx_AckDataSize(ap->nAcks)
+			  + (5 + i) * sizeof(afs_int32),
+		      sizeof(afs_int32), &range);
+	range = ntohl(range);
+	start = first + (range >> 16);
+	end = start + (range & RX_ACKEXT_COUNTMASK);
+	if (start < first + nAcks)
+	    break;		/* Bogus range */
+
+	while (!opr_queue_IsEnd(&call->tq, &tp->entry)
+	       && tp->header.seq < end) {
+	    if (tp->header.seq >= start) {
+		if (!(tp->flags & RX_PKTFLAG_ACKED)) {
+		    newAckCount++;
+		    tp->flags |= RX_PKTFLAG_ACKED;
+		    rxi_ComputeRoundTripTime(tp, ap, call, peer, &now);
+		}
+		if (missing) {
+		    nNacked++;
+		} else {
+		    call->nSoftAcked++;
+		}
+	    } else {
+		tp->flags &= ~RX_PKTFLAG_ACKED;
+		missing = 1;
+	    }
+	    tp = opr_queue_Next(&tp->entry, struct rx_packet, entry);
+	}
+    }
+
+    /* We don't need to take any action with the rest of the 3rd section,
+     * or the 4th section in the queue - they're not addressed by the
+     * contents of this ACK packet.
      */
 
     /* If the window has been extended by this acknowledge packet,
@@ -4499,7 +4614,7 @@ rxi_ReceiveAckPacket(struct rx_call *call, struct rx_packet *np,
 		call->conn->twind[call->channel] = call->twind;
 		call->ssthresh = MIN(call->twind, call->ssthresh);
 	    } else if (tSize > call->twind) {
-		call->twind = tSize;
+		call->twind = MIN(tSize, RX_MAXWINDOW);
 		call->conn->twind[call->channel] = call->twind;
 	    }
 
@@ -4576,7 +4691,7 @@ rxi_ReceiveAckPacket(struct rx_call *call, struct rx_packet *np,
     } else if (nNacked && call->nNacks >= (u_short) rx_nackThreshold) {
 	/* Three negative acks in a row trigger congestion recovery */
 	call->flags |= RX_CALL_FAST_RECOVER;
-	call->ssthresh = MAX(4, MIN((int)call->cwind, (int)call->twind)) >> 1;
+	(*call->ccOps->congestion)(call, 0);
 	call->cwind =
 	    MIN((int)(call->ssthresh + rx_nackThreshold), rx_maxSendWindow);
 	call->nDgramPackets = MAX(2, (int)call->nDgramPackets) >> 1;
@@ -4594,6 +4709,7 @@ rxi_ReceiveAckPacket(struct rx_call *call, struct rx_packet *np,
 	 */
 
 	acked = 0;
+	call->tsend = NULL;
 	for (opr_queue_ScanBackwards(&call->tq, cursor)) {
 	    struct rx_packet *tp =
 		opr_queue_Entry(cursor, struct rx_packet, entry);
@@ -4606,23 +4722,8 @@ rxi_ReceiveAckPacket(struct rx_call *call, struct rx_packet *np,
 	    }
 	}
     } else {
-	/* If cwind is smaller than ssthresh, then increase
-	 * the window one packet for each ack we receive (exponential
-	 * growth).
-	 * If cwind is greater than or equal to ssthresh then increase
-	 * the congestion window by one packet for each cwind acks we
-	 * receive (linear growth).  */
-	if (call->cwind < call->ssthresh) {
-	    call->cwind =
-		MIN((int)call->ssthresh, (int)(call->cwind + newAckCount));
-	    call->nCwindAcks = 0;
-	} else {
-	    call->nCwindAcks += newAckCount;
-	    if (call->nCwindAcks >= call->cwind) {
-		call->nCwindAcks = 0;
-		call->cwind = MIN((int)(call->cwind + 1), rx_maxSendWindow);
-	    }
-	}
+	/* Let the congestion control algorithm open the window */
+	(*call->ccOps->ack)(call, newAckCount, &now);
 	/*
 	 * If we have received several acknowledgements in a row then
 	 * it is time to increase the size of our datagrams
@@ -5002,6 +5103,7 @@ rxi_ClearTransmitQueue(struct rx_call *call, int force)
         call->tqc -=
 #endif /* RXDEBUG_PACKET */
             rxi_FreePackets(0, &call->tq);
+	call->tsend = NULL;
 	rxi_WakeUpTransmitQueue(call);
 #ifdef RX_ENABLE_LOCKS
 	call->flags &= ~RX_CALL_TQ_CLEARME;
@@ -5031,6 +5133,7 @@ rxi_ClearReceiveQueue(struct rx_call *call)
 
         count = rxi_FreePackets(0, &call->rq);
 	rx_packetReclaims += count;
+	call->rqCount = 0;
 #ifdef RXDEBUG_PACKET
         call->rqc -= count;
         if ( call->rqc != 0 )
@@ -5270,6 +5373,7 @@ rxi_ResetCall(struct rx_call *call, int newcall)
     clock_Zero(&call->rto);
     clock_Addmsec(&call->rto,
 		  MAX(((call->rtt >> 3) + call->rtt_dev), rx_minPeerTimeout) + 200);
+    rxi_CongestionStart(call);
     MUTEX_EXIT(&peer->peer_lock);
 
     flags = call->flags;
@@ -5297,6 +5401,7 @@ rxi_ResetCall(struct rx_call *call, int newcall)
     call->nHardAcks = 0;
 
     call->tfirst = call->rnext = call->tnext = 1;
+    call->tsend = NULL;
     call->tprev = 0;
     call->rprev = 0;
     call->lastAcked = 0;
@@ -5387,17 +5492,30 @@ rxi_SendAck(struct rx_call *call,
     u_char offset = 0;
     afs_int32 templ;
     afs_uint32 padbytes = 0;
+    afs_uint32 rwind, seqoff;
+    afs_uint32 range = 0;
+    int nRanges = 0;
+    int ackSize;
 #ifdef RX_ENABLE_TSFPQ
     struct rx_ts_info_t * rx_ts_info;
 #endif
 
     /*
-     * Open the receive window once a thread starts reading packets
+     * Open the receive window once a thread starts reading packets. Only
+     * a peer which understands extended acks may be offered a window
+     * larger than the acks array can describe.
      */
     if (call->rnext > 1) {
-	call->conn->rwind[call->channel] = call->rwind = rx_maxReceiveWindow;
+	rwind = rx_maxReceiveWindow;
+	if (!call->conn->peer->extAcks)
+	    rwind = MIN(rwind, RX_MAXACKS);
+	call->conn->rwind[call->channel] = call->rwind = rwind;
     }
 
+    /* The space needed for the acks array and the trailer */
+    ackSize = rx_AckDataSize(MIN(call->rwind, RX_MAXACKS))
+	      + 4 * sizeof(afs_int32);
+
     /* Don't attempt to grow MTU if this is a critical ping */
     if (reason == RX_ACK_MTU) {
 	/* keep track of per-call attempts, if we're over max, do in small
@@ -5415,7 +5533,7 @@ rxi_SendAck(struct rx_call *call,
 	padbytes = MAX(padbytes, RX_MIN_PACKET_SIZE+RX_IPUDP_SIZE+4);
 
 	/* subtract the ack payload */
-	padbytes -= (rx_AckDataSize(call->rwind) + 4 * sizeof(afs_int32));
+	padbytes -= ackSize;
 	reason = RX_ACK_PING;
     }
 
@@ -5446,9 +5564,8 @@ rxi_SendAck(struct rx_call *call,
     }
 #endif
 
-    templ = padbytes +
-	rx_AckDataSize(call->rwind) + 4 * sizeof(afs_int32) -
-	rx_GetDataSize(p);
+    templ = padbytes + ackSize
+	+ (1 + RX_MAXACKRANGES) * sizeof(afs_int32) - rx_GetDataSize(p);
     if (templ > 0) {
 	if (rxi_AllocDataBuf(p, templ, RX_PACKET_CLASS_SPECIAL) > 0) {
 #ifndef RX_ENABLE_TSFPQ
@@ -5457,7 +5574,7 @@ rxi_SendAck(struct rx_call *call,
 #endif
 	    return optionalPacket;
 	}
-	templ = rx_AckDataSize(call->rwind) + 2 * sizeof(afs_int32);
+	templ = ackSize - 2 * sizeof(afs_int32);
 	if (rx_Contiguous(p) < templ) {
 #ifndef RX_ENABLE_TSFPQ
 	    if (!optionalPacket)
@@ -5497,18 +5614,21 @@ rxi_SendAck(struct rx_call *call,
 
 	ap->previousPacket = htonl(call->rprev);	/* Previous packet received */
 
-	/* No fear of running out of ack packet here because there can only 
-	 * be at most one window full of unacknowledged packets.  The window
-	 * size must be constrained to be less than the maximum ack size, 
-	 * of course.  Also, an ack should always fit into a single packet 
-	 * -- it should not ever be fragmented.  */
+	/* No fear of running out of ack packet here because there can only
+	 * be at most one window full of unacknowledged packets.  The first
+	 * RX_MAXACKS packets of the window go in the acks array, and the
+	 * rest, if the window is larger, are described by ranges following
+	 * the trailer. If there are more ranges than we have room for, the
+	 * packets in the excess ones are left unacknowledged. An ack should
+	 * always fit into a single packet -- it should not ever be
+	 * fragmented.  */
 	offset = 0;
 	for (opr_queue_Scan(&call->rq, cursor)) {
 	    struct rx_packet *rqp
 		= opr_queue_Entry(cursor, struct rx_packet, entry);
 
 	    if (!rqp || !call->rq.next
-		|| (rqp->header.seq > (call->rnext + call->rwind))) {
+		|| (rqp->header.seq >= (call->rnext + call->rwind))) {
 #ifndef RX_ENABLE_TSFPQ
 		if (!optionalPacket)
 		    rxi_FreePacket(p);
@@ -5517,23 +5637,40 @@ rxi_SendAck(struct rx_call *call,
 		return optionalPacket;
 	    }
 
-	    while (rqp->header.seq > call->rnext + offset)
-		ap->acks[offset++] = RX_ACK_TYPE_NACK;
-	    ap->acks[offset++] = RX_ACK_TYPE_ACK;
-
-	    if ((offset > (u_char) rx_maxReceiveWindow) || (offset > call->rwind)) {
-#ifndef RX_ENABLE_TSFPQ
-		if (!optionalPacket)
-		    rxi_FreePacket(p);
-#endif
-		rxi_CallError(call, RX_CALL_DEAD);
-		return optionalPacket;
+	    seqoff = rqp->header.seq - call->rnext;
+	    if (seqoff < RX_MAXACKS) {
+		while (seqoff > offset)
+		    ap->acks[offset++] = RX_ACK_TYPE_NACK;
+		ap->acks[offset++] = RX_ACK_TYPE_ACK;
+	    } else if (range != 0
+		       && (range >> 16) + (range & RX_ACKEXT_COUNTMASK)
+			  == seqoff) {
+		range++;
+	    } else {
+		if (range != 0) {
+		    templ = htonl(range);
+		    rx_packetwrite(p, rx_AckDataSize(offset)
+				      + (5 + nRanges) * sizeof(afs_int32),
+				   sizeof(afs_int32), &templ);
+		    nRanges++;
+		    range = 0;
+		}
+		if (nRanges == RX_MAXACKRANGES)
+		    break;
+		range = (seqoff << 16) | 1;
 	    }
 	}
+	if (range != 0) {
+	    templ = htonl(range);
+	    rx_packetwrite(p, rx_AckDataSize(offset)
+			      + (5 + nRanges) * sizeof(afs_int32),
+			   sizeof(afs_int32), &templ);
+	    nRanges++;
+	}
     }
 
     ap->nAcks = offset;
-    p->length = rx_AckDataSize(offset) + 4 * sizeof(afs_int32);
+    p->length = rx_AckDataSize(offset) + (5 + nRanges) * sizeof(afs_int32);
 
     /* these are new for AFS 3.3 */
     templ = rxi_AdjustMaxMTU(call->conn->peer->ifMTU, rx_maxReceiveSize);
@@ -5553,6 +5690,11 @@ rxi_SendAck(struct rx_call *call,
     rx_packetwrite(p, rx_AckDataSize(offset) + 3 * sizeof(afs_int32),
 		   sizeof(afs_int32), &templ);
 
+    /* extended acknowledgements */
+    templ = htonl(RX_ACKEXT_MAGIC | nRanges);
+    rx_packetwrite(p, rx_AckDataSize(offset) + 4 * sizeof(afs_int32),
+		   sizeof(afs_int32), &templ);
+
     p->header.serviceId = call->conn->serviceId;
     p->header.cid = (call->conn->cid | call->channel);
     p->header.callNumber = *call->callNumber;
@@ -5564,8 +5706,7 @@ rxi_SendAck(struct rx_call *call,
     if (reason == RX_ACK_PING) {
 	p->header.flags |= RX_REQUEST_ACK;
 	if (padbytes) {
-	    p->length = padbytes +
-		rx_AckDataSize(call->rwind) + 4 * sizeof(afs_int32);
+	    p->length = padbytes + ackSize;
 
 	    while (padbytes--)
 		/* not fast but we can potentially use this if truncated
@@ -5649,10 +5790,12 @@ struct xmitlist {
    int resending;
 };
 
-/* Send all of the packets in the list in single datagram */
+/* Send all of the packets in the list in single datagram.  If a transmit
+ * batch is supplied, the datagram is added to it rather than being sent
+ * immediately. */
 static void
 rxi_SendList(struct rx_call *call, struct xmitlist *xmit,
-	     int istack, int moreFlag)
+	     int istack, int moreFlag, struct rx_xmitbatch *batch)
 {
     int i;
     int requestAck = 0;
@@ -5720,6 +5863,11 @@ rxi_SendList(struct rx_call *call, struct xmitlist *xmit,
 
     MUTEX_EXIT(&call->lock);
     CALL_HOLD(call, RX_CALL_REFCOUNT_SEND);
+#ifdef RX_ENABLE_MMSG
+    if (batch != NULL) {
+	rxi_QueuePacketList(call, conn, xmit->list, xmit->len, istack, batch);
+    } else
+#endif
     if (xmit->len > 1) {
 	rxi_SendPacketList(call, conn, xmit->list, xmit->len, istack);
     } else {
@@ -5748,8 +5896,8 @@ rxi_SendList(struct rx_call *call, struct xmitlist *xmit,
  */
 
 static void
-rxi_SendXmitList(struct rx_call *call, struct rx_packet **list, int len,
-		 int istack)
+rxi_SendXmitListInt(struct rx_call *call, struct rx_packet **list, int len,
+		    int istack, struct rx_xmitbatch *batch)
 {
     int i;
     int recovery;
@@ -5776,7 +5924,7 @@ rxi_SendXmitList(struct rx_call *call, struct rx_packet **list, int len,
 	     * set into the 'last' one, and resets the working set */
 
 	    if (last.len > 0) {
-		rxi_SendList(call, &last, istack, 1);
+		rxi_SendList(call, &last, istack, 1, batch);
 		/* If the call enters an error state stop sending, or if
 		 * we entered congestion recovery mode, stop sending */
 		if (call->error
@@ -5803,7 +5951,7 @@ rxi_SendXmitList(struct rx_call *call, struct rx_packet **list, int len,
 		|| list[i]->header.serial
 		|| list[i]->length != RX_JUMBOBUFFERSIZE) {
 		if (last.len > 0) {
-		    rxi_SendList(call, &last, istack, 1);
+		    rxi_SendList(call, &last, istack, 1, batch);
 		    /* If the call enters an error state stop sending, or if
 		     * we entered congestion recovery mode, stop sending */
 		    if (call->error
@@ -5840,7 +5988,7 @@ rxi_SendXmitList(struct rx_call *call, struct rx_packet **list, int len,
 	    morePackets = 1;
 	}
 	if (last.len > 0) {
-	    rxi_SendList(call, &last, istack, morePackets);
+	    rxi_SendList(call, &last, istack, morePackets, batch);
 	    /* If the call enters an error state stop sending, or if
 	     * we entered congestion recovery mode, stop sending */
 	    if (call->error
@@ -5848,14 +5996,40 @@ rxi_SendXmitList(struct rx_call *call, struct rx_packet **list, int len,
 		return;
 	}
 	if (morePackets) {
-	    rxi_SendList(call, &working, istack, 0);
+	    rxi_SendList(call, &working, istack, 0, batch);
 	}
     } else if (last.len > 0) {
-	rxi_SendList(call, &last, istack, 0);
+	rxi_SendList(call, &last, istack, 0, batch);
 	/* Packets which are in 'working' are not sent by this call */
     }
 }
 
+/* Send a list of packets from the call's transmit queue.  When batched I/O
+ * is enabled, the datagrams making up the list are collected and passed to
+ * the kernel together once the list has been processed. */
+static void
+rxi_SendXmitList(struct rx_call *call, struct rx_packet **list, int len,
+		 int istack)
+{
+#ifdef RX_ENABLE_MMSG
+    struct rx_xmitbatch batch;
+
+    if (rx_ioBatchSize > 1) {
+	batch.ndgrams = 0;
+	rxi_SendXmitListInt(call, list, len, istack, &batch);
+	if (batch.ndgrams > 0) {
+	    MUTEX_EXIT(&call->lock);
+	    CALL_HOLD(call, RX_CALL_REFCOUNT_SEND);
+	    rxi_FlushXmitBatch(call, &batch, istack);
+	    MUTEX_ENTER(&call->lock);
+	    CALL_RELE(call, RX_CALL_REFCOUNT_SEND);
+	}
+	return;
+    }
+#endif
+    rxi_SendXmitListInt(call, list, len, istack, NULL);
+}
+
 /**
  * Check if the peer for the given call is known to be dead
  *
@@ -5933,6 +6107,7 @@ rxi_Resend(struct rxevent *event, void *arg0, void *arg1, int istack)
     call->flags |= RX_CALL_FAST_RECOVER;
 
     /* Mark all of the pending packets in the queue as being lost */
+    call->tsend = NULL;
     for (opr_queue_Scan(&call->tq, cursor)) {
 	struct rx_packet *p = opr_queue_Entry(cursor, struct rx_packet, entry);
 	if (!(p->flags & RX_PKTFLAG_ACKED))
@@ -5954,7 +6129,7 @@ rxi_Resend(struct rxevent *event, void *arg0, void *arg1, int istack)
 	call->MTU = RX_JUMBOBUFFERSIZE + RX_HEADER_SIZE;
         call->MTU = MIN(peer->natMTU, peer->maxMTU);
     }
-    call->ssthresh = MAX(4, MIN((int)call->cwind, (int)call->twind)) >> 1;
+    (*call->ccOps->congestion)(call, 1);
     call->nDgramPackets = 1;
     call->cwind = 1;
     call->nextCwind = 1;
@@ -5974,6 +6149,27 @@ out:
     MUTEX_EXIT(&call->lock);
 }
 
+/* Send the packets which rxi_Start has gathered into the call's xmitList.
+ * A packet which couldn't be sent has its SENT flag cleared so that it goes
+ * out again soon; if that happens rxi_Start must go back to scanning the
+ * transmit queue from the start. */
+static void
+rxi_StartXmitList(struct rx_call *call, int len, int istack)
+{
+    int i;
+
+    rxi_SendXmitList(call, call->xmitList, len, istack);
+    if (call->error)
+	return;
+
+    for (i = 0; i < len; i++) {
+	if (!(call->xmitList[i]->flags & (RX_PKTFLAG_SENT | RX_PKTFLAG_ACKED))) {
+	    call->tsend = NULL;
+	    break;
+	}
+    }
+}
+
 /* This routine is called when new packets are readied for
  * transmission and when retransmission may be necessary, or when the
  * transmission window or burst count are favourable.  This should be
@@ -6024,7 +6220,17 @@ rxi_Start(struct rx_call *call, int istack)
 #endif /* RX_ENABLE_LOCKS */
 		nXmitPackets = 0;
 		maxXmitPackets = MIN(call->twind, call->cwind);
-		for (opr_queue_Scan(&call->tq, cursor)) {
+		maxXmitPackets = MIN(maxXmitPackets, RX_MAXACKS); /* xmitList */
+
+		/* With a large window most of the queue is already in flight,
+		 * so pick up from where the last pass stopped rather than
+		 * walking over every outstanding packet on every ack */
+		if (call->tsend != NULL)
+		    cursor = &call->tsend->entry;
+		else
+		    cursor = call->tq.next;
+		for (; !opr_queue_IsEnd(&call->tq, cursor);
+		     cursor = cursor->next) {
 		    struct rx_packet *p
 			= opr_queue_Entry(cursor, struct rx_packet, entry);
 
@@ -6044,6 +6250,7 @@ rxi_Start(struct rx_call *call, int istack)
 					   (int)(call->nSoftAcked +
 						 call->cwind))) {
 			call->flags |= RX_CALL_WAIT_WINDOW_SEND;	/* Wait for transmit window */
+			call->tsend = p;
 			/* Note: if we're waiting for more window space, we can
 			 * still send retransmits; hence we don't return here, but
 			 * break out to schedule a retransmit event */
@@ -6056,8 +6263,8 @@ rxi_Start(struct rx_call *call, int istack)
 		    /* Transmit the packet if it needs to be sent. */
 		    if (!(p->flags & RX_PKTFLAG_SENT)) {
 			if (nXmitPackets == maxXmitPackets) {
-			    rxi_SendXmitList(call, call->xmitList,
-					     nXmitPackets, istack);
+			    call->tsend = p;
+			    rxi_StartXmitList(call, nXmitPackets, istack);
 			    goto restart;
 			}
                         dpf(("call %d xmit packet %"AFS_PTR_FMT"\n",
@@ -6065,13 +6272,14 @@ rxi_Start(struct rx_call *call, int istack)
 			call->xmitList[nXmitPackets++] = p;
 		    }
 		} /* end of the queue_Scan */
+		if (opr_queue_IsEnd(&call->tq, cursor))
+		    call->tsend = opr_queue_Last(&call->tq, struct rx_packet,
+						 entry);
 
 		/* xmitList now hold pointers to all of the packets that are
 		 * ready to send. Now we loop to send the packets */
-		if (nXmitPackets > 0) {
-		    rxi_SendXmitList(call, call->xmitList, nXmitPackets,
-				     istack);
-		}
+		if (nXmitPackets > 0)
+		    rxi_StartXmitList(call, nXmitPackets, istack);
 
 #ifdef RX_ENABLE_LOCKS
 		if (call->error) {
@@ -6100,6 +6308,8 @@ rxi_Start(struct rx_call *call, int istack)
 
 			if (p->header.seq < call->tfirst
 			    && (p->flags & RX_PKTFLAG_ACKED)) {
+			    if (p == call->tsend)
+				call->tsend = NULL;
 			    opr_queue_Remove(&p->entry);
 #ifdef RX_TRACK_PACKETS
 			    p->flags &= ~RX_PKTFLAG_TQ;
@@ -6164,7 +6374,7 @@ rxi_Send(struct rx_call *call, struct rx_packet *p,
      * idle connections) */
     if ((p->header.type != RX_PACKET_TYPE_ACK) ||
 	(((struct rx_ackPacket *)rx_DataOf(p))->reason == RX_ACK_PING) ||
-	(p->length <= (rx_AckDataSize(call->rwind) + 4 * sizeof(afs_int32))))
+	(p->length <= rx_AckMaxSize))
     {
 	conn->lastSendTime = call->lastSendTime = clock_Sec();
     }
@@ -6794,6 +7004,9 @@ rxi_ComputeRoundTripTime(struct rx_packet *p,
         MUTEX_EXIT(&rx_stats_mutex);
     }
 
+    if (call->ccOps->rtt != NULL)
+	(*call->ccOps->rtt)(call, &thisRtt);
+
     /* better rtt calculation courtesy of UMich crew (dave,larry,peter,?) */
 
     /* Apply VanJacobson round-trip estimations */
@@ -6883,18 +7096,15 @@ rxi_ReapConnections(struct rxevent *unused, void *unused1, void *unused2,
     /* Find server connection structures that haven't been used for
      * greater than rx_idleConnectionTime */
     {
-	struct rx_connection **conn_ptr, **conn_end;
-	int i, havecalls = 0;
-	MUTEX_ENTER(&rx_connHashTable_lock);
-	for (conn_ptr = &rx_connHashTable[0], conn_end =
-	     &rx_connHashTable[rx_hashTableSize]; conn_ptr < conn_end;
-	     conn_ptr++) {
+	int hashindex, i, havecalls = 0;
+	for (hashindex = 0; hashindex < rx_hashTableSize; hashindex++) {
 	    struct rx_connection *conn, *next;
 	    struct rx_call *call;
 	    int result;
 
+	    CONN_HASH_LOCK(hashindex);
 	  rereap:
-	    for (conn = *conn_ptr; conn; conn = next) {
+	    for (conn = rx_connHashTable[hashindex]; conn; conn = next) {
 		/* XXX -- Shouldn't the connection be locked? */
 		next = conn->next;
 		havecalls = 0;
@@ -6942,44 +7152,29 @@ rxi_ReapConnections(struct rxevent *unused, void *unused1, void *unused2,
 #endif /* RX_ENABLE_LOCKS */
 		}
 	    }
+	    CONN_HASH_UNLOCK(hashindex);
 	}
 #ifdef RX_ENABLE_LOCKS
-	while (rx_connCleanup_list) {
-	    struct rx_connection *conn;
-	    conn = rx_connCleanup_list;
-	    rx_connCleanup_list = rx_connCleanup_list->next;
-	    MUTEX_EXIT(&rx_connHashTable_lock);
-	    rxi_CleanupConnection(conn);
-	    MUTEX_ENTER(&rx_connHashTable_lock);
-	}
-	MUTEX_EXIT(&rx_connHashTable_lock);
+	rxi_CleanupConnections();
 #endif /* RX_ENABLE_LOCKS */
     }
 
     /* Find any peer structures that haven't been used (haven't had an
      * associated connection) for greater than rx_idlePeerTime */
     {
-	struct rx_peer **peer_ptr, **peer_end;
-	int code;
+	struct rx_peer **peer_ptr;
+	int code, hashIndex;
 
         /*
-         * Why do we need to hold the rx_peerHashTable_lock across
-         * the incrementing of peer_ptr since the rx_peerHashTable
-         * array is not changing?  We don't.
-         *
-         * By dropping the lock periodically we can permit other
-         * activities to be performed while a rxi_ReapConnections
-         * call is in progress.  The goal of reap connections
-         * is to clean up quickly without causing large amounts
-         * of contention.  Therefore, it is important that global
-         * mutexes not be held for extended periods of time.
+         * Each hash chain is only locked while it is being scanned,
+         * so that rxi_ReapConnections can clean up without causing
+         * large amounts of contention with the listener threads.
          */
-	for (peer_ptr = &rx_peerHashTable[0], peer_end =
-	     &rx_peerHashTable[rx_hashTableSize]; peer_ptr < peer_end;
-	     peer_ptr++) {
+	for (hashIndex = 0; hashIndex < rx_hashTableSize; hashIndex++) {
 	    struct rx_peer *peer, *next, *prev;
 
-            MUTEX_ENTER(&rx_peerHashTable_lock);
+	    peer_ptr = &rx_peerHashTable[hashIndex];
+            PEER_HASH_LOCK(hashIndex);
             for (prev = peer = *peer_ptr; peer; peer = next) {
 		next = peer->next;
 		code = MUTEX_TRYENTER(&peer->peer_lock);
@@ -7006,14 +7201,14 @@ rxi_ReapConnections(struct rxevent *unused, void *unused1, void *unused2,
 
                     /*
                      * Now if we hold references on 'prev' and 'next'
-                     * we can safely drop the rx_peerHashTable_lock
+                     * we can safely drop the hash chain lock
                      * while we destroy this 'peer' object.
                      */
                     if (next)
                         next->refCount++;
                     if (prev)
                         prev->refCount++;
-                    MUTEX_EXIT(&rx_peerHashTable_lock);
+                    PEER_HASH_UNLOCK(hashIndex);
 
 		    MUTEX_EXIT(&peer->peer_lock);
 		    MUTEX_DESTROY(&peer->peer_lock);
@@ -7044,11 +7239,11 @@ rxi_ReapConnections(struct rxevent *unused, void *unused1, void *unused2,
 		    rxi_FreePeer(peer);
 
                     /*
-                     * Regain the rx_peerHashTable_lock and
+                     * Regain the hash chain lock and
                      * decrement the reference count on 'prev'
                      * and 'next'.
                      */
-                    MUTEX_ENTER(&rx_peerHashTable_lock);
+                    PEER_HASH_LOCK(hashIndex);
                     if (next)
                         next->refCount--;
                     if (prev)
@@ -7060,7 +7255,7 @@ rxi_ReapConnections(struct rxevent *unused, void *unused1, void *unused2,
 		    prev = peer;
 		}
 	    }
-            MUTEX_EXIT(&rx_peerHashTable_lock);
+            PEER_HASH_UNLOCK(hashIndex);
 	}
     }
 
@@ -7080,6 +7275,10 @@ rxi_ReapConnections(struct rxevent *unused, void *unused1, void *unused2,
     }
     MUTEX_EXIT(&rx_freePktQ_lock);
 
+#ifdef RX_ENABLE_TSFPQ
+    rxi_ShrinkPackets();
+#endif
+
     when = now;
     when.sec += RX_REAP_TIME;	/* Check every RX_REAP_TIME seconds */
     event = rxevent_Post(&when, &now, rxi_ReapConnections, 0, NULL, 0);
@@ -7251,6 +7450,9 @@ rx_PrintTheseStats(FILE * file, struct rx_statistics *s, int size,
 	    "   \t(these should be small) sendFailed %u, " "fatalErrors %u\n",
 	    s->netSendFailures, (int)s->fatalErrors);
 
+    fprintf(file, "   socket calls: recv %u, send %u\n", s->nRecvSyscalls,
+	    s->nSendSyscalls);
+
     if (s->nRttSamples) {
 	fprintf(file, "   Average rtt is %0.3f, with %d samples\n",
 		clock_Float(&s->totalRtt) / s->nRttSamples, s->nRttSamples);
@@ -7470,6 +7672,12 @@ rx_GetServerDebug(osi_socket socket, afs_uint32 remoteAddr,
 	if (stat->version >= RX_DEBUGI_VERSION_W_PACKETS) {
 	    *supportedValues |= RX_SERVER_DEBUG_PACKETS_CNT;
 	}
+	if (stat->version >= RX_DEBUGI_VERSION_W_HASHWAITS) {
+	    *supportedValues |= RX_SERVER_DEBUG_HASH_WAITS;
+	}
+	if (stat->version >= RX_DEBUGI_VERSION_W_PACKETPOOL) {
+	    *supportedValues |= RX_SERVER_DEBUG_PACKET_POOL;
+	}
 	stat->nFreePackets = ntohl(stat->nFreePackets);
 	stat->packetReclaims = ntohl(stat->packetReclaims);
 	stat->callsExecuted = ntohl(stat->callsExecuted);
@@ -7477,6 +7685,11 @@ rx_GetServerDebug(osi_socket socket, afs_uint32 remoteAddr,
 	stat->idleThreads = ntohl(stat->idleThreads);
         stat->nWaited = ntohl(stat->nWaited);
         stat->nPackets = ntohl(stat->nPackets);
+	stat->nConnHashWaits = ntohl(stat->nConnHashWaits);
+	stat->nPeerHashWaits = ntohl(stat->nPeerHashWaits);
+	stat->nDepotPackets = ntohl(stat->nDepotPackets);
+	stat->nDrainingPackets = ntohl(stat->nDrainingPackets);
+	stat->nReleasedPackets = ntohl(stat->nReleasedPackets);
     }
 #else
     afs_int32 rc = -1;
@@ -7694,7 +7907,7 @@ rx_GetLocalPeers(afs_uint32 peerHost, afs_uint16 peerPort,
 	afs_int32 error = 1; /* default to "did not succeed" */
 	afs_uint32 hashValue = PEER_HASH(peerHost, peerPort);
 
-	MUTEX_ENTER(&rx_peerHashTable_lock);
+	PEER_HASH_LOCK(hashValue);
 	for(tp = rx_peerHashTable[hashValue];
 	      tp != NULL; tp = tp->next) {
 		if (tp->host == peerHost)
@@ -7703,7 +7916,7 @@ rx_GetLocalPeers(afs_uint32 peerHost, afs_uint16 peerPort,
 
 	if (tp) {
                 tp->refCount++;
-                MUTEX_EXIT(&rx_peerHashTable_lock);
+                PEER_HASH_UNLOCK(hashValue);
 
 		error = 0;
 
@@ -7738,10 +7951,10 @@ rx_GetLocalPeers(afs_uint32 peerHost, afs_uint16 peerPort,
 				= tp->bytesReceived & MAX_AFS_UINT32;
                 MUTEX_EXIT(&tp->peer_lock);
 
-                MUTEX_ENTER(&rx_peerHashTable_lock);
+                PEER_HASH_LOCK(hashValue);
                 tp->refCount--;
 	}
-	MUTEX_EXIT(&rx_peerHashTable_lock);
+	PEER_HASH_UNLOCK(hashValue);
 
 	return error;
 }
@@ -7796,7 +8009,7 @@ shutdown_rx(void)
 	     peer_ptr++) {
 	    struct rx_peer *peer, *next;
 
-            MUTEX_ENTER(&rx_peerHashTable_lock);
+            PEER_HASH_LOCK(peer_ptr - rx_peerHashTable);
             for (peer = *peer_ptr; peer; peer = next) {
 		struct opr_queue *cursor, *store;
 		size_t space;
@@ -7831,7 +8044,7 @@ shutdown_rx(void)
                 if (rx_stats_active)
                     rx_atomic_dec(&rx_stats.nPeerStructs);
 	    }
-            MUTEX_EXIT(&rx_peerHashTable_lock);
+            PEER_HASH_UNLOCK(peer_ptr - rx_peerHashTable);
 	}
     }
     for (i = 0; i < RX_MAX_SERVICES; i++) {
@@ -7840,7 +8053,7 @@ shutdown_rx(void)
     }
     for (i = 0; i < rx_hashTableSize; i++) {
 	struct rx_connection *tc, *ntc;
-	MUTEX_ENTER(&rx_connHashTable_lock);
+	CONN_HASH_LOCK(i);
 	for (tc = rx_connHashTable[i]; tc; tc = ntc) {
 	    ntc = tc->next;
 	    for (j = 0; j < RX_MAXCALLS; j++) {
@@ -7850,7 +8063,7 @@ shutdown_rx(void)
 	    }
 	    rxi_Free(tc, sizeof(*tc));
 	}
-	MUTEX_EXIT(&rx_connHashTable_lock);
+	CONN_HASH_UNLOCK(i);
     }
 
     MUTEX_ENTER(&freeSQEList_lock);
@@ -7865,7 +8078,10 @@ shutdown_rx(void)
     MUTEX_DESTROY(&freeSQEList_lock);
     MUTEX_DESTROY(&rx_freeCallQueue_lock);
     MUTEX_DESTROY(&rx_connHashTable_lock);
-    MUTEX_DESTROY(&rx_peerHashTable_lock);
+    for (i = 0; i < RX_HASH_LOCKS; i++) {
+	MUTEX_DESTROY(&rx_connHashLocks[i]);
+	MUTEX_DESTROY(&rx_peerHashLocks[i]);
+    }
     MUTEX_DESTROY(&rx_serverPool_lock);
 
     osi_Free(rx_connHashTable,
@@ -8889,7 +9105,7 @@ rx_disablePeerRPCStats(void)
 	 peer_ptr++) {
 	struct rx_peer *peer, *next, *prev;
 
-        MUTEX_ENTER(&rx_peerHashTable_lock);
+        PEER_HASH_LOCK(peer_ptr - rx_peerHashTable);
         MUTEX_ENTER(&rx_rpc_stats);
         for (prev = peer = *peer_ptr; peer; peer = next) {
 	    next = peer->next;
@@ -8909,7 +9125,7 @@ rx_disablePeerRPCStats(void)
                 if (prev)
                     prev->refCount++;
                 peer->refCount++;
-                MUTEX_EXIT(&rx_peerHashTable_lock);
+                PEER_HASH_UNLOCK(peer_ptr - rx_peerHashTable);
 
                 for (opr_queue_ScanSafe(&peer->rpcStats, cursor, store)) {
 		    unsigned int num_funcs = 0;
@@ -8930,7 +9146,7 @@ rx_disablePeerRPCStats(void)
 		}
 		MUTEX_EXIT(&peer->peer_lock);
 
-                MUTEX_ENTER(&rx_peerHashTable_lock);
+                PEER_HASH_LOCK(peer_ptr - rx_peerHashTable);
                 if (next)
                     next->refCount--;
                 if (prev)
@@ -8941,7 +9157,7 @@ rx_disablePeerRPCStats(void)
 	    }
 	}
         MUTEX_EXIT(&rx_rpc_stats);
-        MUTEX_EXIT(&rx_peerHashTable_lock);
+        PEER_HASH_UNLOCK(peer_ptr - rx_peerHashTable);
     }
 }
 
@@ -259,6 +259,13 @@ rx_IsLoopbackAddr(afs_uint32 addr)
 /* Enable or disable asymmetric client checking for a service */
 #define rx_SetCheckReach(service, x) ((service)->checkReach = (x))
 
+/* Congestion control algorithms, for rx_SetCongestionControl() and friends */
+#define RX_CC_DEFAULT	0	/* Use the service or process wide setting */
+#define RX_CC_CLASSIC	1	/* Slow start and linear growth, halve on loss */
+#define RX_CC_CUBIC	2	/* Window is a cubic function of time since loss */
+#define RX_CC_DELAY	3	/* Keep queueing delay small, Vegas style */
+#define RX_CC_MAX	3
+
 /* Set the overload threshold and the overload error */
 #define rx_SetBusyThreshold(threshold, code) (rx_BusyThreshold=(threshold),rx_BusyError=(code))
 
@@ -340,6 +347,7 @@ struct rx_service {
     u_short connDeadTime;	/* Seconds until a client of this service will be declared dead, if it is not responding */
     u_short idleDeadTime;	/* Time a server will wait for I/O to start up again */
     u_char checkReach;		/* Check for asymmetric clients? */
+    u_char ccAlgorithm;		/* Congestion control for this service's calls */
     int nSpecific;		/* number entries in specific data */
     void **specific;		/* pointer to connection specific data */
 #ifdef	RX_ENABLE_LOCKS
@@ -370,6 +378,11 @@ struct rx_service {
 /* Maximum number of acknowledgements in an acknowledge packet */
 #define	RX_MAXACKS	    255
 
+/* Maximum number of ranges in an extended acknowledge, and the largest
+ * window that may be used with a peer which understands them */
+#define RX_MAXACKRANGES	    64
+#define RX_MAXWINDOW	    4096
+
 #ifndef KDUMP_RX_LOCK
 
 /* The structure of the data portion of an acknowledge packet: An acknowledge
@@ -437,6 +450,30 @@ struct rx_ackPacket {
 /* The packet size transmitted for an acknowledge is adjusted to reflect the actual size of the acks array.  This macro defines the size */
 #define rx_AckDataSize(nAcks) (3 + nAcks + offsetof(struct rx_ackPacket, acks[0]))
 
+/* Extended acknowledgements
+ *
+ * The acks array can only describe RX_MAXACKS packets, which limits the
+ * window to that size. To allow larger windows, an acknowledge may carry
+ * a fifth word in its trailer, after the AFS 3.5 jumbogram size, holding
+ * RX_ACKEXT_MAGIC and a count of the ranges which follow it. Each range
+ * is a single word giving, in its top half, the offset from firstPacket
+ * of a run of received packets and, in its bottom half, the number of
+ * packets in the run. Ranges are in ascending order and lie beyond the
+ * acks array; packets between them are negatively acknowledged, and those
+ * after the last range are not acknowledged.
+ *
+ * Sending the fifth word, even with no ranges, tells the peer that we
+ * understand extended acknowledgements, and so that it may offer us a
+ * receive window larger than RX_MAXACKS. Peers which don't understand
+ * the extension ignore it. */
+#define RX_ACKEXT_MAGIC		0x58410000
+#define RX_ACKEXT_MAGICMASK	0xffff0000
+#define RX_ACKEXT_COUNTMASK	0x0000ffff
+
+/* The largest acknowledge we send, other than a padded MTU probe */
+#define rx_AckMaxSize \
+    (rx_AckDataSize(RX_MAXACKS) + (5 + RX_MAXACKRANGES) * sizeof(afs_int32))
+
 #define	RX_CHALLENGE_TIMEOUT	2	/* Number of seconds before another authentication request packet is generated */
 #define RX_CHALLENGE_MAXTRIES	50	/* Max # of times we resend challenge */
 #define	RX_CHECKREACH_TIMEOUT	2	/* Number of seconds before another ping is generated */
@@ -593,8 +630,12 @@ struct rx_securityClass {
 				    rx_securityConfigVariables atype,
 				    void * avalue,
 				    void ** acurrentValue);
-	int (*op_Spare2) (void);
-	int (*op_Spare3) (void);
+	int (*op_PreparePackets) (struct rx_securityClass * aobj,
+				  struct rx_call * acall,
+				  struct rx_packet ** apackets, int npackets);
+	int (*op_CheckPackets) (struct rx_securityClass * aobj,
+				struct rx_call * acall,
+				struct rx_packet ** apackets, int npackets);
     } *ops;
     void *privateData;
     int refCount;
@@ -616,6 +657,12 @@ struct rx_securityClass {
 #define RXS_GetStats(obj,conn,stats) RXS_OP(obj,GetStats,(obj,conn,stats))
 #define RXS_SetConfiguration(obj, conn, type, value, currentValue) RXS_OP(obj, SetConfiguration,(obj,conn,type,value,currentValue))
 
+/* The batched forms of PreparePacket and CheckPacket are optional; a security
+ * class without them has each packet passed to the single packet op. */
+#define RXS_HasOp(obj,op) ((obj) && (obj)->ops->op_ ## op)
+#define RXS_PreparePackets(obj,call,packets,n) RXS_OP(obj,PreparePackets,(obj,call,packets,n))
+#define RXS_CheckPackets(obj,call,packets,n) RXS_OP(obj,CheckPackets,(obj,call,packets,n))
+
 
 
 /* Structure for keeping rx statistics.  Note that this structure is returned
@@ -667,7 +714,9 @@ struct rx_statistics {		/* General rx statistics */
     int receiveCbufPktAllocFailures;
     int sendCbufPktAllocFailures;
     int nBusies;
-    int spares[4];
+    int nRecvSyscalls;		/* Number of recvmsg/recvmmsg calls returning data */
+    int nSendSyscalls;		/* Number of sendmsg/sendmmsg calls */
+    int spares[2];
 };
 
 /* structures for debug input and output packets */
@@ -682,7 +731,7 @@ struct rx_debugIn {
 #define RX_DEBUGI_BADTYPE     (-8)
 
 #define RX_DEBUGI_VERSION_MINIMUM ('L')	/* earliest real version */
-#define RX_DEBUGI_VERSION     ('S')    /* Latest version */
+#define RX_DEBUGI_VERSION     ('U')    /* Latest version */
     /* first version w/ secStats */
 #define RX_DEBUGI_VERSION_W_SECSTATS ('L')
     /* version M is first supporting GETALLCONN and RXSTATS type */
@@ -696,6 +745,8 @@ struct rx_debugIn {
 #define RX_DEBUGI_VERSION_W_GETPEER ('Q')
 #define RX_DEBUGI_VERSION_W_WAITED ('R')
 #define RX_DEBUGI_VERSION_W_PACKETS ('S')
+#define RX_DEBUGI_VERSION_W_HASHWAITS ('T')
+#define RX_DEBUGI_VERSION_W_PACKETPOOL ('U')
 
 #define	RX_DEBUGI_GETSTATS	1	/* get basic rx stats */
 #define	RX_DEBUGI_GETCONN	2	/* get connection info */
@@ -715,7 +766,12 @@ struct rx_debugStats {
     afs_int32 idleThreads;	/* Number of server threads that are idle */
     afs_int32 nWaited;
     afs_int32 nPackets;
-    afs_int32 spare2[6];
+    afs_int32 nConnHashWaits;	/* Waits for a conn hash chain lock */
+    afs_int32 nPeerHashWaits;	/* Waits for a peer hash chain lock */
+    afs_int32 nDepotPackets;	/* Free packets in the per-CPU depots */
+    afs_int32 nDrainingPackets;	/* Free packets waiting to be released */
+    afs_int32 nReleasedPackets;	/* Packets released by the shrinker */
+    afs_int32 spare2[1];
 };
 
 struct rx_debugConn_vL {
@@ -802,6 +858,8 @@ struct rx_debugPeer {
 #define RX_SERVER_DEBUG_ALL_PEER		0x80
 #define RX_SERVER_DEBUG_WAITED_CNT              0x100
 #define RX_SERVER_DEBUG_PACKETS_CNT              0x200
+#define RX_SERVER_DEBUG_HASH_WAITS		0x400
+#define RX_SERVER_DEBUG_PACKET_POOL		0x800
 
 #define AFS_RX_STATS_CLEAR_ALL			0xffffffff
 #define AFS_RX_STATS_CLEAR_INVOCATIONS		0x1
@@ -34,6 +34,19 @@ struct rx_call_appl {
     afs_uint64 bytesRcvd;	/* Number bytes received */
 };
 
+/* State private to the call's congestion control algorithm */
+struct rx_ccstate {
+    afs_uint32 wmax;		/* Window when congestion was last seen */
+    afs_uint32 k;		/* Ticks from epoch until the window is wmax */
+    afs_uint32 origin;		/* Window around which growth is centred */
+    afs_uint32 epoch;		/* Tick at which this growth period began */
+    afs_uint32 est;		/* Window which linear growth would give */
+    afs_uint32 estAcks;		/* Acks towards the next increment of est */
+    afs_uint32 baseRtt;		/* Lowest RTT seen by the call, in usec */
+    afs_uint32 roundRtt;	/* Lowest RTT seen in this round, in usec */
+    afs_uint32 roundEnd;	/* Tick at which this round ends */
+};
+
 /* Call structure:  only instantiated for active calls and dallying
  * server calls.  The permanent call state (i.e. the call number as
  * well as state shared with other calls associated with this
@@ -74,6 +87,7 @@ struct rx_call {
     afs_uint32 rwind;		/* The receive window:  the peer must not send packets with sequence numbers >= rnext+rwind */
     afs_uint32 tfirst;		/* First unacknowledged transmit packet number */
     afs_uint32 tnext;		/* Next transmit sequence number to use */
+    struct rx_packet *tsend;	/* Everything in tq before this has been sent */
     afs_uint32 tprev;		/* Last packet that we saw an ack for */
     u_short twind;		/* The transmit window:  we cannot assign a sequence number to a packet >= tfirst + twind */
     u_short cwind;		/* The congestion window */
@@ -87,7 +101,10 @@ struct rx_call {
 				 * first negatively acked packet */
     u_short nSoftAcks;		/* The number of delayed soft acks */
     u_short nHardAcks;		/* The number of delayed hard acks */
+    u_short rqCount;		/* Number of packets in the receive queue */
     u_short congestSeq;		/* Peer's congestion sequence counter */
+    const struct rx_ccops *ccOps;	/* Congestion control algorithm */
+    struct rx_ccstate cc;	/* and its private state */
     int rtt;
     int rtt_dev;
     struct clock rto;		/* The round trip timeout calculated for this call */
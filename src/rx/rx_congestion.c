@@ -0,0 +1,430 @@
+/*
+ * Copyright 2000, International Business Machines Corporation and others.
+ * All Rights Reserved.
+ *
+ * This software has been released under the terms of the IBM Public
+ * License.  For details, see the LICENSE file in the top-level source
+ * directory or online at http://www.openafs.org/dl/license10.html
+ */
+
+/*!
+ * @file rx_congestion.c
+ *
+ * Congestion control algorithms for RX.
+ *
+ * The mechanics of loss recovery (noticing nacks and timeouts, fast
+ * recovery, and retransmission) are common to all algorithms and live in
+ * rx.c. What an algorithm decides is how the congestion window of a call
+ * grows as its packets are acknowledged, and what the slow start threshold
+ * becomes when congestion is signalled.
+ *
+ * The algorithm used by a call is chosen when the call starts. A setting
+ * for the peer takes precedence over one for the call's service, which
+ * in turn takes precedence over the process wide default.
+ */
+
+#include <afsconfig.h>
+#include <afs/param.h>
+
+#ifdef KERNEL
+# include "afs/sysincludes.h"
+# include "afsincludes.h"
+#else
+# include <roken.h>
+#endif
+
+#include "rx.h"
+#include "rx_clock.h"
+#include "rx_globals.h"
+#include "rx_atomic.h"
+#include "rx_internal.h"
+#include "rx_conn.h"
+#include "rx_call.h"
+#include "rx_peer.h"
+
+/* Times used by the algorithms are in ticks of 1/1024th of a second */
+#define CC_TICKS(c) \
+    ((afs_uint32)(((c)->sec << 10) | ((afs_uint32)(c)->usec >> 10)))
+
+/* The slow start phase, which is common to all of the algorithms. Returns
+ * true if the call is still in slow start. */
+static int
+ccSlowStart(struct rx_call *call, int newAcks)
+{
+    if (call->cwind >= call->ssthresh)
+	return 0;
+
+    call->cwind = MIN((int)call->ssthresh, (int)(call->cwind + newAcks));
+    call->nCwindAcks = 0;
+    return 1;
+}
+
+/* Grow the window by one packet for every 'cnt' acknowledgements */
+static void
+ccGrow(struct rx_call *call, int newAcks, afs_uint32 cnt)
+{
+    afs_uint32 inc;
+
+    if (cnt == 0)
+	cnt = 1;
+    call->nCwindAcks += newAcks;
+    if (call->nCwindAcks >= cnt) {
+	inc = call->nCwindAcks / cnt;
+	call->nCwindAcks -= inc * cnt;
+	call->cwind = MIN((int)(call->cwind + inc), rx_maxSendWindow);
+    }
+}
+
+/*
+ * Classic
+ *
+ * Rx's original algorithm. Exponential growth up to the slow start
+ * threshold, then one packet for each window's worth of acknowledgements.
+ * Congestion halves the window.
+ */
+
+static void
+classicStart(struct rx_call *call)
+{
+}
+
+static void
+classicAck(struct rx_call *call, int newAcks, struct clock *now)
+{
+    if (ccSlowStart(call, newAcks))
+	return;
+
+    call->nCwindAcks += newAcks;
+    if (call->nCwindAcks >= call->cwind) {
+	call->nCwindAcks = 0;
+	call->cwind = MIN((int)(call->cwind + 1), rx_maxSendWindow);
+    }
+}
+
+static void
+classicCongestion(struct rx_call *call, int timeout)
+{
+    call->ssthresh = MAX(4, MIN((int)call->cwind, (int)call->twind)) >> 1;
+}
+
+/*
+ * CUBIC
+ *
+ * After a reduction, the window follows a cubic function of the time since
+ * the reduction, which is centred on the window size at which congestion
+ * was last seen, so that it climbs quickly back towards that point, probes
+ * gingerly around it, and then accelerates away. Growth depends on elapsed
+ * time rather than on the rate of acknowledgements, so a call across a
+ * long fat pipe recovers as quickly as one across a LAN. The window is
+ * never allowed to grow more slowly than the classic algorithm would.
+ *
+ * This follows RFC 8312, with C = 0.4 and beta = 0.7, in integer
+ * arithmetic, as this must also run in the kernel.
+ */
+
+/* beta and (1 + beta) / 2, scaled by 256 */
+#define CUBIC_BETA		179
+#define CUBIC_CONVERGE		217
+
+/* Integer cube root */
+static afs_uint32
+icbrt(afs_uint64 x)
+{
+    afs_uint64 y = 0, b;
+    int s;
+
+    for (s = 63; s >= 0; s -= 3) {
+	y += y;
+	b = 3 * y * (y + 1) + 1;
+	if ((x >> s) >= b) {
+	    x -= b << s;
+	    y++;
+	}
+    }
+    return (afs_uint32)y;
+}
+
+static void
+cubicStart(struct rx_call *call)
+{
+    call->cc.wmax = 0;
+    call->cc.epoch = 0;
+}
+
+static void
+cubicAck(struct rx_call *call, int newAcks, struct clock *now)
+{
+    afs_uint32 t, offs, cnt;
+    afs_uint64 delta;
+    afs_int32 target;
+
+    if (ccSlowStart(call, newAcks) || newAcks == 0)
+	return;
+
+    if (call->cc.epoch == 0) {
+	/* Start of a new growth epoch. K is the time that the window will
+	 * take to get back to where it was when congestion was last seen:
+	 * K^3 = (Wmax - cwind) / C, which in ticks is
+	 * (Wmax - cwind) * 2.5 * 2^30 */
+	call->cc.epoch = CC_TICKS(now);
+	if (call->cc.epoch == 0)
+	    call->cc.epoch = 1;
+	if (call->cwind < call->cc.wmax) {
+	    call->cc.k = icbrt(((afs_uint64)(call->cc.wmax - call->cwind) * 5)
+			       << 29);
+	    call->cc.origin = call->cc.wmax;
+	} else {
+	    call->cc.k = 0;
+	    call->cc.origin = call->cwind;
+	}
+	call->cc.est = call->cwind;
+	call->cc.estAcks = 0;
+    }
+
+    /* Where the window should be one RTT from now */
+    t = CC_TICKS(now) - call->cc.epoch + (call->rtt >> 3);
+    offs = (t > call->cc.k) ? t - call->cc.k : call->cc.k - t;
+    if (offs > (1 << 16))
+	offs = 1 << 16;
+    /* C * (offs / 1024)^3, with 0.4 approximated as 13/32 */
+    delta = ((afs_uint64)offs * offs * offs * 13) >> 35;
+    if (t > call->cc.k)
+	target = call->cc.origin + (afs_int32)MIN(delta, 0xffff);
+    else
+	target = call->cc.origin - (afs_int32)MIN(delta, call->cc.origin);
+
+    /* Never more than 50% growth in one RTT */
+    if (target > call->cwind + (call->cwind >> 1))
+	target = call->cwind + (call->cwind >> 1);
+
+    if (target > call->cwind)
+	cnt = call->cwind / (target - call->cwind);
+    else
+	cnt = 100 * call->cwind;
+
+    /* The window that the classic algorithm would have reached since the
+     * epoch began, growing by 3 * (1 - beta) / (1 + beta) = 0.53 packets
+     * each RTT */
+    call->cc.estAcks += newAcks;
+    if (call->cc.estAcks >= ((afs_uint32)call->cwind * 121) >> 6) {
+	call->cc.estAcks = 0;
+	call->cc.est++;
+    }
+    if (call->cc.est > call->cwind
+	&& call->cwind / (call->cc.est - call->cwind) < cnt)
+	cnt = call->cwind / (call->cc.est - call->cwind);
+
+    ccGrow(call, newAcks, cnt);
+}
+
+static void
+cubicCongestion(struct rx_call *call, int timeout)
+{
+    afs_uint32 cwind = MIN((int)call->cwind, (int)call->twind);
+
+    /* If congestion came before we got back to the last Wmax, then the
+     * available capacity has shrunk, so release some more of it */
+    if (cwind < call->cc.wmax)
+	call->cc.wmax = (cwind * CUBIC_CONVERGE) >> 8;
+    else
+	call->cc.wmax = cwind;
+    call->ssthresh = MAX(2, (cwind * CUBIC_BETA) >> 8);
+    call->cc.epoch = 0;
+}
+
+/*
+ * Delay based
+ *
+ * Rather than waiting for the loss of a packet to reveal that a queue has
+ * overflowed, watch the queue build up. Once per round trip, compare the
+ * lowest RTT seen in that round with the lowest RTT ever seen by the
+ * call; the difference, multiplied by the rate at which we are sending,
+ * is the number of our packets sitting in queues. Keep that between
+ * DELAY_ALPHA and DELAY_BETA packets, and leave slow start as soon as it
+ * exceeds DELAY_GAMMA. Loss is handled as in the classic algorithm.
+ *
+ * This is in the style of TCP Vegas, and suits links where losses are
+ * not caused by congestion, on which a loss based algorithm never opens
+ * its window.
+ */
+
+#define DELAY_ALPHA	2
+#define DELAY_BETA	4
+#define DELAY_GAMMA	1
+
+static void
+delayStart(struct rx_call *call)
+{
+    call->cc.baseRtt = 0;
+    call->cc.roundRtt = 0;
+    call->cc.roundEnd = 0;
+}
+
+static void
+delayRtt(struct rx_call *call, struct clock *rtt)
+{
+    afs_uint32 usec;
+
+    if (rtt->sec > 60)
+	return;
+    usec = rtt->sec * 1000000 + rtt->usec;
+    if (usec == 0)
+	usec = 1;
+
+    if (call->cc.baseRtt == 0 || usec < call->cc.baseRtt)
+	call->cc.baseRtt = usec;
+    if (call->cc.roundRtt == 0 || usec < call->cc.roundRtt)
+	call->cc.roundRtt = usec;
+}
+
+static void
+delayAck(struct rx_call *call, int newAcks, struct clock *now)
+{
+    afs_uint32 queued;
+
+    if (call->cc.roundEnd != 0
+	&& (afs_int32)(CC_TICKS(now) - call->cc.roundEnd) < 0) {
+	/* Part way through a round */
+	ccSlowStart(call, newAcks);
+	return;
+    }
+
+    if (call->cc.roundRtt == 0) {
+	/* Without an RTT sample for the round we can't see the queue, so
+	 * behave like the classic algorithm until one arrives */
+	classicAck(call, newAcks, now);
+	return;
+    }
+
+    /* packets queued = cwind * (rtt - baseRtt) / rtt */
+    queued = ((afs_uint64)call->cwind
+	      * (call->cc.roundRtt - call->cc.baseRtt)) / call->cc.roundRtt;
+
+    if (call->cwind < call->ssthresh) {
+	if (queued > DELAY_GAMMA) {
+	    /* Queues are building, stop slow start here */
+	    call->ssthresh = call->cwind;
+	} else {
+	    ccSlowStart(call, newAcks);
+	}
+    } else if (queued < DELAY_ALPHA) {
+	call->cwind = MIN((int)(call->cwind + 1), rx_maxSendWindow);
+    } else if (queued > DELAY_BETA && call->cwind > 2) {
+	call->cwind--;
+    }
+    call->nCwindAcks = 0;
+
+    /* Start the next round. Rx numbers packets as they are queued rather
+     * than as they are sent, so rounds are measured by the clock */
+    call->cc.roundEnd = CC_TICKS(now) + MAX(call->cc.roundRtt >> 10, 1);
+    if (call->cc.roundEnd == 0)
+	call->cc.roundEnd = 1;
+    call->cc.roundRtt = 0;
+}
+
+static const struct rx_ccops rxi_ccOps[] = {
+    { "classic", classicStart, classicAck, classicCongestion, NULL },
+    { "cubic", cubicStart, cubicAck, cubicCongestion, NULL },
+    { "delay", delayStart, delayAck, classicCongestion, delayRtt },
+};
+
+/*!
+ * Choose the congestion control algorithm for a call which is starting
+ *
+ * Called with the peer locked, once the call's congestion window and slow
+ * start threshold have been initialised.
+ */
+void
+rxi_CongestionStart(struct rx_call *call)
+{
+    struct rx_connection *conn = call->conn;
+    int algorithm = conn->peer->ccAlgorithm;
+
+    if (algorithm == RX_CC_DEFAULT && conn->type == RX_SERVER_CONNECTION
+	&& conn->service != NULL)
+	algorithm = conn->service->ccAlgorithm;
+    if (algorithm == RX_CC_DEFAULT)
+	algorithm = rx_ccAlgorithm;
+
+    call->ccOps = &rxi_ccOps[algorithm - 1];
+    memset(&call->cc, 0, sizeof(call->cc));
+    (*call->ccOps->start)(call);
+}
+
+/*!
+ * Look up a congestion control algorithm by name
+ *
+ * @param[in] name
+ * 	The algorithm's name, "classic", "cubic", or "delay"
+ *
+ * @return
+ *	The algorithm's number, suitable for rx_SetCongestionControl(), or
+ *	-1 if there is no such algorithm.
+ */
+int
+rx_CongestionControlByName(const char *name)
+{
+    int i;
+
+    for (i = 0; i < RX_CC_MAX; i++) {
+	if (strcmp(name, rxi_ccOps[i].name) == 0)
+	    return i + 1;
+    }
+    return -1;
+}
+
+/*!
+ * Set the congestion control algorithm used by default for all calls
+ *
+ * @return
+ *	0 on success, or EINVAL if the algorithm is unknown.
+ */
+int
+rx_SetCongestionControl(int algorithm)
+{
+    if (algorithm < 1 || algorithm > RX_CC_MAX)
+	return EINVAL;
+    rx_ccAlgorithm = algorithm;
+    return 0;
+}
+
+/*!
+ * Set the congestion control algorithm used for calls to a service
+ *
+ * This applies to calls which start afterwards. RX_CC_DEFAULT reverts to
+ * the process wide default.
+ *
+ * @return
+ *	0 on success, or EINVAL if the algorithm is unknown.
+ */
+int
+rx_SetServiceCongestionControl(struct rx_service *service, int algorithm)
+{
+    if (algorithm < RX_CC_DEFAULT || algorithm > RX_CC_MAX)
+	return EINVAL;
+    service->ccAlgorithm = algorithm;
+    return 0;
+}
+
+/*!
+ * Set the congestion control algorithm used for all calls to and from the
+ * peer at the other end of a connection
+ *
+ * This overrides any service or process wide setting, for calls which
+ * start afterwards. RX_CC_DEFAULT removes the override.
+ *
+ * @return
+ *	0 on success, or EINVAL if the algorithm is unknown.
+ */
+int
+rx_SetPeerCongestionControl(struct rx_connection *conn, int algorithm)
+{
+    struct rx_peer *peer = conn->peer;
+
+    if (algorithm < RX_CC_DEFAULT || algorithm > RX_CC_MAX)
+	return EINVAL;
+    MUTEX_ENTER(&peer->peer_lock);
+    peer->ccAlgorithm = algorithm;
+    MUTEX_EXIT(&peer->peer_lock);
+    return 0;
+}
@@ -22,7 +22,7 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-/* A reimplementation of the rx_event handler using red/black trees
+/* A reimplementation of the rx_event handler using hierarchical timing wheels
  *
  * The first rx_event implementation used a simple sorted queue of all
  * events, which lead to O(n^2) performance, where n is the number of
@@ -34,9 +34,32 @@
  * where RTT times are in the millisecond, most connections will have events
  * expiring within the next second, so the problem reoccurs.
  *
- * This new implementation uses Red-Black trees to store a sorted list of
- * events. Red Black trees are guaranteed to have no worse than O(log N)
- * insertion, and are commonly used in timer applications
+ * The third implementation used Red-Black trees to store a sorted list of
+ * events. This gave O(log N) insertion, but every post and cancel from
+ * every call was serialised on the single tree lock, and with tens of
+ * thousands of calls, each of which constantly posts and cancels resend,
+ * delayed ack and keepalive events, that lock and the tree rebalancing
+ * dominated the profile.
+ *
+ * This implementation uses hierarchical timing wheels (Varghese and
+ * Lauck). Time is divided into ticks of 1/1024th of a second (just under
+ * a millisecond). The first level of each wheel has a slot for each of the
+ * next 256 ticks, and each of the three levels above it has 64 slots, each
+ * covering a whole turn of the level below, giving a range of roughly 18
+ * hours. Events which are further away than that are parked in the last
+ * level, and are placed again each time that they come round. An event is
+ * placed in the slot for its expiry tick, so posting and cancelling are O(1).
+ * When the first level completes a turn, the next slot of the level above
+ * is emptied, and its events are placed again, closer to their expiry.
+ *
+ * Events keep their exact expiry time, so an event never fires early, and
+ * the wakeup time handed back to the event thread is exact to the
+ * microsecond whenever an event is on the first level.
+ *
+ * There are several wheels, each with its own lock, and the wheel that an
+ * event lives on is chosen by its argument. Events belonging to a call,
+ * connection or peer therefore always share a wheel, whilst unrelated calls
+ * can post and cancel concurrently without contending for a lock.
  */
 
 #include <afsconfig.h>
@@ -51,18 +74,42 @@
 
 #include <afs/opr.h>
 #include <opr/queue.h>
-#include <opr/rbtree.h>
 
 #include "rx.h"
 #include "rx_atomic.h"
 #include "rx_call.h"
 #include "rx_globals.h"
 
+/* Ticks are 1/1024th of a second, so converting a clock into ticks needs
+ * only shifts. Microseconds above 999423 don't exist, so some tick values
+ * are never used, which doesn't matter. */
+#define RXEVENT_TICKBITS	10
+
+#define RXEVENT_WHEELBITS	3
+#define RXEVENT_WHEELS		(1 << RXEVENT_WHEELBITS)
+
+#define RXEVENT_L0BITS		8
+#define RXEVENT_L0SIZE		(1 << RXEVENT_L0BITS)
+#define RXEVENT_L0MASK		(RXEVENT_L0SIZE - 1)
+
+#define RXEVENT_LNBITS		6
+#define RXEVENT_LNSIZE		(1 << RXEVENT_LNBITS)
+#define RXEVENT_LNMASK		(RXEVENT_LNSIZE - 1)
+
+/* Number of levels above the first */
+#define RXEVENT_LEVELS		3
+
+#define RXEVENT_LEVELSHIFT(level) (RXEVENT_L0BITS + (level) * RXEVENT_LNBITS)
+#define RXEVENT_MAXDELTA \
+	((afs_uint64)1 << RXEVENT_LEVELSHIFT(RXEVENT_LEVELS))
+
+struct rxevent_wheel;
+
 struct rxevent {
     struct opr_queue q;
-    struct opr_rbtree_node node;
     struct clock eventTime;
-    struct rxevent *next;
+    struct rxevent_wheel *wheel;
+    int level;
     rx_atomic_t refcnt;
     int handled;
     void (*func)(struct rxevent *, void *, void *, int);
@@ -71,6 +118,15 @@ struct rxevent {
     int arg2;
 };
 
+struct rxevent_wheel {
+    afs_kmutex_t lock;
+    afs_uint64 tick;		/* Tick of the current first level slot */
+    int count;			/* Events on this wheel */
+    int count0;			/* Events on the first level */
+    struct opr_queue level0[RXEVENT_L0SIZE];
+    struct opr_queue levels[RXEVENT_LEVELS][RXEVENT_LNSIZE];
+};
+
 struct malloclist {
     void *mem;
     int size;
@@ -83,11 +139,7 @@ static struct {
     struct malloclist *mallocs;
 } freeEvents;
 
-static struct {
-    afs_kmutex_t lock;
-    struct opr_rbtree head;
-    struct rxevent *first;
-} eventTree;
+static struct rxevent_wheel eventWheels[RXEVENT_WHEELS];
 
 static struct {
     afs_kmutex_t lock;
@@ -172,26 +224,225 @@ rxevent_Get(struct rxevent *ev) {
     return rxevent_get(ev);
 }
 
+static_inline afs_uint64
+clockToTick(struct clock *c)
+{
+    return ((afs_uint64)c->sec << RXEVENT_TICKBITS)
+	   | ((afs_uint32)c->usec >> (20 - RXEVENT_TICKBITS));
+}
+
+static_inline void
+tickToClock(afs_uint64 tick, struct clock *c)
+{
+    c->sec = tick >> RXEVENT_TICKBITS;
+    c->usec = (tick & ((1 << RXEVENT_TICKBITS) - 1))
+	      << (20 - RXEVENT_TICKBITS);
+    if (c->usec >= 1000000) {
+	c->sec++;
+	c->usec = 0;
+    }
+}
+
+static_inline struct rxevent_wheel *
+chooseWheel(void *arg)
+{
+    afs_uint32 hash = (afs_uint32)((size_t)arg >> 3);
+
+    return &eventWheels[(hash * 2654435761U) >> (32 - RXEVENT_WHEELBITS)];
+}
+
+/* Place an event in the slot for its expiry time. The caller must hold the
+ * wheel lock. */
+static void
+wheelInsert(struct rxevent_wheel *wheel, struct rxevent *ev)
+{
+    afs_uint64 tick, delta;
+    int level;
+
+    tick = clockToTick(&ev->eventTime);
+    if (tick < wheel->tick)
+	tick = wheel->tick;
+    delta = tick - wheel->tick;
+
+    if (delta < RXEVENT_L0SIZE) {
+	ev->level = 0;
+	opr_queue_Append(&wheel->level0[tick & RXEVENT_L0MASK], &ev->q);
+	wheel->count0++;
+    } else {
+	if (delta >= RXEVENT_MAXDELTA)
+	    tick = wheel->tick + RXEVENT_MAXDELTA - 1;
+	for (level = 1; level < RXEVENT_LEVELS; level++) {
+	    if (delta < ((afs_uint64)1 << RXEVENT_LEVELSHIFT(level)))
+		break;
+	}
+	ev->level = level;
+	opr_queue_Append(&wheel->levels[level - 1]
+			    [(tick >> RXEVENT_LEVELSHIFT(level - 1))
+			     & RXEVENT_LNMASK],
+			 &ev->q);
+    }
+    wheel->count++;
+}
+
+static void
+wheelRemove(struct rxevent_wheel *wheel, struct rxevent *ev)
+{
+    opr_queue_Remove(&ev->q);
+    if (ev->level == 0)
+	wheel->count0--;
+    wheel->count--;
+}
+
+/* The first level of the wheel has just completed a turn. Empty the next
+ * slot of the level above into the levels below it, and if that level has
+ * also completed a turn, carry on up. */
+static void
+wheelCascade(struct rxevent_wheel *wheel)
+{
+    struct opr_queue list, *cursor, *store;
+    struct rxevent *ev;
+    int level, slot;
+
+    for (level = 0; level < RXEVENT_LEVELS; level++) {
+	slot = (wheel->tick >> RXEVENT_LEVELSHIFT(level)) & RXEVENT_LNMASK;
+
+	opr_queue_Init(&list);
+	opr_queue_SpliceAppend(&list, &wheel->levels[level][slot]);
+	for (opr_queue_ScanSafe(&list, cursor, store)) {
+	    ev = opr_queue_Entry(cursor, struct rxevent, q);
+	    opr_queue_Remove(&ev->q);
+	    wheel->count--;
+	    wheelInsert(wheel, ev);
+	}
+	if (slot != 0)
+	    break;
+    }
+}
+
+/* Move the wheel on to the tick 'target', moving every event which expires
+ * before 'now' onto the 'expired' queue. The caller must hold the wheel
+ * lock. */
+static void
+wheelAdvance(struct rxevent_wheel *wheel, afs_uint64 target,
+	     struct clock *now, struct opr_queue *expired)
+{
+    struct opr_queue *slot, *cursor, *store;
+    struct rxevent *ev;
+    afs_uint64 next;
+
+    for (;;) {
+	slot = &wheel->level0[wheel->tick & RXEVENT_L0MASK];
+	for (opr_queue_ScanSafe(slot, cursor, store)) {
+	    ev = opr_queue_Entry(cursor, struct rxevent, q);
+	    if (clock_Lt(&ev->eventTime, now)) {
+		wheelRemove(wheel, ev);
+		ev->handled = 1;
+		opr_queue_Append(expired, &ev->q);
+	    }
+	}
+
+	if (wheel->tick >= target)
+	    break;
+
+	if (wheel->count == 0) {
+	    /* Nothing to do, so just jump straight there */
+	    wheel->tick = target;
+	    continue;
+	}
+
+	if (wheel->count0 == 0) {
+	    /* Skip over empty slots to the end of this turn */
+	    next = (wheel->tick | RXEVENT_L0MASK) + 1;
+	    if (next > target) {
+		wheel->tick = target;
+		continue;
+	    }
+	    wheel->tick = next;
+	} else {
+	    wheel->tick++;
+	}
+
+	if ((wheel->tick & RXEVENT_L0MASK) == 0)
+	    wheelCascade(wheel);
+    }
+}
+
+/* Find the time at which this wheel next needs attention. This is either
+ * the exact time of the earliest event on the first level, or the time at
+ * which events will next be cascaded from the levels above. Returns 0 if
+ * the wheel is empty. The caller must hold the wheel lock. */
+static int
+wheelNextTime(struct rxevent_wheel *wheel, struct clock *when)
+{
+    struct opr_queue *slot, *cursor;
+    struct rxevent *ev;
+    struct clock cascade;
+    afs_uint64 base, tick, boundary;
+    int i, level, found = 0;
+
+    if (wheel->count == 0)
+	return 0;
+
+    clock_Zero(when);
+    boundary = (wheel->tick | RXEVENT_L0MASK) + 1;
+
+    if (wheel->count0 > 0) {
+	for (i = 0; i < RXEVENT_L0SIZE; i++) {
+	    slot = &wheel->level0[(wheel->tick + i) & RXEVENT_L0MASK];
+	    if (opr_queue_IsEmpty(slot))
+		continue;
+	    for (opr_queue_Scan(slot, cursor)) {
+		ev = opr_queue_Entry(cursor, struct rxevent, q);
+		if (!found || clock_Lt(&ev->eventTime, when)) {
+		    *when = ev->eventTime;
+		    found = 1;
+		}
+	    }
+	    break;
+	}
+	/* Nothing on the levels above can come due before this */
+	if (wheel->count == wheel->count0 || wheel->tick + i < boundary)
+	    return found;
+    }
+
+    for (level = 0; level < RXEVENT_LEVELS; level++) {
+	base = wheel->tick >> RXEVENT_LEVELSHIFT(level);
+	for (i = 1; i <= RXEVENT_LNSIZE; i++) {
+	    if (!opr_queue_IsEmpty(&wheel->levels[level]
+					       [(base + i) & RXEVENT_LNMASK])) {
+		tick = (base + i) << RXEVENT_LEVELSHIFT(level);
+		tickToClock(tick, &cascade);
+		if (!found || clock_Lt(&cascade, when)) {
+		    *when = cascade;
+		    found = 1;
+		}
+		break;
+	    }
+	}
+    }
+
+    return found;
+}
+
 /* Called if the time now is older than the last time we recorded running an
  * event. This test catches machines where the system time has been set
  * backwards, and avoids RX completely stalling when timers fail to fire.
  *
  * Take the different between now and the last event time, and subtract that
  * from the timing of every event on the system. This does a relatively slow
- * walk of the completely eventTree, but time-travel will hopefully be a pretty
- * rare occurrence.
- *
- * This can only safely be called from the event thread, as it plays with the
- * schedule directly.
- *
+ * walk of every slot of every wheel, but time-travel will hopefully be a
+ * pretty rare occurrence.
  */
 static void
 adjustTimes(void)
 {
-    struct opr_rbtree_node *node;
+    struct rxevent_wheel *wheel;
+    struct opr_queue list, *cursor, *store;
+    struct rxevent *ev;
     struct clock adjTime, now;
+    int i, j, k;
 
-    MUTEX_ENTER(&eventTree.lock);
+    MUTEX_ENTER(&eventSchedule.lock);
     /* Time adjustment is expensive, make absolutely certain that we have
      * to do it, by getting an up to date time to base our decision on
      * once we've acquired the relevant locks.
@@ -205,35 +456,65 @@ adjustTimes(void)
 
     clock_Sub(&adjTime, &now);
 
-    /* If there are no events in the tree, then there's nothing to adjust */
-    if (eventTree.first == NULL)
-	goto out;
+    for (i = 0; i < RXEVENT_WHEELS; i++) {
+	wheel = &eventWheels[i];
+
+	MUTEX_ENTER(&wheel->lock);
+	opr_queue_Init(&list);
+	for (j = 0; j < RXEVENT_L0SIZE; j++)
+	    opr_queue_SpliceAppend(&list, &wheel->level0[j]);
+	for (j = 0; j < RXEVENT_LEVELS; j++) {
+	    for (k = 0; k < RXEVENT_LNSIZE; k++)
+		opr_queue_SpliceAppend(&list, &wheel->levels[j][k]);
+	}
 
-    node = opr_rbtree_first(&eventTree.head);
-    while(node) {
-	struct rxevent *event = opr_containerof(node, struct rxevent, node);
+	wheel->tick = clockToTick(&now);
+	wheel->count = wheel->count0 = 0;
 
-	clock_Sub(&event->eventTime, &adjTime);
-	node = opr_rbtree_next(node);
+	for (opr_queue_ScanSafe(&list, cursor, store)) {
+	    ev = opr_queue_Entry(cursor, struct rxevent, q);
+	    opr_queue_Remove(&ev->q);
+	    clock_Sub(&ev->eventTime, &adjTime);
+	    wheelInsert(wheel, ev);
+	}
+	MUTEX_EXIT(&wheel->lock);
     }
-    eventSchedule.next = eventTree.first->eventTime;
+
+    /* Make sure that the event thread recomputes its next wakeup */
+    clock_Zero(&eventSchedule.next);
 
 out:
-    MUTEX_EXIT(&eventTree.lock);
+    MUTEX_EXIT(&eventSchedule.lock);
 }
 
 static int initialised = 0;
 void
 rxevent_Init(int nEvents, void (*scheduler)(void))
 {
+    struct rxevent_wheel *wheel;
+    struct clock now;
+    int i, j, k;
+
     if (initialised)
 	return;
 
     initialised = 1;
 
     clock_Init();
-    MUTEX_INIT(&eventTree.lock, "event tree lock", MUTEX_DEFAULT, 0);
-    opr_rbtree_init(&eventTree.head);
+    clock_GetTime(&now);
+
+    for (i = 0; i < RXEVENT_WHEELS; i++) {
+	wheel = &eventWheels[i];
+	MUTEX_INIT(&wheel->lock, "event wheel lock", MUTEX_DEFAULT, 0);
+	wheel->tick = clockToTick(&now);
+	wheel->count = wheel->count0 = 0;
+	for (j = 0; j < RXEVENT_L0SIZE; j++)
+	    opr_queue_Init(&wheel->level0[j]);
+	for (j = 0; j < RXEVENT_LEVELS; j++) {
+	    for (k = 0; k < RXEVENT_LNSIZE; k++)
+		opr_queue_Init(&wheel->levels[j][k]);
+	}
+    }
 
     MUTEX_INIT(&freeEvents.lock, "free events lock", MUTEX_DEFAULT, 0);
     opr_queue_Init(&freeEvents.list);
@@ -242,6 +523,7 @@ rxevent_Init(int nEvents, void (*scheduler)(void))
     if (nEvents)
 	allocUnit = nEvents;
 
+    MUTEX_INIT(&eventSchedule.lock, "event schedule lock", MUTEX_DEFAULT, 0);
     clock_Zero(&eventSchedule.next);
     clock_Zero(&eventSchedule.last);
     eventSchedule.raised = 0;
@@ -253,8 +535,9 @@ rxevent_Post(struct clock *when, struct clock *now,
 	     void (*func) (struct rxevent *, void *, void *, int),
 	     void *arg, void *arg1, int arg2)
 {
-    struct rxevent *ev, *event;
-    struct opr_rbtree_node **childptr, *parent = NULL;
+    struct rxevent_wheel *wheel;
+    struct rxevent *ev;
+    afs_uint64 tick;
 
     ev = rxevent_alloc();
     ev->eventTime = *when;
@@ -266,53 +549,36 @@ rxevent_Post(struct clock *when, struct clock *now,
     if (clock_Lt(now, &eventSchedule.last))
 	adjustTimes();
 
-    MUTEX_ENTER(&eventTree.lock);
-
-    /* Work out where in the tree we'll be storing this */
-    childptr = &eventTree.head.root;
-
-    while(*childptr) {
-	event = opr_containerof((*childptr), struct rxevent, node);
-
-	parent = *childptr;
-	if (clock_Lt(when, &event->eventTime))
-	    childptr = &(*childptr)->left;
-	else if (clock_Gt(when, &event->eventTime))
-	    childptr = &(*childptr)->right;
-	else {
-	    opr_queue_Append(&event->q, &ev->q);
-	    goto out;
-	}
+    wheel = chooseWheel(arg);
+    ev->wheel = wheel;
+
+    MUTEX_ENTER(&wheel->lock);
+    /* An empty wheel may not have been turned for a while. Bring it up to
+     * date, so that it doesn't have to turn through all of the intervening
+     * slots to reach this event */
+    if (wheel->count == 0) {
+	tick = clockToTick(now);
+	if (tick > wheel->tick)
+	    wheel->tick = tick;
     }
-    opr_queue_Init(&ev->q);
-    opr_rbtree_insert(&eventTree.head, parent, childptr, &ev->node);
-
-    if (eventTree.first == NULL ||
-	clock_Lt(when, &(eventTree.first->eventTime))) {
-	eventTree.first = ev;
+    wheelInsert(wheel, ev);
+    rxevent_get(ev); /* Reference for the caller */
+    MUTEX_EXIT(&wheel->lock);
+
+    /* If the event thread is idle, or is going to sleep past this event,
+     * then wake it up */
+    MUTEX_ENTER(&eventSchedule.lock);
+    if (!eventSchedule.raised || clock_Lt(when, &eventSchedule.next)) {
 	eventSchedule.raised = 1;
 	clock_Zero(&eventSchedule.next);
-	MUTEX_EXIT(&eventTree.lock);
+	MUTEX_EXIT(&eventSchedule.lock);
 	if (eventSchedule.func != NULL)
 	    (*eventSchedule.func)();
-	return rxevent_get(ev);
+	return ev;
     }
+    MUTEX_EXIT(&eventSchedule.lock);
 
-out:
-    MUTEX_EXIT(&eventTree.lock);
-    return rxevent_get(ev);
-}
-
-/* We're going to remove ev from the tree, so set the first pointer to the
- * next event after it */
-static_inline void
-resetFirst(struct rxevent *ev)
-{
-    struct opr_rbtree_node *next = opr_rbtree_next(&ev->node);
-    if (next)
-	eventTree.first = opr_containerof(next, struct rxevent, node);
-    else
-	eventTree.first = NULL;
+    return ev;
 }
 
 /*!
@@ -325,6 +591,7 @@ resetFirst(struct rxevent *ev)
 int
 rxevent_Cancel(struct rxevent **evp)
 {
+    struct rxevent_wheel *wheel;
     struct rxevent *event;
     int cancelled = 0;
 
@@ -332,50 +599,18 @@ rxevent_Cancel(struct rxevent **evp)
 	return 0;
 
     event = *evp;
+    wheel = event->wheel;
 
-    MUTEX_ENTER(&eventTree.lock);
+    MUTEX_ENTER(&wheel->lock);
 
     if (!event->handled) {
-	/* We're a node on the red/black tree. If our list is non-empty,
-	 * then swap the first element in the list in in our place,
-	 * promoting it to the list head */
-	if (event->node.parent == NULL
-	    && eventTree.head.root != &event->node) {
-	    /* Not in the rbtree, therefore must be a list element */
-	    opr_queue_Remove(&event->q);
-	} else {
-	    if (!opr_queue_IsEmpty(&event->q)) {
-	        struct rxevent *next;
-
-		next = opr_queue_First(&event->q, struct rxevent, q);
-		opr_queue_Remove(&next->q); /* Remove ourselves from list */
-		if (event->q.prev == &event->q) {
-		    next->q.prev = next->q.next = &next->q;
-		} else {
-		    next->q = event->q;
-		    next->q.prev->next = &next->q;
-		    next->q.next->prev = &next->q;
-		}
-
-		opr_rbtree_replace(&eventTree.head, &event->node,
-				   &next->node);
-
-		if (eventTree.first == event)
-		    eventTree.first = next;
-
-	    } else {
-		if (eventTree.first == event)
-		    resetFirst(event);
-
-		opr_rbtree_remove(&eventTree.head, &event->node);
-	    }
-	}
+	wheelRemove(wheel, event);
 	event->handled = 1;
-	rxevent_put(event); /* Dispose of eventTree reference */
+	rxevent_put(event); /* Dispose of wheel reference */
 	cancelled = 1;
     }
 
-    MUTEX_EXIT(&eventTree.lock);
+    MUTEX_EXIT(&wheel->lock);
 
     *evp = NULL;
     rxevent_put(event); /* Dispose of caller's reference */
@@ -396,65 +631,86 @@ rxevent_Cancel(struct rxevent **evp)
 int
 rxevent_RaiseEvents(struct clock *wait)
 {
-    struct clock now;
+    struct rxevent_wheel *wheel;
+    struct opr_queue expired;
+    struct clock now, next, when;
     struct rxevent *event;
-    int ret;
+    afs_uint64 tick;
+    int i, ret;
 
-    clock_GetTime(&now);
+    opr_queue_Init(&expired);
 
-    /* Check for time going backwards */
-    if (clock_Lt(&now, &eventSchedule.last))
-	  adjustTimes();
-    eventSchedule.last = now;
-
-    MUTEX_ENTER(&eventTree.lock);
-    /* Lock our event tree */
-    while (eventTree.first != NULL
-	   && clock_Lt(&eventTree.first->eventTime, &now)) {
-
-	/* Grab the next node, either in the event's list, or in the tree node
-	 * itself, and remove it from the event tree */
-	event = eventTree.first;
-	if (!opr_queue_IsEmpty(&event->q)) {
-	    event = opr_queue_Last(&event->q, struct rxevent, q);
-	    opr_queue_Remove(&event->q);
-	} else {
-	    resetFirst(event);
-	    opr_rbtree_remove(&eventTree.head, &event->node);
+    for (;;) {
+	clock_GetTime(&now);
+
+	/* Check for time going backwards */
+	if (clock_Lt(&now, &eventSchedule.last))
+	    adjustTimes();
+	eventSchedule.last = now;
+
+	tick = clockToTick(&now);
+	for (i = 0; i < RXEVENT_WHEELS; i++) {
+	    wheel = &eventWheels[i];
+	    MUTEX_ENTER(&wheel->lock);
+	    wheelAdvance(wheel, tick, &now, &expired);
+	    MUTEX_EXIT(&wheel->lock);
 	}
-	event->handled = 1;
-        MUTEX_EXIT(&eventTree.lock);
 
-        /* Fire the event, then free the structure */
-	event->func(event, event->arg, event->arg1, event->arg2);
-	rxevent_put(event);
+	/* Fire the events, then free the structures */
+	while (!opr_queue_IsEmpty(&expired)) {
+	    event = opr_queue_First(&expired, struct rxevent, q);
+	    opr_queue_Remove(&event->q);
+	    event->func(event, event->arg, event->arg1, event->arg2);
+	    rxevent_put(event);
+	}
 
-	MUTEX_ENTER(&eventTree.lock);
-    }
+	/* Figure out when we next need to be scheduled. This is done with the
+	 * schedule lock held, so that anything posted after we've looked at
+	 * its wheel will be compared against the new schedule */
+	MUTEX_ENTER(&eventSchedule.lock);
+	ret = 0;
+	for (i = 0; i < RXEVENT_WHEELS; i++) {
+	    wheel = &eventWheels[i];
+	    MUTEX_ENTER(&wheel->lock);
+	    if (wheelNextTime(wheel, &when)) {
+		if (!ret || clock_Lt(&when, &next))
+		    next = when;
+		ret = 1;
+	    }
+	    MUTEX_EXIT(&wheel->lock);
+	}
 
-    /* Figure out when we next need to be scheduled */
-    if (eventTree.first != NULL) {
-	*wait = eventSchedule.next = eventTree.first->eventTime;
-	ret = eventSchedule.raised = 1;
-	clock_Sub(wait, &now);
-    } else {
-	ret = eventSchedule.raised = 0;
-    }
+	/* Events which were posted while we were firing may already be due */
+	if (ret && clock_Lt(&next, &now)) {
+	    MUTEX_EXIT(&eventSchedule.lock);
+	    continue;
+	}
 
-    MUTEX_EXIT(&eventTree.lock);
+	if (ret) {
+	    *wait = eventSchedule.next = next;
+	    eventSchedule.raised = 1;
+	    clock_Sub(wait, &now);
+	} else {
+	    eventSchedule.raised = 0;
+	}
+	MUTEX_EXIT(&eventSchedule.lock);
 
-    return ret;
+	return ret;
+    }
 }
 
 void
 shutdown_rxevent(void)
 {
     struct malloclist *mrec, *nmrec;
+    int i;
 
     if (!initialised) {
 	return;
     }
-    MUTEX_DESTROY(&eventTree.lock);
+    for (i = 0; i < RXEVENT_WHEELS; i++)
+	MUTEX_DESTROY(&eventWheels[i].lock);
+    MUTEX_DESTROY(&eventSchedule.lock);
 
 #if !defined(AFS_AIX32_ENV) || !defined(KERNEL)
     MUTEX_DESTROY(&freeEvents.lock);
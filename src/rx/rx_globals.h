@@ -113,12 +113,13 @@ EXT int rx_BusyError GLOBALSINIT(-1);
 
 EXT int rx_minPeerTimeout GLOBALSINIT(20);      /* in milliseconds */
 EXT int rx_minWindow GLOBALSINIT(1);
-EXT int rx_maxWindow GLOBALSINIT(RX_MAXACKS);   /* must ack what we receive */
+EXT int rx_maxWindow GLOBALSINIT(RX_MAXWINDOW);   /* must ack what we receive */
 EXT int rx_initReceiveWindow GLOBALSINIT(16);	/* how much to accept */
 EXT int rx_maxReceiveWindow GLOBALSINIT(32);	/* how much to accept */
 EXT int rx_initSendWindow GLOBALSINIT(16);
 EXT int rx_maxSendWindow GLOBALSINIT(32);
 EXT int rx_nackThreshold GLOBALSINIT(3);	/* Number NACKS to trigger congestion recovery */
+EXT int rx_ccAlgorithm GLOBALSINIT(RX_CC_CLASSIC);	/* Default congestion control */
 EXT int rx_nDgramThreshold GLOBALSINIT(4);	/* Number of packets before increasing
                                                  * packets per datagram */
 #define RX_MAX_FRAGS 4
@@ -168,6 +169,7 @@ typedef struct rx_ts_info_t {
         int galloc_xfer;
     } _FPQ;
     struct rx_packet * local_special_packet;
+    int depot;			/* Packet depot to use if we don't know our CPU */
 } rx_ts_info_t;
 EXT struct rx_ts_info_t * rx_ts_info_init(void);   /* init function for thread-specific data struct */
 #define RX_TS_INFO_GET(ts_info_p) \
@@ -243,6 +245,30 @@ EXT int rx_TSFPQMaxProcs GLOBALSINIT(0); /* max number of threads expected */
 #define RX_TS_FPQ_FLUSH_GLOBAL 1
 #define RX_TS_FPQ_PULL_GLOBAL 1
 #define RX_TS_FPQ_ALLOW_OVERCOMMIT 1
+/*
+ * Per-CPU packet depots sit between the thread-specific and global free
+ * packet queues. A thread returns its surplus packets to the depot for the
+ * CPU it is running on, and refills from there, so that only a depot's
+ * overflow and underflow reach rx_freePacketQueue. A depot holds no more
+ * than RX_TS_FPQ_DEPOT_MAX packets, and each is protected by its own lock,
+ * which may be taken while holding rx_freePktQ_lock.
+ */
+#define RX_PACKET_DEPOTS 16
+#define RX_TS_FPQ_DEPOT_MAX (4 * rx_TSFPQGlobSize)
+struct rx_packetDepot {
+    afs_kmutex_t lock;
+    struct opr_queue queue;
+    int len;
+};
+EXT struct rx_packetDepot rx_packetDepots[RX_PACKET_DEPOTS];
+/* The pool never shrinks below its initial size */
+EXT int rx_minPackets GLOBALSINIT(0);
+/* Fewest packets in the global free queue since the pool was last shrunk */
+EXT int rx_nFreePacketsLow GLOBALSINIT(0);
+/* Packets set aside so that their block can be freed */
+EXT int rx_nDrainingPackets GLOBALSINIT(0);
+/* Packets freed by the shrinker */
+EXT int rx_nReleasedPackets GLOBALSINIT(0);
 /*
  * compute the localmax and globsize values from rx_TSFPQMaxProcs and rx_nPackets.
  * arbitarily set local max so that all threads consume 90% of packets, if all local queues are full.
@@ -341,6 +367,8 @@ EXT int rx_TSFPQMaxProcs GLOBALSINIT(0); /* max number of threads expected */
 				   &((rx_ts_info_p)->_FPQ.queue), &p->entry); \
         (rx_ts_info_p)->_FPQ.len += i; \
         rx_nFreePackets -= i; \
+        if (rx_nFreePackets < rx_nFreePacketsLow) \
+            rx_nFreePacketsLow = rx_nFreePackets; \
         (rx_ts_info_p)->_FPQ.gtol_ops++; \
         (rx_ts_info_p)->_FPQ.gtol_xfer += i; \
     } while(0)
@@ -359,6 +387,8 @@ EXT int rx_TSFPQMaxProcs GLOBALSINIT(0); /* max number of threads expected */
 				   &((rx_ts_info_p)->_FPQ.queue), &p->entry); \
         (rx_ts_info_p)->_FPQ.len += i; \
         rx_nFreePackets -= i; \
+        if (rx_nFreePackets < rx_nFreePacketsLow) \
+            rx_nFreePacketsLow = rx_nFreePackets; \
         (rx_ts_info_p)->_FPQ.gtol_ops++; \
         (rx_ts_info_p)->_FPQ.gtol_xfer += i; \
     } while(0)
@@ -517,15 +547,53 @@ EXT struct rx_peer **rx_peerHashTable;
 EXT struct rx_connection **rx_connHashTable;
 EXT struct rx_connection *rx_connCleanup_list GLOBALSINIT(0);
 EXT afs_uint32 rx_hashTableSize GLOBALSINIT(257);	/* Prime number */
+
+/* The connection and peer hash tables are each protected by an array of
+ * locks; hash chain i is protected by lock i % RX_HASH_LOCKS.  This keeps
+ * lookups from the listener threads from queueing behind each other and
+ * behind connection creation and reaping. */
+#define RX_HASH_LOCKS 64
 #ifdef RX_ENABLE_LOCKS
-EXT afs_kmutex_t rx_peerHashTable_lock;
-EXT afs_kmutex_t rx_connHashTable_lock;
+EXT afs_kmutex_t rx_connHashLocks[RX_HASH_LOCKS];
+EXT afs_kmutex_t rx_peerHashLocks[RX_HASH_LOCKS];
+EXT afs_kmutex_t rx_connHashTable_lock;	/* rx_nextCid, rx_connCleanup_list */
 #endif /* RX_ENABLE_LOCKS */
 
 #define CONN_HASH(host, port, cid, epoch, type) ((((cid)>>RX_CIDSHIFT)%rx_hashTableSize))
 
 #define PEER_HASH(host, port)  ((host ^ port) % rx_hashTableSize)
 
+/* Lock and unlock the chain with the given hash index.  Times we had to
+ * wait for the lock are counted for rxdebug. */
+#define RX_HASH_LOCK_ENTER(lock, waits)		\
+    do {					\
+	if (!MUTEX_TRYENTER(lock)) {		\
+	    rx_atomic_inc(waits);		\
+	    MUTEX_ENTER(lock);			\
+	}					\
+    } while (0)
+
+#ifdef RX_ENABLE_LOCKS
+#define CONN_HASH_LOCK(idx) \
+    RX_HASH_LOCK_ENTER(&rx_connHashLocks[(idx) % RX_HASH_LOCKS], \
+		       &rx_connHashWaits)
+#define CONN_HASH_UNLOCK(idx) \
+    MUTEX_EXIT(&rx_connHashLocks[(idx) % RX_HASH_LOCKS])
+#define PEER_HASH_LOCK(idx) \
+    RX_HASH_LOCK_ENTER(&rx_peerHashLocks[(idx) % RX_HASH_LOCKS], \
+		       &rx_peerHashWaits)
+#define PEER_HASH_UNLOCK(idx) \
+    MUTEX_EXIT(&rx_peerHashLocks[(idx) % RX_HASH_LOCKS])
+#else
+#define CONN_HASH_LOCK(idx)	((void)(idx))
+#define CONN_HASH_UNLOCK(idx)	((void)(idx))
+#define PEER_HASH_LOCK(idx)	((void)(idx))
+#define PEER_HASH_UNLOCK(idx)	((void)(idx))
+#endif /* RX_ENABLE_LOCKS */
+
+/* The hash index of a peer which is already in the table */
+#define PEER_HASH_INDEX(peer) PEER_HASH((peer)->host, (peer)->port)
+
 /* Forward definitions of internal procedures */
 #define	rxi_ChallengeOff(conn)	\
 	rxevent_Cancel(&(conn)->challengeEvent)
@@ -626,5 +694,25 @@ EXT int rx_enable_stats GLOBALSINIT(0);
  */
 EXT int rx_enable_hot_thread GLOBALSINIT(0);
 
+/*
+ * Batched datagram I/O.  When rx_ioBatchSize is greater than one, the
+ * pthread listener reads up to that many datagrams with a single recvmmsg
+ * call, and the datagrams making up one transmit burst are handed to the
+ * kernel with a single sendmmsg call.  Set with rx_SetIOBatchSize().
+ */
+#if defined(AFS_PTHREAD_ENV) && !defined(KERNEL) && defined(HAVE_RECVMMSG) \
+    && defined(HAVE_SENDMMSG)
+#define RX_ENABLE_MMSG
+#endif
+#define RX_MAXIOBATCH 32
+EXT int rx_ioBatchSize GLOBALSINIT(0);
+
+/*
+ * Number of sockets opened on each Rx port, each read by its own listener
+ * thread.  Set with rx_SetListenerSockets().
+ */
+#define RX_MAXLISTENERSOCKETS 64
+EXT int rx_listenerSockets GLOBALSINIT(1);
+
 EXT int RX_IPUDP_SIZE GLOBALSINIT(_RX_IPUDP_SIZE);
 #endif /* AFS_RX_GLOBALS_H */
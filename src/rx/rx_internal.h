@@ -16,6 +16,12 @@
 /* Globals that we don't want the world to know about */
 extern rx_atomic_t rx_nWaiting;
 extern rx_atomic_t rx_nWaited;
+extern rx_atomic_t rx_connHashWaits;
+extern rx_atomic_t rx_peerHashWaits;
+
+/* The most packets handed to a security class's PreparePackets or
+ * CheckPackets op at once */
+#define RX_SECURITY_BATCH 8
 
 /* Prototypes for internal functions */
 
@@ -60,9 +66,64 @@ extern void rxi_WaitforTQBusy(struct rx_call *call);
 # define rxi_WaitforTQBusy(call)
 #endif
 
+/* rx_congestion.c */
+
+/* A congestion control algorithm. ack is called as new packets are
+ * acknowledged, outside of fast recovery, and grows the window. congestion
+ * sets the slow start threshold when loss is detected, either by negative
+ * acks or by a retransmission timeout. rtt, if present, sees each RTT
+ * sample taken by the call. All are called with the call locked. */
+struct rx_ccops {
+    const char *name;
+    void (*start)(struct rx_call *call);
+    void (*ack)(struct rx_call *call, int newAcks, struct clock *now);
+    void (*congestion)(struct rx_call *call, int timeout);
+    void (*rtt)(struct rx_call *call, struct clock *rtt);
+};
+
+extern void rxi_CongestionStart(struct rx_call *call);
+
 /* rx_packet.h */
 
 extern int rxi_SendIovecs(struct rx_connection *conn, struct iovec *iov,
 			  int iovcnt, size_t length, int istack);
 extern void rxi_SendRaw(struct rx_call *call, struct rx_connection *conn,
 			int type, char *data, int bytes, int istack);
+#ifdef RX_ENABLE_TSFPQ
+extern void rxi_InitPacketDepots(void);
+extern int rxi_CountDepotPackets(void);
+extern void rxi_IdleLocalPacketsTSFPQ(void);
+extern void rxi_ShrinkPackets(void);
+#endif
+
+struct rx_xmitbatch;
+
+#ifdef RX_ENABLE_MMSG
+/* A burst of datagrams for a single peer, handed to the kernel with one
+ * sendmmsg call.  lists and lens record the packets making up each
+ * datagram, so that they can be retransmitted early if the send fails. */
+struct rx_xmitbatch {
+    osi_socket socket;
+    int ndgrams;
+    struct mmsghdr msgs[RX_MAXIOBATCH];
+    struct sockaddr_in addrs[RX_MAXIOBATCH];
+    struct iovec iov[RX_MAXIOBATCH][RX_MAXIOVECS];
+    struct rx_packet **lists[RX_MAXIOBATCH];
+    int lens[RX_MAXIOBATCH];
+};
+
+extern int rxi_ReadPackets(osi_socket socket, struct rx_packet **packets,
+			   int npackets, afs_uint32 *hosts, u_short *ports);
+extern void rxi_QueuePacketList(struct rx_call *call,
+				struct rx_connection *conn,
+				struct rx_packet **list, int len, int istack,
+				struct rx_xmitbatch *batch);
+extern void rxi_FlushXmitBatch(struct rx_call *call,
+			       struct rx_xmitbatch *batch, int istack);
+
+/* rx_pthread.c */
+extern int rxi_Recvmmsg(osi_socket socket, struct mmsghdr *msgs, int nmsgs,
+			int flags);
+extern int rxi_Sendmmsg(osi_socket socket, struct mmsghdr *msgs, int nmsgs,
+			int flags);
+#endif
@@ -52,6 +52,9 @@
 #  include "rx_xmit_nt.h"
 # endif
 # include <lwp.h>
+# ifdef HAVE_SCHED_GETCPU
+#  include <sched.h>
+# endif
 #endif /* KERNEL */
 
 #ifdef	AFS_SUN5_ENV
@@ -99,6 +102,11 @@ static int rxi_FreeDataBufsTSFPQ(struct rx_packet *p, afs_uint32 first,
 				 int flush_global);
 static void rxi_AdjustLocalPacketsTSFPQ(int num_keep_local,
 					int allow_overcommit);
+static void rxi_NewPacketBlockNoLock(struct rx_packet *p, int apackets);
+static int rxi_FillLocalFromDepot(struct rx_ts_info_t *rx_ts_info,
+				  int num_transfer);
+static void rxi_FlushLocalToDepot(struct rx_ts_info_t *rx_ts_info);
+static int rxi_ReclaimPacketsNoLock(void);
 #else
 static void rxi_FreePacketNoLock(struct rx_packet *p);
 static int rxi_FreeDataBufsNoLock(struct rx_packet *p, afs_uint32 first);
@@ -265,6 +273,9 @@ AllocPacketBufs(int class, int num_pkts, struct opr_queue * q)
     RX_TS_INFO_GET(rx_ts_info);
 
     transfer = num_pkts - rx_ts_info->_FPQ.len;
+    if (transfer > 0)
+	transfer -= rxi_FillLocalFromDepot(rx_ts_info,
+					   MAX(transfer, rx_TSFPQGlobSize));
     if (transfer > 0) {
         NETPRI;
         MUTEX_ENTER(&rx_freePktQ_lock);
@@ -369,7 +380,6 @@ rxi_FreePackets(int num_pkts, struct opr_queue * q)
 {
     struct rx_ts_info_t * rx_ts_info;
     struct opr_queue *cursor, *store;
-    SPLVAR;
 
     osi_Assert(num_pkts >= 0);
     RX_TS_INFO_GET(rx_ts_info);
@@ -391,18 +401,8 @@ rxi_FreePackets(int num_pkts, struct opr_queue * q)
 	RX_TS_FPQ_QCHECKIN(rx_ts_info, num_pkts, q);
     }
 
-    if (rx_ts_info->_FPQ.len > rx_TSFPQLocalMax) {
-        NETPRI;
-	MUTEX_ENTER(&rx_freePktQ_lock);
-
-	RX_TS_FPQ_LTOG(rx_ts_info);
-
-	/* Wakeup anyone waiting for packets */
-	rxi_PacketsUnWait();
-
-	MUTEX_EXIT(&rx_freePktQ_lock);
-	USERPRI;
-    }
+    if (rx_ts_info->_FPQ.len > rx_TSFPQLocalMax)
+	rxi_FlushLocalToDepot(rx_ts_info);
 
     return num_pkts;
 }
@@ -536,6 +536,383 @@ rxi_AllocDataBuf(struct rx_packet *p, int nb, int class)
     return nb;
 }
 
+#ifdef RX_ENABLE_TSFPQ
+/*
+ * Each allocation of packets is recorded as a block, so that the shrinker
+ * can hand the memory back once all of a block's packets are free. The list
+ * of blocks and their contents are protected by rx_freePktQ_lock.
+ */
+struct rx_packetBlock {
+    struct opr_queue entry;
+    struct rx_packet *packets;
+    int npackets;
+    int nidle;			/* Packets in the global free queue */
+    int draining;		/* Free packets are being set aside */
+    int naside;			/* Number of packets set aside */
+    int lastaside;		/* naside at the end of the last interval */
+    struct opr_queue aside;	/* Free packets set aside */
+};
+
+static struct opr_queue rx_packetBlocks;
+
+void
+rxi_InitPacketDepots(void)
+{
+    int i;
+
+    for (i = 0; i < RX_PACKET_DEPOTS; i++) {
+	MUTEX_INIT(&rx_packetDepots[i].lock, "rx_packetDepot", MUTEX_DEFAULT,
+		   0);
+	opr_queue_Init(&rx_packetDepots[i].queue);
+	rx_packetDepots[i].len = 0;
+    }
+    opr_queue_Init(&rx_packetBlocks);
+}
+
+static void
+rxi_NewPacketBlockNoLock(struct rx_packet *p, int apackets)
+{
+    struct rx_packetBlock *b;
+    int i;
+
+    b = osi_Alloc(sizeof(*b));
+    osi_Assert(b);
+    memset(b, 0, sizeof(*b));
+    b->packets = p;
+    b->npackets = apackets;
+    opr_queue_Init(&b->aside);
+    for (i = 0; i < apackets; i++)
+	p[i].block = b;
+    opr_queue_Append(&rx_packetBlocks, &b->entry);
+}
+
+/* Find the depot for the CPU we're running on */
+static_inline struct rx_packetDepot *
+rxi_PacketDepot(struct rx_ts_info_t *rx_ts_info)
+{
+#ifdef HAVE_SCHED_GETCPU
+    int cpu = sched_getcpu();
+
+    if (cpu >= 0)
+	return &rx_packetDepots[cpu % RX_PACKET_DEPOTS];
+#endif
+    return &rx_packetDepots[rx_ts_info->depot];
+}
+
+/*
+ * Refill a thread's local free packet queue from the depot for the current
+ * CPU. Returns the number of packets moved, which may be fewer than were
+ * asked for, in which case the caller must go to the global queue.
+ */
+static int
+rxi_FillLocalFromDepot(struct rx_ts_info_t *rx_ts_info, int num_transfer)
+{
+    struct rx_packetDepot *depot;
+    struct rx_packet *p;
+    int i;
+
+    depot = rxi_PacketDepot(rx_ts_info);
+    MUTEX_ENTER(&depot->lock);
+    num_transfer = MIN(num_transfer, depot->len);
+    if (num_transfer <= 0) {
+	MUTEX_EXIT(&depot->lock);
+	return 0;
+    }
+    for (i = 0, p = opr_queue_First(&depot->queue, struct rx_packet, entry);
+	 i < num_transfer;
+	 i++, p = opr_queue_Next(&p->entry, struct rx_packet, entry));
+    opr_queue_SplitBeforeAppend(&depot->queue, &rx_ts_info->_FPQ.queue,
+				&p->entry);
+    depot->len -= num_transfer;
+    MUTEX_EXIT(&depot->lock);
+
+    rx_ts_info->_FPQ.len += num_transfer;
+    rx_ts_info->_FPQ.gtol_ops++;
+    rx_ts_info->_FPQ.gtol_xfer += num_transfer;
+    return num_transfer;
+}
+
+/*
+ * Move the oldest tsize packets on a thread's local free packet queue to the
+ * depot for the current CPU. Only if that overflows the depot does anything
+ * reach the global queue, and then the depot goes back down to half full.
+ */
+static void
+rxi_MoveLocalToDepot(struct rx_ts_info_t *rx_ts_info, int tsize)
+{
+    struct rx_packetDepot *depot;
+    struct rx_packet *p;
+    struct opr_queue overflow;
+    int i, nover = 0;
+    SPLVAR;
+
+    for (i = 0, p = opr_queue_Last(&rx_ts_info->_FPQ.queue, struct rx_packet,
+				   entry);
+	 i < tsize;
+	 i++, p = opr_queue_Prev(&p->entry, struct rx_packet, entry));
+
+    opr_queue_Init(&overflow);
+    depot = rxi_PacketDepot(rx_ts_info);
+    MUTEX_ENTER(&depot->lock);
+    opr_queue_SplitAfterPrepend(&rx_ts_info->_FPQ.queue, &depot->queue,
+				&p->entry);
+    depot->len += tsize;
+    if (depot->len > RX_TS_FPQ_DEPOT_MAX) {
+	nover = depot->len - RX_TS_FPQ_DEPOT_MAX / 2;
+	for (i = 0, p = opr_queue_Last(&depot->queue, struct rx_packet, entry);
+	     i < nover;
+	     i++, p = opr_queue_Prev(&p->entry, struct rx_packet, entry));
+	opr_queue_SplitAfterPrepend(&depot->queue, &overflow, &p->entry);
+	depot->len -= nover;
+    }
+    MUTEX_EXIT(&depot->lock);
+
+    rx_ts_info->_FPQ.len -= tsize;
+    rx_ts_info->_FPQ.ltog_ops++;
+    rx_ts_info->_FPQ.ltog_xfer += tsize;
+    if (rx_ts_info->_FPQ.delta) {
+	MUTEX_ENTER(&rx_packets_mutex);
+	RX_TS_FPQ_COMPUTE_LIMITS;
+	MUTEX_EXIT(&rx_packets_mutex);
+	rx_ts_info->_FPQ.delta = 0;
+    }
+
+    if (nover) {
+	NETPRI;
+	MUTEX_ENTER(&rx_freePktQ_lock);
+
+	opr_queue_SplicePrepend(&rx_freePacketQueue, &overflow);
+	rx_nFreePackets += nover;
+
+	/* Wakeup anyone waiting for packets */
+	rxi_PacketsUnWait();
+
+	MUTEX_EXIT(&rx_freePktQ_lock);
+	USERPRI;
+    }
+}
+
+/* Return the surplus on a thread's local free packet queue */
+static void
+rxi_FlushLocalToDepot(struct rx_ts_info_t *rx_ts_info)
+{
+    int tsize;
+
+    tsize = MIN(rx_ts_info->_FPQ.len,
+		rx_ts_info->_FPQ.len - rx_TSFPQLocalMax + 3 * rx_TSFPQGlobSize);
+    if (tsize > 0)
+	rxi_MoveLocalToDepot(rx_ts_info, tsize);
+}
+
+/*
+ * Called by a server thread before it waits for a call, so that other
+ * threads can use the packets it holds, or the shrinker can release them,
+ * while it is idle.
+ */
+void
+rxi_IdleLocalPacketsTSFPQ(void)
+{
+    struct rx_ts_info_t *rx_ts_info;
+    struct rx_packet *p;
+
+    RX_TS_INFO_GET(rx_ts_info);
+    if ((p = rx_ts_info->local_special_packet)) {
+	rx_ts_info->local_special_packet = NULL;
+	rxi_FreePacket(p);
+    }
+    if (rx_ts_info->_FPQ.len > 0)
+	rxi_MoveLocalToDepot(rx_ts_info, rx_ts_info->_FPQ.len);
+}
+
+/*
+ * Return everything held by the depots, and by any blocks the shrinker is
+ * draining, to the global free queue. Called with rx_freePktQ_lock held when
+ * the global queue has run dry. Returns the number of packets recovered.
+ */
+static int
+rxi_ReclaimPacketsNoLock(void)
+{
+    struct rx_packetDepot *depot;
+    struct rx_packetBlock *b;
+    struct opr_queue *cursor;
+    int i, n = 0;
+
+    for (i = 0; i < RX_PACKET_DEPOTS; i++) {
+	depot = &rx_packetDepots[i];
+	MUTEX_ENTER(&depot->lock);
+	opr_queue_SpliceAppend(&rx_freePacketQueue, &depot->queue);
+	n += depot->len;
+	depot->len = 0;
+	MUTEX_EXIT(&depot->lock);
+    }
+    if (rx_nDrainingPackets) {
+	for (opr_queue_Scan(&rx_packetBlocks, cursor)) {
+	    b = opr_queue_Entry(cursor, struct rx_packetBlock, entry);
+	    opr_queue_SpliceAppend(&rx_freePacketQueue, &b->aside);
+	    n += b->naside;
+	    rx_nDrainingPackets -= b->naside;
+	    b->naside = 0;
+	    b->draining = 0;
+	}
+    }
+    rx_nFreePackets += n;
+    return n;
+}
+
+int
+rxi_CountDepotPackets(void)
+{
+    int i, n = 0;
+
+    for (i = 0; i < RX_PACKET_DEPOTS; i++) {
+	MUTEX_ENTER(&rx_packetDepots[i].lock);
+	n += rx_packetDepots[i].len;
+	MUTEX_EXIT(&rx_packetDepots[i].lock);
+    }
+    return n;
+}
+
+/* Set aside a free packet belonging to a block that is being drained */
+#define RX_PACKET_SET_ASIDE(p) \
+    do { \
+	opr_queue_Remove(&(p)->entry); \
+	opr_queue_Append(&(p)->block->aside, &(p)->entry); \
+	(p)->block->naside++; \
+	rx_nDrainingPackets++; \
+    } while(0)
+
+/*
+ * Give packets that have gone unused back to the system.
+ *
+ * Called every RX_REAP_TIME seconds. Whatever stayed in the global free
+ * queue throughout the last interval, less a reserve, is surplus. Blocks
+ * with at least three quarters of their packets in the global queue are
+ * chosen to make up the surplus and marked as draining; from then on their
+ * free packets are set aside, whenever the shrinker finds them in the global
+ * queue or a depot, and once every packet of a block has been set aside the
+ * block is freed. A block which stops making progress, and running out of
+ * packets, puts what was set aside back into use. The pool never shrinks
+ * below its initial size.
+ */
+void
+rxi_ShrinkPackets(void)
+{
+#ifndef RXDEBUG_PACKET
+    struct opr_queue *cursor, *store;
+    struct opr_queue freeq;
+    struct rx_packetDepot *depot;
+    struct rx_packetBlock *b;
+    struct rx_packet *p;
+    int i, surplus, remaining, released = 0;
+    SPLVAR;
+
+    opr_queue_Init(&freeq);
+
+    NETPRI;
+    MUTEX_ENTER(&rx_freePktQ_lock);
+
+    surplus = rx_nFreePacketsLow - 4 * rx_initSendWindow;
+    rx_nFreePacketsLow = rx_nFreePackets;
+
+    MUTEX_ENTER(&rx_packets_mutex);
+    remaining = rx_nPackets;
+    MUTEX_EXIT(&rx_packets_mutex);
+
+    for (opr_queue_Scan(&rx_packetBlocks, cursor)) {
+	b = opr_queue_Entry(cursor, struct rx_packetBlock, entry);
+	b->nidle = 0;
+	if (b->draining)
+	    remaining -= b->npackets;
+    }
+
+    if (surplus > 0) {
+	for (opr_queue_Scan(&rx_freePacketQueue, cursor))
+	    opr_queue_Entry(cursor, struct rx_packet, entry)->block->nidle++;
+
+	for (opr_queue_Scan(&rx_packetBlocks, cursor)) {
+	    b = opr_queue_Entry(cursor, struct rx_packetBlock, entry);
+	    if (b->draining || b->nidle > surplus
+		|| b->nidle * 4 < b->npackets * 3
+		|| remaining - b->npackets < rx_minPackets)
+		continue;
+	    b->draining = 1;
+	    b->lastaside = -1;
+	    surplus -= b->nidle;
+	    remaining -= b->npackets;
+	}
+    }
+
+    for (opr_queue_ScanSafe(&rx_freePacketQueue, cursor, store)) {
+	p = opr_queue_Entry(cursor, struct rx_packet, entry);
+	if (p->block->draining) {
+	    RX_PACKET_SET_ASIDE(p);
+	    rx_nFreePackets--;
+	}
+    }
+    for (i = 0; i < RX_PACKET_DEPOTS; i++) {
+	depot = &rx_packetDepots[i];
+	MUTEX_ENTER(&depot->lock);
+	for (opr_queue_ScanSafe(&depot->queue, cursor, store)) {
+	    p = opr_queue_Entry(cursor, struct rx_packet, entry);
+	    if (p->block->draining) {
+		RX_PACKET_SET_ASIDE(p);
+		depot->len--;
+	    }
+	}
+	MUTEX_EXIT(&depot->lock);
+    }
+
+    for (opr_queue_ScanSafe(&rx_packetBlocks, cursor, store)) {
+	b = opr_queue_Entry(cursor, struct rx_packetBlock, entry);
+	if (!b->draining)
+	    continue;
+	if (b->naside < b->npackets) {
+	    if (b->naside == b->lastaside) {
+		/* Nothing came back in the last interval; whatever is still
+		 * missing is held for good, so use the block again */
+		opr_queue_SpliceAppend(&rx_freePacketQueue, &b->aside);
+		rx_nFreePackets += b->naside;
+		rx_nDrainingPackets -= b->naside;
+		b->naside = 0;
+		b->draining = 0;
+	    } else {
+		b->lastaside = b->naside;
+	    }
+	    continue;
+	}
+	opr_queue_Remove(&b->entry);
+	opr_queue_Append(&freeq, &b->entry);
+	rx_nDrainingPackets -= b->npackets;
+	released += b->npackets;
+	if (rx_mallocedP >= b->packets
+	    && rx_mallocedP < b->packets + b->npackets)
+	    rx_mallocedP = NULL;
+    }
+    rx_nFreePacketsLow = MIN(rx_nFreePacketsLow, rx_nFreePackets);
+    rx_nReleasedPackets += released;
+
+    MUTEX_EXIT(&rx_freePktQ_lock);
+    USERPRI;
+
+    if (!released)
+	return;
+
+    MUTEX_ENTER(&rx_packets_mutex);
+    rx_nPackets -= released;
+    if (rx_TSFPQMaxProcs)
+	RX_TS_FPQ_COMPUTE_LIMITS;
+    MUTEX_EXIT(&rx_packets_mutex);
+
+    for (opr_queue_ScanSafe(&freeq, cursor, store)) {
+	b = opr_queue_Entry(cursor, struct rx_packetBlock, entry);
+	opr_queue_Remove(&b->entry);
+	osi_Free(b->packets, b->npackets * sizeof(struct rx_packet));
+	osi_Free(b, sizeof(*b));
+    }
+#endif /* !RXDEBUG_PACKET */
+}
+#endif /* RX_ENABLE_TSFPQ */
+
 /* Add more packet buffers */
 #ifdef RX_ENABLE_TSFPQ
 void
@@ -555,6 +932,11 @@ rxi_MorePackets(int apackets)
     RX_TS_INFO_GET(rx_ts_info);
 
     RX_TS_FPQ_LOCAL_ALLOC(rx_ts_info,apackets);
+    NETPRI;
+    MUTEX_ENTER(&rx_freePktQ_lock);
+    rxi_NewPacketBlockNoLock(p, apackets);
+    MUTEX_EXIT(&rx_freePktQ_lock);
+    USERPRI;
     /* TSFPQ patch also needs to keep track of total packets */
 
     MUTEX_ENTER(&rx_packets_mutex);
@@ -651,6 +1033,11 @@ rxi_MorePacketsTSFPQ(int apackets, int flush_global, int num_keep_local)
     RX_TS_INFO_GET(rx_ts_info);
 
     RX_TS_FPQ_LOCAL_ALLOC(rx_ts_info,apackets);
+    NETPRI;
+    MUTEX_ENTER(&rx_freePktQ_lock);
+    rxi_NewPacketBlockNoLock(p, apackets);
+    MUTEX_EXIT(&rx_freePktQ_lock);
+    USERPRI;
     /* TSFPQ patch also needs to keep track of total packets */
     MUTEX_ENTER(&rx_packets_mutex);
     rx_nPackets += apackets;
@@ -700,6 +1087,17 @@ rxi_MorePacketsNoLock(int apackets)
     struct rx_packet *p, *e;
     int getme;
 
+#ifdef RX_ENABLE_TSFPQ
+    /* use whatever is sitting idle in the depots, or waiting to be
+     * returned by the shrinker, before asking for more memory */
+    apackets -= rxi_ReclaimPacketsNoLock();
+    if (apackets <= 0) {
+	rxi_NeedMorePackets = FALSE;
+	rxi_PacketsUnWait();
+	return;
+    }
+#endif /* RX_ENABLE_TSFPQ */
+
     /* allocate enough packets that 1/4 of the packets will be able
      * to hold maximal amounts of data */
     apackets += (apackets / 4)
@@ -717,6 +1115,7 @@ rxi_MorePacketsNoLock(int apackets)
 #ifdef RX_ENABLE_TSFPQ
     RX_TS_INFO_GET(rx_ts_info);
     RX_TS_FPQ_GLOBAL_ALLOC(rx_ts_info,apackets);
+    rxi_NewPacketBlockNoLock(p, apackets);
 #endif /* RX_ENABLE_TSFPQ */
 
     for (e = p + apackets; p < e; p++) {
@@ -841,18 +1240,8 @@ rxi_FreePacketTSFPQ(struct rx_packet *p, int flush_global)
     RX_TS_INFO_GET(rx_ts_info);
     RX_TS_FPQ_CHECKIN(rx_ts_info,p);
 
-    if (flush_global && (rx_ts_info->_FPQ.len > rx_TSFPQLocalMax)) {
-        NETPRI;
-	MUTEX_ENTER(&rx_freePktQ_lock);
-
-	RX_TS_FPQ_LTOG(rx_ts_info);
-
-	/* Wakeup anyone waiting for packets */
-	rxi_PacketsUnWait();
-
-	MUTEX_EXIT(&rx_freePktQ_lock);
-	USERPRI;
-    }
+    if (flush_global && (rx_ts_info->_FPQ.len > rx_TSFPQLocalMax))
+	rxi_FlushLocalToDepot(rx_ts_info);
 }
 #endif /* RX_ENABLE_TSFPQ */
 
@@ -946,18 +1335,8 @@ rxi_FreeDataBufsTSFPQ(struct rx_packet *p, afs_uint32 first, int flush_global)
     p->length = 0;
     p->niovecs = 0;
 
-    if (flush_global && (rx_ts_info->_FPQ.len > rx_TSFPQLocalMax)) {
-        NETPRI;
-	MUTEX_ENTER(&rx_freePktQ_lock);
-
-	RX_TS_FPQ_LTOG(rx_ts_info);
-
-	/* Wakeup anyone waiting for packets */
-	rxi_PacketsUnWait();
-
-	MUTEX_EXIT(&rx_freePktQ_lock);
-	USERPRI;
-    }
+    if (flush_global && (rx_ts_info->_FPQ.len > rx_TSFPQLocalMax))
+	rxi_FlushLocalToDepot(rx_ts_info);
     return 0;
 }
 #endif /* RX_ENABLE_TSFPQ */
@@ -994,7 +1373,6 @@ rxi_TrimDataBufs(struct rx_packet *p, int first)
     int length;
     struct iovec *iov, *end;
     struct rx_ts_info_t * rx_ts_info;
-    SPLVAR;
 
     if (first != 1)
 	osi_Panic("TrimDataBufs 1: first must be 1");
@@ -1020,16 +1398,8 @@ rxi_TrimDataBufs(struct rx_packet *p, int first)
 	RX_TS_FPQ_CHECKIN(rx_ts_info,RX_CBUF_TO_PACKET(iov->iov_base, p));
 	p->niovecs--;
     }
-    if (rx_ts_info->_FPQ.len > rx_TSFPQLocalMax) {
-        NETPRI;
-        MUTEX_ENTER(&rx_freePktQ_lock);
-
-	RX_TS_FPQ_LTOG(rx_ts_info);
-        rxi_PacketsUnWait();
-
-        MUTEX_EXIT(&rx_freePktQ_lock);
-	USERPRI;
-    }
+    if (rx_ts_info->_FPQ.len > rx_TSFPQLocalMax)
+	rxi_FlushLocalToDepot(rx_ts_info);
 
     return 0;
 }
@@ -1119,7 +1489,8 @@ rxi_AllocPacketNoLock(int class)
 
     if (rx_stats_active)
         rx_atomic_inc(&rx_stats.packetRequests);
-    if (opr_queue_IsEmpty(&rx_ts_info->_FPQ.queue)) {
+    if (opr_queue_IsEmpty(&rx_ts_info->_FPQ.queue)
+	&& !rxi_FillLocalFromDepot(rx_ts_info, rx_TSFPQGlobSize)) {
 
 #ifdef KERNEL
         if (opr_queue_IsEmpty(&rx_freePacketQueue))
@@ -1216,7 +1587,8 @@ rxi_AllocPacketTSFPQ(int class, int pull_global)
 
     if (rx_stats_active)
         rx_atomic_inc(&rx_stats.packetRequests);
-    if (pull_global && opr_queue_IsEmpty(&rx_ts_info->_FPQ.queue)) {
+    if (pull_global && opr_queue_IsEmpty(&rx_ts_info->_FPQ.queue)
+	&& !rxi_FillLocalFromDepot(rx_ts_info, rx_TSFPQGlobSize)) {
         MUTEX_ENTER(&rx_freePktQ_lock);
 
         if (opr_queue_IsEmpty(&rx_freePacketQueue))
@@ -1384,20 +1756,16 @@ CountFDs(int amax)
 
 #if !defined(KERNEL) || defined(UKERNEL)
 
-/* This function reads a single packet from the interface into the
- * supplied packet buffer (*p).  Return 0 if the packet is bogus.  The
- * (host,port) of the sender are stored in the supplied variables, and
- * the data length of the packet is stored in the packet structure.
- * The header is decoded. */
-int
-rxi_ReadPacket(osi_socket socket, struct rx_packet *p, afs_uint32 * host,
-	       u_short * port)
+/* Prepare the packet buffer (*p) to have a datagram read into it.  The
+ * packet's iovecs are extended to cover the largest datagram we are
+ * advertising, plus some padding to detect oversized datagrams.  Returns
+ * the largest datagram size that will be accepted. */
+static afs_int32
+rxi_PrepareReadPacket(struct rx_packet *p)
 {
-    struct sockaddr_in from;
-    int nbytes;
     afs_int32 rlen;
-    afs_uint32 tlen, savelen;
-    struct msghdr msg;
+    afs_uint32 tlen;
+
     rx_computelen(p, tlen);
     rx_SetDataSize(p, tlen);	/* this is the size of the user data area */
 
@@ -1419,18 +1787,30 @@ rxi_ReadPacket(osi_socket socket, struct rx_packet *p, afs_uint32 * host,
      * our problems caused by the lack of a length field in the rx header.
      * Use the extra buffer that follows the localdata in each packet
      * structure. */
-    savelen = p->wirevec[p->niovecs - 1].iov_len;
     p->wirevec[p->niovecs - 1].iov_len += RX_EXTRABUFFERSIZE;
 
-    memset(&msg, 0, sizeof(msg));
-    msg.msg_name = (char *)&from;
-    msg.msg_namelen = sizeof(struct sockaddr_in);
-    msg.msg_iov = p->wirevec;
-    msg.msg_iovlen = p->niovecs;
-    nbytes = rxi_Recvmsg(socket, &msg, 0);
+    return tlen;
+}
 
+/* Undo the iovec padding added by rxi_PrepareReadPacket. */
+static_inline void
+rxi_UnprepareReadPacket(struct rx_packet *p)
+{
+    p->wirevec[p->niovecs - 1].iov_len -= RX_EXTRABUFFERSIZE;
+}
+
+/* Check a datagram of nbytes which has been read into the packet buffer
+ * (*p) from the address (from).  Return 0 if the packet is bogus.  The
+ * (host,port) of the sender are stored in the supplied variables, and
+ * the data length of the packet is stored in the packet structure.
+ * The header is decoded. */
+static int
+rxi_FinishReadPacket(struct rx_packet *p, int nbytes, afs_int32 tlen,
+		     struct sockaddr_in *from, afs_uint32 * host,
+		     u_short * port)
+{
     /* restore the vec to its correct state */
-    p->wirevec[p->niovecs - 1].iov_len = savelen;
+    rxi_UnprepareReadPacket(p);
 
     p->length = (u_short)(nbytes - RX_HEADER_SIZE);
     if (nbytes < 0 || (nbytes > tlen) || (p->length & 0x8000)) { /* Bogus packet */
@@ -1440,10 +1820,10 @@ rxi_ReadPacket(osi_socket socket, struct rx_packet *p, afs_uint32 * host,
 	} else if (nbytes <= 0) {
             if (rx_stats_active) {
                 rx_atomic_inc(&rx_stats.bogusPacketOnRead);
-                rx_stats.bogusHost = from.sin_addr.s_addr;
+                rx_stats.bogusHost = from->sin_addr.s_addr;
             }
-	    dpf(("B: bogus packet from [%x,%d] nb=%d\n", ntohl(from.sin_addr.s_addr),
-		 ntohs(from.sin_port), nbytes));
+	    dpf(("B: bogus packet from [%x,%d] nb=%d\n", ntohl(from->sin_addr.s_addr),
+		 ntohs(from->sin_port), nbytes));
 	}
 	return 0;
     }
@@ -1452,8 +1832,8 @@ rxi_ReadPacket(osi_socket socket, struct rx_packet *p, afs_uint32 * host,
 		&& (random() % 100 < rx_intentionallyDroppedOnReadPer100)) {
 	rxi_DecodePacketHeader(p);
 
-	*host = from.sin_addr.s_addr;
-	*port = from.sin_port;
+	*host = from->sin_addr.s_addr;
+	*port = from->sin_port;
 
 	dpf(("Dropped %d %s: %x.%u.%u.%u.%u.%u.%u flags %d len %d\n",
 	      p->header.serial, rx_packetTypes[p->header.type - 1], ntohl(*host), ntohs(*port), p->header.serial,
@@ -1469,8 +1849,8 @@ rxi_ReadPacket(osi_socket socket, struct rx_packet *p, afs_uint32 * host,
 	/* Extract packet header. */
 	rxi_DecodePacketHeader(p);
 
-	*host = from.sin_addr.s_addr;
-	*port = from.sin_port;
+	*host = from->sin_addr.s_addr;
+	*port = from->sin_port;
 	if (rx_stats_active
 	    && p->header.type > 0 && p->header.type < RX_N_PACKET_TYPES) {
 
@@ -1485,6 +1865,109 @@ rxi_ReadPacket(osi_socket socket, struct rx_packet *p, afs_uint32 * host,
     }
 }
 
+/* This function reads a single packet from the interface into the
+ * supplied packet buffer (*p).  Return 0 if the packet is bogus.  The
+ * (host,port) of the sender are stored in the supplied variables, and
+ * the data length of the packet is stored in the packet structure.
+ * The header is decoded. */
+int
+rxi_ReadPacket(osi_socket socket, struct rx_packet *p, afs_uint32 * host,
+	       u_short * port)
+{
+    struct sockaddr_in from;
+    int nbytes;
+    afs_int32 tlen;
+    struct msghdr msg;
+
+    tlen = rxi_PrepareReadPacket(p);
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = (char *)&from;
+    msg.msg_namelen = sizeof(struct sockaddr_in);
+    msg.msg_iov = p->wirevec;
+    msg.msg_iovlen = p->niovecs;
+    nbytes = rxi_Recvmsg(socket, &msg, 0);
+
+    if (nbytes >= 0 && rx_stats_active)
+	rx_atomic_inc(&rx_stats.nRecvSyscalls);
+
+    return rxi_FinishReadPacket(p, nbytes, tlen, &from, host, port);
+}
+
+#ifdef RX_ENABLE_MMSG
+/* Read up to npackets datagrams from the interface with a single system
+ * call, one into each of the supplied packet buffers.  The call blocks
+ * until at least one datagram is available.  On return, the good packets
+ * have been moved, in the order in which they arrived, to the front of
+ * the packets array, with their senders in the hosts and ports arrays;
+ * the number of good packets is returned.  Buffers that did not receive a
+ * usable datagram are left at the end of the array, ready for reuse.
+ *
+ * If the kernel turns out not to support recvmmsg, batching is switched
+ * off and the caller is expected to fall back to rxi_ReadPacket. */
+int
+rxi_ReadPackets(osi_socket socket, struct rx_packet **packets, int npackets,
+		afs_uint32 * hosts, u_short * ports)
+{
+    struct sockaddr_in from[RX_MAXIOBATCH];
+    struct mmsghdr msgs[RX_MAXIOBATCH];
+    afs_int32 tlen[RX_MAXIOBATCH];
+    struct rx_packet *p;
+    int i, nread, ngood;
+
+    if (npackets > RX_MAXIOBATCH)
+	npackets = RX_MAXIOBATCH;
+
+    memset(msgs, 0, npackets * sizeof(msgs[0]));
+    for (i = 0; i < npackets; i++) {
+	p = packets[i];
+	tlen[i] = rxi_PrepareReadPacket(p);
+	msgs[i].msg_hdr.msg_name = (char *)&from[i];
+	msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+	msgs[i].msg_hdr.msg_iov = p->wirevec;
+	msgs[i].msg_hdr.msg_iovlen = p->niovecs;
+    }
+
+    nread = rxi_Recvmmsg(socket, msgs, npackets, MSG_WAITFORONE);
+
+    if (nread < 0) {
+	if (errno == ENOSYS) {
+	    dpf(("rxi_ReadPackets: recvmmsg unsupported, disabling batching\n"));
+	    rx_ioBatchSize = 0;
+	    for (i = 0; i < npackets; i++)
+		rxi_UnprepareReadPacket(packets[i]);
+	    return 0;
+	}
+	/* Let the single packet code account for the failure */
+	rxi_FinishReadPacket(packets[0], nread, tlen[0], &from[0], &hosts[0],
+			     &ports[0]);
+	for (i = 1; i < npackets; i++)
+	    rxi_UnprepareReadPacket(packets[i]);
+	return 0;
+    }
+
+    if (rx_stats_active)
+	rx_atomic_inc(&rx_stats.nRecvSyscalls);
+
+    for (i = nread; i < npackets; i++)
+	rxi_UnprepareReadPacket(packets[i]);
+
+    /* Compact the good packets to the front of the array, keeping them in
+     * arrival order. */
+    for (i = 0, ngood = 0; i < nread; i++) {
+	p = packets[i];
+	if (rxi_FinishReadPacket(p, msgs[i].msg_len, tlen[i], &from[i],
+				 &hosts[ngood], &ports[ngood])) {
+	    packets[i] = packets[ngood];
+	    packets[ngood] = p;
+	    ngood++;
+	}
+    }
+
+    return ngood;
+}
+#endif /* RX_ENABLE_MMSG */
+
 #endif /* !KERNEL || UKERNEL */
 
 /* This function splits off the first packet in a jumbo packet.
@@ -1572,6 +2055,8 @@ osi_NetSend(osi_socket socket, void *addr, struct iovec *dvec, int nvecs,
     msg.msg_namelen = sizeof(struct sockaddr_in);
 
     ret = rxi_Sendmsg(socket, &msg, 0);
+    if (rx_stats_active)
+	rx_atomic_inc(&rx_stats.nSendSyscalls);
 
     return ret;
 }
@@ -1776,6 +2261,13 @@ rxi_ReceiveDebugPacket(struct rx_packet *ap, osi_socket asocket,
 	    tstat.idleThreads = opr_queue_Count(&rx_idleServerQueue);
 	    MUTEX_EXIT(&rx_serverPool_lock);
 	    tstat.idleThreads = htonl(tstat.idleThreads);
+	    tstat.nConnHashWaits = htonl(rx_atomic_read(&rx_connHashWaits));
+	    tstat.nPeerHashWaits = htonl(rx_atomic_read(&rx_peerHashWaits));
+#ifdef RX_ENABLE_TSFPQ
+	    tstat.nDepotPackets = htonl(rxi_CountDepotPackets());
+	    tstat.nDrainingPackets = htonl(rx_nDrainingPackets);
+	    tstat.nReleasedPackets = htonl(rx_nReleasedPackets);
+#endif
 	    tl = sizeof(struct rx_debugStats) - ap->length;
 	    if (tl > 0)
 		tl = rxi_AllocDataBuf(ap, tl, RX_PACKET_CLASS_SEND_CBUF);
@@ -1818,7 +2310,7 @@ rxi_ReceiveDebugPacket(struct rx_packet *ap, osi_socket asocket,
 		(void)IOMGR_Poll();
 #endif
 #endif
-		MUTEX_ENTER(&rx_connHashTable_lock);
+		CONN_HASH_LOCK(i);
 		/* We might be slightly out of step since we are not
 		 * locking each call, but this is only debugging output.
 		 */
@@ -1860,19 +2352,19 @@ rxi_ReceiveDebugPacket(struct rx_packet *ap, osi_socket asocket,
 			    DOHTONL(packetsSent);
 			    DOHTONL(bytesReceived);
 			    DOHTONL(bytesSent);
-			    for (i = 0;
-				 i <
+			    for (j = 0;
+				 j <
 				 sizeof(tconn.secStats.spares) /
-				 sizeof(short); i++)
-				DOHTONS(spares[i]);
-			    for (i = 0;
-				 i <
+				 sizeof(short); j++)
+				DOHTONS(spares[j]);
+			    for (j = 0;
+				 j <
 				 sizeof(tconn.secStats.sparel) /
-				 sizeof(afs_int32); i++)
-				DOHTONL(sparel[i]);
+				 sizeof(afs_int32); j++)
+				DOHTONL(sparel[j]);
 			}
 
-			MUTEX_EXIT(&rx_connHashTable_lock);
+			CONN_HASH_UNLOCK(i);
 			rx_packetwrite(ap, 0, sizeof(struct rx_debugConn),
 				       (char *)&tconn);
 			tl = ap->length;
@@ -1883,7 +2375,7 @@ rxi_ReceiveDebugPacket(struct rx_packet *ap, osi_socket asocket,
 			return ap;
 		    }
 		}
-		MUTEX_EXIT(&rx_connHashTable_lock);
+		CONN_HASH_UNLOCK(i);
 	    }
 	    /* if we make it here, there are no interesting packets */
 	    tconn.cid = htonl(0xffffffff);	/* means end */
@@ -1919,7 +2411,7 @@ rxi_ReceiveDebugPacket(struct rx_packet *ap, osi_socket asocket,
 		 * exponentially increses with the number of peers.
 		 *
 		 * Yielding after processing each hash table entry
-		 * and dropping rx_peerHashTable_lock.
+		 * and dropping the hash chain lock
 		 * also increases the risk that we will miss a new
 		 * entry - but we are willing to live with this
 		 * limitation since this is meant for debugging only
@@ -1930,11 +2422,11 @@ rxi_ReceiveDebugPacket(struct rx_packet *ap, osi_socket asocket,
 		(void)IOMGR_Poll();
 #endif
 #endif
-		MUTEX_ENTER(&rx_peerHashTable_lock);
+		PEER_HASH_LOCK(i);
 		for (tp = rx_peerHashTable[i]; tp; tp = tp->next) {
 		    if (tin.index-- <= 0) {
                         tp->refCount++;
-                        MUTEX_EXIT(&rx_peerHashTable_lock);
+                        PEER_HASH_UNLOCK(i);
 
                         MUTEX_ENTER(&tp->peer_lock);
 			tpeer.host = tp->host;
@@ -1968,9 +2460,9 @@ rxi_ReceiveDebugPacket(struct rx_packet *ap, osi_socket asocket,
 			    htonl(tp->bytesReceived & MAX_AFS_UINT32);
                         MUTEX_EXIT(&tp->peer_lock);
 
-                        MUTEX_ENTER(&rx_peerHashTable_lock);
+                        PEER_HASH_LOCK(i);
                         tp->refCount--;
-			MUTEX_EXIT(&rx_peerHashTable_lock);
+			PEER_HASH_UNLOCK(i);
 
 			rx_packetwrite(ap, 0, sizeof(struct rx_debugPeer),
 				       (char *)&tpeer);
@@ -1982,7 +2474,7 @@ rxi_ReceiveDebugPacket(struct rx_packet *ap, osi_socket asocket,
 			return ap;
 		    }
 		}
-		MUTEX_EXIT(&rx_peerHashTable_lock);
+		PEER_HASH_UNLOCK(i);
 	    }
 	    /* if we make it here, there are no interesting packets */
 	    tpeer.host = htonl(0xffffffff);	/* means end */
@@ -2157,12 +2649,39 @@ rxi_NetSendError(struct rx_call *call, int code)
     }
 }
 
+#ifdef RX_ENABLE_MMSG
+/* Add a datagram to a transmit batch.  The iovecs are copied, as the
+ * caller's may be on its stack; the buffers they describe must remain
+ * valid until the batch is flushed. */
+static void
+rxi_XmitBatchAdd(struct rx_xmitbatch *batch, osi_socket socket,
+		 struct sockaddr_in *addr, struct iovec *iov, int niovecs)
+{
+    struct mmsghdr *msg = &batch->msgs[batch->ndgrams];
+
+    batch->socket = socket;
+    batch->addrs[batch->ndgrams] = *addr;
+    memcpy(batch->iov[batch->ndgrams], iov, niovecs * sizeof(struct iovec));
+
+    memset(msg, 0, sizeof(*msg));
+    msg->msg_hdr.msg_name = &batch->addrs[batch->ndgrams];
+    msg->msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    msg->msg_hdr.msg_iov = batch->iov[batch->ndgrams];
+    msg->msg_hdr.msg_iovlen = niovecs;
+
+    batch->ndgrams++;
+}
+#endif
+
 /* Send the packet to appropriate destination for the specified
  * call.  The header is first encoded and placed in the packet.
+ * If a transmit batch is supplied, the datagram is added to it
+ * rather than being sent immediately.
  */
-void
-rxi_SendPacket(struct rx_call *call, struct rx_connection *conn,
-	       struct rx_packet *p, int istack)
+static void
+rxi_SendPacketInt(struct rx_call *call, struct rx_connection *conn,
+		  struct rx_packet *p, int istack,
+		  struct rx_xmitbatch *batch)
 {
 #if defined(KERNEL)
     int waslocked;
@@ -2260,6 +2779,11 @@ rxi_SendPacket(struct rx_call *call, struct rx_connection *conn,
 	if (waslocked)
 	    AFS_GUNLOCK();
 #endif
+#endif
+#ifdef RX_ENABLE_MMSG
+	if (batch != NULL) {
+	    rxi_XmitBatchAdd(batch, socket, &addr, p->wirevec, p->niovecs);
+	} else
 #endif
 	if ((code =
 	     osi_NetSend(socket, &addr, p->wirevec, p->niovecs,
@@ -2307,12 +2831,22 @@ rxi_SendPacket(struct rx_call *call, struct rx_connection *conn,
     }
 }
 
+void
+rxi_SendPacket(struct rx_call *call, struct rx_connection *conn,
+	       struct rx_packet *p, int istack)
+{
+    rxi_SendPacketInt(call, conn, p, istack, NULL);
+}
+
 /* Send a list of packets to appropriate destination for the specified
  * connection.  The headers are first encoded and placed in the packets.
+ * If a transmit batch is supplied, the jumbogram is added to it rather
+ * than being sent immediately.
  */
-void
-rxi_SendPacketList(struct rx_call *call, struct rx_connection *conn,
-		   struct rx_packet **list, int len, int istack)
+static void
+rxi_SendPacketListInt(struct rx_call *call, struct rx_connection *conn,
+		      struct rx_packet **list, int len, int istack,
+		      struct rx_xmitbatch *batch)
 {
 #if     defined(AFS_SUN5_ENV) && defined(KERNEL)
     int waslocked;
@@ -2458,6 +2992,11 @@ rxi_SendPacketList(struct rx_call *call, struct rx_connection *conn,
 	waslocked = ISAFS_GLOCK();
 	if (!istack && waslocked)
 	    AFS_GUNLOCK();
+#endif
+#ifdef RX_ENABLE_MMSG
+	if (batch != NULL) {
+	    rxi_XmitBatchAdd(batch, socket, &addr, &wirevec[0], len + 1);
+	} else
 #endif
 	if ((code =
 	     osi_NetSend(socket, &addr, &wirevec[0], len + 1, length,
@@ -2501,6 +3040,93 @@ rxi_SendPacketList(struct rx_call *call, struct rx_connection *conn,
     }
 }
 
+void
+rxi_SendPacketList(struct rx_call *call, struct rx_connection *conn,
+		   struct rx_packet **list, int len, int istack)
+{
+    rxi_SendPacketListInt(call, conn, list, len, istack, NULL);
+}
+
+#ifdef RX_ENABLE_MMSG
+/* Mark the packets of a datagram in a transmit batch that could not be
+ * sent for early retransmission. */
+static void
+rxi_XmitBatchSendError(struct rx_call *call, struct rx_xmitbatch *batch,
+		       int dgram, int code)
+{
+    int i;
+
+    if (rx_stats_active)
+	rx_atomic_inc(&rx_stats.netSendFailures);
+    for (i = 0; i < batch->lens[dgram]; i++)
+	batch->lists[dgram][i]->flags &= ~RX_PKTFLAG_SENT;
+    if (call) {
+	rxi_NetSendError(call, code);
+    }
+}
+
+/* Encode a list of packets from a call's transmit queue and add them to
+ * a transmit batch as a single datagram (a jumbogram if there is more
+ * than one packet).  The list must stay valid until the batch is flushed,
+ * which is the case for the call's xmitList while RX_CALL_TQ_BUSY is set.
+ * A full batch is flushed first, so this must be called without the call
+ * lock held. */
+void
+rxi_QueuePacketList(struct rx_call *call, struct rx_connection *conn,
+		    struct rx_packet **list, int len, int istack,
+		    struct rx_xmitbatch *batch)
+{
+    if (batch->ndgrams == RX_MAXIOBATCH)
+	rxi_FlushXmitBatch(call, batch, istack);
+
+    batch->lists[batch->ndgrams] = list;
+    batch->lens[batch->ndgrams] = len;
+    if (len > 1)
+	rxi_SendPacketListInt(call, conn, list, len, istack, batch);
+    else
+	rxi_SendPacketInt(call, conn, list[0], istack, batch);
+}
+
+/* Hand all of the datagrams in a transmit batch to the kernel, using as
+ * few sendmmsg calls as possible.  Must be called without the call lock
+ * held. */
+void
+rxi_FlushXmitBatch(struct rx_call *call, struct rx_xmitbatch *batch,
+		   int istack)
+{
+    struct msghdr *msg;
+    int i, nsent, code;
+
+    for (i = 0; i < batch->ndgrams; i += nsent) {
+	nsent = rxi_Sendmmsg(batch->socket, &batch->msgs[i],
+			     batch->ndgrams - i, 0);
+	if (nsent == -ENOSYS) {
+	    /* No sendmmsg in this kernel; send the rest one at a time, and
+	     * don't try batching again. */
+	    dpf(("rxi_FlushXmitBatch: sendmmsg unsupported, disabling batching\n"));
+	    rx_ioBatchSize = 0;
+	    for (; i < batch->ndgrams; i++) {
+		msg = &batch->msgs[i].msg_hdr;
+		code = osi_NetSend(batch->socket, msg->msg_name, msg->msg_iov,
+				   msg->msg_iovlen, 0, istack);
+		if (code != 0)
+		    rxi_XmitBatchSendError(call, batch, i, code);
+	    }
+	    break;
+	}
+	if (rx_stats_active)
+	    rx_atomic_inc(&rx_stats.nSendSyscalls);
+	if (nsent <= 0) {
+	    /* The datagram at the head of the list failed; skip over it
+	     * and carry on with the rest. */
+	    rxi_XmitBatchSendError(call, batch, i, nsent < 0 ? nsent : -1);
+	    nsent = 1;
+	}
+    }
+    batch->ndgrams = 0;
+}
+#endif /* RX_ENABLE_MMSG */
+
 /* Send a raw abort packet, without any call or connection structures */
 void
 rxi_SendRawAbort(osi_socket socket, afs_uint32 host, u_short port,
@@ -2692,16 +3318,18 @@ rxi_DecodePacketHeader(struct rx_packet *p)
  * in the future.  Beyond that there is nothing in this
  * function that requires the call being locked.  This
  * function can only be called by the application thread.
+ *
+ * The NoSecurity form leaves out the security object's work, which must
+ * then be done by rxi_SecureSendPackets before the packet is queued.
  */
 void
-rxi_PrepareSendPacket(struct rx_call *call,
-		      struct rx_packet *p, int last)
+rxi_PrepareSendPacketNoSecurity(struct rx_call *call,
+				struct rx_packet *p, int last)
 {
     struct rx_connection *conn = call->conn;
     afs_uint32 seq = call->tnext++;
     unsigned int i;
     afs_int32 len;		/* len must be a signed type; it can go negative */
-    int code;
 
     /* No data packets on call 0. Where do these come from? */
     if (*call->callNumber == 0)
@@ -2753,20 +3381,77 @@ rxi_PrepareSendPacket(struct rx_call *call,
     if (len)
         p->wirevec[i - 1].iov_len += len;
     MUTEX_ENTER(&call->lock);
-    code = RXS_PreparePacket(conn->securityObject, call, p);
-    if (code) {
-	MUTEX_EXIT(&call->lock);
-	rxi_ConnectionError(conn, code);
-	MUTEX_ENTER(&conn->conn_data_lock);
-	p = rxi_SendConnectionAbort(conn, p, 0, 0);
-	MUTEX_EXIT(&conn->conn_data_lock);
-	MUTEX_ENTER(&call->lock);
-	/* setting a connection error means all calls for that conn are also
-	 * error'd. if this call does not have an error by now, something is
-	 * very wrong, and we risk sending data in the clear that is supposed
-	 * to be encrypted. */
-	osi_Assert(call->error);
+}
+
+static void
+rxi_SendPacketSecurityError(struct rx_call *call, struct rx_packet *p,
+			    int code)
+{
+    struct rx_connection *conn = call->conn;
+
+    MUTEX_EXIT(&call->lock);
+    rxi_ConnectionError(conn, code);
+    MUTEX_ENTER(&conn->conn_data_lock);
+    p = rxi_SendConnectionAbort(conn, p, 0, 0);
+    MUTEX_EXIT(&conn->conn_data_lock);
+    MUTEX_ENTER(&call->lock);
+    /* setting a connection error means all calls for that conn are also
+     * error'd. if this call does not have an error by now, something is
+     * very wrong, and we risk sending data in the clear that is supposed
+     * to be encrypted. */
+    osi_Assert(call->error);
+}
+
+void
+rxi_PrepareSendPacket(struct rx_call *call,
+		      struct rx_packet *p, int last)
+{
+    int code;
+
+    rxi_PrepareSendPacketNoSecurity(call, p, last);
+    code = RXS_PreparePacket(call->conn->securityObject, call, p);
+    if (code)
+	rxi_SendPacketSecurityError(call, p, code);
+}
+
+/*
+ * Apply the security object to a queue of packets which have been through
+ * rxi_PrepareSendPacketNoSecurity.  Packets are handed over RX_SECURITY_BATCH
+ * at a time if the security class can take them that way, so that it can
+ * spread its per call setup and keep its crypto busy.
+ *
+ * LOCKS HELD: called with call->lock held.
+ */
+void
+rxi_SecureSendPackets(struct rx_call *call, struct opr_queue *q)
+{
+    struct rx_securityClass *obj = call->conn->securityObject;
+    struct rx_packet *batch[RX_SECURITY_BATCH];
+    struct opr_queue *cursor;
+    int code = 0, n = 0;
+
+    if (!RXS_HasOp(obj, PreparePackets)) {
+	for (opr_queue_Scan(q, cursor)) {
+	    batch[0] = opr_queue_Entry(cursor, struct rx_packet, entry);
+	    code = RXS_PreparePacket(obj, call, batch[0]);
+	    if (code)
+		break;
+	}
+    } else {
+	for (opr_queue_Scan(q, cursor)) {
+	    batch[n++] = opr_queue_Entry(cursor, struct rx_packet, entry);
+	    if (n == RX_SECURITY_BATCH) {
+		code = RXS_PreparePackets(obj, call, batch, n);
+		if (code)
+		    break;
+		n = 0;
+	    }
+	}
+	if (!code && n > 0)
+	    code = RXS_PreparePackets(obj, call, batch, n);
     }
+    if (code)
+	rxi_SendPacketSecurityError(call, batch[0], code);
 }
 
 /* Given an interface MTU size, calculate an adjusted MTU size that
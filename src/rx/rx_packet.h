@@ -168,6 +168,7 @@
 #define RX_PKTFLAG_CP           0x20
 #endif
 #define RX_PKTFLAG_SENT		0x40
+#define RX_PKTFLAG_CHECKED	0x80	/* security check already done */
 
 /* The rx part of the header of a packet, in host form */
 struct rx_header {
@@ -242,6 +243,8 @@ struct rx_jumboHeader {
 #error RX_MAXWVECS not defined
 #endif
 
+struct rx_packetBlock;
+
 struct rx_packet {
     struct opr_queue entry;	/* Packets are chained using opr_queue */
     struct clock timeSent;	/* When this packet was transmitted last */
@@ -251,6 +254,7 @@ struct rx_packet {
     unsigned int niovecs;       /* # of iovecs that potentially have data */
     unsigned int aiovecs;       /* # of allocated iovecs */
     struct iovec wirevec[RX_MAXWVECS + 1];	/* the new form of the packet */
+    struct rx_packetBlock *block;	/* The allocation this packet came from */
 
     u_char flags;		/* Flags for local state of this packet */
     u_char unused;		/* was backoff, now just here for alignment */
@@ -31,7 +31,7 @@ struct rx_peer {
 
     /* For garbage collection */
     afs_uint32 idleWhen;	/* When the refcountwent to zero */
-    afs_int32 refCount;	        /* Reference count for this structure (rx_peerHashTable_lock) */
+    afs_int32 refCount;	        /* Reference count for this structure (rx_peerHashLocks) */
 
     int rtt;			/* Smoothed round trip time, measured in milliseconds/8 */
     int rtt_dev;		/* Smoothed rtt mean difference, in milliseconds/4 */
@@ -58,6 +58,8 @@ struct rx_peer {
     u_short cwind;		/* congestion window */
     u_short nDgramPackets;	/* number packets per AFS 3.5 jumbogram */
     u_short congestSeq;		/* Changed when a call retransmits */
+    u_char extAcks;		/* Peer understands extended acks */
+    u_char ccAlgorithm;		/* Congestion control for calls to this peer */
     afs_uint64 bytesSent;	/* Number of bytes sent to this peer */
     afs_uint64 bytesReceived;	/* Number of bytes received from this peer */
     struct opr_queue rpcStats;	/* rpc statistic list */
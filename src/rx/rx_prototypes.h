@@ -241,6 +241,14 @@ extern void rx_SetMaxSendWindow(int packets);
 extern int rx_GetMinPeerTimeout(void);
 extern void rx_SetMinPeerTimeout(int msecs);
 
+/* rx_congestion.c */
+extern int rx_CongestionControlByName(const char *name);
+extern int rx_SetCongestionControl(int algorithm);
+extern int rx_SetServiceCongestionControl(struct rx_service *service,
+					  int algorithm);
+extern int rx_SetPeerCongestionControl(struct rx_connection *conn,
+				       int algorithm);
+
 #ifdef KERNEL
 /* rx_kcommon.c */
 struct socket;
@@ -438,6 +446,9 @@ extern void rxi_DecodePacketHeader(struct rx_packet *p);
 extern void rxi_PrepareSendPacket(struct rx_call *call,
 				  struct rx_packet *p,
 				  int last);
+extern void rxi_PrepareSendPacketNoSecurity(struct rx_call *call,
+					    struct rx_packet *p, int last);
+extern void rxi_SecureSendPackets(struct rx_call *call, struct opr_queue *q);
 extern int rxi_AdjustIfMTU(int mtu);
 extern int rxi_AdjustMaxMTU(int mtu, int peerMaxMTU);
 extern int rxi_AdjustDgramPackets(int frags, int mtu);
@@ -516,6 +527,8 @@ extern void osi_Panic(char *fmt, ...) AFS_NORETURN;
 extern void rx_GetIFInfo(void);
 extern void rx_SetNoJumbo(void);
 extern int rx_SetMaxMTU(int mtu);
+extern int rx_SetIOBatchSize(int ndgrams);
+extern int rx_SetListenerSockets(int nsockets);
 
 /* rx_xmit_nt.c */
 
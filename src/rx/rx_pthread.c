@@ -199,6 +199,70 @@ rxi_ReScheduleEvents(void)
 }
 
 
+#ifdef RX_ENABLE_MMSG
+/* Batched version of the listener loop, reading up to rx_ioBatchSize
+ * datagrams per system call.  Returns when this thread should become a
+ * server thread, or when batching has been switched off. */
+static void
+rxi_ListenerProcBatched(osi_socket sock, int *tnop,
+			struct rx_call **newcallp)
+{
+    afs_uint32 hosts[RX_MAXIOBATCH];
+    u_short ports[RX_MAXIOBATCH];
+    struct rx_packet *packets[RX_MAXIOBATCH];
+    struct rx_packet *p;
+    int npackets = 0;
+    int nbatch, ngood, i;
+
+    while ((nbatch = rx_ioBatchSize) > 1) {
+	rx_CheckPackets();
+
+	if (nbatch > RX_MAXIOBATCH)
+	    nbatch = RX_MAXIOBATCH;
+
+	/* Top up the set of packets we are reading into, re-using the ones
+	 * left over from the last batch */
+	for (i = 0; i < npackets; i++)
+	    rxi_RestoreDataBufs(packets[i]);
+	for (; npackets < nbatch; npackets++) {
+	    if (!(packets[npackets] = rxi_AllocPacket(RX_PACKET_CLASS_RECEIVE))) {
+		/* Could this happen with multiple socket listeners? */
+		osi_Panic("rxi_Listener: no packets!");	/* Shouldn't happen */
+	    }
+	}
+
+	ngood = rxi_ReadPackets(sock, packets, npackets, hosts, ports);
+	if (ngood > 0)
+	    clock_NewTime();
+
+	for (i = 0; i < ngood; i++) {
+	    /* Once this thread has picked up a call, the rest of the batch
+	     * is dispatched to other server threads */
+	    if (newcallp && *newcallp)
+		p = rxi_ReceivePacket(packets[i], sock, hosts[i], ports[i],
+				      NULL, NULL);
+	    else
+		p = rxi_ReceivePacket(packets[i], sock, hosts[i], ports[i],
+				      tnop, newcallp);
+	    packets[i] = p;
+	}
+
+	/* Squeeze out the packets which were consumed */
+	for (i = 0, nbatch = 0; i < npackets; i++) {
+	    if (packets[i])
+		packets[nbatch++] = packets[i];
+	}
+	npackets = nbatch;
+
+	if (newcallp && *newcallp)
+	    break;
+    }
+
+    for (i = 0; i < npackets; i++)
+	rxi_FreePacket(packets[i]);
+}
+#endif /* RX_ENABLE_MMSG */
+
 /* Loop to listen on a socket. Return setting *newcallp if this
  * thread should become a server thread.  */
 static void
@@ -215,6 +279,17 @@ rxi_ListenerProc(osi_socket sock, int *tnop, struct rx_call **newcallp)
     MUTEX_EXIT(&listener_mutex);
 
     for (;;) {
+#ifdef RX_ENABLE_MMSG
+	if (rx_ioBatchSize > 1) {
+	    if (p) {
+		rxi_FreePacket(p);
+		p = NULL;
+	    }
+	    rxi_ListenerProcBatched(sock, tnop, newcallp);
+	    if (newcallp && *newcallp)
+		return;
+	}
+#endif
         /* See if a check for additional packets was issued */
         rx_CheckPackets();
 
@@ -405,6 +480,50 @@ rxi_Recvmsg(osi_socket socket, struct msghdr *msg_p, int flags)
     return ret;
 }
 
+#ifdef RX_ENABLE_MMSG
+/*
+ * Recvmmsg.
+ */
+int
+rxi_Recvmmsg(osi_socket socket, struct mmsghdr *msgs, int nmsgs, int flags)
+{
+    int ret;
+    ret = recvmmsg(socket, msgs, nmsgs, flags, NULL);
+
+#ifdef AFS_RXERRQ_ENV
+    if (ret < 0) {
+	int code = errno;
+	while (rxi_HandleSocketError(socket) > 0)
+	    ;
+	errno = code;
+    }
+#endif
+
+    return ret;
+}
+
+/*
+ * Sendmmsg.  Returns the number of messages sent, or a negative errno.
+ */
+int
+rxi_Sendmmsg(osi_socket socket, struct mmsghdr *msgs, int nmsgs, int flags)
+{
+    int ret;
+    ret = sendmmsg(socket, msgs, nmsgs, flags);
+
+    if (ret < 0) {
+	int code = errno;
+#ifdef AFS_RXERRQ_ENV
+	while (rxi_HandleSocketError(socket) > 0)
+	    ;
+#endif
+	dpf(("rxi_Sendmmsg failed, error %d\n", code));
+	return -code;
+    }
+    return ret;
+}
+#endif /* RX_ENABLE_MMSG */
+
 /*
  * Sendmsg.
  */
@@ -454,6 +573,7 @@ struct rx_ts_info_t * rx_ts_info_init(void) {
     MUTEX_ENTER(&rx_packets_mutex);
     rx_TSFPQMaxProcs++;
     RX_TS_FPQ_COMPUTE_LIMITS;
+    rx_ts_info->depot = rx_TSFPQMaxProcs % RX_PACKET_DEPOTS;
     MUTEX_EXIT(&rx_packets_mutex);
 #endif /* RX_ENABLE_TSFPQ */
     return rx_ts_info;
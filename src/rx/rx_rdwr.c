@@ -70,6 +70,36 @@
 static int rxdb_fileID = RXDB_FILE_RX_RDWR;
 #endif /* RX_LOCKS_DB */
 
+/* Check rp, which has just been taken off the receive queue, together with
+ * the packets which follow it in sequence on the queue, and mark those as
+ * checked for when their turn comes. */
+static int
+rxi_CheckPacketRun(struct rx_call *call, struct rx_packet *rp)
+{
+    struct rx_packet *batch[RX_SECURITY_BATCH];
+    struct rx_packet *np;
+    struct opr_queue *cursor;
+    afs_uint32 seq = rp->header.seq;
+    int error, n, i;
+
+    batch[0] = rp;
+    n = 1;
+    for (opr_queue_Scan(&call->rq, cursor)) {
+	if (n == RX_SECURITY_BATCH)
+	    break;
+	np = opr_queue_Entry(cursor, struct rx_packet, entry);
+	if (np->header.seq != seq + n || (np->flags & RX_PKTFLAG_CHECKED))
+	    break;
+	batch[n++] = np;
+    }
+    error = RXS_CheckPackets(call->conn->securityObject, call, batch, n);
+    if (!error) {
+	for (i = 1; i < n; i++)
+	    batch[i]->flags |= RX_PKTFLAG_CHECKED;
+    }
+    return error;
+}
+
 /* Get the next packet in the receive queue
  *
  * Dispose of the call's currentPacket, and move the next packet in the
@@ -108,6 +138,7 @@ rxi_GetNextPacket(struct rx_call *call) {
 	return 0;
 
     opr_queue_Remove(&rp->entry);
+    call->rqCount--;
 #ifdef RX_TRACK_PACKETS
     rp->flags &= ~RX_PKTFLAG_RQ;
 #endif
@@ -117,8 +148,16 @@ rxi_GetNextPacket(struct rx_call *call) {
 
     /* RXS_CheckPacket called to undo RXS_PreparePacket's work.  It may
      * reduce the length of the packet by up to conn->maxTrailerSize,
-     * to reflect the length of the data + the header. */
-    if ((error = RXS_CheckPacket(call->conn->securityObject, call, rp))) {
+     * to reflect the length of the data + the header.  If the security
+     * class can, check this packet along with those in sequence behind it
+     * while we are at it. */
+    if (rp->flags & RX_PKTFLAG_CHECKED)
+	error = 0;
+    else if (RXS_HasOp(call->conn->securityObject, CheckPackets))
+	error = rxi_CheckPacketRun(call, rp);
+    else
+	error = RXS_CheckPacket(call->conn->securityObject, call, rp);
+    if (error) {
 	/* Used to merely shut down the call, but now we shut down the whole
 	 * connection since this may indicate an attempt to hijack it */
 
@@ -1071,11 +1110,12 @@ rxi_WritevProc(struct rx_call *call, struct iovec *iov, int nio, int nbytes)
 	if (call->app.nFree == 0 && call->app.currentPacket) {
 	    clock_NewTime();	/* Bogus:  need new time package */
 	    /* The 0, below, specifies that it is not the last packet:
-	     * there will be others. PrepareSendPacket may
+	     * there will be others. The security object may
 	     * alter the packet length by up to
-	     * conn->securityMaxTrailerSize */
+	     * conn->securityMaxTrailerSize; it is applied to all of
+	     * tmpq at once below. */
 	    call->app.bytesSent += call->app.currentPacket->length;
-	    rxi_PrepareSendPacket(call, call->app.currentPacket, 0);
+	    rxi_PrepareSendPacketNoSecurity(call, call->app.currentPacket, 0);
             /* PrepareSendPacket drops the call lock */
             rxi_WaitforTQBusy(call);
 	    opr_queue_Append(&tmpq, &call->app.currentPacket->entry);
@@ -1158,6 +1198,8 @@ rxi_WritevProc(struct rx_call *call, struct iovec *iov, int nio, int nbytes)
 	}
     } while (nbytes && nextio < nio);
 
+    rxi_SecureSendPackets(call, &tmpq);
+
     /* Move the packets from the temporary queue onto the transmit queue.
      * We may end up with more than call->twind packets on the queue. */
 
@@ -74,7 +74,9 @@ struct rx_statisticsAtomic {    /* Atomic version of rx_statistics */
     rx_atomic_t receiveCbufPktAllocFailures;
     rx_atomic_t sendCbufPktAllocFailures;
     rx_atomic_t nBusies;
-    rx_atomic_t spares[4];
+    rx_atomic_t nRecvSyscalls;
+    rx_atomic_t nSendSyscalls;
+    rx_atomic_t spares[2];
 };
 
 #if defined(RX_ENABLE_LOCKS)
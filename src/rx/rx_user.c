@@ -52,6 +52,14 @@
 #include "rx_packet.h"
 #include "rx_internal.h"
 
+/* Linux spreads the datagrams arriving on a port over all the SO_REUSEPORT
+ * sockets bound to it by hashing the sender's address, so each peer is
+ * always read by the same socket.  Other platforms either lack the option
+ * or hand the whole port to the most recently bound socket. */
+#if defined(AFS_PTHREAD_ENV) && defined(AFS_LINUX22_ENV) && defined(SO_REUSEPORT)
+# define RX_ENABLE_REUSEPORT
+#endif
+
 #ifdef AFS_PTHREAD_ENV
 
 /*
@@ -82,13 +90,12 @@ afs_kmutex_t rx_if_mutex;
 
 
 /*
- * Make a socket for receiving/sending IP packets.  Set it into non-blocking
- * and large buffering modes.  If port isn't specified, the kernel will pick
- * one.  Returns the socket (>= 0) on success.  Returns OSI_NULLSOCKET on
- * failure. Port must be in network byte order.
+ * Make a socket for receiving/sending IP packets, set it into large
+ * buffering mode and start listening on it.  If reuseport is set, the
+ * socket may share its address with other sockets.
  */
-osi_socket
-rxi_GetHostUDPSocket(u_int ahost, u_short port)
+static osi_socket
+rxi_MakeUDPSocket(u_int ahost, u_short port, int reuseport)
 {
     int binds, code = 0;
     osi_socket socketFd = OSI_NULLSOCKET;
@@ -136,6 +143,17 @@ rxi_GetHostUDPSocket(u_int ahost, u_short port)
 #ifdef STRUCT_SOCKADDR_HAS_SA_LEN
     taddr.sin_len = sizeof(struct sockaddr_in);
 #endif
+#ifdef RX_ENABLE_REUSEPORT
+    if (reuseport) {
+	int on = 1;
+
+	if (setsockopt(socketFd, SOL_SOCKET, SO_REUSEPORT, &on,
+		       sizeof(on)) < 0) {
+	    (osi_Msg "%sunable to set SO_REUSEPORT\n", name);
+	    goto error;
+	}
+    }
+#endif
 #define MAX_RX_BINDS 10
     for (binds = 0; binds < MAX_RX_BINDS; binds++) {
 	if (binds)
@@ -224,6 +242,61 @@ rxi_GetHostUDPSocket(u_int ahost, u_short port)
     return OSI_NULLSOCKET;
 }
 
+#ifdef RX_ENABLE_REUSEPORT
+/*
+ * Open the rest of the rx_listenerSockets sockets for the address sock is
+ * bound to, each with its own listener thread.  These sockets are only
+ * used for receiving; replies still go out through sock.  Failing to open
+ * one just leaves us with fewer listeners.
+ */
+static void
+rxi_AddListenerSockets(u_int ahost, osi_socket sock)
+{
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    int i;
+
+    if (getsockname(sock, (struct sockaddr *)&addr, &addrlen) != 0) {
+	(osi_Msg "rxi_GetUDPSocket: *WARNING* getsockname failed; using a "
+	 "single listener socket\n");
+	return;
+    }
+    for (i = 1; i < rx_listenerSockets; i++) {
+	if (rxi_MakeUDPSocket(ahost, addr.sin_port, 1) == OSI_NULLSOCKET) {
+	    (osi_Msg "rxi_GetUDPSocket: *WARNING* only %d of %d listener "
+	     "sockets opened\n", i, rx_listenerSockets);
+	    break;
+	}
+    }
+}
+#endif
+
+/*
+ * Make a socket for receiving/sending IP packets.  Set it into non-blocking
+ * and large buffering modes.  If port isn't specified, the kernel will pick
+ * one.  Returns the socket (>= 0) on success.  Returns OSI_NULLSOCKET on
+ * failure. Port must be in network byte order.
+ *
+ * If more than one listener socket per port has been requested, additional
+ * sockets are bound to the same address with SO_REUSEPORT.
+ */
+osi_socket
+rxi_GetHostUDPSocket(u_int ahost, u_short port)
+{
+    osi_socket socketFd;
+    int reuseport = 0;
+
+#ifdef RX_ENABLE_REUSEPORT
+    reuseport = (rx_listenerSockets > 1);
+#endif
+    socketFd = rxi_MakeUDPSocket(ahost, port, reuseport);
+#ifdef RX_ENABLE_REUSEPORT
+    if (socketFd != OSI_NULLSOCKET && reuseport)
+	rxi_AddListenerSockets(ahost, socketFd);
+#endif
+    return socketFd;
+}
+
 osi_socket
 rxi_GetUDPSocket(u_short port)
 {
@@ -778,6 +851,39 @@ rx_SetMaxMTU(int mtu)
     return 0;
 }
 
+/* Set the number of datagrams which may be moved by a single system call
+ * in the listener and transmit paths.  0 or 1 disables batching.  Returns
+ * ENOSYS if batched datagram I/O isn't available on this platform. */
+int
+rx_SetIOBatchSize(int ndgrams)
+{
+    if (ndgrams < 0)
+	return EINVAL;
+#ifdef RX_ENABLE_MMSG
+    rx_ioBatchSize = MIN(ndgrams, RX_MAXIOBATCH);
+#else
+    if (ndgrams > 1)
+	return ENOSYS;
+#endif
+    return 0;
+}
+
+/* Set the number of sockets, each with its own listener thread, opened on
+ * each Rx port.  Must be called before rx_Init.  Returns ENOSYS if sockets
+ * can't share a port on this platform. */
+int
+rx_SetListenerSockets(int nsockets)
+{
+    if (nsockets < 1 || nsockets > RX_MAXLISTENERSOCKETS)
+	return EINVAL;
+#ifndef RX_ENABLE_REUSEPORT
+    if (nsockets > 1)
+	return ENOSYS;
+#endif
+    rx_listenerSockets = nsockets;
+    return 0;
+}
+
 #ifdef AFS_RXERRQ_ENV
 int
 rxi_HandleSocketError(int socket)
@@ -80,6 +80,8 @@ MainCommand(struct cmd_syndesc *as, void *arock)
     int withWaited;
     int withPeers;
     int withPackets;
+    int withHashWaits;
+    int withPacketPool;
     struct rx_debugStats tstats;
     char *portName, *hostName;
     char hoststr[20];
@@ -242,6 +244,8 @@ MainCommand(struct cmd_syndesc *as, void *arock)
     withWaited = (supportedDebugValues & RX_SERVER_DEBUG_WAITED_CNT);
     withPeers = (supportedDebugValues & RX_SERVER_DEBUG_ALL_PEER);
     withPackets = (supportedDebugValues & RX_SERVER_DEBUG_PACKETS_CNT);
+    withHashWaits = (supportedDebugValues & RX_SERVER_DEBUG_HASH_WAITS);
+    withPacketPool = (supportedDebugValues & RX_SERVER_DEBUG_PACKET_POOL);
 
     if (withPackets)
         printf("Free packets: %d/%d, packet reclaims: %d, calls: %d, used FDs: %d\n",
@@ -260,6 +264,13 @@ MainCommand(struct cmd_syndesc *as, void *arock)
 	printf("%d threads are idle\n", tstats.idleThreads);
     if (withWaited)
 	printf("%d calls have waited for a thread\n", tstats.nWaited);
+    if (withHashWaits)
+	printf("%d connection and %d peer hash table lock waits\n",
+	       tstats.nConnHashWaits, tstats.nPeerHashWaits);
+    if (withPacketPool)
+	printf("%d packets in CPU depots, %d draining, %d released\n",
+	       tstats.nDepotPackets, tstats.nDrainingPackets,
+	       tstats.nReleasedPackets);
 
     if (rxstats) {
 	if (!withRxStats) {
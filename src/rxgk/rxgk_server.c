@@ -86,8 +86,8 @@ static struct rx_securityOps rxgk_server_ops = {
     rxgk_DestroyServerConnection,
     rxgk_ServerGetStats,
     0,
-    0,				/* spare 1 */
-    0,				/* spare 2 */
+    0,				/* prepare packets */
+    0,				/* check packets */
 };
 
 static struct rx_securityClass dummySC = {
@@ -105,3 +105,154 @@ rxkad_EncryptPacket(const struct rx_connection * conn,
     }
     return 0;
 }
+
+/*
+ * Batched forms of the above, for use when a whole run of packets of one
+ * connection is to be crypted at once.  Each packet is crypted from the
+ * connection's ivec on its own, so the packets are independent of each
+ * other and are done two at a time with fc_cbc_encrypt2.  The length to
+ * crypt is the current data size of each packet.
+ */
+
+/* Where we are in the data of a packet: the iovec, the offset into it and the
+ * bytes left to crypt. */
+struct crypt_cursor {
+    struct rx_packet *packet;
+    int iov;
+    int off;
+    int left;
+};
+
+static_inline void
+CursorInit(struct crypt_cursor *cur, struct rx_packet *packet)
+{
+    cur->packet = packet;
+    cur->iov = 0;
+    cur->off = 0;
+    cur->left = rx_GetDataSize(packet);
+}
+
+/* Return the next contiguous piece of the packet to crypt, and its length. */
+static_inline char *
+CursorData(struct crypt_cursor *cur, int *alen)
+{
+    char *data;
+    int tlen;
+
+    while (cur->left > 0 && cur->iov < RX_MAXWVECS) {
+	data = rx_data(cur->packet, cur->iov, tlen);
+	if (!data || !tlen)
+	    break;
+	if (cur->off < tlen) {
+	    *alen = MIN(cur->left, tlen - cur->off);
+	    return data + cur->off;
+	}
+	cur->iov++;
+	cur->off = 0;
+    }
+    return NULL;
+}
+
+static_inline void
+CursorAdvance(struct crypt_cursor *cur, int len)
+{
+    cur->off += len;
+    cur->left -= len;
+}
+
+static void
+CryptRest(struct crypt_cursor *cur, const fc_KeySchedule * schedule,
+	  afs_uint32 *xor, int encrypt)
+{
+    char *data;
+    int len;
+
+    while ((data = CursorData(cur, &len)) != NULL) {
+	fc_cbc_encrypt(data, data, len, *schedule, xor, encrypt);
+	CursorAdvance(cur, len);
+    }
+}
+
+static void
+CryptPackets(const fc_KeySchedule * schedule,
+	     const fc_InitializationVector * ivec,
+	     struct rx_packet **packets, int npackets, int encrypt)
+{
+    struct crypt_cursor cur0, cur1;
+    afs_uint32 xor0[2], xor1[2];
+    char *data0, *data1;
+    int i, len0, len1, len;
+
+    for (i = 0; i + 1 < npackets; i += 2) {
+	CursorInit(&cur0, packets[i]);
+	CursorInit(&cur1, packets[i + 1]);
+	memcpy(xor0, ivec, sizeof(xor0));
+	memcpy(xor1, ivec, sizeof(xor1));
+
+	/* Go in step while both packets have whole blocks in their current
+	 * iovecs, then finish off whatever is left of each. */
+	for (;;) {
+	    data0 = CursorData(&cur0, &len0);
+	    data1 = CursorData(&cur1, &len1);
+	    if (!data0 || !data1)
+		break;
+	    len = MIN(len0, len1) & ~(ENCRYPTIONBLOCKSIZE - 1);
+	    if (len == 0)
+		break;
+	    fc_cbc_encrypt2(data0, data0, xor0, data1, data1, xor1, len,
+			    *schedule, encrypt);
+	    CursorAdvance(&cur0, len);
+	    CursorAdvance(&cur1, len);
+	}
+	CryptRest(&cur0, schedule, xor0, encrypt);
+	CryptRest(&cur1, schedule, xor1, encrypt);
+    }
+    if (i < npackets) {
+	CursorInit(&cur0, packets[i]);
+	memcpy(xor0, ivec, sizeof(xor0));
+	CryptRest(&cur0, schedule, xor0, encrypt);
+    }
+}
+
+afs_int32
+rxkad_DecryptPackets(const struct rx_connection *conn,
+		     const fc_KeySchedule * schedule,
+		     const fc_InitializationVector * ivec,
+		     struct rx_packet **packets, int npackets)
+{
+    struct rx_securityClass *obj;
+    struct rxkad_cprivate *tp;	/* s & c have type at same offset */
+    int i, len;
+
+    obj = rx_SecurityObjectOf(conn);
+    tp = (struct rxkad_cprivate *)obj->privateData;
+    for (i = 0, len = 0; i < npackets; i++)
+	len += rx_GetDataSize(packets[i]);
+    ADD_RXKAD_STATS(bytesDecrypted[rxkad_TypeIndex(tp->type)],len);
+
+    CryptPackets(schedule, ivec, packets, npackets, DECRYPT);
+    return 0;
+}
+
+afs_int32
+rxkad_EncryptPackets(const struct rx_connection *conn,
+		     const fc_KeySchedule * schedule,
+		     const fc_InitializationVector * ivec,
+		     struct rx_packet **packets, int npackets)
+{
+    struct rx_securityClass *obj;
+    struct rxkad_cprivate *tp;	/* s & c have type at same offset */
+    int i, len;
+
+    obj = rx_SecurityObjectOf(conn);
+    tp = (struct rxkad_cprivate *)obj->privateData;
+    for (i = 0, len = 0; i < npackets; i++) {
+	len += rx_GetDataSize(packets[i]);
+	/* no checksum; see rxkad_EncryptPacket */
+	rx_PutInt32(packets[i], 1 * sizeof(afs_int32), 0);
+    }
+    ADD_RXKAD_STATS(bytesEncrypted[rxkad_TypeIndex(tp->type)],len);
+
+    CryptPackets(schedule, ivec, packets, npackets, ENCRYPT);
+    return 0;
+}
@@ -94,85 +94,106 @@ fc_keysched(struct ktc_encryptionKey *key, fc_KeySchedule schedule)
     return 0;
 }
 
+/* The round function: the sboxes already place and rotate their output, so
+ * all that is left is four lookups. */
+#define F(S) (sbox0[(S) >> 24] ^ sbox1[((S) >> 16) & 0xff] \
+	      ^ sbox2[((S) >> 8) & 0xff] ^ sbox3[(S) & 0xff])
+
+/* Encrypt or decrypt one block held as two host order words. */
+static_inline void
+fc_block(afs_uint32 *aL, afs_uint32 *aR, const afs_int32 *schedule,
+	 int encrypt)
+{
+    afs_uint32 L = *aL, R = *aR;
+    int i;
+
+    if (encrypt) {
+	for (i = 0; i < ROUNDS; i += 2) {
+	    L ^= F(schedule[i] ^ R);
+	    R ^= F(schedule[i + 1] ^ L);
+	}
+    } else {
+	for (i = ROUNDS - 1; i > 0; i -= 2) {
+	    R ^= F(schedule[i] ^ L);
+	    L ^= F(schedule[i - 1] ^ R);
+	}
+    }
+    *aL = L;
+    *aR = R;
+}
+
+/* The same for a block from each of two independent streams.  The rounds of
+ * a single block depend on each other, so interleaving two of them keeps the
+ * table lookups of one going while the other waits. */
+static_inline void
+fc_block2(afs_uint32 *aL0, afs_uint32 *aR0, afs_uint32 *aL1, afs_uint32 *aR1,
+	  const afs_int32 *schedule, int encrypt)
+{
+    afs_uint32 L0 = *aL0, R0 = *aR0, L1 = *aL1, R1 = *aR1;
+    afs_uint32 k;
+    int i;
+
+    if (encrypt) {
+	for (i = 0; i < ROUNDS; i += 2) {
+	    k = schedule[i];
+	    L0 ^= F(k ^ R0);
+	    L1 ^= F(k ^ R1);
+	    k = schedule[i + 1];
+	    R0 ^= F(k ^ L0);
+	    R1 ^= F(k ^ L1);
+	}
+    } else {
+	for (i = ROUNDS - 1; i > 0; i -= 2) {
+	    k = schedule[i];
+	    R0 ^= F(k ^ L0);
+	    R1 ^= F(k ^ L1);
+	    k = schedule[i - 1];
+	    L0 ^= F(k ^ R0);
+	    L1 ^= F(k ^ R1);
+	}
+    }
+    *aL0 = L0;
+    *aR0 = R0;
+    *aL1 = L1;
+    *aR1 = R1;
+}
+
 /* IN int encrypt; * 0 ==> decrypt, else encrypt */
 afs_int32
 fc_ecb_encrypt(void * clear, void * cipher,
 	       const fc_KeySchedule schedule, int encrypt)
 {
     afs_uint32 L, R;
-    volatile afs_uint32 S, P;
-    volatile unsigned char *Pchar = (unsigned char *)&P;
-    volatile unsigned char *Schar = (unsigned char *)&S;
-    int i;
-
-#ifndef WORDS_BIGENDIAN
-#define Byte0 3
-#define Byte1 2
-#define Byte2 1
-#define Byte3 0
-#else
-#define Byte0 0
-#define Byte1 1
-#define Byte2 2
-#define Byte3 3
-#endif
 
-#if 0
-    memcpy(&L, clear, sizeof(afs_int32));
-    memcpy(&R, clear + 1, sizeof(afs_int32));
-#else
     L = ntohl(*((afs_uint32 *)clear));
     R = ntohl(*((afs_uint32 *)clear + 1));
-#endif
 
     if (encrypt) {
 	INC_RXKAD_STATS(fc_encrypts[ENCRYPT]);
-	for (i = 0; i < (ROUNDS / 2); i++) {
-	    S = *schedule++ ^ R;	/* xor R with key bits from schedule */
-	    Pchar[Byte2] = sbox0[Schar[Byte0]];	/* do 8-bit S Box subst. */
-	    Pchar[Byte3] = sbox1[Schar[Byte1]];	/* and permute the result */
-	    Pchar[Byte1] = sbox2[Schar[Byte2]];
-	    Pchar[Byte0] = sbox3[Schar[Byte3]];
-	    P = (P >> 5) | ((P & ((1 << 5) - 1)) << (32 - 5));	/* right rot 5 bits */
-	    L ^= P;		/* we're done with L, so save there */
-	    S = *schedule++ ^ L;	/* this time xor with L */
-	    Pchar[Byte2] = sbox0[Schar[Byte0]];
-	    Pchar[Byte3] = sbox1[Schar[Byte1]];
-	    Pchar[Byte1] = sbox2[Schar[Byte2]];
-	    Pchar[Byte0] = sbox3[Schar[Byte3]];
-	    P = (P >> 5) | ((P & ((1 << 5) - 1)) << (32 - 5));	/* right rot 5 bits */
-	    R ^= P;
-	}
     } else {
 	INC_RXKAD_STATS(fc_encrypts[DECRYPT]);
-	schedule = &schedule[ROUNDS - 1];	/* start at end of key schedule */
-	for (i = 0; i < (ROUNDS / 2); i++) {
-	    S = *schedule-- ^ L;	/* xor R with key bits from schedule */
-	    Pchar[Byte2] = sbox0[Schar[Byte0]];	/* do 8-bit S Box subst. and */
-	    Pchar[Byte3] = sbox1[Schar[Byte1]];	/* permute the result */
-	    Pchar[Byte1] = sbox2[Schar[Byte2]];
-	    Pchar[Byte0] = sbox3[Schar[Byte3]];
-	    P = (P >> 5) | ((P & ((1 << 5) - 1)) << (32 - 5));	/* right rot 5 bits */
-	    R ^= P;		/* we're done with L, so save there */
-	    S = *schedule-- ^ R;	/* this time xor with L */
-	    Pchar[Byte2] = sbox0[Schar[Byte0]];
-	    Pchar[Byte3] = sbox1[Schar[Byte1]];
-	    Pchar[Byte1] = sbox2[Schar[Byte2]];
-	    Pchar[Byte0] = sbox3[Schar[Byte3]];
-	    P = (P >> 5) | ((P & ((1 << 5) - 1)) << (32 - 5));	/* right rot 5 bits */
-	    L ^= P;
-	}
     }
-#if 0
-    memcpy(cipher, &L, sizeof(afs_int32));
-    memcpy(cipher + 1, &R, sizeof(afs_int32));
-#else
+    fc_block(&L, &R, schedule, encrypt);
+
     *((afs_int32 *)cipher) = htonl(L);
     *((afs_int32 *)cipher + 1) = htonl(R);
-#endif
     return 0;
 }
 
+/* Fetch the next block of a stream, zero padding a final partial block when
+ * encrypting.  There is no padding for decrypt. */
+static_inline void
+fc_getblock(afs_uint32 *block, const char *input, afs_int32 length,
+	    int encrypt)
+{
+    if (length >= 8 || !encrypt) {
+	memcpy(block, input, 8);
+    } else {
+	block[0] = block[1] = 0;
+	memcpy(block, input, length);
+    }
+}
+
 /* Crypting can be done in segments by recycling xor.  All but the final segment must
  * be multiples of 8 bytes.
  * NOTE: fc_cbc_encrypt now modifies its 5th argument, to permit chaining over
@@ -188,61 +209,100 @@ afs_int32
 fc_cbc_encrypt(void *input, void *output, afs_int32 length,
 	       const fc_KeySchedule key, afs_uint32 * xor, int encrypt)
 {
-    afs_uint32 i, j;
+    char *in = input, *out = output;
     afs_uint32 t_input[2];
-    afs_uint32 t_output[2];
-    unsigned char *t_in_p = (unsigned char *)t_input;
+    afs_uint32 L, R;
 
+    if (length <= 0)
+	return 0;
     if (encrypt) {
-	for (i = 0; length > 0; i++, length -= 8) {
-	    /* get input */
-	    memcpy(t_input, input, sizeof(t_input));
-	    input=((char *)input) + sizeof(t_input);
-
-	    /* zero pad */
-	    for (j = length; j <= 7; j++)
-		*(t_in_p + j) = 0;
-
-	    /* do the xor for cbc into the temp */
-	    xor[0] ^= t_input[0];
-	    xor[1] ^= t_input[1];
-	    /* encrypt */
-	    fc_ecb_encrypt(xor, t_output, key, encrypt);
-
-	    /* copy temp output and save it for cbc */
-	    memcpy(output, t_output, sizeof(t_output));
-	    output=(char *)output + sizeof(t_output);
+	ADD_RXKAD_STATS(fc_encrypts[ENCRYPT], (length + 7) / 8);
+    } else {
+	ADD_RXKAD_STATS(fc_encrypts[DECRYPT], (length + 7) / 8);
+    }
 
-	    /* calculate xor value for next round from plain & cipher text */
-	    xor[0] = t_input[0] ^ t_output[0];
-	    xor[1] = t_input[1] ^ t_output[1];
+    for (; length > 0; length -= 8, in += 8, out += 8) {
+	fc_getblock(t_input, in, length, encrypt);
+	if (encrypt) {
+	    /* do the xor for cbc into the block and encrypt it */
+	    L = ntohl(xor[0] ^ t_input[0]);
+	    R = ntohl(xor[1] ^ t_input[1]);
+	    fc_block(&L, &R, key, ENCRYPT);
+	    L = htonl(L);
+	    R = htonl(R);
+	    /* next xor value is from plain & cipher text */
+	    xor[0] = t_input[0] ^ L;
+	    xor[1] = t_input[1] ^ R;
+	} else {
+	    L = ntohl(t_input[0]);
+	    R = ntohl(t_input[1]);
+	    fc_block(&L, &R, key, DECRYPT);
+	    L = htonl(L) ^ xor[0];
+	    R = htonl(R) ^ xor[1];
+	    xor[0] = t_input[0] ^ L;
+	    xor[1] = t_input[1] ^ R;
+	}
+	memcpy(out, &L, sizeof(L));
+	memcpy(out + 4, &R, sizeof(R));
+    }
+    return 0;
+}
 
+/* Crypt two independent streams of the same length at once, each with its own
+ * xor in the manner of fc_cbc_encrypt.  This is what a caller with several
+ * packets to process at a time should use; it is roughly twice as fast as
+ * doing the streams one after the other.
+ */
+afs_int32
+fc_cbc_encrypt2(void *input0, void *output0, afs_uint32 *xor0,
+		void *input1, void *output1, afs_uint32 *xor1,
+		afs_int32 length, const fc_KeySchedule key, int encrypt)
+{
+    char *in0 = input0, *out0 = output0;
+    char *in1 = input1, *out1 = output1;
+    afs_uint32 t0[2], t1[2];
+    afs_uint32 L0, R0, L1, R1;
 
-	}
-	t_output[0] = 0;
-	t_output[1] = 0;
+    if (length <= 0)
+	return 0;
+    if (encrypt) {
+	ADD_RXKAD_STATS(fc_encrypts[ENCRYPT], 2 * ((length + 7) / 8));
     } else {
-	/* decrypt */
-	for (i = 0; length > 0; i++, length -= 8) {
-	    /* get input */
-	    memcpy(t_input, input, sizeof(t_input));
-	    input=((char *)input) + sizeof(t_input);
-
-	    /* no padding for decrypt */
-	    fc_ecb_encrypt(t_input, t_output, key, encrypt);
-
-	    /* do the xor for cbc into the output */
-	    t_output[0] ^= xor[0];
-	    t_output[1] ^= xor[1];
-
-	    /* copy temp output */
-	    memcpy(output, t_output, sizeof(t_output));
-	    output=((char *)output) + sizeof(t_output);
-
-	    /* calculate xor value for next round from plain & cipher text */
-	    xor[0] = t_input[0] ^ t_output[0];
-	    xor[1] = t_input[1] ^ t_output[1];
+	ADD_RXKAD_STATS(fc_encrypts[DECRYPT], 2 * ((length + 7) / 8));
+    }
+
+    for (; length > 0; length -= 8, in0 += 8, out0 += 8, in1 += 8, out1 += 8) {
+	fc_getblock(t0, in0, length, encrypt);
+	fc_getblock(t1, in1, length, encrypt);
+	if (encrypt) {
+	    L0 = ntohl(xor0[0] ^ t0[0]);
+	    R0 = ntohl(xor0[1] ^ t0[1]);
+	    L1 = ntohl(xor1[0] ^ t1[0]);
+	    R1 = ntohl(xor1[1] ^ t1[1]);
+	    fc_block2(&L0, &R0, &L1, &R1, key, ENCRYPT);
+	    L0 = htonl(L0);
+	    R0 = htonl(R0);
+	    L1 = htonl(L1);
+	    R1 = htonl(R1);
+	} else {
+	    L0 = ntohl(t0[0]);
+	    R0 = ntohl(t0[1]);
+	    L1 = ntohl(t1[0]);
+	    R1 = ntohl(t1[1]);
+	    fc_block2(&L0, &R0, &L1, &R1, key, DECRYPT);
+	    L0 = htonl(L0) ^ xor0[0];
+	    R0 = htonl(R0) ^ xor0[1];
+	    L1 = htonl(L1) ^ xor1[0];
+	    R1 = htonl(R1) ^ xor1[1];
 	}
+	xor0[0] = t0[0] ^ L0;
+	xor0[1] = t0[1] ^ R0;
+	xor1[0] = t1[0] ^ L1;
+	xor1[1] = t1[1] ^ R1;
+	memcpy(out0, &L0, sizeof(L0));
+	memcpy(out0 + 4, &R0, sizeof(R0));
+	memcpy(out1, &L1, sizeof(L1));
+	memcpy(out1 + 4, &R1, sizeof(R1));
     }
     return 0;
 }
@@ -64,8 +64,8 @@ static struct rx_securityOps rxkad_client_ops = {
     rxkad_DestroyConnection,
     rxkad_GetStats,
     0,
-    0,
-    0,
+    rxkad_PreparePackets,	/* a run of packets at once */
+    rxkad_CheckPackets,
 };
 
 /* Allocate a new client security object.  Called with the encryption level,
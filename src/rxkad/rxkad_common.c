@@ -410,17 +410,19 @@ rxkad_DestroyConnection(struct rx_securityClass *aobj,
 
 /* either: decode packet */
 
-int
-rxkad_CheckPacket(struct rx_securityClass *aobj, struct rx_call *acall,
-		  struct rx_packet *apacket)
+/* The work of rxkad_CheckPacket up to decryption: find the keys for the
+ * connection and verify the packet checksum. */
+static int
+CheckPacketKeys(struct rx_securityClass *aobj, struct rx_call *acall,
+		struct rx_packet *apacket, rxkad_level *alevel,
+		const fc_KeySchedule **aschedule,
+		fc_InitializationVector **aivec)
 {
     struct rx_connection *tconn;
     rxkad_level level;
     const fc_KeySchedule *schedule;
     fc_InitializationVector *ivec;
     int len;
-    int nlen = 0;
-    u_int word;			/* so we get unsigned right-shift */
     int checkCksum;
     afs_int32 *preSeq;
     afs_int32 code;
@@ -471,6 +473,44 @@ rxkad_CheckPacket(struct rx_securityClass *aobj, struct rx_call *acall,
 	    return RXKADSEALEDINCON;
     }
 
+    *alevel = level;
+    *aschedule = schedule;
+    *aivec = ivec;
+    return 0;
+}
+
+/* The work of rxkad_CheckPacket after decryption: check the sealed header
+ * and trim the packet to the real user data length. */
+static int
+CheckPacketSeal(struct rx_packet *apacket, int len)
+{
+    int nlen = 0;
+    u_int word;			/* so we get unsigned right-shift */
+
+    word = ntohl(rx_GetInt32(apacket, 0));	/* get first sealed word */
+    if ((word >> 16) !=
+	((apacket->header.seq ^ apacket->header.callNumber) & 0xffff))
+	return RXKADSEALEDINCON;
+    nlen = word & 0xffff;	/* get real user data length */
+
+    /* The sealed length should be no larger than the initial length, since the
+     * reverse (round-up) occurs in ...PreparePacket */
+    if (nlen > len)
+	return RXKADDATALEN;
+    rx_SetDataSize(apacket, nlen);
+    return 0;
+}
+
+/* Decrypt and check one packet once CheckPacketKeys has passed it. */
+static int
+CheckPacketData(struct rx_connection *tconn, struct rx_packet *apacket,
+		rxkad_level level, const fc_KeySchedule *schedule,
+		fc_InitializationVector *ivec)
+{
+    int len;
+    afs_int32 code;
+
+    len = rx_GetDataSize(apacket);
     switch (level) {
     case rxkad_clear:
 	return 0;		/* shouldn't happen */
@@ -485,25 +525,77 @@ rxkad_CheckPacket(struct rx_securityClass *aobj, struct rx_call *acall,
 	    return code;
 	break;
     }
-    word = ntohl(rx_GetInt32(apacket, 0));	/* get first sealed word */
-    if ((word >> 16) !=
-	((apacket->header.seq ^ apacket->header.callNumber) & 0xffff))
-	return RXKADSEALEDINCON;
-    nlen = word & 0xffff;	/* get real user data length */
+    return CheckPacketSeal(apacket, len);
+}
 
-    /* The sealed length should be no larger than the initial length, since the
-     * reverse (round-up) occurs in ...PreparePacket */
-    if (nlen > len)
-	return RXKADDATALEN;
-    rx_SetDataSize(apacket, nlen);
+int
+rxkad_CheckPacket(struct rx_securityClass *aobj, struct rx_call *acall,
+		  struct rx_packet *apacket)
+{
+    rxkad_level level;
+    const fc_KeySchedule *schedule;
+    fc_InitializationVector *ivec;
+    afs_int32 code;
+
+    code = CheckPacketKeys(aobj, acall, apacket, &level, &schedule, &ivec);
+    if (code)
+	return code;
+    return CheckPacketData(rx_ConnectionOf(acall), apacket, level, schedule,
+			   ivec);
+}
+
+/* either: decode a run of packets of the same call.  Only rxkad_crypt
+ * gains anything, by having the packets decrypted together. */
+
+int
+rxkad_CheckPackets(struct rx_securityClass *aobj, struct rx_call *acall,
+		   struct rx_packet **apackets, int npackets)
+{
+    struct rx_connection *tconn;
+    rxkad_level level = rxkad_clear;
+    const fc_KeySchedule *schedule = NULL;
+    fc_InitializationVector *ivec = NULL;
+    afs_int32 code;
+    int i;
+
+    tconn = rx_ConnectionOf(acall);
+    for (i = 0; i < npackets; i++) {
+	code = CheckPacketKeys(aobj, acall, apackets[i], &level, &schedule,
+			       &ivec);
+	if (code)
+	    return code;
+	if (level != rxkad_crypt) {
+	    code = CheckPacketData(tconn, apackets[i], level, schedule, ivec);
+	    if (code)
+		return code;
+	}
+    }
+    if (level != rxkad_crypt)
+	return 0;
+
+    code = rxkad_DecryptPackets(tconn, schedule,
+				(const fc_InitializationVector *)ivec,
+				apackets, npackets);
+    if (code)
+	return code;
+    for (i = 0; i < npackets; i++) {
+	code = CheckPacketSeal(apackets[i], rx_GetDataSize(apackets[i]));
+	if (code)
+	    return code;
+    }
     return 0;
 }
 
 /* either: encode packet */
 
-int
-rxkad_PreparePacket(struct rx_securityClass *aobj, struct rx_call *acall,
-		    struct rx_packet *apacket)
+/* The work of rxkad_PreparePacket short of the rxkad_crypt encryption: the
+ * checksum, the sealed header and padding.  Returns the length the packet is
+ * to have in *anlen, or -1 if it is to be left alone. */
+static int
+SealPacket(struct rx_securityClass *aobj, struct rx_call *acall,
+	   struct rx_packet *apacket, rxkad_level *alevel,
+	   fc_KeySchedule **aschedule, fc_InitializationVector **aivec,
+	   int *anlen)
 {
     struct rx_connection *tconn;
     rxkad_level level;
@@ -512,7 +604,6 @@ rxkad_PreparePacket(struct rx_securityClass *aobj, struct rx_call *acall,
     int len;
     int nlen = 0;
     int word;
-    afs_int32 code;
     afs_int32 *preSeq;
 
     tconn = rx_ConnectionOf(acall);
@@ -548,6 +639,10 @@ rxkad_PreparePacket(struct rx_securityClass *aobj, struct rx_call *acall,
 	schedule = (fc_KeySchedule *) tcp->keysched;
 	ivec = (fc_InitializationVector *) tcp->ivec;
     }
+    *alevel = level;
+    *aschedule = schedule;
+    *aivec = ivec;
+    *anlen = -1;
 
     /* compute upward compatible checksum */
     rx_SetPacketCksum(apacket, ComputeSum(apacket, schedule, preSeq));
@@ -580,15 +675,62 @@ rxkad_PreparePacket(struct rx_securityClass *aobj, struct rx_call *acall,
 	    rxi_RoundUpPacket(apacket,
 			      nlen - (len + rx_GetSecurityHeaderSize(tconn)));
 	}
-	code = rxkad_EncryptPacket(tconn, (const fc_KeySchedule *)schedule,  (const fc_InitializationVector *)ivec, nlen, apacket);
+	break;
+    }
+    *anlen = nlen;
+    return 0;
+}
+
+int
+rxkad_PreparePacket(struct rx_securityClass *aobj, struct rx_call *acall,
+		    struct rx_packet *apacket)
+{
+    rxkad_level level;
+    fc_KeySchedule *schedule;
+    fc_InitializationVector *ivec;
+    int nlen;
+    afs_int32 code;
+
+    code = SealPacket(aobj, acall, apacket, &level, &schedule, &ivec, &nlen);
+    if (code || nlen < 0)
+	return code;
+    if (level == rxkad_crypt) {
+	code = rxkad_EncryptPacket(rx_ConnectionOf(acall), (const fc_KeySchedule *)schedule,  (const fc_InitializationVector *)ivec, nlen, apacket);
 	if (code)
 	    return code;
-	break;
     }
     rx_SetDataSize(apacket, nlen);
     return 0;
 }
 
+/* either: encode a run of packets of the same call */
+
+int
+rxkad_PreparePackets(struct rx_securityClass *aobj, struct rx_call *acall,
+		     struct rx_packet **apackets, int npackets)
+{
+    rxkad_level level = rxkad_clear;
+    fc_KeySchedule *schedule = NULL;
+    fc_InitializationVector *ivec = NULL;
+    int i, nlen;
+    afs_int32 code;
+
+    for (i = 0; i < npackets; i++) {
+	code = SealPacket(aobj, acall, apackets[i], &level, &schedule, &ivec,
+			  &nlen);
+	if (code)
+	    return code;
+	if (nlen >= 0)
+	    rx_SetDataSize(apackets[i], nlen);
+    }
+    if (level != rxkad_crypt)
+	return 0;
+    return rxkad_EncryptPackets(rx_ConnectionOf(acall),
+				(const fc_KeySchedule *)schedule,
+				(const fc_InitializationVector *)ivec,
+				apackets, npackets);
+}
+
 /* either: return connection stats */
 
 int
@@ -23,6 +23,16 @@ extern afs_int32 rxkad_EncryptPacket(const struct rx_connection *conn,
 				     const fc_KeySchedule * schedule,
 				     const fc_InitializationVector * ivec,
 				     const int len, struct rx_packet *packet);
+extern afs_int32 rxkad_DecryptPackets(const struct rx_connection *conn,
+				      const fc_KeySchedule * schedule,
+				      const fc_InitializationVector * ivec,
+				      struct rx_packet **packets,
+				      int npackets);
+extern afs_int32 rxkad_EncryptPackets(const struct rx_connection *conn,
+				      const fc_KeySchedule * schedule,
+				      const fc_InitializationVector * ivec,
+				      struct rx_packet **packets,
+				      int npackets);
 
 
 /* fcrypt.c */
@@ -33,6 +43,11 @@ extern afs_int32 fc_ecb_encrypt(void * clear, void * cipher,
 extern afs_int32 fc_cbc_encrypt(void *input, void *output, afs_int32 length,
 				const fc_KeySchedule key, afs_uint32 * iv,
 				int encrypt);
+extern afs_int32 fc_cbc_encrypt2(void *input0, void *output0,
+				 afs_uint32 *iv0, void *input1,
+				 void *output1, afs_uint32 *iv1,
+				 afs_int32 length, const fc_KeySchedule key,
+				 int encrypt);
 
 /* rxkad_client.c */
 extern int rxkad_AllocCID(struct rx_securityClass *aobj,
@@ -71,9 +86,15 @@ extern int rxkad_DestroyConnection(struct rx_securityClass *aobj,
 extern int rxkad_CheckPacket(struct rx_securityClass *aobj,
 			     struct rx_call *acall,
 			     struct rx_packet *apacket);
+extern int rxkad_CheckPackets(struct rx_securityClass *aobj,
+			      struct rx_call *acall,
+			      struct rx_packet **apackets, int npackets);
 extern int rxkad_PreparePacket(struct rx_securityClass *aobj,
 			       struct rx_call *acall,
 			       struct rx_packet *apacket);
+extern int rxkad_PreparePackets(struct rx_securityClass *aobj,
+				struct rx_call *acall,
+				struct rx_packet **apackets, int npackets);
 extern int rxkad_GetStats(struct rx_securityClass *aobj,
 			  struct rx_connection *aconn,
 			  struct rx_securityObjectStats *astats);
@@ -56,8 +56,8 @@ static struct rx_securityOps rxkad_server_ops = {
     rxkad_DestroyConnection,
     rxkad_GetStats,
     rxkad_SetConfiguration,
-    0,				/* spare 2 */
-    0,				/* spare 3 */
+    rxkad_PreparePackets,	/* a run of packets at once */
+    rxkad_CheckPackets,
 };
 extern afs_uint32 rx_MyMaxSendSize;
 
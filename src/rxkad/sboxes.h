@@ -15,107 +15,197 @@
  * Initial revision
  *  */
 
-static const unsigned char sbox0[256] = {
-    0xea, 0x7f, 0xb2, 0x64, 0x9d, 0xb0, 0xd9, 0x11, 0xcd, 0x86, 0x86,
-    0x91, 0x0a, 0xb2, 0x93, 0x06, 0x0e, 0x06, 0xd2, 0x65, 0x73, 0xc5,
-    0x28, 0x60, 0xf2, 0x20, 0xb5, 0x38, 0x7e, 0xda, 0x9f, 0xe3, 0xd2,
-    0xcf, 0xc4, 0x3c, 0x61, 0xff, 0x4a, 0x4a, 0x35, 0xac, 0xaa, 0x5f,
-    0x2b, 0xbb, 0xbc, 0x53, 0x4e, 0x9d, 0x78, 0xa3, 0xdc, 0x09, 0x32,
-    0x10, 0xc6, 0x6f, 0x66, 0xd6, 0xab, 0xa9, 0xaf, 0xfd, 0x3b, 0x95,
-    0xe8, 0x34, 0x9a, 0x81, 0x72, 0x80, 0x9c, 0xf3, 0xec, 0xda, 0x9f,
-    0x26, 0x76, 0x15, 0x3e, 0x55, 0x4d, 0xde, 0x84, 0xee, 0xad, 0xc7,
-    0xf1, 0x6b, 0x3d, 0xd3, 0x04, 0x49, 0xaa, 0x24, 0x0b, 0x8a, 0x83,
-    0xba, 0xfa, 0x85, 0xa0, 0xa8, 0xb1, 0xd4, 0x01, 0xd8, 0x70, 0x64,
-    0xf0, 0x51, 0xd2, 0xc3, 0xa7, 0x75, 0x8c, 0xa5, 0x64, 0xef, 0x10,
-    0x4e, 0xb7, 0xc6, 0x61, 0x03, 0xeb, 0x44, 0x3d, 0xe5, 0xb3, 0x5b,
-    0xae, 0xd5, 0xad, 0x1d, 0xfa, 0x5a, 0x1e, 0x33, 0xab, 0x93, 0xa2,
-    0xb7, 0xe7, 0xa8, 0x45, 0xa4, 0xcd, 0x29, 0x63, 0x44, 0xb6, 0x69,
-    0x7e, 0x2e, 0x62, 0x03, 0xc8, 0xe0, 0x17, 0xbb, 0xc7, 0xf3, 0x3f,
-    0x36, 0xba, 0x71, 0x8e, 0x97, 0x65, 0x60, 0x69, 0xb6, 0xf6, 0xe6,
-    0x6e, 0xe0, 0x81, 0x59, 0xe8, 0xaf, 0xdd, 0x95, 0x22, 0x99, 0xfd,
-    0x63, 0x19, 0x74, 0x61, 0xb1, 0xb6, 0x5b, 0xae, 0x54, 0xb3, 0x70,
-    0xff, 0xc6, 0x3b, 0x3e, 0xc1, 0xd7, 0xe1, 0x0e, 0x76, 0xe5, 0x36,
-    0x4f, 0x59, 0xc7, 0x08, 0x6e, 0x82, 0xa6, 0x93, 0xc4, 0xaa, 0x26,
-    0x49, 0xe0, 0x21, 0x64, 0x07, 0x9f, 0x64, 0x81, 0x9c, 0xbf, 0xf9,
-    0xd1, 0x43, 0xf8, 0xb6, 0xb9, 0xf1, 0x24, 0x75, 0x03, 0xe4, 0xb0,
-    0x99, 0x46, 0x3d, 0xf5, 0xd1, 0x39, 0x72, 0x12, 0xf6, 0xba, 0x0c,
-    0x0d, 0x42, 0x2e
+/*
+ * Each entry holds the S-box output already moved to its byte position in
+ * the round function's result and rotated right by 5 bits, so that a round
+ * is just four table lookups xor'ed together.
+ */
+#define FC_ROR5(x)	((((afs_uint32)(x)) >> 5) | (((afs_uint32)(x)) << 27))
+#define S0(x)	FC_ROR5((x) << 8)
+#define S1(x)	FC_ROR5(x)
+#define S2(x)	FC_ROR5((x) << 16)
+#define S3(x)	FC_ROR5((x) << 24)
+
+static const afs_uint32 sbox0[256] = {
+    S0(0xea), S0(0x7f), S0(0xb2), S0(0x64), S0(0x9d), S0(0xb0),
+    S0(0xd9), S0(0x11), S0(0xcd), S0(0x86), S0(0x86), S0(0x91),
+    S0(0x0a), S0(0xb2), S0(0x93), S0(0x06), S0(0x0e), S0(0x06),
+    S0(0xd2), S0(0x65), S0(0x73), S0(0xc5), S0(0x28), S0(0x60),
+    S0(0xf2), S0(0x20), S0(0xb5), S0(0x38), S0(0x7e), S0(0xda),
+    S0(0x9f), S0(0xe3), S0(0xd2), S0(0xcf), S0(0xc4), S0(0x3c),
+    S0(0x61), S0(0xff), S0(0x4a), S0(0x4a), S0(0x35), S0(0xac),
+    S0(0xaa), S0(0x5f), S0(0x2b), S0(0xbb), S0(0xbc), S0(0x53),
+    S0(0x4e), S0(0x9d), S0(0x78), S0(0xa3), S0(0xdc), S0(0x09),
+    S0(0x32), S0(0x10), S0(0xc6), S0(0x6f), S0(0x66), S0(0xd6),
+    S0(0xab), S0(0xa9), S0(0xaf), S0(0xfd), S0(0x3b), S0(0x95),
+    S0(0xe8), S0(0x34), S0(0x9a), S0(0x81), S0(0x72), S0(0x80),
+    S0(0x9c), S0(0xf3), S0(0xec), S0(0xda), S0(0x9f), S0(0x26),
+    S0(0x76), S0(0x15), S0(0x3e), S0(0x55), S0(0x4d), S0(0xde),
+    S0(0x84), S0(0xee), S0(0xad), S0(0xc7), S0(0xf1), S0(0x6b),
+    S0(0x3d), S0(0xd3), S0(0x04), S0(0x49), S0(0xaa), S0(0x24),
+    S0(0x0b), S0(0x8a), S0(0x83), S0(0xba), S0(0xfa), S0(0x85),
+    S0(0xa0), S0(0xa8), S0(0xb1), S0(0xd4), S0(0x01), S0(0xd8),
+    S0(0x70), S0(0x64), S0(0xf0), S0(0x51), S0(0xd2), S0(0xc3),
+    S0(0xa7), S0(0x75), S0(0x8c), S0(0xa5), S0(0x64), S0(0xef),
+    S0(0x10), S0(0x4e), S0(0xb7), S0(0xc6), S0(0x61), S0(0x03),
+    S0(0xeb), S0(0x44), S0(0x3d), S0(0xe5), S0(0xb3), S0(0x5b),
+    S0(0xae), S0(0xd5), S0(0xad), S0(0x1d), S0(0xfa), S0(0x5a),
+    S0(0x1e), S0(0x33), S0(0xab), S0(0x93), S0(0xa2), S0(0xb7),
+    S0(0xe7), S0(0xa8), S0(0x45), S0(0xa4), S0(0xcd), S0(0x29),
+    S0(0x63), S0(0x44), S0(0xb6), S0(0x69), S0(0x7e), S0(0x2e),
+    S0(0x62), S0(0x03), S0(0xc8), S0(0xe0), S0(0x17), S0(0xbb),
+    S0(0xc7), S0(0xf3), S0(0x3f), S0(0x36), S0(0xba), S0(0x71),
+    S0(0x8e), S0(0x97), S0(0x65), S0(0x60), S0(0x69), S0(0xb6),
+    S0(0xf6), S0(0xe6), S0(0x6e), S0(0xe0), S0(0x81), S0(0x59),
+    S0(0xe8), S0(0xaf), S0(0xdd), S0(0x95), S0(0x22), S0(0x99),
+    S0(0xfd), S0(0x63), S0(0x19), S0(0x74), S0(0x61), S0(0xb1),
+    S0(0xb6), S0(0x5b), S0(0xae), S0(0x54), S0(0xb3), S0(0x70),
+    S0(0xff), S0(0xc6), S0(0x3b), S0(0x3e), S0(0xc1), S0(0xd7),
+    S0(0xe1), S0(0x0e), S0(0x76), S0(0xe5), S0(0x36), S0(0x4f),
+    S0(0x59), S0(0xc7), S0(0x08), S0(0x6e), S0(0x82), S0(0xa6),
+    S0(0x93), S0(0xc4), S0(0xaa), S0(0x26), S0(0x49), S0(0xe0),
+    S0(0x21), S0(0x64), S0(0x07), S0(0x9f), S0(0x64), S0(0x81),
+    S0(0x9c), S0(0xbf), S0(0xf9), S0(0xd1), S0(0x43), S0(0xf8),
+    S0(0xb6), S0(0xb9), S0(0xf1), S0(0x24), S0(0x75), S0(0x03),
+    S0(0xe4), S0(0xb0), S0(0x99), S0(0x46), S0(0x3d), S0(0xf5),
+    S0(0xd1), S0(0x39), S0(0x72), S0(0x12), S0(0xf6), S0(0xba),
+    S0(0x0c), S0(0x0d), S0(0x42), S0(0x2e)
 };
-static const unsigned char sbox1[256] = {
-    0x77, 0x14, 0xa6, 0xfe, 0xb2, 0x5e, 0x8c, 0x3e, 0x67, 0x6c, 0xa1,
-    0x0d, 0xc2, 0xa2, 0xc1, 0x85, 0x6c, 0x7b, 0x67, 0xc6, 0x23, 0xe3,
-    0xf2, 0x89, 0x50, 0x9c, 0x03, 0xb7, 0x73, 0xe6, 0xe1, 0x39, 0x31,
-    0x2c, 0x27, 0x9f, 0xa5, 0x69, 0x44, 0xd6, 0x23, 0x83, 0x98, 0x7d,
-    0x3c, 0xb4, 0x2d, 0x99, 0x1c, 0x1f, 0x8c, 0x20, 0x03, 0x7c, 0x5f,
-    0xad, 0xf4, 0xfa, 0x95, 0xca, 0x76, 0x44, 0xcd, 0xb6, 0xb8, 0xa1,
-    0xa1, 0xbe, 0x9e, 0x54, 0x8f, 0x0b, 0x16, 0x74, 0x31, 0x8a, 0x23,
-    0x17, 0x04, 0xfa, 0x79, 0x84, 0xb1, 0xf5, 0x13, 0xab, 0xb5, 0x2e,
-    0xaa, 0x0c, 0x60, 0x6b, 0x5b, 0xc4, 0x4b, 0xbc, 0xe2, 0xaf, 0x45,
-    0x73, 0xfa, 0xc9, 0x49, 0xcd, 0000, 0x92, 0x7d, 0x97, 0x7a, 0x18,
-    0x60, 0x3d, 0xcf, 0x5b, 0xde, 0xc6, 0xe2, 0xe6, 0xbb, 0x8b, 0x06,
-    0xda, 0x08, 0x15, 0x1b, 0x88, 0x6a, 0x17, 0x89, 0xd0, 0xa9, 0xc1,
-    0xc9, 0x70, 0x6b, 0xe5, 0x43, 0xf4, 0x68, 0xc8, 0xd3, 0x84, 0x28,
-    0x0a, 0x52, 0x66, 0xa3, 0xca, 0xf2, 0xe3, 0x7f, 0x7a, 0x31, 0xf7,
-    0x88, 0x94, 0x5e, 0x9c, 0x63, 0xd5, 0x24, 0x66, 0xfc, 0xb3, 0x57,
-    0x25, 0xbe, 0x89, 0x44, 0xc4, 0xe0, 0x8f, 0x23, 0x3c, 0x12, 0x52,
-    0xf5, 0x1e, 0xf4, 0xcb, 0x18, 0x33, 0x1f, 0xf8, 0x69, 0x10, 0x9d,
-    0xd3, 0xf7, 0x28, 0xf8, 0x30, 0x05, 0x5e, 0x32, 0xc0, 0xd5, 0x19,
-    0xbd, 0x45, 0x8b, 0x5b, 0xfd, 0xbc, 0xe2, 0x5c, 0xa9, 0x96, 0xef,
-    0x70, 0xcf, 0xc2, 0x2a, 0xb3, 0x61, 0xad, 0x80, 0x48, 0x81, 0xb7,
-    0x1d, 0x43, 0xd9, 0xd7, 0x45, 0xf0, 0xd8, 0x8a, 0x59, 0x7c, 0x57,
-    0xc1, 0x79, 0xc7, 0x34, 0xd6, 0x43, 0xdf, 0xe4, 0x78, 0x16, 0x06,
-    0xda, 0x92, 0x76, 0x51, 0xe1, 0xd4, 0x70, 0x03, 0xe0, 0x2f, 0x96,
-    0x91, 0x82, 0x80
+
+static const afs_uint32 sbox1[256] = {
+    S1(0x77), S1(0x14), S1(0xa6), S1(0xfe), S1(0xb2), S1(0x5e),
+    S1(0x8c), S1(0x3e), S1(0x67), S1(0x6c), S1(0xa1), S1(0x0d),
+    S1(0xc2), S1(0xa2), S1(0xc1), S1(0x85), S1(0x6c), S1(0x7b),
+    S1(0x67), S1(0xc6), S1(0x23), S1(0xe3), S1(0xf2), S1(0x89),
+    S1(0x50), S1(0x9c), S1(0x03), S1(0xb7), S1(0x73), S1(0xe6),
+    S1(0xe1), S1(0x39), S1(0x31), S1(0x2c), S1(0x27), S1(0x9f),
+    S1(0xa5), S1(0x69), S1(0x44), S1(0xd6), S1(0x23), S1(0x83),
+    S1(0x98), S1(0x7d), S1(0x3c), S1(0xb4), S1(0x2d), S1(0x99),
+    S1(0x1c), S1(0x1f), S1(0x8c), S1(0x20), S1(0x03), S1(0x7c),
+    S1(0x5f), S1(0xad), S1(0xf4), S1(0xfa), S1(0x95), S1(0xca),
+    S1(0x76), S1(0x44), S1(0xcd), S1(0xb6), S1(0xb8), S1(0xa1),
+    S1(0xa1), S1(0xbe), S1(0x9e), S1(0x54), S1(0x8f), S1(0x0b),
+    S1(0x16), S1(0x74), S1(0x31), S1(0x8a), S1(0x23), S1(0x17),
+    S1(0x04), S1(0xfa), S1(0x79), S1(0x84), S1(0xb1), S1(0xf5),
+    S1(0x13), S1(0xab), S1(0xb5), S1(0x2e), S1(0xaa), S1(0x0c),
+    S1(0x60), S1(0x6b), S1(0x5b), S1(0xc4), S1(0x4b), S1(0xbc),
+    S1(0xe2), S1(0xaf), S1(0x45), S1(0x73), S1(0xfa), S1(0xc9),
+    S1(0x49), S1(0xcd), S1(0x00), S1(0x92), S1(0x7d), S1(0x97),
+    S1(0x7a), S1(0x18), S1(0x60), S1(0x3d), S1(0xcf), S1(0x5b),
+    S1(0xde), S1(0xc6), S1(0xe2), S1(0xe6), S1(0xbb), S1(0x8b),
+    S1(0x06), S1(0xda), S1(0x08), S1(0x15), S1(0x1b), S1(0x88),
+    S1(0x6a), S1(0x17), S1(0x89), S1(0xd0), S1(0xa9), S1(0xc1),
+    S1(0xc9), S1(0x70), S1(0x6b), S1(0xe5), S1(0x43), S1(0xf4),
+    S1(0x68), S1(0xc8), S1(0xd3), S1(0x84), S1(0x28), S1(0x0a),
+    S1(0x52), S1(0x66), S1(0xa3), S1(0xca), S1(0xf2), S1(0xe3),
+    S1(0x7f), S1(0x7a), S1(0x31), S1(0xf7), S1(0x88), S1(0x94),
+    S1(0x5e), S1(0x9c), S1(0x63), S1(0xd5), S1(0x24), S1(0x66),
+    S1(0xfc), S1(0xb3), S1(0x57), S1(0x25), S1(0xbe), S1(0x89),
+    S1(0x44), S1(0xc4), S1(0xe0), S1(0x8f), S1(0x23), S1(0x3c),
+    S1(0x12), S1(0x52), S1(0xf5), S1(0x1e), S1(0xf4), S1(0xcb),
+    S1(0x18), S1(0x33), S1(0x1f), S1(0xf8), S1(0x69), S1(0x10),
+    S1(0x9d), S1(0xd3), S1(0xf7), S1(0x28), S1(0xf8), S1(0x30),
+    S1(0x05), S1(0x5e), S1(0x32), S1(0xc0), S1(0xd5), S1(0x19),
+    S1(0xbd), S1(0x45), S1(0x8b), S1(0x5b), S1(0xfd), S1(0xbc),
+    S1(0xe2), S1(0x5c), S1(0xa9), S1(0x96), S1(0xef), S1(0x70),
+    S1(0xcf), S1(0xc2), S1(0x2a), S1(0xb3), S1(0x61), S1(0xad),
+    S1(0x80), S1(0x48), S1(0x81), S1(0xb7), S1(0x1d), S1(0x43),
+    S1(0xd9), S1(0xd7), S1(0x45), S1(0xf0), S1(0xd8), S1(0x8a),
+    S1(0x59), S1(0x7c), S1(0x57), S1(0xc1), S1(0x79), S1(0xc7),
+    S1(0x34), S1(0xd6), S1(0x43), S1(0xdf), S1(0xe4), S1(0x78),
+    S1(0x16), S1(0x06), S1(0xda), S1(0x92), S1(0x76), S1(0x51),
+    S1(0xe1), S1(0xd4), S1(0x70), S1(0x03), S1(0xe0), S1(0x2f),
+    S1(0x96), S1(0x91), S1(0x82), S1(0x80)
 };
-static const unsigned char sbox2[256] = {
-    0xf0, 0x37, 0x24, 0x53, 0x2a, 0x03, 0x83, 0x86, 0xd1, 0xec, 0x50,
-    0xf0, 0x42, 0x78, 0x2f, 0x6d, 0xbf, 0x80, 0x87, 0x27, 0x95, 0xe2,
-    0xc5, 0x5d, 0xf9, 0x6f, 0xdb, 0xb4, 0x65, 0x6e, 0xe7, 0x24, 0xc8,
-    0x1a, 0xbb, 0x49, 0xb5, 0x0a, 0x7d, 0xb9, 0xe8, 0xdc, 0xb7, 0xd9,
-    0x45, 0x20, 0x1b, 0xce, 0x59, 0x9d, 0x6b, 0xbd, 0x0e, 0x8f, 0xa3,
-    0xa9, 0xbc, 0x74, 0xa6, 0xf6, 0x7f, 0x5f, 0xb1, 0x68, 0x84, 0xbc,
-    0xa9, 0xfd, 0x55, 0x50, 0xe9, 0xb6, 0x13, 0x5e, 0x07, 0xb8, 0x95,
-    0x02, 0xc0, 0xd0, 0x6a, 0x1a, 0x85, 0xbd, 0xb6, 0xfd, 0xfe, 0x17,
-    0x3f, 0x09, 0xa3, 0x8d, 0xfb, 0xed, 0xda, 0x1d, 0x6d, 0x1c, 0x6c,
-    0x01, 0x5a, 0xe5, 0x71, 0x3e, 0x8b, 0x6b, 0xbe, 0x29, 0xeb, 0x12,
-    0x19, 0x34, 0xcd, 0xb3, 0xbd, 0x35, 0xea, 0x4b, 0xd5, 0xae, 0x2a,
-    0x79, 0x5a, 0xa5, 0x32, 0x12, 0x7b, 0xdc, 0x2c, 0xd0, 0x22, 0x4b,
-    0xb1, 0x85, 0x59, 0x80, 0xc0, 0x30, 0x9f, 0x73, 0xd3, 0x14, 0x48,
-    0x40, 0x07, 0x2d, 0x8f, 0x80, 0x0f, 0xce, 0x0b, 0x5e, 0xb7, 0x5e,
-    0xac, 0x24, 0x94, 0x4a, 0x18, 0x15, 0x05, 0xe8, 0x02, 0x77, 0xa9,
-    0xc7, 0x40, 0x45, 0x89, 0xd1, 0xea, 0xde, 0x0c, 0x79, 0x2a, 0x99,
-    0x6c, 0x3e, 0x95, 0xdd, 0x8c, 0x7d, 0xad, 0x6f, 0xdc, 0xff, 0xfd,
-    0x62, 0x47, 0xb3, 0x21, 0x8a, 0xec, 0x8e, 0x19, 0x18, 0xb4, 0x6e,
-    0x3d, 0xfd, 0x74, 0x54, 0x1e, 0x04, 0x85, 0xd8, 0xbc, 0x1f, 0x56,
-    0xe7, 0x3a, 0x56, 0x67, 0xd6, 0xc8, 0xa5, 0xf3, 0x8e, 0xde, 0xae,
-    0x37, 0x49, 0xb7, 0xfa, 0xc8, 0xf4, 0x1f, 0xe0, 0x2a, 0x9b, 0x15,
-    0xd1, 0x34, 0x0e, 0xb5, 0xe0, 0x44, 0x78, 0x84, 0x59, 0x56, 0x68,
-    0x77, 0xa5, 0x14, 0x06, 0xf5, 0x2f, 0x8c, 0x8a, 0x73, 0x80, 0x76,
-    0xb4, 0x10, 0x86
+
+static const afs_uint32 sbox2[256] = {
+    S2(0xf0), S2(0x37), S2(0x24), S2(0x53), S2(0x2a), S2(0x03),
+    S2(0x83), S2(0x86), S2(0xd1), S2(0xec), S2(0x50), S2(0xf0),
+    S2(0x42), S2(0x78), S2(0x2f), S2(0x6d), S2(0xbf), S2(0x80),
+    S2(0x87), S2(0x27), S2(0x95), S2(0xe2), S2(0xc5), S2(0x5d),
+    S2(0xf9), S2(0x6f), S2(0xdb), S2(0xb4), S2(0x65), S2(0x6e),
+    S2(0xe7), S2(0x24), S2(0xc8), S2(0x1a), S2(0xbb), S2(0x49),
+    S2(0xb5), S2(0x0a), S2(0x7d), S2(0xb9), S2(0xe8), S2(0xdc),
+    S2(0xb7), S2(0xd9), S2(0x45), S2(0x20), S2(0x1b), S2(0xce),
+    S2(0x59), S2(0x9d), S2(0x6b), S2(0xbd), S2(0x0e), S2(0x8f),
+    S2(0xa3), S2(0xa9), S2(0xbc), S2(0x74), S2(0xa6), S2(0xf6),
+    S2(0x7f), S2(0x5f), S2(0xb1), S2(0x68), S2(0x84), S2(0xbc),
+    S2(0xa9), S2(0xfd), S2(0x55), S2(0x50), S2(0xe9), S2(0xb6),
+    S2(0x13), S2(0x5e), S2(0x07), S2(0xb8), S2(0x95), S2(0x02),
+    S2(0xc0), S2(0xd0), S2(0x6a), S2(0x1a), S2(0x85), S2(0xbd),
+    S2(0xb6), S2(0xfd), S2(0xfe), S2(0x17), S2(0x3f), S2(0x09),
+    S2(0xa3), S2(0x8d), S2(0xfb), S2(0xed), S2(0xda), S2(0x1d),
+    S2(0x6d), S2(0x1c), S2(0x6c), S2(0x01), S2(0x5a), S2(0xe5),
+    S2(0x71), S2(0x3e), S2(0x8b), S2(0x6b), S2(0xbe), S2(0x29),
+    S2(0xeb), S2(0x12), S2(0x19), S2(0x34), S2(0xcd), S2(0xb3),
+    S2(0xbd), S2(0x35), S2(0xea), S2(0x4b), S2(0xd5), S2(0xae),
+    S2(0x2a), S2(0x79), S2(0x5a), S2(0xa5), S2(0x32), S2(0x12),
+    S2(0x7b), S2(0xdc), S2(0x2c), S2(0xd0), S2(0x22), S2(0x4b),
+    S2(0xb1), S2(0x85), S2(0x59), S2(0x80), S2(0xc0), S2(0x30),
+    S2(0x9f), S2(0x73), S2(0xd3), S2(0x14), S2(0x48), S2(0x40),
+    S2(0x07), S2(0x2d), S2(0x8f), S2(0x80), S2(0x0f), S2(0xce),
+    S2(0x0b), S2(0x5e), S2(0xb7), S2(0x5e), S2(0xac), S2(0x24),
+    S2(0x94), S2(0x4a), S2(0x18), S2(0x15), S2(0x05), S2(0xe8),
+    S2(0x02), S2(0x77), S2(0xa9), S2(0xc7), S2(0x40), S2(0x45),
+    S2(0x89), S2(0xd1), S2(0xea), S2(0xde), S2(0x0c), S2(0x79),
+    S2(0x2a), S2(0x99), S2(0x6c), S2(0x3e), S2(0x95), S2(0xdd),
+    S2(0x8c), S2(0x7d), S2(0xad), S2(0x6f), S2(0xdc), S2(0xff),
+    S2(0xfd), S2(0x62), S2(0x47), S2(0xb3), S2(0x21), S2(0x8a),
+    S2(0xec), S2(0x8e), S2(0x19), S2(0x18), S2(0xb4), S2(0x6e),
+    S2(0x3d), S2(0xfd), S2(0x74), S2(0x54), S2(0x1e), S2(0x04),
+    S2(0x85), S2(0xd8), S2(0xbc), S2(0x1f), S2(0x56), S2(0xe7),
+    S2(0x3a), S2(0x56), S2(0x67), S2(0xd6), S2(0xc8), S2(0xa5),
+    S2(0xf3), S2(0x8e), S2(0xde), S2(0xae), S2(0x37), S2(0x49),
+    S2(0xb7), S2(0xfa), S2(0xc8), S2(0xf4), S2(0x1f), S2(0xe0),
+    S2(0x2a), S2(0x9b), S2(0x15), S2(0xd1), S2(0x34), S2(0x0e),
+    S2(0xb5), S2(0xe0), S2(0x44), S2(0x78), S2(0x84), S2(0x59),
+    S2(0x56), S2(0x68), S2(0x77), S2(0xa5), S2(0x14), S2(0x06),
+    S2(0xf5), S2(0x2f), S2(0x8c), S2(0x8a), S2(0x73), S2(0x80),
+    S2(0x76), S2(0xb4), S2(0x10), S2(0x86)
 };
-static const unsigned char sbox3[256] = {
-    0xa9, 0x2a, 0x48, 0x51, 0x84, 0x7e, 0x49, 0xe2, 0xb5, 0xb7, 0x42,
-    0x33, 0x7d, 0x5d, 0xa6, 0x12, 0x44, 0x48, 0x6d, 0x28, 0xaa, 0x20,
-    0x6d, 0x57, 0xd6, 0x6b, 0x5d, 0x72, 0xf0, 0x92, 0x5a, 0x1b, 0x53,
-    0x80, 0x24, 0x70, 0x9a, 0xcc, 0xa7, 0x66, 0xa1, 0x01, 0xa5, 0x41,
-    0x97, 0x41, 0x31, 0x82, 0xf1, 0x14, 0xcf, 0x53, 0x0d, 0xa0, 0x10,
-    0xcc, 0x2a, 0x7d, 0xd2, 0xbf, 0x4b, 0x1a, 0xdb, 0x16, 0x47, 0xf6,
-    0x51, 0x36, 0xed, 0xf3, 0xb9, 0x1a, 0xa7, 0xdf, 0x29, 0x43, 0x01,
-    0x54, 0x70, 0xa4, 0xbf, 0xd4, 0x0b, 0x53, 0x44, 0x60, 0x9e, 0x23,
-    0xa1, 0x18, 0x68, 0x4f, 0xf0, 0x2f, 0x82, 0xc2, 0x2a, 0x41, 0xb2,
-    0x42, 0x0c, 0xed, 0x0c, 0x1d, 0x13, 0x3a, 0x3c, 0x6e, 0x35, 0xdc,
-    0x60, 0x65, 0x85, 0xe9, 0x64, 0x02, 0x9a, 0x3f, 0x9f, 0x87, 0x96,
-    0xdf, 0xbe, 0xf2, 0xcb, 0xe5, 0x6c, 0xd4, 0x5a, 0x83, 0xbf, 0x92,
-    0x1b, 0x94, 0000, 0x42, 0xcf, 0x4b, 0000, 0x75, 0xba, 0x8f, 0x76,
-    0x5f, 0x5d, 0x3a, 0x4d, 0x09, 0x12, 0x08, 0x38, 0x95, 0x17, 0xe4,
-    0x01, 0x1d, 0x4c, 0xa9, 0xcc, 0x85, 0x82, 0x4c, 0x9d, 0x2f, 0x3b,
-    0x66, 0xa1, 0x34, 0x10, 0xcd, 0x59, 0x89, 0xa5, 0x31, 0xcf, 0x05,
-    0xc8, 0x84, 0xfa, 0xc7, 0xba, 0x4e, 0x8b, 0x1a, 0x19, 0xf1, 0xa1,
-    0x3b, 0x18, 0x12, 0x17, 0xb0, 0x98, 0x8d, 0x0b, 0x23, 0xc3, 0x3a,
-    0x2d, 0x20, 0xdf, 0x13, 0xa0, 0xa8, 0x4c, 0x0d, 0x6c, 0x2f, 0x47,
-    0x13, 0x13, 0x52, 0x1f, 0x2d, 0xf5, 0x79, 0x3d, 0xa2, 0x54, 0xbd,
-    0x69, 0xc8, 0x6b, 0xf3, 0x05, 0x28, 0xf1, 0x16, 0x46, 0x40, 0xb0,
-    0x11, 0xd3, 0xb7, 0x95, 0x49, 0xcf, 0xc3, 0x1d, 0x8f, 0xd8, 0xe1,
-    0x73, 0xdb, 0xad, 0xc8, 0xc9, 0xa9, 0xa1, 0xc2, 0xc5, 0xe3, 0xba,
-    0xfc, 0x0e, 0x25
+
+static const afs_uint32 sbox3[256] = {
+    S3(0xa9), S3(0x2a), S3(0x48), S3(0x51), S3(0x84), S3(0x7e),
+    S3(0x49), S3(0xe2), S3(0xb5), S3(0xb7), S3(0x42), S3(0x33),
+    S3(0x7d), S3(0x5d), S3(0xa6), S3(0x12), S3(0x44), S3(0x48),
+    S3(0x6d), S3(0x28), S3(0xaa), S3(0x20), S3(0x6d), S3(0x57),
+    S3(0xd6), S3(0x6b), S3(0x5d), S3(0x72), S3(0xf0), S3(0x92),
+    S3(0x5a), S3(0x1b), S3(0x53), S3(0x80), S3(0x24), S3(0x70),
+    S3(0x9a), S3(0xcc), S3(0xa7), S3(0x66), S3(0xa1), S3(0x01),
+    S3(0xa5), S3(0x41), S3(0x97), S3(0x41), S3(0x31), S3(0x82),
+    S3(0xf1), S3(0x14), S3(0xcf), S3(0x53), S3(0x0d), S3(0xa0),
+    S3(0x10), S3(0xcc), S3(0x2a), S3(0x7d), S3(0xd2), S3(0xbf),
+    S3(0x4b), S3(0x1a), S3(0xdb), S3(0x16), S3(0x47), S3(0xf6),
+    S3(0x51), S3(0x36), S3(0xed), S3(0xf3), S3(0xb9), S3(0x1a),
+    S3(0xa7), S3(0xdf), S3(0x29), S3(0x43), S3(0x01), S3(0x54),
+    S3(0x70), S3(0xa4), S3(0xbf), S3(0xd4), S3(0x0b), S3(0x53),
+    S3(0x44), S3(0x60), S3(0x9e), S3(0x23), S3(0xa1), S3(0x18),
+    S3(0x68), S3(0x4f), S3(0xf0), S3(0x2f), S3(0x82), S3(0xc2),
+    S3(0x2a), S3(0x41), S3(0xb2), S3(0x42), S3(0x0c), S3(0xed),
+    S3(0x0c), S3(0x1d), S3(0x13), S3(0x3a), S3(0x3c), S3(0x6e),
+    S3(0x35), S3(0xdc), S3(0x60), S3(0x65), S3(0x85), S3(0xe9),
+    S3(0x64), S3(0x02), S3(0x9a), S3(0x3f), S3(0x9f), S3(0x87),
+    S3(0x96), S3(0xdf), S3(0xbe), S3(0xf2), S3(0xcb), S3(0xe5),
+    S3(0x6c), S3(0xd4), S3(0x5a), S3(0x83), S3(0xbf), S3(0x92),
+    S3(0x1b), S3(0x94), S3(0x00), S3(0x42), S3(0xcf), S3(0x4b),
+    S3(0x00), S3(0x75), S3(0xba), S3(0x8f), S3(0x76), S3(0x5f),
+    S3(0x5d), S3(0x3a), S3(0x4d), S3(0x09), S3(0x12), S3(0x08),
+    S3(0x38), S3(0x95), S3(0x17), S3(0xe4), S3(0x01), S3(0x1d),
+    S3(0x4c), S3(0xa9), S3(0xcc), S3(0x85), S3(0x82), S3(0x4c),
+    S3(0x9d), S3(0x2f), S3(0x3b), S3(0x66), S3(0xa1), S3(0x34),
+    S3(0x10), S3(0xcd), S3(0x59), S3(0x89), S3(0xa5), S3(0x31),
+    S3(0xcf), S3(0x05), S3(0xc8), S3(0x84), S3(0xfa), S3(0xc7),
+    S3(0xba), S3(0x4e), S3(0x8b), S3(0x1a), S3(0x19), S3(0xf1),
+    S3(0xa1), S3(0x3b), S3(0x18), S3(0x12), S3(0x17), S3(0xb0),
+    S3(0x98), S3(0x8d), S3(0x0b), S3(0x23), S3(0xc3), S3(0x3a),
+    S3(0x2d), S3(0x20), S3(0xdf), S3(0x13), S3(0xa0), S3(0xa8),
+    S3(0x4c), S3(0x0d), S3(0x6c), S3(0x2f), S3(0x47), S3(0x13),
+    S3(0x13), S3(0x52), S3(0x1f), S3(0x2d), S3(0xf5), S3(0x79),
+    S3(0x3d), S3(0xa2), S3(0x54), S3(0xbd), S3(0x69), S3(0xc8),
+    S3(0x6b), S3(0xf3), S3(0x05), S3(0x28), S3(0xf1), S3(0x16),
+    S3(0x46), S3(0x40), S3(0xb0), S3(0x11), S3(0xd3), S3(0xb7),
+    S3(0x95), S3(0x49), S3(0xcf), S3(0xc3), S3(0x1d), S3(0x8f),
+    S3(0xd8), S3(0xe1), S3(0x73), S3(0xdb), S3(0xad), S3(0xc8),
+    S3(0xc9), S3(0xa9), S3(0xa1), S3(0xc2), S3(0xc5), S3(0xe3),
+    S3(0xba), S3(0xfc), S3(0x0e), S3(0x25)
 };
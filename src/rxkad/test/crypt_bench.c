@@ -0,0 +1,189 @@
+/*
+ * Copyright 2000, International Business Machines Corporation and others.
+ * All Rights Reserved.
+ *
+ * This software has been released under the terms of the IBM Public
+ * License.  For details, see the LICENSE file in the top-level source
+ * directory or online at http://www.openafs.org/dl/license10.html
+ */
+
+/* rxkad crypto throughput: fcrypt one packet at a time, as rxkad_EncryptPacket
+ * does, against two packets at a time with fc_cbc_encrypt2, as the batched
+ * rxkad_EncryptPackets does.  The results of both are checked against each
+ * other and against the known answers from fc_test before anything is timed.
+ *
+ * usage: crypt_bench [packets [length]]
+ */
+
+#include <afsconfig.h>
+#include <afs/param.h>
+
+#include <roken.h>
+
+#include <rx/rx.h>
+#include <rx/rx_packet.h>
+#include <rx/rxkad.h>
+
+static const char the_quick[] =
+    "The quick brown fox jumps over the lazy dogs.\0\0";
+
+static const unsigned char key1[8] =
+    { 0xf0, 0xe1, 0xd2, 0xc3, 0xb4, 0xa5, 0x96, 0x87 };
+static const unsigned char ciph1[] = {
+    0x00, 0xf0, 0xe, 0x11, 0x75, 0xe6, 0x23, 0x82, 0xee, 0xac, 0x98, 0x62,
+    0x44, 0x51, 0xe4, 0x84, 0xc3, 0x59, 0xd8, 0xaa, 0x64, 0x60, 0xae, 0xf7,
+    0xd2, 0xd9, 0x13, 0x79, 0x72, 0xa3, 0x45, 0x03, 0x23, 0xb5, 0x62, 0xd7,
+    0xc, 0xf5, 0x27, 0xd1, 0xf8, 0x91, 0x3c, 0xac, 0x44, 0x22, 0x92, 0xef
+};
+
+static const unsigned char key2[8] =
+    { 0xfe, 0xdc, 0xba, 0x98, 0x76, 0x54, 0x32, 0x10 };
+static const unsigned char ciph2[] = {
+    0xca, 0x90, 0xf5, 0x9d, 0xcb, 0xd4, 0xd2, 0x3c, 0x01, 0x88, 0x7f, 0x3e,
+    0x31, 0x6e, 0x62, 0x9d, 0xd8, 0xe0, 0x57, 0xa3, 0x06, 0x3a, 0x42, 0x58,
+    0x2a, 0x28, 0xfe, 0x72, 0x52, 0x2f, 0xdd, 0xe0, 0x19, 0x89, 0x09, 0x1c,
+    0x2a, 0x8e, 0x8c, 0x94, 0xfc, 0xc7, 0x68, 0xe4, 0x88, 0xaa, 0xde, 0x0f
+};
+
+static int
+KnownAnswer(const unsigned char *key, const unsigned char *iv,
+	    const unsigned char *answer)
+{
+    fc_KeySchedule sched;
+    char ciph[sizeof(the_quick)], ciph2[sizeof(the_quick)];
+    char clear[sizeof(the_quick)], clear2[sizeof(the_quick)];
+    afs_uint32 xor[2], xor2[2];
+    int fail = 0;
+
+    fc_keysched((struct ktc_encryptionKey *)key, sched);
+
+    memcpy(xor, iv, sizeof(xor));
+    fc_cbc_encrypt((void *)the_quick, ciph, sizeof(the_quick), sched, xor,
+		   ENCRYPT);
+    if (memcmp(ciph, answer, sizeof(ciph)) != 0) {
+	fprintf(stderr, "fc_cbc_encrypt encrypt FAILED\n");
+	fail++;
+    }
+    memcpy(xor, iv, sizeof(xor));
+    fc_cbc_encrypt(ciph, clear, sizeof(ciph), sched, xor, DECRYPT);
+    if (memcmp(clear, the_quick, sizeof(clear)) != 0) {
+	fprintf(stderr, "fc_cbc_encrypt decrypt FAILED\n");
+	fail++;
+    }
+
+    memcpy(xor, iv, sizeof(xor));
+    memcpy(xor2, iv, sizeof(xor2));
+    fc_cbc_encrypt2((void *)the_quick, ciph, xor, (void *)the_quick, ciph2,
+		    xor2, sizeof(the_quick), sched, ENCRYPT);
+    if (memcmp(ciph, answer, sizeof(ciph)) != 0
+	|| memcmp(ciph2, answer, sizeof(ciph2)) != 0) {
+	fprintf(stderr, "fc_cbc_encrypt2 encrypt FAILED\n");
+	fail++;
+    }
+    memcpy(xor, iv, sizeof(xor));
+    memcpy(xor2, iv, sizeof(xor2));
+    fc_cbc_encrypt2(ciph, clear, xor, ciph2, clear2, xor2, sizeof(ciph),
+		    sched, DECRYPT);
+    if (memcmp(clear, the_quick, sizeof(clear)) != 0
+	|| memcmp(clear2, the_quick, sizeof(clear2)) != 0) {
+	fprintf(stderr, "fc_cbc_encrypt2 decrypt FAILED\n");
+	fail++;
+    }
+    return fail;
+}
+
+static double
+Elapsed(struct timeval *start, struct timeval *stop)
+{
+    return stop->tv_sec - start->tv_sec
+	+ (stop->tv_usec - start->tv_usec) / 1e6;
+}
+
+int
+main(int argc, char **argv)
+{
+    fc_KeySchedule sched;
+    afs_uint32 iv[2], xor[2], xor2[2];
+    struct timeval start, stop;
+    char *buf, *check;
+    int npackets = 20000, length = RX_JUMBOBUFFERSIZE;
+    int fail = 0;
+    int i, encrypt;
+    double t;
+
+    if (argc > 1)
+	npackets = atoi(argv[1]) & ~1;
+    if (argc > 2)
+	length = atoi(argv[2]);
+    length &= ~(ENCRYPTIONBLOCKSIZE - 1);
+    if (npackets <= 0 || length <= 0) {
+	fprintf(stderr, "usage: %s [packets [length]]\n", argv[0]);
+	exit(1);
+    }
+
+    fail += KnownAnswer(key1, key2, ciph1);
+    fail += KnownAnswer(key2, key1, ciph2);
+
+    buf = malloc(2 * length);
+    check = malloc(2 * length);
+    if (buf == NULL || check == NULL) {
+	fprintf(stderr, "out of memory\n");
+	exit(1);
+    }
+    for (i = 0; i < 2 * length; i++)
+	buf[i] = i * 7;
+    fc_keysched((struct ktc_encryptionKey *)key1, sched);
+    memcpy(iv, key2, sizeof(iv));
+
+    /* The interleaved streams must come out just as they would singly. */
+    memcpy(check, buf, 2 * length);
+    memcpy(xor, iv, sizeof(xor));
+    fc_cbc_encrypt(check, check, length, sched, xor, ENCRYPT);
+    memcpy(xor, iv, sizeof(xor));
+    fc_cbc_encrypt(check + length, check + length, length, sched, xor,
+		   ENCRYPT);
+    memcpy(xor, iv, sizeof(xor));
+    memcpy(xor2, iv, sizeof(xor2));
+    fc_cbc_encrypt2(buf, buf, xor, buf + length, buf + length, xor2, length,
+		    sched, ENCRYPT);
+    if (memcmp(buf, check, 2 * length) != 0) {
+	fprintf(stderr, "fc_cbc_encrypt2 does not match fc_cbc_encrypt\n");
+	fail++;
+    }
+    if (fail)
+	exit(fail);
+
+    printf("%d packets of %d bytes\n", npackets, length);
+    for (encrypt = ENCRYPT; encrypt >= DECRYPT; encrypt--) {
+	gettimeofday(&start, NULL);
+	for (i = 0; i < npackets; i += 2) {
+	    memcpy(xor, iv, sizeof(xor));
+	    fc_cbc_encrypt(buf, buf, length, sched, xor, encrypt);
+	    memcpy(xor, iv, sizeof(xor));
+	    fc_cbc_encrypt(buf + length, buf + length, length, sched, xor,
+			   encrypt);
+	}
+	gettimeofday(&stop, NULL);
+	t = Elapsed(&start, &stop);
+	printf("%s one at a time: %8.1f MB/s\n",
+	       encrypt ? "encrypt" : "decrypt",
+	       (double)npackets * length / t / 1e6);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < npackets; i += 2) {
+	    memcpy(xor, iv, sizeof(xor));
+	    memcpy(xor2, iv, sizeof(xor2));
+	    fc_cbc_encrypt2(buf, buf, xor, buf + length, buf + length, xor2,
+			    length, sched, encrypt);
+	}
+	gettimeofday(&stop, NULL);
+	t = Elapsed(&start, &stop);
+	printf("%s two at a time: %8.1f MB/s\n",
+	       encrypt ? "encrypt" : "decrypt",
+	       (double)npackets * length / t / 1e6);
+    }
+
+    free(buf);
+    free(check);
+    return 0;
+}
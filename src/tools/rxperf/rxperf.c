@@ -46,6 +46,9 @@ nn * We are using getopt since we want it to be possible to link to
 #ifdef HAVE_SYS_FILE_H
 #include <sys/file.h>
 #endif
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
 
 #include <assert.h>
 
@@ -105,14 +108,51 @@ sigint(int foo)
 static struct timeval timer_start;
 static struct timeval timer_stop;
 static int timer_check = 0;
+#ifndef AFS_NT40_ENV
+static struct rusage rusage_start;
+#endif
 
 static void
 start_timer(void)
 {
     timer_check++;
+#ifndef AFS_NT40_ENV
+    getrusage(RUSAGE_SELF, &rusage_start);
+#endif
     gettimeofday(&timer_start, NULL);
 }
 
+#ifndef AFS_NT40_ENV
+static long long
+tv2usec(struct timeval *tv)
+{
+    return (long long)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+/*
+ * Print the CPU time used since start_timer, and how much of it was
+ * spent for each gigabyte moved, so that transfer settings can be compared.
+ */
+
+static void
+print_cpu(long long bytes)
+{
+    struct rusage rusage_stop;
+    long long user_l, sys_l;
+
+    getrusage(RUSAGE_SELF, &rusage_stop);
+    user_l = tv2usec(&rusage_stop.ru_utime) - tv2usec(&rusage_start.ru_utime);
+    sys_l = tv2usec(&rusage_stop.ru_stime) - tv2usec(&rusage_start.ru_stime);
+
+    printf("cpu:\t%8llu msec user\t%8llu msec sys", user_l / 1000,
+	   sys_l / 1000);
+    if (bytes > 0)
+	printf("\t[%.4g msec/GB]",
+	       (user_l + sys_l) / 1000.0 * (1024.0 * 1024 * 1024) / bytes);
+    printf("\n");
+}
+#endif
+
 /*
  *
  */
@@ -137,6 +177,9 @@ end_and_print_timer(char *str, long long bytes)
         printf("\t[%.4g Mbit/s]\n", kbps/1000.0);
     else
         printf("\t[%.4g kbit/s]\n", kbps);
+#ifndef AFS_NT40_ENV
+    print_cpu(bytes);
+#endif
 }
 
 /*
@@ -406,8 +449,8 @@ rxperf_ExecuteRequest(struct rx_call *call)
 
 static void
 do_server(short port, int nojumbo, int maxmtu, int maxwsize, int minpeertimeout,
-          int udpbufsz, int nostats, int hotthread,
-          int minprocs, int maxprocs)
+          int udpbufsz, int nostats, int hotthread, int iobatch,
+          int listeners, int minprocs, int maxprocs, int ccalg)
 {
     struct rx_service *service;
     struct rx_securityClass *secureobj;
@@ -429,6 +472,9 @@ do_server(short port, int nojumbo, int maxmtu, int maxwsize, int minpeertimeout,
 
     rx_SetUdpBufSize(udpbufsz);
 
+    if (listeners > 1 && rx_SetListenerSockets(listeners))
+	errx(1, "multiple listener sockets are not supported");
+
     ret = rx_Init(htons(port));
     if (ret)
 	errx(1, "rx_Init failed");
@@ -447,6 +493,8 @@ do_server(short port, int nojumbo, int maxmtu, int maxwsize, int minpeertimeout,
     if (minpeertimeout)
         rx_SetMinPeerTimeout(minpeertimeout);
 
+    if (iobatch && rx_SetIOBatchSize(iobatch))
+	errx(1, "batched I/O is not supported");
 
     get_sec(1, &secureobj, &secureindex);
 
@@ -461,6 +509,9 @@ do_server(short port, int nojumbo, int maxmtu, int maxwsize, int minpeertimeout,
 
     rx_SetCheckReach(service, 1);
 
+    if (ccalg)
+	rx_SetServiceCongestionControl(service, ccalg);
+
     rx_StartServer(1);
 
     abort();
@@ -684,7 +735,8 @@ static void
 do_client(const char *server, short port, char *filename, afs_int32 command,
 	  afs_int32 times, afs_int32 bytes, afs_int32 sendbytes, afs_int32 readbytes,
           int dumpstats, int nojumbo, int maxmtu, int maxwsize, int minpeertimeout,
-          int udpbufsz, int nostats, int hotthread, int threads)
+          int udpbufsz, int nostats, int hotthread, int iobatch, int threads,
+          int ccalg)
 {
     struct rx_connection *conn;
     afs_uint32 addr;
@@ -738,6 +790,8 @@ do_client(const char *server, short port, char *filename, afs_int32 command,
     if (minpeertimeout)
         rx_SetMinPeerTimeout(minpeertimeout);
 
+    if (iobatch && rx_SetIOBatchSize(iobatch))
+	errx(1, "batched I/O is not supported");
 
     get_sec(0, &secureobj, &secureindex);
 
@@ -764,6 +818,9 @@ do_client(const char *server, short port, char *filename, afs_int32 command,
     if (conn == NULL)
 	errx(1, "failed to contact server");
 
+    if (ccalg)
+	rx_SetPeerCongestionControl(conn, ccalg);
+
 #ifdef AFS_PTHREAD_ENV
     pthread_attr_init(&tattr);
     pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_JOINABLE);
@@ -842,7 +899,12 @@ usage(void)
 	    "%s: usage:	common option to the client "
 	    "-w <write-bytes> -r <read-bytes> -T times -p port -s server -D\n",
 	    getprogname());
-    fprintf(stderr, "usage: %s server -p port\n", getprogname());
+    fprintf(stderr,
+	    "%s: usage:	common option to the client and server "
+	    "-B <datagrams per system call> -C <classic|cubic|delay>\n",
+	    getprogname());
+    fprintf(stderr, "usage: %s server -p port -L <listener sockets>\n",
+	    getprogname());
 #undef COMMMON
     exit(1);
 }
@@ -866,11 +928,29 @@ rxperf_server(int argc, char **argv)
     int maxprocs = 20;
     int maxwsize = 0;
     int minpeertimeout = 0;
+    int iobatch = 0;
+    int listeners = 1;
+    int ccalg = 0;
     char *ptr;
     int ch;
 
-    while ((ch = getopt(argc, argv, "r:d:p:P:w:W:HNjm:u:4:s:S:V")) != -1) {
+    while ((ch = getopt(argc, argv, "r:d:p:P:w:W:B:C:L:HNjm:u:4:s:S:V")) != -1) {
 	switch (ch) {
+	case 'B':
+	    iobatch = strtol(optarg, &ptr, 0);
+	    if (ptr && *ptr != '\0')
+		errx(1, "can't resolve I/O batch size (datagrams)");
+	    break;
+	case 'C':
+	    ccalg = rx_CongestionControlByName(optarg);
+	    if (ccalg < 0)
+		errx(1, "unknown congestion control algorithm %s", optarg);
+	    break;
+	case 'L':
+	    listeners = strtol(optarg, &ptr, 0);
+	    if (ptr && *ptr != '\0')
+		errx(1, "can't resolve number of listener sockets");
+	    break;
 	case 'd':
 #ifdef RXDEBUG
 	    rx_debugFile = fopen(optarg, "w");
@@ -955,7 +1035,8 @@ rxperf_server(int argc, char **argv)
 	usage();
 
     do_server(port, nojumbo, maxmtu, maxwsize, minpeertimeout, udpbufsz,
-              nostats, hotthreads, minprocs, maxprocs);
+              nostats, hotthreads, iobatch, listeners, minprocs, maxprocs,
+              ccalg);
 
     return 0;
 }
@@ -984,13 +1065,25 @@ rxperf_client(int argc, char **argv)
     int udpbufsz = 64 * 1024;
     int maxwsize = 0;
     int minpeertimeout = 0;
+    int iobatch = 0;
+    int ccalg = 0;
     char *ptr;
     int ch;
 
     cmd = RX_PERF_UNKNOWN;
 
-    while ((ch = getopt(argc, argv, "T:S:R:b:c:d:p:P:r:s:w:W:f:HDNjm:u:4:t:V")) != -1) {
+    while ((ch = getopt(argc, argv, "T:S:R:b:B:C:c:d:p:P:r:s:w:W:f:HDNjm:u:4:t:V")) != -1) {
 	switch (ch) {
+	case 'B':
+	    iobatch = strtol(optarg, &ptr, 0);
+	    if (ptr && *ptr != '\0')
+		errx(1, "can't resolve I/O batch size (datagrams)");
+	    break;
+	case 'C':
+	    ccalg = rx_CongestionControlByName(optarg);
+	    if (ccalg < 0)
+		errx(1, "unknown congestion control algorithm %s", optarg);
+	    break;
 	case 'b':
 	    bytes = strtol(optarg, &ptr, 0);
 	    if (ptr && *ptr != '\0')
@@ -1129,7 +1222,7 @@ rxperf_client(int argc, char **argv)
 
     do_client(host, port, filename, cmd, times, bytes, sendbytes,
 	      readbytes, dumpstats, nojumbo, maxmtu, maxwsize, minpeertimeout,
-              udpbufsz, nostats, hotthreads, threads);
+              udpbufsz, nostats, hotthreads, iobatch, threads, ccalg);
 
     return 0;
 }
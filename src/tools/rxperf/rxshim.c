@@ -0,0 +1,343 @@
+/*
+ * Copyright 2000, International Business Machines Corporation and others.
+ * All Rights Reserved.
+ *
+ * This software has been released under the terms of the IBM Public
+ * License.  For details, see the LICENSE file in the top-level source
+ * directory or online at http://www.openafs.org/dl/license10.html
+ */
+
+/*
+ * rxshim - a UDP relay which emulates a slow, lossy network
+ *
+ * rxshim sits between a single rx client and a server, and forwards
+ * datagrams between them through a pair of emulated links, one in each
+ * direction. Each link has a bandwidth, a drop tail queue in front of it,
+ * a propagation delay and a random loss rate. This makes it possible to
+ * see how rx, and in particular its congestion control, behaves on a long
+ * fat network or a lossy wireless one without leaving the local machine.
+ *
+ * usage: rxshim -l <listen port> -s <server host:port> [-d <delay ms>]
+ *               [-L <loss %>] [-b <bandwidth kbit/s>] [-q <queue packets>]
+ *               [-S <random seed>]
+ *
+ * For example, to compare algorithms over a 20Mbit/s, 40ms RTT link with
+ * 0.5% loss:
+ *
+ *    rxperf server -p 7009 -C cubic
+ *    rxshim -l 7010 -s 127.0.0.1:7009 -d 20 -L 0.5 -b 20000 -q 100
+ *    rxperf client -c recv -b 10000000 -p 7010 -C cubic
+ */
+
+#include <afsconfig.h>
+#include <afs/param.h>
+
+#include <roken.h>
+
+#include <poll.h>
+
+#define SHIM_MAXPACKET	65536
+
+struct shimPacket {
+    struct shimPacket *next;
+    struct timeval depart;	/* When the last bit leaves the queue */
+    struct timeval deliver;	/* When it arrives at the far end */
+    int len;
+    char data[1];
+};
+
+struct shimLink {
+    const char *name;
+    int sock;			/* Socket to send from */
+    struct sockaddr_in to;	/* Where to send */
+    int haveTo;
+    struct shimPacket *head;
+    struct shimPacket *tail;
+    struct timeval busy;	/* Link is busy sending until this time */
+    afs_uint64 forwarded;
+    afs_uint64 lost;
+    afs_uint64 dropped;
+};
+
+static int delay = 0;		/* One way delay, in msec */
+static double lossRate = 0;	/* Fraction of packets lost */
+static int bandwidth = 0;	/* In kbit/s, or 0 for unlimited */
+static int queueLimit = 0;	/* Packets, or 0 for unlimited */
+static volatile int finished = 0;
+
+static void
+tvAddUsec(struct timeval *tv, long usec)
+{
+    tv->tv_usec += usec;
+    tv->tv_sec += tv->tv_usec / 1000000;
+    tv->tv_usec %= 1000000;
+}
+
+static int
+tvCmp(struct timeval *a, struct timeval *b)
+{
+    if (a->tv_sec != b->tv_sec)
+	return a->tv_sec < b->tv_sec ? -1 : 1;
+    if (a->tv_usec != b->tv_usec)
+	return a->tv_usec < b->tv_usec ? -1 : 1;
+    return 0;
+}
+
+static long
+tvDiffMsec(struct timeval *a, struct timeval *b)
+{
+    return (a->tv_sec - b->tv_sec) * 1000
+	   + (a->tv_usec - b->tv_usec) / 1000;
+}
+
+/* Count the packets which are still waiting to go onto the link */
+static int
+linkQueued(struct shimLink *link, struct timeval *now)
+{
+    struct shimPacket *p;
+    int n = 0;
+
+    for (p = link->head; p != NULL; p = p->next) {
+	if (tvCmp(&p->depart, now) > 0)
+	    n++;
+    }
+    return n;
+}
+
+static void
+linkEnqueue(struct shimLink *link, char *data, int len, struct timeval *now)
+{
+    struct shimPacket *p;
+
+    if (lossRate > 0 && drand48() < lossRate) {
+	link->lost++;
+	return;
+    }
+    if (queueLimit > 0 && linkQueued(link, now) >= queueLimit) {
+	link->dropped++;
+	return;
+    }
+
+    p = malloc(sizeof(*p) + len);
+    if (p == NULL)
+	err(1, "malloc");
+    p->next = NULL;
+    p->len = len;
+    memcpy(p->data, data, len);
+
+    /* Packets are serialised onto the link one after another */
+    if (tvCmp(&link->busy, now) < 0)
+	link->busy = *now;
+    if (bandwidth > 0)
+	tvAddUsec(&link->busy, ((long)len * 8 * 1000) / bandwidth);
+    p->depart = link->busy;
+    p->deliver = p->depart;
+    tvAddUsec(&p->deliver, (long)delay * 1000);
+
+    if (link->tail != NULL)
+	link->tail->next = p;
+    else
+	link->head = p;
+    link->tail = p;
+}
+
+/* Deliver everything which has arrived, and return the number of msec
+ * until the next packet is due, or -1 if the link is idle */
+static int
+linkDeliver(struct shimLink *link, struct timeval *now)
+{
+    struct shimPacket *p;
+
+    while ((p = link->head) != NULL && tvCmp(&p->deliver, now) <= 0) {
+	link->head = p->next;
+	if (link->head == NULL)
+	    link->tail = NULL;
+	if (link->haveTo) {
+	    if (sendto(link->sock, p->data, p->len, 0,
+		       (struct sockaddr *)&link->to, sizeof(link->to)) < 0)
+		warn("sendto");
+	    else
+		link->forwarded++;
+	}
+	free(p);
+    }
+    if (p == NULL)
+	return -1;
+    return tvDiffMsec(&p->deliver, now) + 1;
+}
+
+static void
+readFrom(int sock, struct shimLink *link, struct sockaddr_in *from,
+	 struct timeval *now)
+{
+    static char buf[SHIM_MAXPACKET];
+    socklen_t fromlen;
+    int len;
+
+    for (;;) {
+	fromlen = sizeof(*from);
+	len = recvfrom(sock, buf, sizeof(buf), MSG_DONTWAIT,
+		       (struct sockaddr *)from, &fromlen);
+	if (len < 0)
+	    return;
+	linkEnqueue(link, buf, len, now);
+    }
+}
+
+static void
+sigint(int sig)
+{
+    finished = 1;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: %s -l <listen port> -s <server host:port> "
+	    "[-d <delay ms>] [-L <loss %%>] [-b <bandwidth kbit/s>] "
+	    "[-q <queue packets>] [-S <seed>]\n", getprogname());
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct shimLink toServer, toClient;
+    struct sockaddr_in sin, from;
+    struct pollfd fds[2];
+    struct timeval now;
+    struct hostent *he;
+    int clientSock, serverSock;
+    int listenPort = 0;
+    long seed = 1;
+    int ch, t1, t2, timeout;
+    char *server = NULL, *colon, *ptr;
+
+    setprogname(argv[0]);
+
+    while ((ch = getopt(argc, argv, "b:d:l:L:q:s:S:")) != -1) {
+	switch (ch) {
+	case 'b':
+	    bandwidth = strtol(optarg, &ptr, 0);
+	    if (*ptr != '\0' || bandwidth < 0)
+		errx(1, "can't resolve bandwidth");
+	    break;
+	case 'd':
+	    delay = strtol(optarg, &ptr, 0);
+	    if (*ptr != '\0' || delay < 0)
+		errx(1, "can't resolve delay");
+	    break;
+	case 'l':
+	    listenPort = strtol(optarg, &ptr, 0);
+	    if (*ptr != '\0')
+		errx(1, "can't resolve listen port");
+	    break;
+	case 'L':
+	    lossRate = strtod(optarg, &ptr) / 100;
+	    if (*ptr != '\0' || lossRate < 0 || lossRate > 1)
+		errx(1, "can't resolve loss rate");
+	    break;
+	case 'q':
+	    queueLimit = strtol(optarg, &ptr, 0);
+	    if (*ptr != '\0' || queueLimit < 0)
+		errx(1, "can't resolve queue limit");
+	    break;
+	case 's':
+	    server = optarg;
+	    break;
+	case 'S':
+	    seed = strtol(optarg, &ptr, 0);
+	    if (*ptr != '\0')
+		errx(1, "can't resolve seed");
+	    break;
+	default:
+	    usage();
+	}
+    }
+    if (optind != argc || listenPort == 0 || server == NULL)
+	usage();
+
+    srand48(seed);
+
+    memset(&toServer, 0, sizeof(toServer));
+    memset(&toClient, 0, sizeof(toClient));
+    toServer.name = "to server";
+    toClient.name = "to client";
+
+    colon = strchr(server, ':');
+    if (colon == NULL)
+	usage();
+    *colon++ = '\0';
+    toServer.to.sin_family = AF_INET;
+    toServer.to.sin_port = htons(strtol(colon, &ptr, 0));
+    if (*ptr != '\0')
+	errx(1, "can't resolve server port");
+    he = gethostbyname(server);
+    if (he == NULL)
+	errx(1, "unknown host %s", server);
+    memcpy(&toServer.to.sin_addr, he->h_addr, sizeof(toServer.to.sin_addr));
+    toServer.haveTo = 1;
+
+    /* One socket faces the client, the other the server, so that the
+     * server sees all of the client's traffic coming from a single peer */
+    clientSock = socket(AF_INET, SOCK_DGRAM, 0);
+    serverSock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (clientSock < 0 || serverSock < 0)
+	err(1, "socket");
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(listenPort);
+    if (bind(clientSock, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+	err(1, "bind");
+    toServer.sock = serverSock;
+    toClient.sock = clientSock;
+
+    signal(SIGINT, sigint);
+    signal(SIGTERM, sigint);
+
+    fds[0].fd = clientSock;
+    fds[0].events = POLLIN;
+    fds[1].fd = serverSock;
+    fds[1].events = POLLIN;
+
+    while (!finished) {
+	gettimeofday(&now, NULL);
+	t1 = linkDeliver(&toServer, &now);
+	t2 = linkDeliver(&toClient, &now);
+	if (t1 < 0)
+	    timeout = t2;
+	else if (t2 < 0)
+	    timeout = t1;
+	else
+	    timeout = MIN(t1, t2);
+
+	if (poll(fds, 2, timeout) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    err(1, "poll");
+	}
+
+	gettimeofday(&now, NULL);
+	if (fds[0].revents & POLLIN) {
+	    readFrom(clientSock, &toServer, &from, &now);
+	    if (!toClient.haveTo) {
+		/* The first client to send us anything is the one we serve */
+		toClient.to = from;
+		toClient.haveTo = 1;
+	    }
+	}
+	if (fds[1].revents & POLLIN)
+	    readFrom(serverSock, &toClient, &from, &now);
+    }
+
+    printf("%s: %llu forwarded, %llu lost, %llu dropped\n", toServer.name,
+	   (unsigned long long)toServer.forwarded,
+	   (unsigned long long)toServer.lost,
+	   (unsigned long long)toServer.dropped);
+    printf("%s: %llu forwarded, %llu lost, %llu dropped\n", toClient.name,
+	   (unsigned long long)toClient.forwarded,
+	   (unsigned long long)toClient.lost,
+	   (unsigned long long)toClient.dropped);
+
+    return 0;
+}
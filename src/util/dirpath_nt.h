@@ -151,6 +151,7 @@ extern int
 #define AFSDIR_MIGRATE_LOGNAME  "wtlog."
 
 #define AFSDIR_FSSTATE_FILE     "fsstate.dat"
+#define AFSDIR_CBSTATE_FILE     "cbstate.dat"
 
 #ifdef COMMENT
 #define AFSDIR_CELLSERVDB_FILE_NTCLIENT  "afsdcell.ini"
@@ -279,6 +280,7 @@ typedef enum afsdir_id {
     AFSDIR_SERVER_FSSTATE_FILEPATH_ID,
     AFSDIR_CLIENT_CONFIG_FILE_FILEPATH_ID,
     AFSDIR_SERVER_CONFIG_FILE_FILEPATH_ID,
+    AFSDIR_SERVER_CBSTATE_FILEPATH_ID,
     AFSDIR_PATHSTRING_MAX
 } afsdir_id_t;
 
@@ -352,6 +354,7 @@ const char *getDirPath(afsdir_id_t string_id);
 #define AFSDIR_SERVER_MIGRATELOG_FILEPATH getDirPath(AFSDIR_SERVER_MIGRATELOG_FILEPATH_ID)
 #define AFSDIR_SERVER_KRB_EXCL_FILEPATH getDirPath(AFSDIR_SERVER_KRB_EXCL_FILEPATH_ID)
 #define AFSDIR_SERVER_FSSTATE_FILEPATH getDirPath(AFSDIR_SERVER_FSSTATE_FILEPATH_ID)
+#define AFSDIR_SERVER_CBSTATE_FILEPATH getDirPath(AFSDIR_SERVER_CBSTATE_FILEPATH_ID)
 #define AFSDIR_SERVER_CONFIG_FILE_FILEPATH getDirPath(AFSDIR_SERVER_CONFIG_FILE_FILEPATH_ID)
 
 /* client file paths */
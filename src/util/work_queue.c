@@ -1232,7 +1232,7 @@ _afs_wq_node_free(struct afs_work_queue_node * node)
     }
 
     opr_mutex_destroy(&node->lock);
-    opr_cv_destory(&node->state_cv);
+    opr_cv_destroy(&node->state_cv);
 
     if (node->rock_dtor) {
 	(*node->rock_dtor) (node->rock);
@@ -1897,7 +1897,7 @@ afs_wq_node_wait(struct afs_work_queue_node * node,
 	   (node->state != AFS_WQ_NODE_STATE_ERROR)) {
 	opr_cv_wait(&node->state_cv, &node->lock);
     }
-    if (retcowait{
+    if (retcode) {
 	*retcode = node->retcode;
     }
 
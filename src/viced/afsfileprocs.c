@@ -90,6 +90,7 @@
 #include <afs/acl.h>
 #include <rx/rx.h>
 #include <rx/rx_globals.h>
+#include <rx/rx_packet.h>
 
 #include <afs/cellconfig.h>
 #include <afs/keys.h>
@@ -103,6 +104,8 @@
 #include <afs/audit.h>
 #include <afs/afsutil.h>
 #include <afs/dir.h>
+#include <afs/work_queue.h>
+#include <afs/thread_pool.h>
 
 extern void SetDirHandle(DirHandle * dir, Vnode * vnode);
 extern void FidZap(DirHandle * file);
@@ -148,6 +151,7 @@ pthread_mutex_t fileproc_glock_mutex;
 
 #define	NOTACTIVECALL	0
 #define	ACTIVECALL	1
+#define	BULKCALL	2	/* with ACTIVECALL: FetchData or StoreData */
 
 #define CREATE_SGUID_ADMIN_ONLY 1
 
@@ -425,10 +429,29 @@ CallPreamble(struct rx_call *acall, int activecall, struct AFSFid *Fid,
 	goto retry;
     }
 
+    if (activecall
+	&& h_SchedAdmit_r(thost, tclient->z.ViceId,
+			  (activecall & BULKCALL) ? H_SCHED_BULK : H_SCHED_META)) {
+	h_ReleaseClient_r(tclient);
+	h_Release_r(thost);
+	H_UNLOCK;
+	return VBUSY;
+    }
+
     tclient->z.LastCall = thost->z.LastCall = time(NULL);
     if (activecall)		/* For all but "GetTime", "GetStats", and "GetCaps" calls */
 	thost->z.ActiveCall = thost->z.LastCall;
 
+    /* Nearly every call comes from a host that is up and has no delayed
+     * callbacks; there is nothing to do for those under the host lock, so
+     * don't wait for it (and possibly give up H_LOCK) just to look. */
+    if (!(thost->z.hostFlags & (HOSTDELETED | VENUSDOWN | HFE_LATER))) {
+	h_ReleaseClient_r(tclient);
+	H_UNLOCK;
+	*ahostp = thost;
+	return 0;
+    }
+
     h_Lock_r(thost);
     if (thost->z.hostFlags & HOSTDELETED) {
 	ViceLog(3,
@@ -2194,6 +2217,18 @@ AllocSendBuffer(void)
     return (char *)tp;
 
 }				/*AllocSendBuffer */
+#else /* HAVE_PIOV */
+/*
+ * With vectored I/O the data moves directly between the file and the
+ * packet buffers, so rather than the size of a send buffer, it is the
+ * number of packet buffers that can be described in one go which bounds
+ * each transfer.
+ */
+# if defined(IOV_MAX) && IOV_MAX < 64
+#  define FS_MAXIOVECS IOV_MAX
+# else
+#  define FS_MAXIOVECS 64
+# endif
 #endif /* HAVE_PIOV */
 
 /*
@@ -2281,7 +2316,7 @@ common_FetchData64(struct rx_call *acall, struct AFSFid *Fid,
     FS_LOCK;
     AFSCallStats.FetchData++, AFSCallStats.TotalCalls++;
     FS_UNLOCK;
-    if ((errorCode = CallPreamble(acall, ACTIVECALL, Fid, &tcon, &thost)))
+    if ((errorCode = CallPreamble(acall, ACTIVECALL | BULKCALL, Fid, &tcon, &thost)))
 	goto Bad_FetchData;
 
     /* Get ptr to client data for user Id for logging */
@@ -2570,6 +2605,191 @@ SAFSS_FetchStatus(struct rx_call *acall, struct AFSFid *Fid,
 }				/*SAFSS_FetchStatus */
 
 
+/*
+ * bulk status prefetch.
+ *
+ * BulkStatus and InlineBulkStatus look at their fids one at a time, so
+ * on a cold cache each call waits for up to AFSCBMAX vnode reads in
+ * turn.  When -bulkprefetchthreads is given, the fids are also handed to
+ * a pool of threads that read them into the vnode cache in parallel,
+ * while the calling thread works through the fids in order as before.
+ *
+ * This is only offered by the demand attach fileserver; elsewhere two
+ * threads loading the same vnode at once can end up with two copies of
+ * it in the cache (see VGetVnode_r).
+ */
+static struct afs_work_queue *bulkPrefetchQueue;
+static struct afs_thread_pool *bulkPrefetchPool;
+static int nBulkPrefetchThreads;
+
+struct bulk_prefetch_work {
+    int nfids;
+    struct AFSFid fids[1];	/* really nfids long */
+};
+
+/**
+ * read a set of vnodes into the vnode cache.
+ *
+ * @param[in] queue        work queue
+ * @param[in] node         work queue node
+ * @param[in] queue_rock   unused
+ * @param[in] node_rock    struct bulk_prefetch_work
+ * @param[in] caller_rock  unused
+ *
+ * @return 0
+ *
+ * @note errors are ignored; the caller of the RPC will see them when
+ *       it gets to the fid itself.
+ */
+static int
+BulkPrefetch_cbk(struct afs_work_queue *queue,
+		 struct afs_work_queue_node *node,
+		 void *queue_rock, void *node_rock, void *caller_rock)
+{
+    struct bulk_prefetch_work *work = node_rock;
+    Volume *volptr = NULL;
+    Vnode *vnptr;
+    Error ec, client_ec;
+    int i;
+
+    for (i = 0; i < work->nfids; i++) {
+	struct AFSFid *fid = &work->fids[i];
+
+	if (volptr && V_id(volptr) != fid->Volume) {
+	    VPutVolume(volptr);
+	    volptr = NULL;
+	}
+	if (!volptr) {
+	    volptr = VGetVolume(&ec, &client_ec, fid->Volume);
+	    if (!volptr)
+		continue;
+	}
+	vnptr = VGetVnode(&ec, volptr, fid->Vnode, READ_LOCK);
+	if (vnptr)
+	    VPutVnode(&ec, vnptr);
+    }
+    if (volptr)
+	VPutVolume(volptr);
+
+    return 0;
+}
+
+/**
+ * start reading the vnodes of a bulk status request into the cache.
+ *
+ * @param[in] Fids  fids of the request
+ *
+ * The fids after the first are dealt out round robin to one work node
+ * per prefetch thread, so the threads read them in about the order the
+ * calling thread will want them.  Nothing is waited for; if the queue
+ * is full the request is simply not prefetched.
+ */
+static void
+BulkPrefetch(struct AFSCBFids *Fids)
+{
+    struct afs_work_queue *queue = bulkPrefetchQueue;
+    struct afs_work_queue_node *node;
+    struct afs_work_queue_add_opts opts;
+    struct bulk_prefetch_work *work;
+    int nfiles = Fids->AFSCBFids_len;
+    int nnodes, per, i, j;
+
+    if (!queue || nfiles < 2)
+	return;
+
+    nnodes = nfiles - 1;
+    if (nnodes > nBulkPrefetchThreads)
+	nnodes = nBulkPrefetchThreads;
+    per = (nfiles - 1 + nnodes - 1) / nnodes;
+
+    afs_wq_add_opts_init(&opts);
+    opts.donate = 1;
+    opts.block = 0;
+
+    for (i = 0; i < nnodes; i++) {
+	work = malloc(sizeof(*work) + (per - 1) * sizeof(struct AFSFid));
+	if (!work)
+	    return;
+	work->nfids = 0;
+	for (j = 1 + i; j < nfiles; j += nnodes)
+	    work->fids[work->nfids++] = Fids->AFSCBFids_val[j];
+
+	if (afs_wq_node_alloc(&node)) {
+	    free(work);
+	    return;
+	}
+	if (afs_wq_node_set_detached(node) ||
+	    afs_wq_node_set_callback(node, BulkPrefetch_cbk, work, free)) {
+	    free(work);
+	    afs_wq_node_put(node);
+	    return;
+	}
+	if (afs_wq_add(queue, node, &opts)) {
+	    /* queue is full or shutting down */
+	    afs_wq_node_put(node);
+	    return;
+	}
+    }
+}
+
+/**
+ * start the bulk status prefetch threads.
+ *
+ * @param[in] nthreads  number of threads; 0 to not prefetch
+ *
+ * @return operation status
+ *    @retval 0 success
+ */
+int
+InitBulkPrefetch(int nthreads)
+{
+    struct afs_work_queue_opts opts;
+    int code;
+
+    if (nthreads <= 0)
+	return 0;
+    nBulkPrefetchThreads = nthreads;
+
+    afs_wq_opts_init(&opts);
+    afs_wq_opts_calc_thresh(&opts, nthreads);
+    code = afs_wq_create(&bulkPrefetchQueue, NULL, &opts);
+    if (code)
+	goto error;
+    code = afs_tp_create(&bulkPrefetchPool, bulkPrefetchQueue);
+    if (code)
+	goto error;
+    code = afs_tp_set_threads(bulkPrefetchPool, nthreads);
+    if (code)
+	goto error;
+    code = afs_tp_start(bulkPrefetchPool);
+    if (code)
+	goto error;
+
+    ViceLog(0, ("Started %d bulk status prefetch threads\n", nthreads));
+    return 0;
+
+ error:
+    ViceLog(0, ("Failed to start bulk status prefetch threads (code %d); "
+		"bulk status requests will not be prefetched\n", code));
+    bulkPrefetchQueue = NULL;
+    return code;
+}
+
+/**
+ * stop the bulk status prefetch threads.
+ *
+ * Prefetches which have not started yet are dropped.  Must be called
+ * before the volume package is shut down.
+ */
+void
+ShutDownBulkPrefetch(void)
+{
+    if (!bulkPrefetchQueue)
+	return;
+    bulkPrefetchQueue = NULL;
+    afs_tp_shutdown(bulkPrefetchPool, 1);
+}
+
 afs_int32
 SRXAFS_BulkStatus(struct rx_call * acall, struct AFSCBFids * Fids,
 		  struct AFSBulkStats * OutStats, struct AFSCBs * CallBacks,
@@ -2618,6 +2838,8 @@ SRXAFS_BulkStatus(struct rx_call * acall, struct AFSCBFids * Fids,
     if ((errorCode = CallPreamble(acall, ACTIVECALL, tfid, &tcon, &thost)))
 	goto Bad_BulkStatus;
 
+    BulkPrefetch(Fids);
+
     for (i = 0; i < nfiles; i++, tfid++) {
 	/*
 	 * Get volume/vnode for the fetched file; caller's rights to it
@@ -2743,6 +2965,8 @@ SRXAFS_InlineBulkStatus(struct rx_call * acall, struct AFSCBFids * Fids,
 	goto Bad_InlineBulkStatus;
     }
 
+    BulkPrefetch(Fids);
+
     for (i = 0; i < nfiles; i++, tfid++) {
 	/*
 	 * Get volume/vnode for the fetched file; caller's rights to it
@@ -2911,7 +3135,7 @@ common_StoreData64(struct rx_call *acall, struct AFSFid *Fid,
     FS_LOCK;
     AFSCallStats.StoreData++, AFSCallStats.TotalCalls++;
     FS_UNLOCK;
-    if ((errorCode = CallPreamble(acall, ACTIVECALL, Fid, &tcon, &thost)))
+    if ((errorCode = CallPreamble(acall, ACTIVECALL | BULKCALL, Fid, &tcon, &thost)))
 	goto Bad_StoreData;
 
     /* Get ptr to client data for user Id for logging */
@@ -5464,6 +5688,7 @@ SRXAFS_GetXStats(struct rx_call *a_call, afs_int32 a_clientVersionNum,
     case AFS_XSTATSCOLL_CBSTATS:
 	afs_perfstats.numPerfCalls++;
 
+	FoldCallBackCounters();
 	dataBytes = sizeof(struct cbcounters);
 	dataBuffP = malloc(dataBytes);
 	{
@@ -5484,12 +5709,39 @@ SRXAFS_GetXStats(struct rx_call *a_call, afs_int32 a_clientVersionNum,
 	    dataBuffP[13]=cbstuff.GSS3;
 	    dataBuffP[14]=cbstuff.GSS4;
 	    dataBuffP[15]=cbstuff.GSS5;
+	    dataBuffP[16]=cbstuff.nBreakQueued;
+	    dataBuffP[17]=cbstuff.BreakQueueHigh;
+	    dataBuffP[18]=cbstuff.BreakRPCs;
+	    dataBuffP[19]=cbstuff.BreakFids;
+	    dataBuffP[20]=cbstuff.BreakRetries;
+	    dataBuffP[21]=cbstuff.BreakDelayed;
+	    dataBuffP[22]=cbstuff.BreakStalls;
+	    dataBuffP[23]=cbstuff.BreakLatency;
+	    dataBuffP[24]=cbstuff.BreakLatencyMax;
 	}
 
 	a_dataP->AFS_CollData_len = dataBytes >> 2;
 	a_dataP->AFS_CollData_val = dataBuffP;
 	break;
 
+    case AFS_XSTATSCOLL_VNODE_INFO:
+	afs_perfstats.numPerfCalls++;
+
+	dataBuffP = malloc(AFS_MAX_XSTAT_LONGS * sizeof(afs_int32));
+	a_dataP->AFS_CollData_len =
+	    VCollectVnodeCacheStats(dataBuffP, AFS_MAX_XSTAT_LONGS);
+	a_dataP->AFS_CollData_val = dataBuffP;
+	break;
+
+    case AFS_XSTATSCOLL_ADMIT_INFO:
+	afs_perfstats.numPerfCalls++;
+
+	dataBuffP = malloc(AFS_MAX_XSTAT_LONGS * sizeof(afs_int32));
+	a_dataP->AFS_CollData_len =
+	    h_CollectSchedStats(dataBuffP, AFS_MAX_XSTAT_LONGS);
+	a_dataP->AFS_CollData_val = dataBuffP;
+	break;
+
 
     default:
 	/*
@@ -5697,6 +5949,7 @@ SRXAFS_FlushCPS(struct rx_call * acall, struct ViceIds * vids,
     for (i = 0; i < nids; i++, vd++) {
 	if (!*vd)
 	    continue;
+	h_FlushCachedCPS(*vd);
 	h_EnumerateClients(*vd, FlushClientCPS, NULL);
     }
 
@@ -6157,7 +6410,7 @@ FetchData_RXStyle(Volume * volptr, Vnode * targetptr,
 #ifndef HAVE_PIOV
     char *tbuffer;
 #else /* HAVE_PIOV */
-    struct iovec tiov[RX_MAXIOVECS];
+    struct iovec tiov[FS_MAXIOVECS];
     int tnio;
 #endif /* HAVE_PIOV */
     afs_sfsize_t tlen;
@@ -6194,6 +6447,10 @@ FetchData_RXStyle(Volume * volptr, Vnode * targetptr,
 	return EIO;
     }
     optSize = sendBufSize;
+#ifdef HAVE_PIOV
+    if (optSize < FS_MAXIOVECS * RX_CBUFFERSIZE)
+	optSize = FS_MAXIOVECS * RX_CBUFFERSIZE;
+#endif /* HAVE_PIOV */
     tlen = FDH_SIZE(fdP);
     ViceLog(25,
 	    ("FetchData_RXStyle: file size %llu\n", (afs_uintmax_t) tlen));
@@ -6250,7 +6507,7 @@ FetchData_RXStyle(Volume * volptr, Vnode * targetptr,
 	}
 	nBytes = rx_Write(Call, tbuffer, wlen);
 #else /* HAVE_PIOV */
-	nBytes = rx_WritevAlloc(Call, tiov, &tnio, RX_MAXIOVECS, wlen);
+	nBytes = rx_WritevAlloc(Call, tiov, &tnio, FS_MAXIOVECS, wlen);
 	if (nBytes <= 0) {
 	    FDH_CLOSE(fdP);
 	    return EIO;
@@ -6376,7 +6633,7 @@ StoreData_RXStyle(Volume * volptr, Vnode * targetptr, struct AFSFid * Fid,
 #ifndef HAVE_PIOV
     char *tbuffer;	/* data copying buffer */
 #else /* HAVE_PIOV */
-    struct iovec tiov[RX_MAXIOVECS];	/* no data copying with iovec */
+    struct iovec tiov[FS_MAXIOVECS];	/* no data copying with iovec */
     int tnio;			/* temp for iovec size */
 #endif /* HAVE_PIOV */
     afs_sfsize_t tlen;		/* temp for xfr length */
@@ -6512,6 +6769,10 @@ StoreData_RXStyle(Volume * volptr, Vnode * targetptr, struct AFSFid * Fid,
     rx_SetLocalStatus(Call, 1);
 
     optSize = sendBufSize;
+#ifdef HAVE_PIOV
+    if (optSize < FS_MAXIOVECS * RX_CBUFFERSIZE)
+	optSize = FS_MAXIOVECS * RX_CBUFFERSIZE;
+#endif /* HAVE_PIOV */
     ViceLog(25,
 	    ("StoreData_RXStyle: Pos %llu, DataLength %llu, FileLength %llu, Length %llu\n",
 	     (afs_uintmax_t) Pos, (afs_uintmax_t) DataLength,
@@ -6563,7 +6824,7 @@ StoreData_RXStyle(Volume * volptr, Vnode * targetptr, struct AFSFid * Fid,
 #ifndef HAVE_PIOV
 	    errorCode = rx_Read(Call, tbuffer, rlen);
 #else /* HAVE_PIOV */
-	    errorCode = rx_Readv(Call, tiov, &tnio, RX_MAXIOVECS, rlen);
+	    errorCode = rx_Readv(Call, tiov, &tnio, FS_MAXIOVECS, rlen);
 #endif /* HAVE_PIOV */
 	    if (errorCode <= 0) {
 		errorCode = -32;
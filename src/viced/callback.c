@@ -87,6 +87,7 @@
 
 #include <roken.h>
 
+#include <stddef.h>
 #ifdef HAVE_SYS_FILE_H
 #include <sys/file.h>
 #endif
@@ -109,6 +110,8 @@
 #include "host.h"
 #include "callback.h"
 #ifdef AFS_DEMAND_ATTACH_FS
+#include <sys/mman.h>
+#include <opr/jhash.h>
 #include "serialize_state.h"
 #endif /* AFS_DEMAND_ATTACH_FS */
 
@@ -125,8 +128,9 @@ struct cbcounters cbstuff;
 static struct FileEntry * FE = NULL;    /* don't use FE[0] */
 static struct CallBack * CB = NULL;     /* don't use CB[0] */
 
-static struct CallBack * CBfree = NULL;
-static struct FileEntry * FEfree = NULL;
+/* free lists, linked by index through cnext and fnext */
+static afs_uint32 CBfree = 0;
+static afs_uint32 FEfree = 0;
 
 
 /* Time to live for call backs depends upon number of users of the file.
@@ -200,7 +204,46 @@ static int DumpCallBackState_r(void);
 /* Other protos - move out sometime */
 void PrintCB(struct CallBack *cb, afs_uint32 now);
 
-static afs_uint32 HashTable[FEHASH_SIZE];	/* File entry hash table */
+/*
+ * File entry hash table.  It has FEHashSize buckets, a power of 2 chosen
+ * from the number of callbacks in InitCallBack, and is doubled (up to
+ * FEHashMax) as the number of file entries in use grows, so that the chains
+ * stay short on servers run with a large -cb.
+ *
+ * The chains and the table are only changed with H_LOCK held, so anything
+ * holding H_LOCK may walk them.  Each chain is also covered by one of the
+ * FEHashStripes locks (picked by FEHashLock, which does not depend upon the
+ * table size), which is held for every change to that chain; growing the
+ * table holds all of them.  That lets FEExists look up a fid without
+ * H_LOCK, so breaking or deleting callbacks for files nobody has callbacks
+ * on does not have to wait for the host lock.
+ */
+static afs_uint32 *HashTable = NULL;
+static afs_uint32 FEHashSize, FEHashMask, FEHashMax;
+
+#ifndef INTERPRET_DUMP
+static struct {
+    opr_mutex_t lock;
+    afs_int32 BreakCallBacks;	/* calls that found no FE, not yet in cbstuff */
+    afs_int32 DeleteFiles;	/* ditto */
+} FEHashStripes[FEHASH_LOCKS];
+
+/*
+ * With demand attach, the FE and CB tables and the hash table are normally
+ * kept in the callback arena, a shared mapping of cbstate.dat (see
+ * serialize_state.h), rather than allocated, so that they can be handed to
+ * the next fileserver as they are.  When the arena is mapped, the hash
+ * table has room for FEHashMax buckets from the start.
+ */
+static struct {
+    int fd;
+    char *map;			/* the mapping, or NULL if not in use */
+    size_t size;
+    struct callback_arena_header *hdr;
+    afs_uint32 *sums;		/* region checksums */
+    int pending;		/* saved tables not yet restored or reset */
+} cbArena = { -1, NULL, 0, NULL, NULL, 0 };
+#endif
 
 static struct FileEntry *
 FindFE(AFSFid * fid)
@@ -221,23 +264,194 @@ FindFE(AFSFid * fid)
 
 #ifndef INTERPRET_DUMP
 
+/* Return whether fid has an FE, holding only its hash stripe lock.  If it
+ * has none, the call is counted against the stripe as a break or a delete,
+ * as appropriate; FoldCallBackCounters moves those counts into cbstuff.
+ *
+ * The answer may be out of date by the time the caller acts on it, but a
+ * zero answer means no FE existed at some point during the call, which is
+ * all that a caller holding H_LOCK would have known, too. */
+static int
+FEExists(AFSFid * fid, int deleting)
+{
+    int lock = FEHashLock(fid->Volume, fid->Unique);
+    int exists;
+
+    opr_mutex_enter(&FEHashStripes[lock].lock);
+    exists = (FindFE(fid) != NULL);
+    if (!exists) {
+	if (deleting)
+	    FEHashStripes[lock].DeleteFiles++;
+	else
+	    FEHashStripes[lock].BreakCallBacks++;
+    }
+    opr_mutex_exit(&FEHashStripes[lock].lock);
+    return exists;
+}
+
+static void
+FEHashLockAll(void)
+{
+    int i;
+
+    for (i = 0; i < FEHASH_LOCKS; i++)
+	opr_mutex_enter(&FEHashStripes[i].lock);
+}
+
+static void
+FEHashUnlockAll(void)
+{
+    int i;
+
+    for (i = FEHASH_LOCKS - 1; i >= 0; i--)
+	opr_mutex_exit(&FEHashStripes[i].lock);
+}
+
+/* Replace the hash table with an empty one of size buckets.  Called with
+ * H_LOCK held, before anything is in the table, or with a table that will
+ * be filled in afterwards (by cb_stateRestoreFEHash). */
+static int
+FEHashAlloc(afs_uint32 size)
+{
+    afs_uint32 *table;
+
+    if (cbArena.map) {
+	if (size > FEHashMax)
+	    return ENOMEM;
+	FEHashLockAll();
+	memset(HashTable, 0, size * sizeof(afs_uint32));
+	FEHashSize = size;
+	FEHashMask = size - 1;
+	FEHashUnlockAll();
+	return 0;
+    }
+
+    table = calloc(size, sizeof(afs_uint32));
+    if (!table)
+	return ENOMEM;
+    FEHashLockAll();
+    free(HashTable);
+    HashTable = table;
+    FEHashSize = size;
+    FEHashMask = size - 1;
+    FEHashUnlockAll();
+    return 0;
+}
+
+/* Double the size of the hash table if the FEs in use have outgrown it.
+ * Called with H_LOCK held.  If there is no memory for a larger table, we
+ * simply carry on with longer chains. */
+static void
+FEHashGrow(void)
+{
+    afs_uint32 *table, size, mask, hash, fei, next, lo, hi;
+    struct FileEntry *fe;
+
+    if (FEHashSize >= FEHashMax
+	|| cbstuff.nFEs <= FEHASH_LOAD * FEHashSize)
+	return;
+
+    size = FEHashSize << 1;
+    mask = size - 1;
+    if (cbArena.map) {
+	/* The arena already has room for the larger table, so split each
+	 * chain between its own bucket and the new one above it. */
+	FEHashLockAll();
+	for (hash = 0; hash < FEHashSize; hash++) {
+	    lo = hi = 0;
+	    for (fei = HashTable[hash]; fei; fei = next) {
+		fe = itofe(fei);
+		next = fe->fnext;
+		if (FEHashKey(fe->volid, fe->unique) & FEHashSize) {
+		    fe->fnext = hi;
+		    hi = fei;
+		} else {
+		    fe->fnext = lo;
+		    lo = fei;
+		}
+	    }
+	    HashTable[hash] = lo;
+	    HashTable[hash + FEHashSize] = hi;
+	}
+	goto grown;
+    }
+
+    table = calloc(size, sizeof(afs_uint32));
+    if (!table)
+	return;
+
+    FEHashLockAll();
+    for (hash = 0; hash < FEHashSize; hash++) {
+	for (fei = HashTable[hash]; fei; fei = next) {
+	    fe = itofe(fei);
+	    next = fe->fnext;
+	    fe->fnext = table[FEHashKey(fe->volid, fe->unique) & mask];
+	    table[FEHashKey(fe->volid, fe->unique) & mask] = fei;
+	}
+    }
+    free(HashTable);
+    HashTable = table;
+ grown:
+    FEHashSize = size;
+    FEHashMask = mask;
+    FEHashUnlockAll();
+
+    ViceLog(1, ("FEHashGrow: callback hash table grown to %u buckets "
+		"(%d file entries in use)\n", FEHashSize, cbstuff.nFEs));
+}
+
+/* Add fe to the hash table.  Called with H_LOCK held. */
+static void
+FEHashInsert(struct FileEntry *fe)
+{
+    int lock = FEHashLock(fe->volid, fe->unique);
+    afs_uint32 hash;
+
+    opr_mutex_enter(&FEHashStripes[lock].lock);
+    hash = FEHash(fe->volid, fe->unique);
+    fe->fnext = HashTable[hash];
+    HashTable[hash] = fetoi(fe);
+    opr_mutex_exit(&FEHashStripes[lock].lock);
+}
+
+/* Move the counts of calls that were answered by FEExists alone into
+ * cbstuff. */
+void
+FoldCallBackCounters(void)
+{
+    int i;
+
+    H_LOCK;
+    for (i = 0; i < FEHASH_LOCKS; i++) {
+	opr_mutex_enter(&FEHashStripes[i].lock);
+	cbstuff.BreakCallBacks += FEHashStripes[i].BreakCallBacks;
+	cbstuff.DeleteFiles += FEHashStripes[i].DeleteFiles;
+	FEHashStripes[i].BreakCallBacks = 0;
+	FEHashStripes[i].DeleteFiles = 0;
+	opr_mutex_exit(&FEHashStripes[i].lock);
+    }
+    H_UNLOCK;
+}
+
 static struct CallBack *
 iGetCB(int *nused)
 {
     struct CallBack *ret;
 
-    if ((ret = CBfree)) {
-	CBfree = (struct CallBack *)(((struct object *)ret)->next);
+    if ((ret = itocb(CBfree))) {
+	CBfree = ret->cnext;
 	(*nused)++;
     }
     return ret;
 }
 
+/* A free CB has a zero status, which no CB in use has. */
 static int
 iFreeCB(struct CallBack *cb, int *nused)
 {
-    ((struct object *)cb)->next = (struct object *)CBfree;
-    CBfree = cb;
+    cb->cnext = CBfree;
+    cb->status = 0;
+    CBfree = cbtoi(cb);
     (*nused)--;
     return 0;
 }
@@ -247,8 +461,8 @@ iGetFE(int *nused)
 {
     struct FileEntry *ret;
 
-    if ((ret = FEfree)) {
-	FEfree = (struct FileEntry *)(((struct object *)ret)->next);
+    if ((ret = itofe(FEfree))) {
+	FEfree = ret->fnext;
 	(*nused)++;
     }
     return ret;
@@ -257,8 +471,8 @@ iGetFE(int *nused)
 static int
 iFreeFE(struct FileEntry *fe, int *nused)
 {
-    ((struct object *)fe)->next = (struct object *)FEfree;
-    FEfree = fe;
+    fe->fnext = FEfree;
+    FEfree = fetoi(fe);
     (*nused)--;
     return 0;
 }
@@ -408,24 +622,234 @@ static int
 FDel(struct FileEntry *fe)
 {
     int fei = fetoi(fe);
-    afs_uint32 *p = &HashTable[FEHash(fe->volid, fe->unique)];
+    int lock = FEHashLock(fe->volid, fe->unique);
+    afs_uint32 *p;
 
+    opr_mutex_enter(&FEHashStripes[lock].lock);
+    p = &HashTable[FEHash(fe->volid, fe->unique)];
     while (*p && *p != fei)
 	p = &itofe(*p)->fnext;
     opr_Assert(*p);
     *p = fe->fnext;
+    opr_mutex_exit(&FEHashStripes[lock].lock);
     FreeFE(fe);
     return 0;
 }
 
+/* Empty the FE and CB tables and the hash table, putting every entry on
+ * its free list.  Called with H_LOCK held. */
+static void
+ResetCallBackTables(int nblks)
+{
+    afs_uint32 size;
+
+    /* Start the hash table at one bucket for every FEHASH_LOAD FEs in a
+     * quarter of the pool, and let it grow to one for every FEHASH_LOAD FEs
+     * in the whole pool. */
+    size = FEHashMax >> 2;
+    if (size < FEHASH_SIZE)
+	size = FEHASH_SIZE;
+    if (FEHashAlloc(size))
+	ViceLogThenPanic(0, ("Failed malloc in InitCallBack\n"));
+    memset(&FE[1], 0, nblks * sizeof(struct FileEntry));
+    memset(&CB[1], 0, nblks * sizeof(struct CallBack));
+    memset(timeout, 0, sizeof(timeout));
+    FEfree = CBfree = 0;
+    cbstuff.nFEs = nblks;
+    while (cbstuff.nFEs)
+	FreeFE(&FE[cbstuff.nFEs]);	/* This is correct */
+    cbstuff.nCBs = nblks;
+    while (cbstuff.nCBs)
+	FreeCB(&CB[cbstuff.nCBs]);	/* This is correct */
+}
+
+#ifdef AFS_DEMAND_ATTACH_FS
+/* Work out where everything goes in an arena for nblks entries. */
+static void
+cb_ArenaLayout(struct callback_arena_header *hdr, int nblks)
+{
+    afs_uint64 off, len;
+
+#define ARENA_ROUND(x) \
+    (((x) + CALLBACK_ARENA_ALIGN - 1) & ~((afs_uint64)CALLBACK_ARENA_ALIGN - 1))
+    hdr->nblks = nblks;
+    hdr->fe_size = sizeof(struct FileEntry);
+    hdr->cb_size = sizeof(struct CallBack);
+    hdr->fehash_max = FEHashMax;
+    len = ARENA_ROUND((afs_uint64)nblks * sizeof(struct FileEntry))
+	+ ARENA_ROUND((afs_uint64)nblks * sizeof(struct CallBack))
+	+ ARENA_ROUND((afs_uint64)FEHashMax * sizeof(afs_uint32));
+    hdr->nregions = (len + CALLBACK_ARENA_REGION - 1) / CALLBACK_ARENA_REGION;
+    off = CALLBACK_ARENA_ALIGN;
+    hdr->sums_offset = off;
+    off += ARENA_ROUND((afs_uint64)hdr->nregions * sizeof(afs_uint32));
+    hdr->fe_offset = off;
+    off += ARENA_ROUND((afs_uint64)nblks * sizeof(struct FileEntry));
+    hdr->cb_offset = off;
+    off += ARENA_ROUND((afs_uint64)nblks * sizeof(struct CallBack));
+    hdr->fehash_offset = off;
+    off += ARENA_ROUND((afs_uint64)FEHashMax * sizeof(afs_uint32));
+    hdr->size = off;
+#undef ARENA_ROUND
+}
+
+static afs_uint32
+cb_ArenaHeaderSum(struct callback_arena_header *hdr)
+{
+    struct callback_arena_header tmp;
+
+    tmp = *hdr;
+    tmp.hdr_sum = 0;
+    return opr_jhash((afs_uint32 *)&tmp, sizeof(tmp) / sizeof(afs_uint32), 0);
+}
+
+/* Map the callback arena, creating or resizing cbstate.dat as needed.  If
+ * it holds tables saved by the last fileserver that could be restored, they
+ * are left alone and the arena is marked pending; otherwise the caller must
+ * reset the tables.  Either way, the arena is marked as no longer clean.
+ * Returns non-zero if the arena cannot be used, in which case the tables
+ * are allocated in memory as usual. */
+static int
+cb_ArenaOpen(int nblks)
+{
+    const char *fn = AFSDIR_SERVER_CBSTATE_FILEPATH;
+    struct callback_arena_header layout, *hdr;
+    struct afs_stat status;
+    char *map = MAP_FAILED, *zeros = NULL;
+    afs_uint64 off;
+    ssize_t len;
+    int fd, restorable = 0;
+
+    memset(&layout, 0, sizeof(layout));
+    cb_ArenaLayout(&layout, nblks);
+    if ((size_t)layout.size != layout.size) {
+	ViceLog(0, ("InitCallBack: callback arena too large for this "
+		    "platform; keeping callbacks in memory\n"));
+	return 1;
+    }
+
+    fd = afs_open(fn, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if (fd < 0 || afs_fstat(fd, &status) < 0)
+	goto fail;
+
+    if (status.st_size != layout.size) {
+	/* Write out the whole file, so that running out of space shows up
+	 * now and not as a fault on some later store into the mapping. */
+	if (afs_ftruncate(fd, 0) < 0)
+	    goto fail;
+	zeros = calloc(1, CALLBACK_ARENA_ALIGN);
+	if (!zeros)
+	    goto fail;
+	if (afs_lseek(fd, 0, SEEK_SET) < 0)
+	    goto fail;
+	for (off = 0; off < layout.size; off += CALLBACK_ARENA_ALIGN) {
+	    len = write(fd, zeros, CALLBACK_ARENA_ALIGN);
+	    if (len != CALLBACK_ARENA_ALIGN)
+		goto fail;
+	}
+	free(zeros);
+	zeros = NULL;
+    }
+
+    map = afs_mmap(NULL, layout.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   fd, 0);
+    if (map == MAP_FAILED)
+	goto fail;
+    hdr = (struct callback_arena_header *)map;
+
+    if (fs_state.options.fs_state_restore
+	&& hdr->stamp.magic == CALLBACK_ARENA_MAGIC
+	&& hdr->stamp.version == CALLBACK_ARENA_VERSION
+	&& hdr->clean
+	&& hdr->hdr_sum == cb_ArenaHeaderSum(hdr)
+	&& hdr->nblks == layout.nblks
+	&& hdr->fe_size == layout.fe_size
+	&& hdr->cb_size == layout.cb_size
+	&& hdr->fehash_max == layout.fehash_max
+	&& hdr->nregions == layout.nregions
+	&& hdr->sums_offset == layout.sums_offset
+	&& hdr->fe_offset == layout.fe_offset
+	&& hdr->cb_offset == layout.cb_offset
+	&& hdr->fehash_offset == layout.fehash_offset
+	&& hdr->size == layout.size) {
+	restorable = 1;
+    } else {
+	layout.stamp.magic = CALLBACK_ARENA_MAGIC;
+	layout.stamp.version = CALLBACK_ARENA_VERSION;
+	*hdr = layout;
+    }
+
+    /* From here on the tables may change, so the next fileserver must not
+     * trust them until we have saved them again. */
+    hdr->clean = 0;
+    if (msync(map, CALLBACK_ARENA_ALIGN, MS_SYNC) < 0)
+	goto fail;
+
+    cbArena.fd = fd;
+    cbArena.map = map;
+    cbArena.size = layout.size;
+    cbArena.hdr = hdr;
+    cbArena.sums = (afs_uint32 *)(map + layout.sums_offset);
+    cbArena.pending = restorable;
+    FE = (struct FileEntry *)(map + layout.fe_offset) - 1;
+    CB = (struct CallBack *)(map + layout.cb_offset) - 1;
+    HashTable = (afs_uint32 *)(map + layout.fehash_offset);
+
+    ViceLog(0, ("InitCallBack: callback tables mapped from %s (%llu bytes)%s\n",
+		fn, (unsigned long long)layout.size,
+		restorable ? "; saved tables found" : ""));
+    return 0;
+
+ fail:
+    ViceLog(0, ("InitCallBack: cannot use callback arena %s (errno %d); "
+		"keeping callbacks in memory\n", fn, errno));
+    free(zeros);
+    if (map != MAP_FAILED)
+	munmap(map, layout.size);
+    if (fd >= 0) {
+	close(fd);
+	unlink(fn);
+    }
+    return 1;
+}
+#endif /* AFS_DEMAND_ATTACH_FS */
+
 /* initialize the callback package */
 int
 InitCallBack(int nblks)
 {
+    int i;
+
     opr_Assert(nblks > 0);
 
+    for (i = 0; i < FEHASH_LOCKS; i++)
+	opr_mutex_init(&FEHashStripes[i].lock);
+
     H_LOCK;
     tfirst = CBtime(time(NULL));
+    for (FEHashMax = FEHASH_SIZE; FEHashMax < nblks / FEHASH_LOAD;
+	 FEHashMax <<= 1)
+	;
+    cbstuff.nblks = nblks;
+    cbstuff.nbreakers = 0;
+
+#ifdef AFS_DEMAND_ATTACH_FS
+    if ((fs_state.options.fs_state_save || fs_state.options.fs_state_restore)
+	&& cb_ArenaOpen(nblks) == 0) {
+	if (cbArena.pending) {
+	    /* Leave the saved tables for cb_stateRestore.  Nothing can be
+	     * allocated from them until it has taken them over, or
+	     * cb_stateResetArena has thrown them away. */
+	    FEfree = CBfree = 0;
+	    cbstuff.nFEs = cbstuff.nCBs = nblks;
+	} else {
+	    ResetCallBackTables(nblks);
+	}
+	H_UNLOCK;
+	return 0;
+    }
+#endif
+
     /* N.B. The "-1", below, is because
      * FE[0] and CB[0] are not used--and not allocated */
     FE = calloc(nblks, sizeof(struct FileEntry));
@@ -433,19 +857,12 @@ InitCallBack(int nblks)
 	ViceLogThenPanic(0, ("Failed malloc in InitCallBack\n"));
     }
     FE--;  /* FE[0] is supposed to point to junk */
-    cbstuff.nFEs = nblks;
-    while (cbstuff.nFEs)
-	FreeFE(&FE[cbstuff.nFEs]);	/* This is correct */
     CB = calloc(nblks, sizeof(struct CallBack));
     if (!CB) {
 	ViceLogThenPanic(0, ("Failed malloc in InitCallBack\n"));
     }
     CB--;  /* CB[0] is supposed to point to junk */
-    cbstuff.nCBs = nblks;
-    while (cbstuff.nCBs)
-	FreeCB(&CB[cbstuff.nCBs]);	/* This is correct */
-    cbstuff.nblks = nblks;
-    cbstuff.nbreakers = 0;
+    ResetCallBackTables(nblks);
     H_UNLOCK;
     return 0;
 }
@@ -581,8 +998,6 @@ AddCallBack1_r(struct host *host, AFSFid * fid, afs_uint32 * thead, int type,
     host->z.Console &= ~2;
 
     if (!fe) {
-	afs_uint32 hash;
-
 	fe = newfe;
 	newfe = NULL;
 	fe->firstcb = 0;
@@ -591,9 +1006,7 @@ AddCallBack1_r(struct host *host, AFSFid * fid, afs_uint32 * thead, int type,
 	fe->unique = fid->Unique;
 	fe->ncbs = 0;
 	fe->status = 0;
-	hash = FEHash(fid->Volume, fid->Unique);
-	fe->fnext = HashTable[hash];
-	HashTable[hash] = fetoi(fe);
+	FEHashInsert(fe);
     }
     for (safety = 0, lastcb = cb = itocb(fe->firstcb); cb;
 	 lastcb = cb, cb = itocb(cb->cnext), safety++) {
@@ -637,6 +1050,8 @@ AddCallBack1_r(struct host *host, AFSFid * fid, afs_uint32 * thead, int type,
 	FreeCB(newcb);
     if (newfe)
 	FreeFE(newfe);
+    else
+	FEHashGrow();
 
     if (!locked)		/* freecb and freefe might(?) yield */
 	h_Unlock_r(host);
@@ -791,6 +1206,354 @@ MultiBreakCallBack_r(struct cbstruct cba[], int ncbas,
     return;
 }
 
+/*
+ * Asynchronous callback breaks.
+ *
+ * With -cbbreakthreads, BreakCallBack does not make the CallBack RPCs
+ * itself.  Each break is queued on the host it is for, and a pool of break
+ * threads sends each host's queue in batches of up to AFSCBMAX fids per
+ * RPC, so a writer waits only for its breaks to be queued and never for a
+ * slow or dead client.  A host whose RPC fails is tried again every
+ * CBB_RETRY until its oldest break is CBB_DEADLINE old; then the host is
+ * marked down and its breaks become delayed breaks, just as a failed
+ * synchronous break would.  When all the queue entries are in use writers
+ * wait for the break threads to catch up.
+ *
+ * A host with breaks queued is held, and sits on the cbBreakQ list of hosts
+ * waiting for a thread unless a thread is already sending to it; only one
+ * thread sends to a host at a time, so its breaks go out in order.  All of
+ * this is protected by H_LOCK.
+ */
+static struct {
+    int nthreads;		/* break threads; 0 to break synchronously */
+    int draining;		/* shutting down; break synchronously */
+    int nbusy;			/* threads sending breaks */
+    struct host *first, *last;	/* hosts waiting for a thread */
+    struct cbBreak *free;	/* unused queue entries */
+    pthread_cond_t work;	/* a host is waiting for a thread */
+    pthread_cond_t space;	/* queue entries were freed */
+    pthread_cond_t idle;	/* nothing is queued */
+} cbBreakQ;
+
+static afs_uint32
+CBBNow(void)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return now.tv_sec * 1000 + now.tv_usec / 1000;
+}
+
+/* Put a held host with breaks queued on the list waiting for a thread. */
+static void
+CBBReady_r(struct host *host)
+{
+    host->z.breakstate = CBB_READY;
+    host->z.breaknext = NULL;
+    if (cbBreakQ.last)
+	cbBreakQ.last->z.breaknext = host;
+    else
+	cbBreakQ.first = host;
+    cbBreakQ.last = host;
+    opr_cv_signal(&cbBreakQ.work);
+}
+
+/*
+ * Queue a break of fid for host.  Returns non-zero, without queueing
+ * anything, if the break must be made synchronously instead.
+ */
+static int
+CBBQueue_r(struct host *host, AFSFid * fid, afs_uint32 thead)
+{
+    struct cbBreak *cbb = cbBreakQ.free;
+
+    if (!cbBreakQ.nthreads || cbBreakQ.draining || !cbb)
+	return 1;
+    cbBreakQ.free = cbb->next;
+
+    cbb->next = NULL;
+    cbb->fid = *fid;
+    cbb->thead = thead;
+    cbb->queued = CBBNow();
+    if (!host->z.breakq)
+	host->z.breakqtail = &host->z.breakq;
+    *host->z.breakqtail = cbb;
+    host->z.breakqtail = &cbb->next;
+
+    if (host->z.breakstate == CBB_IDLE) {
+	h_Hold_r(host);
+	CBBReady_r(host);
+    }
+    if (++cbstuff.nBreakQueued > cbstuff.BreakQueueHigh)
+	cbstuff.BreakQueueHigh = cbstuff.nBreakQueued;
+    return 0;
+}
+
+/*
+ * If the queues are full, wait for the break threads to make room.  Returns
+ * non-zero if we waited, and so dropped H_LOCK.
+ */
+static int
+CBBWaitForSpace_r(void)
+{
+    if (!cbBreakQ.nthreads || cbBreakQ.draining || cbBreakQ.free)
+	return 0;
+    cbstuff.BreakStalls++;
+    do {
+	opr_cv_wait(&cbBreakQ.space, &host_glock_mutex);
+    } while (!cbBreakQ.draining && !cbBreakQ.free);
+    return 1;
+}
+
+static void
+CBBFree_r(struct cbBreak *cbb)
+{
+    cbb->next = cbBreakQ.free;
+    cbBreakQ.free = cbb;
+    cbstuff.nBreakQueued--;
+}
+
+/*
+ * Take the next host whose breaks may be sent now off the list, waiting for
+ * one if need be.
+ */
+static struct host *
+CBBNextHost_r(void)
+{
+    struct host *host, *prev;
+    struct timeval tv;
+    struct timespec until;
+    afs_uint32 now;
+    afs_int32 wait;
+
+    for (;;) {
+	now = CBBNow();
+	wait = 0;
+	for (prev = NULL, host = cbBreakQ.first; host;
+	     prev = host, host = host->z.breaknext) {
+	    afs_int32 left = host->z.breakwhen - now;
+
+	    if (left <= 0) {
+		if (prev)
+		    prev->z.breaknext = host->z.breaknext;
+		else
+		    cbBreakQ.first = host->z.breaknext;
+		if (cbBreakQ.last == host)
+		    cbBreakQ.last = prev;
+		host->z.breaknext = NULL;
+		return host;
+	    }
+	    if (!wait || left < wait)
+		wait = left;
+	}
+	if (!wait) {
+	    opr_cv_wait(&cbBreakQ.work, &host_glock_mutex);
+	} else {
+	    /* every waiting host is backing off after a failure */
+	    gettimeofday(&tv, NULL);
+	    until.tv_sec = tv.tv_sec + wait / 1000;
+	    until.tv_nsec = tv.tv_usec * 1000 + (wait % 1000) * 1000000;
+	    if (until.tv_nsec >= 1000000000) {
+		until.tv_sec++;
+		until.tv_nsec -= 1000000000;
+	    }
+	    opr_cv_timedwait(&cbBreakQ.work, &host_glock_mutex, &until);
+	}
+    }
+}
+
+/*
+ * We could not reach host before the deadline, or it is already known to be
+ * down: mark it down, and turn the breaks in batch and all those still
+ * queued for it into delayed breaks, to be sent when it next talks to us.
+ */
+static void
+CBBGiveUp_r(struct host *host, struct cbBreak **batch, int n)
+{
+    struct cbBreak *cbb;
+    char hoststr[16];
+    int i, ndelayed = 0;
+
+    h_Lock_r(host);
+    if (!(host->z.hostFlags & HOSTDELETED)) {
+	ViceLog(7, ("BCB: Host %p (%s:%d) is down; delaying its queued "
+		    "breaks\n", host, afs_inet_ntoa_r(host->z.host, hoststr),
+		    ntohs(host->z.port)));
+	host->z.hostFlags |= VENUSDOWN;
+    }
+    for (i = 0; i < n; i++) {
+	if (!(host->z.hostFlags & HOSTDELETED)) {
+	    AddCallBack1_r(host, &batch[i]->fid, itot(batch[i]->thead),
+			   CB_DELAYED, 1);
+	    ndelayed++;
+	}
+	CBBFree_r(batch[i]);
+    }
+    while ((cbb = host->z.breakq) != NULL) {
+	host->z.breakq = cbb->next;
+	if (!(host->z.hostFlags & HOSTDELETED)) {
+	    AddCallBack1_r(host, &cbb->fid, itot(cbb->thead), CB_DELAYED, 1);
+	    ndelayed++;
+	}
+	CBBFree_r(cbb);
+    }
+    host->z.breakqtail = &host->z.breakq;
+    h_Unlock_r(host);
+    cbstuff.BreakDelayed += ndelayed;
+}
+
+static void *
+CallBackBreakThread(void *unused)
+{
+    static struct AFSCBs tc = { 0, 0 };
+    struct cbBreak *batch[AFSCBMAX];
+    AFSFid fids[AFSCBMAX];
+    struct AFSCBFids tf;
+    struct rx_connection *conn;
+    struct host *host;
+    afs_uint32 now, latency;
+    int i, n, code;
+
+    rx_SetThreadNum();
+    afs_pthread_setname_self("CallBackBreaker");
+
+    H_LOCK;
+    for (;;) {
+	host = CBBNextHost_r();
+	host->z.breakstate = CBB_BUSY;
+	cbBreakQ.nbusy++;
+
+	if (host->z.hostFlags & (HOSTDELETED | VENUSDOWN)) {
+	    CBBGiveUp_r(host, NULL, 0);
+	    goto next;
+	}
+
+	for (n = 0; n < AFSCBMAX && host->z.breakq; n++) {
+	    batch[n] = host->z.breakq;
+	    host->z.breakq = batch[n]->next;
+	    fids[n] = batch[n]->fid;
+	}
+	if (!host->z.breakq)
+	    host->z.breakqtail = &host->z.breakq;
+	tf.AFSCBFids_len = n;
+	tf.AFSCBFids_val = fids;
+
+	conn = host->z.callback_rxcon;
+	rx_GetConnection(conn);
+	rx_SetConnDeadTime(conn, 4);
+	rx_SetConnHardDeadTime(conn, AFS_HARDDEADTIME);
+	cbstuff.nbreakers++;
+	H_UNLOCK;
+	code = RXAFSCB_CallBack(conn, &tf, &tc);
+	rx_PutConnection(conn);
+	H_LOCK;
+	cbstuff.nbreakers--;
+
+	/* try breaking callbacks on alternate interface addresses */
+	if (code && !(host->z.hostFlags & HOSTDELETED)
+	    && MultiBreakCallBackAlternateAddress_r(host, &tf) == 0)
+	    code = 0;
+
+	now = CBBNow();
+	if (!code) {
+	    cbstuff.BreakRPCs++;
+	    cbstuff.BreakFids += n;
+	    for (i = 0; i < n; i++) {
+		latency = now - batch[i]->queued;
+		cbstuff.BreakLatency += latency;
+		if (latency > cbstuff.BreakLatencyMax)
+		    cbstuff.BreakLatencyMax = latency;
+		CBBFree_r(batch[i]);
+	    }
+	} else if ((afs_int32)(now - batch[0]->queued) < CBB_DEADLINE
+		   && !(host->z.hostFlags & (HOSTDELETED | VENUSDOWN))) {
+	    /* put them back at the front and try again a little later */
+	    batch[n - 1]->next = host->z.breakq;
+	    if (!host->z.breakq)
+		host->z.breakqtail = &batch[n - 1]->next;
+	    host->z.breakq = batch[0];
+	    host->z.breakwhen = now + CBB_RETRY;
+	    cbstuff.BreakRetries++;
+	} else {
+	    CBBGiveUp_r(host, batch, n);
+	}
+
+      next:
+	cbBreakQ.nbusy--;
+	if (host->z.breakq) {
+	    CBBReady_r(host);
+	} else {
+	    host->z.breakstate = CBB_IDLE;
+	    h_Release_r(host);
+	}
+	opr_cv_broadcast(&cbBreakQ.space);
+	if (!cbstuff.nBreakQueued && !cbBreakQ.nbusy)
+	    opr_cv_broadcast(&cbBreakQ.idle);
+    }
+    H_UNLOCK;
+    return NULL;
+}
+
+/* Start nthreads threads to break callbacks asynchronously. */
+int
+InitCallBackBreakers(int nthreads)
+{
+    struct cbBreak *cbbs;
+    pthread_attr_t tattr;
+    pthread_t tid;
+    int i, n;
+
+    if (nthreads <= 0)
+	return 0;
+
+    n = nthreads * CBB_PERTHREAD;
+    cbbs = calloc(n, sizeof(struct cbBreak));
+    if (!cbbs) {
+	ViceLogThenPanic(0, ("Failed malloc in InitCallBackBreakers\n"));
+    }
+    opr_cv_init(&cbBreakQ.work);
+    opr_cv_init(&cbBreakQ.space);
+    opr_cv_init(&cbBreakQ.idle);
+
+    H_LOCK;
+    for (i = 0; i < n; i++) {
+	cbbs[i].next = cbBreakQ.free;
+	cbBreakQ.free = &cbbs[i];
+    }
+    cbBreakQ.nthreads = nthreads;
+    H_UNLOCK;
+
+    opr_Verify(pthread_attr_init(&tattr) == 0);
+    opr_Verify(pthread_attr_setdetachstate(&tattr,
+					   PTHREAD_CREATE_DETACHED) == 0);
+    for (i = 0; i < nthreads; i++)
+	opr_Verify(pthread_create(&tid, &tattr, CallBackBreakThread,
+				  NULL) == 0);
+    ViceLog(0, ("Started %d callback break threads\n", nthreads));
+    return 0;
+}
+
+/*
+ * Make any further breaks synchronously, and wait for the break threads to
+ * send (or give up on) everything already queued, so that no break is lost
+ * across a restart.
+ */
+void
+ShutDownCallBackBreaks(void)
+{
+    H_LOCK;
+    if (cbBreakQ.nthreads) {
+	cbBreakQ.draining = 1;
+	opr_cv_broadcast(&cbBreakQ.space);
+	if (cbstuff.nBreakQueued || cbBreakQ.nbusy)
+	    ViceLog(0, ("Waiting for %d queued callback breaks\n",
+			cbstuff.nBreakQueued));
+	while (cbstuff.nBreakQueued || cbBreakQ.nbusy)
+	    opr_cv_wait(&cbBreakQ.idle, &host_glock_mutex);
+    }
+    H_UNLOCK;
+}
+
 /*
  * Break all call backs for fid, except for the specified host (unless flag
  * is true, in which case all get a callback message. Assumption: the specified
@@ -822,8 +1585,12 @@ BreakCallBack(struct host *xhost, AFSFid * fid, int flag)
 		("BCB: BreakCallBack(No Host, (%u,%u,%u))\n",
 		fid->Volume, fid->Vnode, fid->Unique));
 
+    if (!FEExists(fid, 0))
+	return 0;
+
     H_LOCK;
     cbstuff.BreakCallBacks++;
+  again:
     fe = FindFE(fid);
     if (!fe) {
 	goto done;
@@ -834,6 +1601,8 @@ BreakCallBack(struct host *xhost, AFSFid * fid, int flag)
 	/* the most common case is what follows the || */
 	goto done;
     }
+    if (CBBWaitForSpace_r())
+	goto again;
     tf.AFSCBFids_len = 1;
     tf.AFSCBFids_val = fid;
 
@@ -871,7 +1640,10 @@ BreakCallBack(struct host *xhost, AFSFid * fid, int flag)
 			     ntohs(thishost->z.port)));
 		    cb->status = CB_DELAYED;
 		} else {
-		    if (!(thishost->z.hostFlags & HOSTDELETED)) {
+		    /* queue the break for a break thread if we can, else
+		     * make it ourselves */
+		    if (!(thishost->z.hostFlags & HOSTDELETED)
+			&& CBBQueue_r(thishost, fid, cb->thead)) {
 			h_Hold_r(thishost);
 			cba[ncbas].hp = thishost;
 			cba[ncbas].thead = cb->thead;
@@ -960,6 +1732,13 @@ DeleteFileCallBacks(AFSFid * fid)
     afs_uint32 cbi;
     int n;
 
+    if (!FEExists(fid, 1)) {
+	ViceLog(8,
+		("DF: No fid (%u,%u,%u) to delete\n", fid->Volume, fid->Vnode,
+		 fid->Unique));
+	return 0;
+    }
+
     H_LOCK;
     cbstuff.DeleteFiles++;
     fe = FindFE(fid);
@@ -1229,7 +2008,7 @@ BreakVolumeCallBacksLater(VolumeId volume)
     ViceLog(25, ("Setting later on volume %" AFS_VOLID_FMT "\n",
 		 afs_printable_VolumeId_lu(volume)));
     H_LOCK;
-    for (hash = 0; hash < FEHASH_SIZE; hash++) {
+    for (hash = 0; hash < FEHashSize; hash++) {
 	for (feip = &HashTable[hash]; (fe = itofe(*feip)) != NULL; ) {
 	    if (fe->volid == volume) {
 		struct CallBack *cbnext;
@@ -1281,7 +2060,8 @@ BreakLaterCallBacks(void)
     /* Pick the first volume we see to clean up */
     fid.Volume = fid.Vnode = fid.Unique = 0;
 
-    for (hash = 0; hash < FEHASH_SIZE; hash++) {
+    for (hash = 0; hash < FEHashSize; hash++) {
+	opr_mutex_enter(&FEHashStripes[hash & (FEHASH_LOCKS - 1)].lock);
 	for (feip = &HashTable[hash]; (fe = itofe(*feip)) != NULL; ) {
 	    if (fe && (fe->status & FE_LATER)
 		&& (fid.Volume == 0 || fid.Volume == fe->volid)) {
@@ -1300,6 +2080,7 @@ BreakLaterCallBacks(void)
 	    } else
 		feip = &fe->fnext;
 	}
+	opr_mutex_exit(&FEHashStripes[hash & (FEHASH_LOCKS - 1)].lock);
     }
     FSYNC_UNLOCK;
 
@@ -1688,12 +2469,20 @@ PrintCallBackStats(void)
 	    cbstuff.nblks);
     fprintf(stderr, "%d GSS1, %d GSS2, %d GSS3, %d GSS4, %d GSS5 (internal counters)\n",
 	    cbstuff.GSS1, cbstuff.GSS2, cbstuff.GSS3, cbstuff.GSS4, cbstuff.GSS5);
+    if (cbstuff.BreakRPCs || cbstuff.nBreakQueued)
+	fprintf(stderr, "%d queued breaks (at most %d), %d fids broken by %d RPCs in %d ms, %d retries, %d delayed, %d stalls\n",
+		cbstuff.nBreakQueued, cbstuff.BreakQueueHigh, cbstuff.BreakFids,
+		cbstuff.BreakRPCs, cbstuff.BreakLatency, cbstuff.BreakRetries,
+		cbstuff.BreakDelayed, cbstuff.BreakStalls);
 
     return 0;
 }
 
 #define MAGIC 0x12345678	/* To check byte ordering of dump when it is read in */
 #define MAGICV2 0x12345679      /* To check byte ordering & version of dump when it is read in */
+#define MAGICV3 0x1234567a      /* As MAGICV2, and the hash table size precedes the table */
+/* Dumps hold only the counters that predate the break queue */
+#define CBCOUNTERS_DUMPSIZE offsetof(struct cbcounters, nBreakQueued)
 
 
 #ifndef INTERPRET_DUMP
@@ -1732,6 +2521,10 @@ static int cb_stateCheckHeader(struct callback_state_header * hdr);
 
 static int cb_stateAllocMap(struct fs_dump_state * state);
 
+static int cb_stateSaveArena(struct fs_dump_state * state);
+static int cb_stateRestoreArena(struct fs_dump_state * state);
+static int cb_stateRestoreArenaIndices(struct fs_dump_state * state);
+
 int
 cb_stateSave(struct fs_dump_state * state)
 {
@@ -1755,16 +2548,24 @@ cb_stateSave(struct fs_dump_state * state)
 	goto done;
     }
 
-    /* dump fe hashtable state */
-    if (cb_stateSaveFEHash(state)) {
-	ret = 1;
-	goto done;
-    }
+    if (cbArena.map) {
+	/* the FEs, CBs and hash table stay in the arena */
+	if (cb_stateSaveArena(state)) {
+	    ret = 1;
+	    goto done;
+	}
+    } else {
+	/* dump fe hashtable state */
+	if (cb_stateSaveFEHash(state)) {
+	    ret = 1;
+	    goto done;
+	}
 
-    /* dump callback state */
-    if (cb_stateSaveFEs(state)) {
-	ret = 1;
-	goto done;
+	/* dump callback state */
+	if (cb_stateSaveFEs(state)) {
+	    ret = 1;
+	    goto done;
+	}
     }
 
     /* write the callback state header to disk */
@@ -1795,6 +2596,16 @@ cb_stateRestore(struct fs_dump_state * state)
 	goto done;
     }
 
+    if (state->cb_hdr->arena) {
+	/* cb_stateCheckArena has already checked the arena over */
+	if (cb_stateRestoreTimeouts(state) || cb_stateRestoreArena(state)) {
+	    ret = 1;
+	    goto done;
+	}
+	tfirst = state->cb_hdr->tfirst;
+	goto done;
+    }
+
     if (cb_stateAllocMap(state)) {
 	ret = 1;
 	goto done;
@@ -1830,6 +2641,9 @@ cb_stateRestoreIndices(struct fs_dump_state * state)
     struct FileEntry * fe;
     struct CallBack * cb;
 
+    if (state->flags.cb_arena)
+	return cb_stateRestoreArenaIndices(state);
+
     /* restore indices in the FileEntry structures */
     for (i = 1; i < state->fe_map.len; i++) {
 	if (state->fe_map.entries[i].new_idx) {
@@ -1941,7 +2755,7 @@ cb_stateVerifyFEHash(struct fs_dump_state * state)
     struct FileEntry * fe;
     afs_uint32 fei, chain_len;
 
-    for (i = 0; i < FEHASH_SIZE; i++) {
+    for (i = 0; i < FEHashSize; i++) {
 	chain_len = 0;
 	for (fei = HashTable[i], fe = itofe(fei);
 	     fe;
@@ -2229,14 +3043,14 @@ cb_stateSaveFEHash(struct fs_dump_state * state)
 
     memset(state->cb_fehash_hdr, 0, sizeof(struct callback_state_fehash_header));
     state->cb_fehash_hdr->magic = CALLBACK_STATE_FEHASH_MAGIC;
-    state->cb_fehash_hdr->records = FEHASH_SIZE;
+    state->cb_fehash_hdr->records = FEHashSize;
     state->cb_fehash_hdr->len = sizeof(struct callback_state_fehash_header) +
 	(state->cb_fehash_hdr->records * sizeof(afs_uint32));
 
     iov[0].iov_base = (char *)state->cb_fehash_hdr;
     iov[0].iov_len = sizeof(struct callback_state_fehash_header);
     iov[1].iov_base = (char *)HashTable;
-    iov[1].iov_len = sizeof(HashTable);
+    iov[1].iov_len = FEHashSize * sizeof(afs_uint32);
 
     if (fs_stateSeek(state, &state->cb_hdr->fehash_offset)) {
 	ret = 1;
@@ -2257,7 +3071,8 @@ cb_stateSaveFEHash(struct fs_dump_state * state)
 static int
 cb_stateRestoreFEHash(struct fs_dump_state * state)
 {
-    int ret = 0, len;
+    int ret = 0;
+    afs_uint32 records, len;
 
     if (fs_stateReadHeader(state, &state->cb_hdr->fehash_offset,
 			   state->cb_fehash_hdr,
@@ -2270,12 +3085,19 @@ cb_stateRestoreFEHash(struct fs_dump_state * state)
 	ret = 1;
 	goto done;
     }
-    if (state->cb_fehash_hdr->records != FEHASH_SIZE) {
+    /* The table may have been saved by a fileserver with a different -cb,
+     * or one that had grown it further; its chains are only valid for the
+     * size they were hashed with, so take on that size. */
+    records = state->cb_fehash_hdr->records;
+    if (records < FEHASH_SIZE || records > FEHASH_SIZE_MAX
+	|| (records & (records - 1)) != 0) {
+	ViceLog(0, ("cb_stateRestoreFEHash: invalid hash table size %u\n",
+		    records));
 	ret = 1;
 	goto done;
     }
 
-    len = state->cb_fehash_hdr->records * sizeof(afs_uint32);
+    len = records * sizeof(afs_uint32);
 
     if (state->cb_fehash_hdr->len !=
 	(sizeof(struct callback_state_fehash_header) + len)) {
@@ -2283,6 +3105,15 @@ cb_stateRestoreFEHash(struct fs_dump_state * state)
 	goto done;
     }
 
+    if (records != FEHashSize) {
+	if (FEHashAlloc(records)) {
+	    ret = 1;
+	    goto done;
+	}
+	if (FEHashMax < records)
+	    FEHashMax = records;
+    }
+
     if (fs_stateRead(state, HashTable, len)) {
 	ret = 1;
 	goto done;
@@ -2301,7 +3132,7 @@ cb_stateSaveFEs(struct fs_dump_state * state)
 
     AssignInt64(state->eof_offset, &state->cb_hdr->fe_offset);
 
-    for (hash = 0; hash < FEHASH_SIZE ; hash++) {
+    for (hash = 0; hash < FEHashSize ; hash++) {
 	for (fei = HashTable[hash]; fei; fei = fe->fnext) {
 	    fe = itofe(fei);
 	    if (cb_stateSaveFE(state, fe)) {
@@ -2520,6 +3351,11 @@ cb_stateFillHeader(struct callback_state_header * hdr)
     hdr->stamp.magic = CALLBACK_STATE_MAGIC;
     hdr->stamp.version = CALLBACK_STATE_VERSION;
     hdr->tfirst = tfirst;
+    if (cbArena.map) {
+	hdr->arena = 1;
+	hdr->arena_generation = cbArena.hdr->generation;
+	hdr->arena_timestamp = cbArena.hdr->timestamp;
+    }
     return 0;
 }
 
@@ -2530,7 +3366,9 @@ cb_stateCheckHeader(struct callback_state_header * hdr)
 
     if (hdr->stamp.magic != CALLBACK_STATE_MAGIC) {
 	ret = 1;
-    } else if (hdr->stamp.version != CALLBACK_STATE_VERSION) {
+    } else if (hdr->stamp.version != CALLBACK_STATE_VERSION
+	       && hdr->stamp.version != 1) {
+	/* version 1 is version 2 without the arena */
 	ret = 1;
     } else if ((hdr->nFEs > cbstuff.nblks) || (hdr->nCBs > cbstuff.nblks)) {
 	ViceLog(0, ("cb_stateCheckHeader: saved callback state larger than callback memory allocation\n"));
@@ -2626,6 +3464,17 @@ fe_OldToNew(struct fs_dump_state * state, afs_uint32 old, afs_uint32 * new)
 	goto done;
     }
 
+    /* FEs restored from the arena keep their indices */
+    if (state->flags.cb_arena) {
+	if (old > cbstuff.nblks) {
+	    ViceLog(0, ("fe_OldToNew: index %d is out of range\n", old));
+	    ret = 1;
+	} else {
+	    *new = old;
+	}
+	goto done;
+    }
+
     if (old >= state->fe_map.len) {
 	ViceLog(0, ("fe_OldToNew: index %d is out of range\n", old));
 	ret = 1;
@@ -2652,6 +3501,20 @@ cb_OldToNew(struct fs_dump_state * state, afs_uint32 old, afs_uint32 * new)
 	goto done;
     }
 
+    /* as do CBs */
+    if (state->flags.cb_arena) {
+	if (old > cbstuff.nblks) {
+	    ViceLog(0, ("cb_OldToNew: index %d is out of range\n", old));
+	    ret = 1;
+	} else if (!itocb(old)->status) {
+	    ViceLog(0, ("cb_OldToNew: index %d points to a free CallBack record\n", old));
+	    ret = 1;
+	} else {
+	    *new = old;
+	}
+	goto done;
+    }
+
     if (old >= state->cb_map.len) {
 	ViceLog(0, ("cb_OldToNew: index %d is out of range\n", old));
 	ret = 1;
@@ -2666,6 +3529,251 @@ cb_OldToNew(struct fs_dump_state * state, afs_uint32 old, afs_uint32 * new)
  done:
     return ret;
 }
+
+/*
+ * callback arena routines
+ */
+
+struct cbArenaSumJob {
+    afs_uint32 first;		/* first region */
+    afs_uint32 last;		/* one past the last region */
+    int verify;			/* check the sums rather than set them */
+    afs_uint32 nbad;		/* regions that did not match */
+};
+
+static void *
+cb_ArenaSumThread(void *rock)
+{
+    struct cbArenaSumJob *job = rock;
+    char *base = cbArena.map + cbArena.hdr->fe_offset;
+    afs_uint64 len = cbArena.size - cbArena.hdr->fe_offset;
+    afs_uint64 off, n;
+    afs_uint32 i, sum;
+
+    for (i = job->first; i < job->last; i++) {
+	off = (afs_uint64)i * CALLBACK_ARENA_REGION;
+	n = len - off;
+	if (n > CALLBACK_ARENA_REGION)
+	    n = CALLBACK_ARENA_REGION;
+	sum = opr_jhash((afs_uint32 *)(base + off), n / sizeof(afs_uint32), i);
+	if (!job->verify)
+	    cbArena.sums[i] = sum;
+	else if (cbArena.sums[i] != sum)
+	    job->nbad++;
+    }
+    return NULL;
+}
+
+/* Set (or, if verify is set, check) the checksum of each region of the
+ * tables in the arena, spread over up to one thread per processor.
+ * Returns the number of regions whose checksums did not match. */
+static afs_uint32
+cb_ArenaSum(int verify)
+{
+    struct cbArenaSumJob jobs[CALLBACK_ARENA_MAX_THREADS];
+    pthread_t tids[CALLBACK_ARENA_MAX_THREADS];
+    int started[CALLBACK_ARENA_MAX_THREADS];
+    afs_uint32 nregions = cbArena.hdr->nregions, per, nbad = 0;
+    long nthreads = 1;
+    int i;
+
+#ifdef _SC_NPROCESSORS_ONLN
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (nthreads > CALLBACK_ARENA_MAX_THREADS)
+	nthreads = CALLBACK_ARENA_MAX_THREADS;
+    if (nthreads > nregions)
+	nthreads = nregions;
+    if (nthreads < 1)
+	nthreads = 1;
+    per = (nregions + nthreads - 1) / nthreads;
+
+    for (i = 0; i < nthreads; i++) {
+	jobs[i].first = i * per;
+	jobs[i].last = jobs[i].first + per;
+	if (jobs[i].first > nregions)
+	    jobs[i].first = nregions;
+	if (jobs[i].last > nregions)
+	    jobs[i].last = nregions;
+	jobs[i].verify = verify;
+	jobs[i].nbad = 0;
+	/* this thread takes the first share, and any a thread could not be
+	 * started for */
+	started[i] = (i > 0
+		      && pthread_create(&tids[i], NULL, cb_ArenaSumThread,
+					&jobs[i]) == 0);
+    }
+    for (i = 0; i < nthreads; i++) {
+	if (!started[i])
+	    cb_ArenaSumThread(&jobs[i]);
+    }
+    for (i = 0; i < nthreads; i++) {
+	if (started[i])
+	    opr_Verify(pthread_join(tids[i], NULL) == 0);
+	nbad += jobs[i].nbad;
+    }
+    return nbad;
+}
+
+/* Write out the tables in the arena and mark it clean.  Only the pages
+ * changed since the kernel last wrote them back have to go to disk, so
+ * this costs far less than serializing every FE and CB. */
+static int
+cb_stateSaveArena(struct fs_dump_state * state)
+{
+    struct callback_arena_header *hdr = cbArena.hdr;
+
+    hdr->clean = 0;
+    hdr->verified = state->flags.verified;
+    if (++hdr->generation == 0)
+	hdr->generation = 1;
+    hdr->timestamp = time(NULL);
+    hdr->fehash_size = FEHashSize;
+    hdr->fe_free = FEfree;
+    hdr->cb_free = CBfree;
+    hdr->nFEs = cbstuff.nFEs;
+    hdr->nCBs = cbstuff.nCBs;
+
+    cb_ArenaSum(0);
+    hdr->sums_sum = opr_jhash(cbArena.sums, hdr->nregions, 0);
+    if (msync(cbArena.map, cbArena.size, MS_SYNC) < 0) {
+	ViceLog(0, ("cb_stateSaveArena: failed to sync callback arena (errno %d)\n",
+		    errno));
+	return 1;
+    }
+
+    /* only now that everything else is on disk may the header say so */
+    hdr->clean = 1;
+    hdr->hdr_sum = cb_ArenaHeaderSum(hdr);
+    if (msync(cbArena.map, CALLBACK_ARENA_ALIGN, MS_SYNC) < 0) {
+	ViceLog(0, ("cb_stateSaveArena: failed to sync callback arena header (errno %d)\n",
+		    errno));
+	hdr->clean = 0;
+	return 1;
+    }
+    return 0;
+}
+
+/* Before anything is restored, check that the arena holds the tables that
+ * were saved along with this dump.  Returns non-zero if the dump needs
+ * them, but they cannot be used.  If the dump was made without the arena,
+ * whatever is in the arena is thrown away. */
+int
+cb_stateCheckArena(struct fs_dump_state * state)
+{
+    struct callback_arena_header *hdr = cbArena.hdr;
+    struct callback_state_header *cb_hdr = state->cb_hdr;
+    afs_uint32 nbad;
+
+    if (fs_stateReadHeader(state, &state->hdr->cb_offset, cb_hdr,
+			   sizeof(struct callback_state_header))) {
+	return 1;
+    }
+    if (cb_hdr->stamp.magic != CALLBACK_STATE_MAGIC
+	|| cb_hdr->stamp.version < 2 || !cb_hdr->arena) {
+	/* cb_stateRestore will sort out anything else wrong with it */
+	cb_stateResetArena();
+	return 0;
+    }
+
+    if (!cbArena.pending) {
+	ViceLog(0, ("cb_stateCheckArena: callback arena %s does not hold saved tables\n",
+		    AFSDIR_SERVER_CBSTATE_FILEPATH));
+	return 1;
+    }
+    if (hdr->generation != cb_hdr->arena_generation
+	|| hdr->timestamp != cb_hdr->arena_timestamp) {
+	ViceLog(0, ("cb_stateCheckArena: callback arena was saved at a different time than %s\n",
+		    state->fn));
+	return 1;
+    }
+    if (hdr->fe_free > hdr->nblks || hdr->cb_free > hdr->nblks
+	|| hdr->nFEs > hdr->nblks || hdr->nCBs > hdr->nblks
+	|| hdr->fehash_size < FEHASH_SIZE || hdr->fehash_size > hdr->fehash_max
+	|| (hdr->fehash_size & (hdr->fehash_size - 1)) != 0) {
+	ViceLog(0, ("cb_stateCheckArena: callback arena header is inconsistent\n"));
+	return 1;
+    }
+    if (opr_jhash(cbArena.sums, hdr->nregions, 0) != hdr->sums_sum) {
+	ViceLog(0, ("cb_stateCheckArena: callback arena checksums are corrupt\n"));
+	return 1;
+    }
+    nbad = cb_ArenaSum(1);
+    if (nbad) {
+	ViceLog(0, ("cb_stateCheckArena: %u of %u callback arena regions failed their checksums\n",
+		    nbad, hdr->nregions));
+	return 1;
+    }
+    ViceLog(0, ("cb_stateCheckArena: callback arena checksums match (%u regions)\n",
+		hdr->nregions));
+    return 0;
+}
+
+/* Throw away any saved tables in the arena that were not restored, so that
+ * the fileserver starts without callbacks.  Called with H_LOCK held. */
+void
+cb_stateResetArena(void)
+{
+    if (!cbArena.pending)
+	return;
+    cbArena.pending = 0;
+    ResetCallBackTables(cbstuff.nblks);
+    ViceLog(0, ("cb_stateResetArena: saved callback tables not restored; discarded\n"));
+}
+
+/* Take over the tables checked by cb_stateCheckArena as they are. */
+static int
+cb_stateRestoreArena(struct fs_dump_state * state)
+{
+    struct callback_arena_header *hdr = cbArena.hdr;
+
+    if (!cbArena.pending) {
+	ViceLog(0, ("cb_stateRestoreArena: no saved tables in the callback arena\n"));
+	return 1;
+    }
+    FEfree = hdr->fe_free;
+    CBfree = hdr->cb_free;
+    cbstuff.nFEs = hdr->nFEs;
+    cbstuff.nCBs = hdr->nCBs;
+    FEHashLockAll();
+    FEHashSize = hdr->fehash_size;
+    FEHashMask = FEHashSize - 1;
+    FEHashUnlockAll();
+    cbArena.pending = 0;
+    state->flags.cb_arena = 1;
+    state->flags.verified = hdr->verified;
+    return 0;
+}
+
+/* The FEs and CBs in the arena keep their indices, so only the host index
+ * in each CB needs to change.  The CBs of hosts that were not restored are
+ * dropped. */
+static int
+cb_stateRestoreArenaIndices(struct fs_dump_state * state)
+{
+    afs_uint32 i, dropped = 0;
+    struct CallBack *cb;
+
+    for (i = 1; i <= cbstuff.nblks; i++) {
+	cb = itocb(i);
+	if (!cb->status)
+	    continue;
+	if (cb->hhead < state->h_map.len &&
+	    state->h_map.entries[cb->hhead].valid == FS_STATE_IDX_SKIPPED) {
+	    TDel(cb);
+	    CDel(cb, 1);
+	    dropped++;
+	    continue;
+	}
+	if (h_OldToNew(state, cb->hhead, &cb->hhead))
+	    return 1;
+    }
+    if (dropped) {
+	ViceLog(0, ("cb_stateRestoreIndices: dropped %u callbacks of hosts that were not restored\n",
+		    dropped));
+    }
+    return 0;
+}
 #endif /* AFS_DEMAND_ATTACH_FS */
 
 #define DumpBytes(fd,buf,req) if (write(fd, buf, req) < 0) {} /* don't care */
@@ -2674,7 +3782,7 @@ static int
 DumpCallBackState_r(void)
 {
     int fd, oflag;
-    afs_uint32 magic = MAGICV2, now = (afs_int32) time(NULL), freelisthead;
+    afs_uint32 magic = MAGICV3, now = (afs_int32) time(NULL), freelisthead;
 
     oflag = O_WRONLY | O_CREAT | O_TRUNC;
 #ifdef AFS_NT40_ENV
@@ -2693,15 +3801,16 @@ DumpCallBackState_r(void)
      */
     DumpBytes(fd, &magic, sizeof(magic));
     DumpBytes(fd, &now, sizeof(now));
-    DumpBytes(fd, &cbstuff, sizeof(cbstuff));
+    DumpBytes(fd, &cbstuff, CBCOUNTERS_DUMPSIZE);
     DumpBytes(fd, TimeOuts, sizeof(TimeOuts));
     DumpBytes(fd, timeout, sizeof(timeout));
     DumpBytes(fd, &tfirst, sizeof(tfirst));
-    freelisthead = cbtoi((struct CallBack *)CBfree);
-    DumpBytes(fd, &freelisthead, sizeof(freelisthead));	/* This is a pointer */
-    freelisthead = fetoi((struct FileEntry *)FEfree);
-    DumpBytes(fd, &freelisthead, sizeof(freelisthead));	/* This is a pointer */
-    DumpBytes(fd, HashTable, sizeof(HashTable));
+    freelisthead = CBfree;
+    DumpBytes(fd, &freelisthead, sizeof(freelisthead));
+    freelisthead = FEfree;
+    DumpBytes(fd, &freelisthead, sizeof(freelisthead));
+    DumpBytes(fd, &FEHashSize, sizeof(FEHashSize));
+    DumpBytes(fd, HashTable, FEHashSize * sizeof(afs_uint32));
     DumpBytes(fd, &CB[1], sizeof(CB[1]) * cbstuff.nblks);	/* CB stuff */
     DumpBytes(fd, &FE[1], sizeof(FE[1]) * cbstuff.nblks);	/* FE stuff */
     close(fd);
@@ -2760,7 +3869,7 @@ ReadDump(char *file, int timebits)
 	exit(1);
     }
     ReadBytes(fd, &magic, sizeof(magic));
-    if (magic == MAGICV2) {
+    if (magic == MAGICV2 || magic == MAGICV3) {
 	timebits = 32;
     } else {
 	if (magic != MAGIC) {
@@ -2778,7 +3887,7 @@ ReadDump(char *file, int timebits)
     } else
 	ReadBytes(fd, &now, sizeof(afs_int32));
 
-    ReadBytes(fd, &cbstuff, sizeof(cbstuff));
+    ReadBytes(fd, &cbstuff, CBCOUNTERS_DUMPSIZE);
     ReadBytes(fd, TimeOuts, sizeof(TimeOuts));
     ReadBytes(fd, timeout, sizeof(timeout));
     ReadBytes(fd, &tfirst, sizeof(tfirst));
@@ -2787,10 +3896,21 @@ ReadDump(char *file, int timebits)
 	   *)(calloc(cbstuff.nblks, sizeof(struct CallBack)))) - 1;
     FE = ((struct FileEntry
 	   *)(calloc(cbstuff.nblks, sizeof(struct FileEntry)))) - 1;
-    CBfree = (struct CallBack *)itocb(freelisthead);
+    CBfree = freelisthead;
     ReadBytes(fd, &freelisthead, sizeof(freelisthead));
-    FEfree = (struct FileEntry *)itofe(freelisthead);
-    ReadBytes(fd, HashTable, sizeof(HashTable));
+    FEfree = freelisthead;
+    if (magic == MAGICV3)
+	ReadBytes(fd, &FEHashSize, sizeof(FEHashSize));
+    else
+	FEHashSize = FEHASH_SIZE;
+    FEHashMask = FEHashSize - 1;
+    HashTable = calloc(FEHashSize, sizeof(afs_uint32));
+    if (!HashTable) {
+	fprintf(stderr, "Couldn't allocate a hash table of %u buckets\n",
+		FEHashSize);
+	exit(1);
+    }
+    ReadBytes(fd, HashTable, FEHashSize * sizeof(afs_uint32));
     ReadBytes(fd, &CB[1], sizeof(CB[1]) * cbstuff.nblks);	/* CB stuff */
     ReadBytes(fd, &FE[1], sizeof(FE[1]) * cbstuff.nblks);	/* FE stuff */
     if (close(fd)) {
@@ -2897,7 +4017,7 @@ main(int argc, char **argv)
 	struct CallBack *cb;
 	struct FileEntry *fe;
 
-	for (hash = 0; hash < FEHASH_SIZE; hash++) {
+	for (hash = 0; hash < FEHashSize; hash++) {
 	    for (feip = &HashTable[hash]; (fe = itofe(*feip));) {
 		if (!vol || (fe->volid == vol)) {
 		    afs_uint32 fe_i = fetoi(fe);
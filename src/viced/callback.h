@@ -38,6 +38,16 @@ struct cbcounters {
     afs_int32 CBsTimedOut;
     afs_int32 nbreakers;
     afs_int32 GSS1, GSS2, GSS3, GSS4, GSS5;
+    /* asynchronous breaks; see -cbbreakthreads */
+    afs_int32 nBreakQueued;	/* fids queued now */
+    afs_int32 BreakQueueHigh;	/* most fids ever queued at once */
+    afs_int32 BreakRPCs;	/* CallBack RPCs made by the break threads */
+    afs_int32 BreakFids;	/* fids broken by them */
+    afs_int32 BreakRetries;	/* failed RPCs retried before the deadline */
+    afs_int32 BreakDelayed;	/* fids left as delayed breaks for down hosts */
+    afs_int32 BreakStalls;	/* breaks that waited for room in the queue */
+    afs_int32 BreakLatency;	/* total ms from queueing to break, all fids */
+    afs_int32 BreakLatencyMax;	/* longest ms from queueing to break */
 };
 extern struct cbcounters cbstuff;
 
@@ -46,6 +56,26 @@ struct cbstruct {
     afs_uint32 thead;
 };
 
+/* A callback break waiting in a host's queue for a break thread */
+struct cbBreak {
+    struct cbBreak *next;
+    AFSFid fid;
+    afs_uint32 thead;		/* timeout queue, if the break is delayed */
+    afs_uint32 queued;		/* when it was queued (ms) */
+};
+
+/* host->z.breakstate */
+#define CBB_IDLE	0	/* nothing queued */
+#define CBB_READY	1	/* on the list of hosts waiting for a thread */
+#define CBB_BUSY	2	/* a break thread is sending to the host */
+
+/* Give up on a host and delay its breaks once they are this old (ms) */
+#define CBB_DEADLINE	(30 * 1000)
+/* and wait this long (ms) before trying a host again after a failure */
+#define CBB_RETRY	(2 * 1000)
+/* Queue at most this many fids per break thread before writers wait */
+#define CBB_PERTHREAD	1024
+
 /* structure MUST be multiple of 8 bytes, otherwise the casts to
  * struct object will have alignment issues on *P64 userspaces */
 struct FileEntry {
@@ -82,10 +112,15 @@ struct VCBParams {
 };
 
 
-/* callback hash macros */
-#define FEHASH_SIZE 512		/* Power of 2 */
-#define FEHASH_MASK (FEHASH_SIZE-1)
-#define FEHash(volume, unique) (((volume)+(unique))&(FEHASH_MASK))
+/* callback hash macros; the table size is a power of 2, at least
+ * FEHASH_SIZE, chosen from the number of callbacks and grown at run time */
+#define FEHASH_SIZE 512		/* Power of 2; smallest hash table */
+#define FEHASH_SIZE_MAX (1U<<29)	/* nblks / FEHASH_LOAD, rounded up */
+#define FEHASH_LOAD 4		/* grow when FEs in use exceed this per bucket */
+#define FEHASH_LOCKS 64		/* Power of 2, no more than FEHASH_SIZE */
+#define FEHashKey(volume, unique) ((volume)+(unique))
+#define FEHash(volume, unique) (FEHashKey(volume, unique)&(FEHashMask))
+#define FEHashLock(volume, unique) (FEHashKey(volume, unique)&(FEHASH_LOCKS-1))
 
 #define CB_NUM_TIMEOUT_QUEUES 128
 
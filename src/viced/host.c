@@ -16,6 +16,7 @@
 #include <roken.h>
 #include <afs/opr.h>
 #include <opr/lock.h>
+#include <opr/jhash.h>
 
 #ifdef HAVE_SYS_FILE_H
 #include <sys/file.h>
@@ -436,17 +437,905 @@ hpr_GetCPS(afs_int32 id, prlist *CPS)
     return 0;
 }
 
+/*
+ * CPS cache.
+ *
+ * Every new client connection needs its user's CPS, and fetching that is a
+ * ptserver RPC made by the thread serving the call, so when the ptserver is
+ * slow, so is the first call on every new connection.  With -cpscachettl,
+ * the CPS fetched for a viceid is kept for that many seconds and shared by
+ * all connections for that user.
+ *
+ *  - Only one thread fetches a given viceid at a time; others wait for it.
+ *  - CPSRefreshLWP refetches entries that have been used since they were
+ *    fetched once they are in the last quarter of their life, so a busy
+ *    user's entry does not expire; the old entry is used until the new
+ *    one arrives.  Unused entries are dropped on expiry.
+ *  - Errors other than network and quorum errors (e.g. PRNOENT) are cached
+ *    as negative entries for a quarter of the TTL, at most
+ *    CPS_NEGATIVE_MAXTTL seconds.  Network and quorum errors are not
+ *    cached; a failed refresh leaves the old entry in place until it
+ *    expires.
+ *  - When a host with several connections needing their CPS re-evaluated
+ *    (e.g. after a FlushCPS naming many users) misses in the cache, the
+ *    others are queued for CPSRefreshLWP to fetch in the background.
+ *  - h_FlushCachedCPS drops an entry; a fetch in flight for it completes
+ *    but is not cached.
+ *
+ * The cache is protected by H_LOCK.
+ */
+#define CPS_HASH_SIZE		1024	/* must be a power of 2 */
+#define CPS_HASH(id)		(opr_jhash_int((id), 0) & (CPS_HASH_SIZE - 1))
+#define CPS_NEGATIVE_MAXTTL	60	/* longest we remember an error */
+#define CPS_PREFETCH_MIN	4	/* clients of one host worth prefetching */
+#define CPS_PREFETCH_MAX	64	/* most users queued by one prefetch */
+#define CPS_REFRESH_BATCH	32	/* most entries fetched per refresh pass */
+
+#define CPS_FETCHING		0x01	/* a thread is fetching this entry */
+#define CPS_QUEUED		0x02	/* queued for a background fetch */
+#define CPS_USED		0x04	/* used since it was last fetched */
+#define CPS_FLUSHED		0x08	/* flushed while being fetched */
+
+struct cpsEntry {
+    struct cpsEntry *next;	/* hash chain */
+    afs_int32 viceid;
+    afs_int32 code;		/* ptserver error, for a negative entry */
+    time_t expires;		/* 0 until fetched */
+    prlist cps;
+    int flags;
+};
+
+static struct cpsEntry *cpsHashTable[CPS_HASH_SIZE];
+static int cpsTTL = 0;		/* seconds; 0 = no CPS cache */
+static pthread_cond_t cpsFetchCond;	/* some fetch completed */
+static pthread_cond_t cpsRefreshCond;	/* work queued for CPSRefreshLWP */
+
+static struct {
+    afs_uint32 entries;
+    afs_uint32 hits;
+    afs_uint32 negHits;
+    afs_uint32 misses;
+    afs_uint32 waits;
+    afs_uint32 refreshes;
+    afs_uint32 prefetches;
+    afs_uint32 errors;
+} cpsStats;
+
+static_inline int
+cps_IsTransient(afs_int32 code)
+{
+    /* see the comment in h_FindClient_r */
+    return (code < 0 || code == UNOQUORUM || code == UNOTSYNC);
+}
+
+static struct cpsEntry *
+cps_Lookup_r(afs_int32 viceid)
+{
+    struct cpsEntry *entry;
+
+    for (entry = cpsHashTable[CPS_HASH(viceid)]; entry; entry = entry->next) {
+	if (entry->viceid == viceid)
+	    return entry;
+    }
+    return NULL;
+}
+
+static struct cpsEntry *
+cps_Add_r(afs_int32 viceid)
+{
+    struct cpsEntry *entry;
+    int bucket = CPS_HASH(viceid);
+
+    entry = calloc(1, sizeof(*entry));
+    if (!entry) {
+	ViceLogThenPanic(0, ("Failed malloc in cps_Add_r\n"));
+    }
+    entry->viceid = viceid;
+    entry->next = cpsHashTable[bucket];
+    cpsHashTable[bucket] = entry;
+    cpsStats.entries++;
+    return entry;
+}
+
+static void
+cps_Free_r(struct cpsEntry *entry)
+{
+    struct cpsEntry **ep;
+
+    for (ep = &cpsHashTable[CPS_HASH(entry->viceid)]; *ep; ep = &(*ep)->next) {
+	if (*ep == entry) {
+	    *ep = entry->next;
+	    break;
+	}
+    }
+    free(entry->cps.prlist_val);
+    free(entry);
+    cpsStats.entries--;
+}
+
+static void
+cps_Copy(prlist *from, prlist *to)
+{
+    to->prlist_len = from->prlist_len;
+    to->prlist_val = malloc(from->prlist_len * sizeof(afs_int32) + 1);
+    if (!to->prlist_val) {
+	ViceLogThenPanic(0, ("Failed malloc in cps_Copy\n"));
+    }
+    memcpy(to->prlist_val, from->prlist_val,
+	   from->prlist_len * sizeof(afs_int32));
+}
+
+/*
+ * Record the result of a fetch of entry, started while it was marked
+ * CPS_FETCHING.  Takes over the list in cps.
+ */
+static void
+cps_Fetched_r(struct cpsEntry *entry, afs_int32 code, prlist *cps)
+{
+    time_t now = time(NULL);
+    int ttl;
+
+    entry->flags &= ~(CPS_FETCHING | CPS_QUEUED);
+    opr_cv_broadcast(&cpsFetchCond);
+
+    if (code)
+	cpsStats.errors++;
+    if (entry->flags & CPS_FLUSHED) {
+	free(cps->prlist_val);
+	cps_Free_r(entry);
+    } else if (code == 0) {
+	free(entry->cps.prlist_val);
+	entry->cps = *cps;
+	entry->code = 0;
+	entry->expires = now + cpsTTL;
+	entry->flags &= ~CPS_USED;
+    } else if (cps_IsTransient(code)) {
+	/* keep what we had, if anything, until it expires */
+	free(cps->prlist_val);
+	if (entry->expires <= now)
+	    cps_Free_r(entry);
+    } else {
+	free(cps->prlist_val);
+	free(entry->cps.prlist_val);
+	entry->cps.prlist_val = NULL;
+	entry->cps.prlist_len = 0;
+	entry->code = code;
+	ttl = cpsTTL / 4;
+	if (ttl > CPS_NEGATIVE_MAXTTL)
+	    ttl = CPS_NEGATIVE_MAXTTL;
+	entry->expires = now + (ttl > 0 ? ttl : 1);
+	entry->flags &= ~CPS_USED;
+    }
+}
+
+/*
+ * The connection we are fetching a CPS for is from host; if enough of the
+ * host's other connections are also waiting to have their CPS (re)fetched,
+ * queue their users for CPSRefreshLWP so they find it cached.
+ */
+static void
+cps_Prefetch_r(struct host *host, afs_int32 viceid)
+{
+    struct client *client;
+    struct cpsEntry *entry;
+    int n = 0;
+
+    for (client = host->z.FirstClient; client; client = client->z.next) {
+	if (!client->z.deleted && client->z.ViceId != viceid
+	    && client->z.ViceId != ANONYMOUSID
+	    && (client->z.prfail == 2 || !client->z.CPS.prlist_val)
+	    && !cps_Lookup_r(client->z.ViceId))
+	    n++;
+    }
+    if (n < CPS_PREFETCH_MIN)
+	return;
+
+    n = 0;
+    for (client = host->z.FirstClient; client && n < CPS_PREFETCH_MAX;
+	 client = client->z.next) {
+	if (!client->z.deleted && client->z.ViceId != viceid
+	    && client->z.ViceId != ANONYMOUSID
+	    && (client->z.prfail == 2 || !client->z.CPS.prlist_val)
+	    && !cps_Lookup_r(client->z.ViceId)) {
+	    entry = cps_Add_r(client->z.ViceId);
+	    entry->flags |= CPS_QUEUED;
+	    n++;
+	}
+    }
+    opr_cv_signal(&cpsRefreshCond);
+}
+
+/*
+ * Get the CPS for viceid into CPS, for a connection from host (which may
+ * be NULL), from the CPS cache or the ptserver.  Called with H_LOCK held,
+ * which is dropped while waiting for the ptserver.
+ */
+int
+h_GetCachedCPS_r(struct host *host, afs_int32 viceid, prlist *CPS)
+{
+    struct cpsEntry *entry;
+    prlist cps;
+    afs_int32 code;
+
+    if (!cpsTTL) {
+	H_UNLOCK;
+	code = hpr_GetCPS(viceid, CPS);
+	H_LOCK;
+	return code;
+    }
+
+    for (;;) {
+	entry = cps_Lookup_r(viceid);
+	/* keep using an entry while CPSRefreshLWP is refreshing it */
+	if (entry && entry->expires
+	    && (entry->expires > time(NULL)
+		|| (entry->code == 0 && (entry->flags & CPS_FETCHING)))) {
+	    entry->flags |= CPS_USED;
+	    if (entry->code) {
+		cpsStats.negHits++;
+		return entry->code;
+	    }
+	    cpsStats.hits++;
+	    cps_Copy(&entry->cps, CPS);
+	    return 0;
+	}
+	if (!entry || !(entry->flags & CPS_FETCHING))
+	    break;
+	cpsStats.waits++;
+	opr_cv_wait(&cpsFetchCond, &host_glock_mutex);
+    }
+
+    cpsStats.misses++;
+    if (!entry) {
+	entry = cps_Add_r(viceid);
+	if (host)
+	    cps_Prefetch_r(host, viceid);
+    }
+    entry->expires = 0;		/* others wait for us, not use the old one */
+    entry->flags |= CPS_FETCHING;
+
+    memset(&cps, 0, sizeof(cps));
+    H_UNLOCK;
+    code = hpr_GetCPS(viceid, &cps);
+    H_LOCK;
+
+    if (code == 0)
+	cps_Copy(&cps, CPS);
+    cps_Fetched_r(entry, code, &cps);
+    return code;
+}
+
+/* Forget any cached CPS for viceid. */
+void
+h_FlushCachedCPS(afs_int32 viceid)
+{
+    struct cpsEntry *entry;
+
+    H_LOCK;
+    entry = cps_Lookup_r(viceid);
+    if (entry) {
+	if (entry->flags & CPS_FETCHING) {
+	    entry->flags |= CPS_FLUSHED;
+	    entry->expires = 0;
+	} else {
+	    cps_Free_r(entry);
+	}
+    }
+    H_UNLOCK;
+}
+
+/*
+ * Pick up to max users whose CPS should be fetched now, and drop expired
+ * entries nobody wants.
+ */
+static int
+cps_Scan_r(afs_int32 *ids, int max)
+{
+    struct cpsEntry *entry, *next;
+    time_t now = time(NULL);
+    int i, n = 0;
+
+    for (i = 0; i < CPS_HASH_SIZE; i++) {
+	for (entry = cpsHashTable[i]; entry; entry = next) {
+	    next = entry->next;
+	    if (entry->flags & CPS_FETCHING)
+		continue;
+	    if (entry->flags & CPS_QUEUED) {
+		if (n < max)
+		    ids[n++] = entry->viceid;
+	    } else if (entry->expires <= now) {
+		cps_Free_r(entry);
+	    } else if ((entry->flags & CPS_USED) && entry->code == 0
+		       && entry->expires - now <= cpsTTL / 4) {
+		if (n < max)
+		    ids[n++] = entry->viceid;
+	    }
+	}
+    }
+    return n;
+}
+
+static void *
+CPSRefreshLWP(void *unused)
+{
+    afs_int32 ids[CPS_REFRESH_BATCH];
+    struct cpsEntry *entry;
+    struct timespec until;
+    prlist cps;
+    afs_int32 code;
+    int i, n, failed;
+    int interval = cpsTTL / 8;
+
+    if (interval < 1)
+	interval = 1;
+    else if (interval > 60)
+	interval = 60;
+
+    rx_SetThreadNum();
+    afs_pthread_setname_self("CPSRefresh");
+
+    H_LOCK;
+    for (;;) {
+	n = cps_Scan_r(ids, CPS_REFRESH_BATCH);
+	failed = 0;
+	for (i = 0; i < n; i++) {
+	    entry = cps_Lookup_r(ids[i]);
+	    if (!entry || (entry->flags & CPS_FETCHING))
+		continue;
+	    if (entry->flags & CPS_QUEUED)
+		cpsStats.prefetches++;
+	    else
+		cpsStats.refreshes++;
+	    entry->flags |= CPS_FETCHING;
+
+	    memset(&cps, 0, sizeof(cps));
+	    H_UNLOCK;
+	    code = hpr_GetCPS(ids[i], &cps);
+	    H_LOCK;
+
+	    if (code && cps_IsTransient(code))
+		failed = 1;
+	    cps_Fetched_r(entry, code, &cps);
+	}
+	/* don't hammer a ptserver that is failing */
+	if (n < CPS_REFRESH_BATCH || failed) {
+	    until.tv_sec = time(NULL) + interval;
+	    until.tv_nsec = 0;
+	    opr_cv_timedwait(&cpsRefreshCond, &host_glock_mutex, &until);
+	}
+    }
+    H_UNLOCK;
+    return NULL;
+}
+
+/* Enable the CPS cache, keeping entries for ttl seconds. */
+void
+h_InitCPSCache(int ttl)
+{
+    pthread_attr_t tattr;
+    pthread_t tid;
+
+    if (ttl <= 0)
+	return;
+
+    opr_cv_init(&cpsFetchCond);
+    opr_cv_init(&cpsRefreshCond);
+    cpsTTL = ttl;
+
+    opr_Verify(pthread_attr_init(&tattr) == 0);
+    opr_Verify(pthread_attr_setdetachstate(&tattr,
+					   PTHREAD_CREATE_DETACHED) == 0);
+    opr_Verify(pthread_create(&tid, &tattr, CPSRefreshLWP, NULL) == 0);
+    ViceLog(0, ("CPS cache enabled; entries kept for %d seconds\n", ttl));
+}
+
+/*
+ * RPC admission control.
+ *
+ * Rx hands calls to the server threads first come, first served, so a
+ * client with many calls outstanding (a parallel find, say) gets the
+ * threads in proportion to the calls it sends, and everyone else waits
+ * behind it.  With -admitslots, at most that many RPCs run at once.  The
+ * other server threads hold calls waiting for admission, and as slots free
+ * up they are handed out by deficit round robin: first among the hosts
+ * with calls waiting, then among the users of the chosen host.
+ *
+ * FetchData and StoreData are bulk calls.  They take SCHED_BULK_COST of a
+ * turn's SCHED_QUANTUM where other calls take SCHED_META_COST, a user's
+ * metadata calls go before its bulk calls, and bulk calls may hold at most
+ * three quarters of the slots, so status and directory calls are not stuck
+ * behind a wall of transfers.
+ *
+ * A call waits at most -admitwait seconds, and at most -admitqueue calls
+ * wait at once; past either limit the call fails with VBUSY and the client
+ * retries later.  When the queue is full, a call from a host with fewer
+ * calls waiting than the host with the most pushes out the newest waiting
+ * call of the latter instead of being turned away.
+ *
+ * Calls that are not ACTIVECALLs (GetTime, GetStatistics, GetCapabilities)
+ * are always admitted.  All of this is protected by H_LOCK.
+ */
+#define SCHED_QUANTUM		4
+#define SCHED_META_COST		1
+#define SCHED_BULK_COST		4
+
+#define SCHED_WAITING		0
+#define SCHED_ADMITTED		1
+#define SCHED_EVICTED		2
+#define SCHED_TIMEDOUT		3
+
+struct schedWaiter {
+    struct schedWaiter *next;
+    struct schedFlow *flow;
+    pthread_cond_t cond;
+    int cls;
+    int state;			/* SCHED_WAITING until dequeued */
+};
+
+/* the calls of one user of one host waiting for admission */
+struct schedFlow {
+    struct schedFlow *next;	/* ring of the host's flows */
+    struct host *host;
+    afs_int32 viceid;
+    struct schedWaiter *head[H_SCHED_NCLASSES];
+    struct schedWaiter **tail[H_SCHED_NCLASSES];
+    afs_int32 waiting;
+    afs_int32 deficit;
+    char visited;
+};
+
+static const int schedCost[H_SCHED_NCLASSES] = {
+    SCHED_META_COST, SCHED_BULK_COST
+};
+
+static int schedSlots = 0;	/* 0 = no admission control */
+static int schedBulkSlots;	/* most slots bulk calls may hold */
+static int schedQueueMax;	/* most calls waiting at once */
+static int schedMaxWait;	/* seconds */
+static int schedRunning[H_SCHED_NCLASSES];
+static int schedWaiting[H_SCHED_NCLASSES];
+static int schedHostCount;	/* hosts in schedHosts */
+static int schedFlowCount;	/* flows of all hosts */
+static struct host *schedHosts;	/* ring of hosts with calls waiting;
+				 * points to the last one */
+static pthread_key_t schedKey;	/* class + 1 of the call this thread
+				 * was admitted for */
+
+static struct {
+    afs_uint32 admitted[H_SCHED_NCLASSES];	/* without waiting */
+    afs_uint32 queued[H_SCHED_NCLASSES];	/* after waiting */
+    afs_uint32 busy[H_SCHED_NCLASSES];		/* turned away on arrival */
+    afs_uint32 evicted[H_SCHED_NCLASSES];	/* pushed out by other hosts */
+    afs_uint32 timedOut[H_SCHED_NCLASSES];
+    afs_uint32 waitMsecs[H_SCHED_NCLASSES];	/* total time waited */
+    afs_uint32 maxWaitMsecs[H_SCHED_NCLASSES];
+    afs_uint32 maxWaiting;			/* most calls waiting at once */
+} schedStats;
+
+static_inline int
+sched_Eligible(int cls)
+{
+    return (cls != H_SCHED_BULK || schedRunning[H_SCHED_BULK] < schedBulkSlots);
+}
+
+static void
+sched_Enqueue_r(struct host *host, afs_int32 viceid, struct schedWaiter *w)
+{
+    struct schedFlow *flow = NULL;
+    int i;
+
+    if (host->z.schedFlows) {
+	flow = host->z.schedFlows;
+	do {
+	    if (flow->viceid == viceid)
+		break;
+	    flow = flow->next;
+	} while (flow != host->z.schedFlows);
+	if (flow->viceid != viceid)
+	    flow = NULL;
+    }
+    if (!flow) {
+	flow = calloc(1, sizeof(*flow));
+	if (!flow) {
+	    ViceLogThenPanic(0, ("Failed malloc in sched_Enqueue_r\n"));
+	}
+	flow->host = host;
+	flow->viceid = viceid;
+	for (i = 0; i < H_SCHED_NCLASSES; i++)
+	    flow->tail[i] = &flow->head[i];
+	if (host->z.schedFlows) {
+	    flow->next = host->z.schedFlows->next;
+	    host->z.schedFlows->next = flow;
+	} else {
+	    flow->next = flow;
+	}
+	host->z.schedFlows = flow;
+	host->z.schedFlowCount++;
+	schedFlowCount++;
+    }
+    if (!host->z.schedWaiting) {
+	if (schedHosts) {
+	    host->z.schedNext = schedHosts->z.schedNext;
+	    schedHosts->z.schedNext = host;
+	} else {
+	    host->z.schedNext = host;
+	}
+	schedHosts = host;
+	schedHostCount++;
+    }
+
+    w->flow = flow;
+    w->next = NULL;
+    *flow->tail[w->cls] = w;
+    flow->tail[w->cls] = &w->next;
+    flow->waiting++;
+    host->z.schedWaiting++;
+    schedWaiting[w->cls]++;
+    if (schedWaiting[H_SCHED_META] + schedWaiting[H_SCHED_BULK] >
+	schedStats.maxWaiting)
+	schedStats.maxWaiting =
+	    schedWaiting[H_SCHED_META] + schedWaiting[H_SCHED_BULK];
+}
+
+static void
+sched_Dequeue_r(struct schedWaiter *w)
+{
+    struct schedFlow *flow = w->flow;
+    struct host *host = flow->host;
+    struct schedWaiter **wp;
+    struct schedFlow *pf;
+    struct host *ph;
+
+    for (wp = &flow->head[w->cls]; *wp != w; wp = &(*wp)->next)
+	opr_Assert(*wp);
+    *wp = w->next;
+    if (flow->tail[w->cls] == &w->next)
+	flow->tail[w->cls] = wp;
+    flow->waiting--;
+    host->z.schedWaiting--;
+    schedWaiting[w->cls]--;
+
+    if (!flow->waiting) {
+	for (pf = flow; pf->next != flow; pf = pf->next)
+	    ;
+	if (pf == flow) {
+	    host->z.schedFlows = NULL;
+	} else {
+	    pf->next = flow->next;
+	    if (host->z.schedFlows == flow)
+		host->z.schedFlows = pf;
+	}
+	host->z.schedFlowCount--;
+	schedFlowCount--;
+	free(flow);
+    }
+    if (!host->z.schedWaiting) {
+	for (ph = host; ph->z.schedNext != host; ph = ph->z.schedNext)
+	    ;
+	if (ph == host) {
+	    schedHosts = NULL;
+	} else {
+	    ph->z.schedNext = host->z.schedNext;
+	    if (schedHosts == host)
+		schedHosts = ph;
+	}
+	host->z.schedNext = NULL;
+	host->z.schedDeficit = 0;
+	host->z.schedVisited = 0;
+	schedHostCount--;
+    }
+}
+
+/* The first call of a user that may be admitted now, if any. */
+static struct schedWaiter *
+sched_FlowHead(struct schedFlow *flow)
+{
+    if (flow->head[H_SCHED_META])
+	return flow->head[H_SCHED_META];
+    if (flow->head[H_SCHED_BULK] && sched_Eligible(H_SCHED_BULK))
+	return flow->head[H_SCHED_BULK];
+    return NULL;
+}
+
+/*
+ * The next call of a host, by deficit round robin among its users.  The
+ * ring head's turn lasts while its credit covers its next call; a user
+ * with nothing admissible loses its turn.  Every user with an admissible
+ * call is given credit within two trips around the ring.
+ */
+static struct schedWaiter *
+sched_HostNext(struct host *host)
+{
+    struct schedFlow *flow;
+    struct schedWaiter *w;
+    int n;
+
+    for (n = 2 * host->z.schedFlowCount; n > 0; n--) {
+	flow = host->z.schedFlows->next;
+	w = sched_FlowHead(flow);
+	if (w) {
+	    if (!flow->visited) {
+		flow->deficit += SCHED_QUANTUM;
+		flow->visited = 1;
+	    }
+	    if (flow->deficit >= schedCost[w->cls])
+		return w;
+	}
+	flow->visited = 0;
+	host->z.schedFlows = flow;
+    }
+    return NULL;
+}
+
+/* The next call to admit, by deficit round robin among the hosts. */
+static struct schedWaiter *
+sched_Next_r(void)
+{
+    struct host *host;
+    struct schedWaiter *w;
+    int n;
+
+    for (n = 2 * schedHostCount; n > 0; n--) {
+	host = schedHosts->z.schedNext;
+	w = sched_HostNext(host);
+	if (w) {
+	    if (!host->z.schedVisited) {
+		host->z.schedDeficit += SCHED_QUANTUM;
+		host->z.schedVisited = 1;
+	    }
+	    if (host->z.schedDeficit >= schedCost[w->cls]) {
+		host->z.schedDeficit -= schedCost[w->cls];
+		w->flow->deficit -= schedCost[w->cls];
+		sched_Dequeue_r(w);
+		return w;
+	    }
+	}
+	host->z.schedVisited = 0;
+	schedHosts = host;
+    }
+    return NULL;
+}
+
+/* Hand free slots to waiting calls. */
+static void
+sched_Dispatch_r(void)
+{
+    struct schedWaiter *w;
+
+    while (schedRunning[H_SCHED_META] + schedRunning[H_SCHED_BULK] < schedSlots
+	   && (schedWaiting[H_SCHED_META]
+	       || (schedWaiting[H_SCHED_BULK]
+		   && sched_Eligible(H_SCHED_BULK)))) {
+	w = sched_Next_r();
+	if (!w)
+	    break;
+	schedRunning[w->cls]++;
+	w->state = SCHED_ADMITTED;
+	opr_cv_signal(&w->cond);
+    }
+}
+
+/*
+ * Make room in a full queue for a call from host, by pushing out the newest
+ * call of the busiest user of the host with the most calls waiting, if that
+ * host would still have more calls waiting than this one.  Bulk calls go
+ * first.
+ */
+static int
+sched_Evict_r(struct host *host)
+{
+    struct host *victim = NULL, *th;
+    struct schedFlow *flow = NULL, *tf;
+    struct schedWaiter *w;
+    int cls;
+
+    th = schedHosts;
+    do {
+	if (!victim || th->z.schedWaiting > victim->z.schedWaiting)
+	    victim = th;
+	th = th->z.schedNext;
+    } while (th != schedHosts);
+    if (victim->z.schedWaiting <= host->z.schedWaiting + 1)
+	return 0;
+
+    tf = victim->z.schedFlows;
+    do {
+	if (!flow || tf->waiting > flow->waiting)
+	    flow = tf;
+	tf = tf->next;
+    } while (tf != victim->z.schedFlows);
+
+    cls = flow->head[H_SCHED_BULK] ? H_SCHED_BULK : H_SCHED_META;
+    for (w = flow->head[cls]; w->next; w = w->next)
+	;
+    sched_Dequeue_r(w);
+    w->state = SCHED_EVICTED;
+    schedStats.evicted[cls]++;
+    opr_cv_signal(&w->cond);
+    return 1;
+}
+
+/*
+ * Admit an RPC of class cls from a user of a host, waiting for a slot if
+ * need be.  Returns 0 when the call may proceed, or VBUSY when the server
+ * is too busy to take it.  May drop H_LOCK.
+ */
+int
+h_SchedAdmit_r(struct host *host, afs_int32 viceid, int cls)
+{
+    struct schedWaiter w;
+    struct timespec until;
+    struct timeval start, now;
+    afs_uint32 msecs;
+
+    if (!schedSlots || pthread_getspecific(schedKey))
+	return 0;
+
+    if (schedRunning[H_SCHED_META] + schedRunning[H_SCHED_BULK] < schedSlots
+	&& !schedWaiting[cls] && sched_Eligible(cls)) {
+	schedRunning[cls]++;
+	schedStats.admitted[cls]++;
+	opr_Verify(pthread_setspecific(schedKey,
+				       (void *)(intptr_t)(cls + 1)) == 0);
+	return 0;
+    }
+
+    if (schedWaiting[H_SCHED_META] + schedWaiting[H_SCHED_BULK]
+	>= schedQueueMax && (!schedHosts || !sched_Evict_r(host))) {
+	schedStats.busy[cls]++;
+	return VBUSY;
+    }
+
+    memset(&w, 0, sizeof(w));
+    w.cls = cls;
+    w.state = SCHED_WAITING;
+    opr_cv_init(&w.cond);
+    sched_Enqueue_r(host, viceid, &w);
+
+    gettimeofday(&start, NULL);
+    until.tv_sec = start.tv_sec + schedMaxWait;
+    until.tv_nsec = start.tv_usec * 1000;
+    while (w.state == SCHED_WAITING) {
+	if (opr_cv_timedwait(&w.cond, &host_glock_mutex, &until) == ETIMEDOUT
+	    && w.state == SCHED_WAITING) {
+	    sched_Dequeue_r(&w);
+	    w.state = SCHED_TIMEDOUT;
+	    schedStats.timedOut[cls]++;
+	}
+    }
+    opr_cv_destroy(&w.cond);
+
+    gettimeofday(&now, NULL);
+    msecs = (now.tv_sec - start.tv_sec) * 1000
+	+ (now.tv_usec - start.tv_usec) / 1000;
+    schedStats.waitMsecs[cls] += msecs;
+    if (msecs > schedStats.maxWaitMsecs[cls])
+	schedStats.maxWaitMsecs[cls] = msecs;
+
+    if (w.state != SCHED_ADMITTED)
+	return VBUSY;
+    schedStats.queued[cls]++;
+    opr_Verify(pthread_setspecific(schedKey,
+				   (void *)(intptr_t)(cls + 1)) == 0);
+    return 0;
+}
+
+/* Rx after-procedure: give back the slot of the call just finished. */
+void
+h_SchedDone(struct rx_call *acall, afs_int32 code)
+{
+    intptr_t admitted = (intptr_t)pthread_getspecific(schedKey);
+
+    if (!admitted)
+	return;
+    opr_Verify(pthread_setspecific(schedKey, NULL) == 0);
+
+    H_LOCK;
+    schedRunning[admitted - 1]--;
+    sched_Dispatch_r();
+    H_UNLOCK;
+}
+
+/*
+ * Enable admission control: run at most slots RPCs at once, with at most
+ * queue calls waiting for at most wait seconds each.
+ */
+void
+h_InitSched(int slots, int queue, int wait)
+{
+    if (slots <= 0)
+	return;
+
+    opr_Verify(pthread_key_create(&schedKey, NULL) == 0);
+    schedSlots = slots;
+    schedBulkSlots = (slots * 3) / 4;
+    if (schedBulkSlots < 1)
+	schedBulkSlots = 1;
+    schedQueueMax = queue;
+    schedMaxWait = wait;
+    ViceLog(0, ("RPC admission control enabled: %d slots (%d for bulk "
+		"calls), up to %d calls waiting up to %d seconds\n",
+		schedSlots, schedBulkSlots, schedQueueMax, schedMaxWait));
+}
+
+/*
+ * Fill buf with the AFS_XSTATSCOLL_ADMIT_INFO collection; returns the
+ * number of words used.  The layout is: slots, bulk slots, queue limit,
+ * wait limit, hosts waiting, users waiting, most calls waiting at once and
+ * the number of classes, then for each class (metadata, bulk) the calls
+ * running, waiting, admitted at once, admitted after waiting, turned away,
+ * pushed out, timed out, and the total and longest wait in milliseconds.
+ */
+int
+h_CollectSchedStats(afs_int32 *buf, int max)
+{
+    int n = 0, i;
+
+    if (max < 8 + 9 * H_SCHED_NCLASSES)
+	return 0;
+
+    H_LOCK;
+    buf[n++] = schedSlots;
+    buf[n++] = schedBulkSlots;
+    buf[n++] = schedQueueMax;
+    buf[n++] = schedMaxWait;
+    buf[n++] = schedHostCount;
+    buf[n++] = schedFlowCount;
+    buf[n++] = schedStats.maxWaiting;
+    buf[n++] = H_SCHED_NCLASSES;
+    for (i = 0; i < H_SCHED_NCLASSES; i++) {
+	buf[n++] = schedRunning[i];
+	buf[n++] = schedWaiting[i];
+	buf[n++] = schedStats.admitted[i];
+	buf[n++] = schedStats.queued[i];
+	buf[n++] = schedStats.busy[i];
+	buf[n++] = schedStats.evicted[i];
+	buf[n++] = schedStats.timedOut[i];
+	buf[n++] = schedStats.waitMsecs[i];
+	buf[n++] = schedStats.maxWaitMsecs[i];
+    }
+    H_UNLOCK;
+    return n;
+}
+
 static short consolePort = 0;
 
+/*
+ * Write-lock a host.  The host lock comes before H_LOCK, so if we may have
+ * to wait for it we must drop H_LOCK first; but trying for it without
+ * waiting is safe with H_LOCK held, and when the host is not locked (by far
+ * the usual case) that spares us giving up H_LOCK and contending for it
+ * again.
+ */
 int
 h_Lock_r(struct host *host)
 {
+    int code;
+
+    ObtainWriteLockNoBlock(&host->lock, code);
+    if (code == 0)
+	return 0;
     H_UNLOCK;
     h_Lock(host);
     H_LOCK;
     return 0;
 }
 
+/* Write-lock a client, only dropping H_LOCK if we have to wait; see
+ * h_Lock_r. */
+static void
+h_LockClient_r(struct client *client)
+{
+    int code;
+
+    ObtainWriteLockNoBlock(&client->lock, code);
+    if (code == 0)
+	return;
+    H_UNLOCK;
+    ObtainWriteLock(&client->lock);
+    H_LOCK;
+}
+
 /**
   * Non-blocking lock
   * returns 1 if already locked
@@ -2642,9 +3531,7 @@ h_FindClient_r(struct rx_connection *tcon, afs_int32 *a_viceid)
 	     */
 	    return client;
 	}
-	H_UNLOCK;
-	ObtainWriteLock(&client->lock);	/* released at end */
-	H_LOCK;
+	h_LockClient_r(client);	/* released at end */
     } else {
 	client = NULL;
     }
@@ -2671,9 +3558,7 @@ h_FindClient_r(struct rx_connection *tcon, afs_int32 *a_viceid)
 	    if (!client->z.deleted && (client->z.sid == rx_GetConnectionId(tcon))
 		&& (client->z.VenusEpoch == rx_GetConnectionEpoch(tcon))) {
 		client->z.refCount++;
-		H_UNLOCK;
-		ObtainWriteLock(&client->lock);
-		H_LOCK;
+		h_LockClient_r(client);
 		break;
 	    }
 	}
@@ -2724,9 +3609,7 @@ h_FindClient_r(struct rx_connection *tcon, afs_int32 *a_viceid)
 	    client->z.CPS.prlist_len = AnonCPS.prlist_len;
 	    client->z.CPS.prlist_val = AnonCPS.prlist_val;
 	} else {
-	    H_UNLOCK;
-	    code = hpr_GetCPS(viceid, &client->z.CPS);
-	    H_LOCK;
+	    code = h_GetCachedCPS_r(client->z.host, viceid, &client->z.CPS);
 	    if (code) {
 		char hoststr[16];
 		ViceLog(0,
@@ -2796,9 +3679,7 @@ h_FindClient_r(struct rx_connection *tcon, afs_int32 *a_viceid)
 	    h_Hold_r(oldClient->z.host);
 	    h_Release_r(client->z.host);
 
-	    H_UNLOCK;
-	    ObtainWriteLock(&oldClient->lock);
-	    H_LOCK;
+	    h_LockClient_r(oldClient);
 	    client = oldClient;
 	    host = oldClient->z.host;
 	} else {
@@ -2962,6 +3843,29 @@ h_PrintStats(void)
     ViceLog(0,
 	    ("Total Client entries = %d, blocks = %d; Host entries = %d, blocks = %d\n",
 	     CEs, CEBlocks, HTs, HTBlocks));
+    if (cpsTTL)
+	ViceLog(0,
+		("CPS cache: %u entries, %u hits, %u negative hits, %u misses, "
+		 "%u waits, %u refreshes, %u prefetches, %u errors\n",
+		 cpsStats.entries, cpsStats.hits, cpsStats.negHits,
+		 cpsStats.misses, cpsStats.waits, cpsStats.refreshes,
+		 cpsStats.prefetches, cpsStats.errors));
+    if (schedSlots)
+	ViceLog(0,
+		("RPC admission: %d/%d running, %d/%d waiting, "
+		 "%u/%u admitted, %u/%u queued, %u/%u busy, %u/%u pushed out, "
+		 "%u/%u timed out (metadata/bulk)\n",
+		 schedRunning[H_SCHED_META], schedRunning[H_SCHED_BULK],
+		 schedWaiting[H_SCHED_META], schedWaiting[H_SCHED_BULK],
+		 schedStats.admitted[H_SCHED_META],
+		 schedStats.admitted[H_SCHED_BULK],
+		 schedStats.queued[H_SCHED_META],
+		 schedStats.queued[H_SCHED_BULK],
+		 schedStats.busy[H_SCHED_META], schedStats.busy[H_SCHED_BULK],
+		 schedStats.evicted[H_SCHED_META],
+		 schedStats.evicted[H_SCHED_BULK],
+		 schedStats.timedOut[H_SCHED_META],
+		 schedStats.timedOut[H_SCHED_BULK]));
 
 }				/*h_PrintStats */
 
@@ -29,7 +29,7 @@ extern pthread_mutex_t host_glock_mutex;
 extern pthread_key_t viced_uclient_key;
 
 #define h_MAXHOSTTABLEENTRIES 1000
-#define h_HASHENTRIES 256	/* Power of 2 */
+#define h_HASHENTRIES 4096	/* Power of 2; ~ hosts/8 on a large server */
 #define h_MAXHOSTTABLES 200
 #define h_HTSPERBLOCK 512	/* Power of 2 */
 #define h_HTSHIFT 9		/* log base 2 of HTSPERBLOCK */
@@ -74,6 +74,11 @@ struct host_to_zero {
     struct Interface *interface;/* all alternate addr for client */
     afs_uint32 cblist;	 	/* index of a cb in the per-host circular CB
 				 * list */
+    struct cbBreak *breakq;	/* queued asynchronous callback breaks */
+    struct cbBreak **breakqtail;
+    struct host *breaknext;	/* next host waiting for a break thread */
+    afs_uint32 breakwhen;	/* don't retry breaks before this (ms) */
+    char breakstate;		/* CBB_IDLE, CBB_READY or CBB_BUSY */
 
     unsigned int n_tmays;    	/* how many successful TellMeAboutYourself
 				 * calls have we made against this host? */
@@ -81,6 +86,15 @@ struct host_to_zero {
     /* cache of the result of the last successful TMAY call to this host */
     struct interfaceAddr tmay_interf;
     Capabilities tmay_caps;
+
+    /* RPC admission control; see h_SchedAdmit_r */
+    struct host *schedNext;	/* ring of hosts with calls waiting */
+    struct schedFlow *schedFlows; /* ring of this host's users with calls
+				 * waiting; points to the last one */
+    afs_int32 schedWaiting;	/* calls from this host waiting */
+    afs_int32 schedFlowCount;	/* entries in schedFlows */
+    afs_int32 schedDeficit;	/* deficit round robin credit */
+    char schedVisited;		/* credit given for the current turn */
 };
 
 struct host {
@@ -203,6 +217,7 @@ extern int MultiBreakCallBackAlternateAddress_r(struct host *host,
 				     struct AFSCBFids *afidp);
 extern int DumpCallBackState(void);
 extern int PrintCallBackStats(void);
+extern void FoldCallBackCounters(void);
 extern void *ShutDown(void *);
 extern void ShutDownAndCore(int dopanic);
 
@@ -242,6 +257,19 @@ extern afs_int32 hpr_Initialize(struct ubik_client **);
 extern int hpr_End(struct ubik_client *);
 extern int hpr_IdToName(idlist *ids, namelist *names);
 extern int hpr_NameToId(namelist *names, idlist *ids);
+extern int h_GetCachedCPS_r(struct host *host, afs_int32 viceid, prlist *CPS);
+extern void h_FlushCachedCPS(afs_int32 viceid);
+extern void h_InitCPSCache(int ttl);
+
+/* admission classes for h_SchedAdmit_r */
+#define H_SCHED_META	0	/* status, directory and other metadata RPCs */
+#define H_SCHED_BULK	1	/* FetchData and StoreData */
+#define H_SCHED_NCLASSES 2
+
+extern int h_SchedAdmit_r(struct host *host, afs_int32 viceid, int cls);
+extern void h_SchedDone(struct rx_call *acall, afs_int32 code);
+extern void h_InitSched(int slots, int queue, int wait);
+extern int h_CollectSchedStats(afs_int32 *buf, int max);
 
 #ifdef AFS_DEMAND_ATTACH_FS
 /*
@@ -159,6 +159,8 @@ fs_stateSave(void)
 	    ret = 1;
 	}
 
+	state.flags.verified = verified;
+
 	/* if a consistency check asserted the bail flag, reset it */
 	state.bail = 0;
 
@@ -245,6 +247,10 @@ fs_stateRestore(void)
 	goto done;
     }
 
+    if (state.flags.do_host_restore && cb_stateCheckArena(&state)) {
+	ViceLog(0, ("fs_stateRestore: warning: saved callback tables cannot be used; skipping host and callback restore\n"));
+	state.flags.do_host_restore = 0;
+    }
 
     if (state.flags.do_host_restore) {
 	if (h_stateRestore(&state)) {
@@ -283,7 +289,11 @@ fs_stateRestore(void)
 		exit(0);
 	    }
 
-	    if (cb_stateVerify(&state)) {
+	    if (state.flags.cb_arena && state.flags.verified) {
+		/* they were checked before they were saved, and their
+		 * checksums show that they have not changed since */
+		ViceLog(0, ("fs_stateRestore: callback tables were verified before save; skipping their verification\n"));
+	    } else if (cb_stateVerify(&state)) {
 		ViceLog(0, ("fs_stateRestore: error: callback table consistency checks failed; exiting to avoid further corruption\n"));
 		exit(0);
 	    }
@@ -299,6 +309,7 @@ fs_stateRestore(void)
 	fs_stateInvalidateDump(&state);
 	fs_stateCloseDump(&state);
     }
+    cb_stateResetArena();
     fs_stateFree(&state);
     H_UNLOCK;
     return ret;
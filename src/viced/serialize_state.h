@@ -26,12 +26,15 @@
 #define HOST_STATE_ENTRY_MAGIC 0xA8B9CADB
 
 #define CALLBACK_STATE_MAGIC 0x89DE67BC
-#define CALLBACK_STATE_VERSION 1
+#define CALLBACK_STATE_VERSION 2
 
 #define CALLBACK_STATE_TIMEOUT_MAGIC 0x99DD5511
 #define CALLBACK_STATE_FEHASH_MAGIC 0x77BB33FF
 #define CALLBACK_STATE_ENTRY_MAGIC 0x54637281
 
+#define CALLBACK_ARENA_MAGIC 0x3CBA4E7A
+#define CALLBACK_ARENA_VERSION 1
+
 #define ACTIVE_VOLUME_STATE_MAGIC 0xAC7557CA
 #define ACTIVE_VOLUME_STATE_VERSION 1
 
@@ -124,7 +127,10 @@ struct callback_state_header {
     afs_uint32 fe_max;                  /* max FileEntry index */
     afs_uint32 cb_max;                  /* max CallBack index */
     afs_int32 tfirst;                   /* first valid timeout */
-    afs_uint32 reserved[115];           /* for expansion */
+    afs_uint32 arena;                   /* FEs and CBs are in the callback arena */
+    afs_uint32 arena_generation;        /* generation of the arena save */
+    afs_uint32 arena_timestamp;         /* timestamp of the arena save */
+    afs_uint32 reserved[112];           /* for expansion */
     afs_uint64 timeout_offset;          /* offset of timeout queue heads */
     afs_uint64 fehash_offset;           /* offset of file entry hash buckets */
     afs_uint64 fe_offset;               /* offset of first file entry */
@@ -164,6 +170,51 @@ struct CBDiskEntry {
     afs_uint32 index;
 };
 
+/*
+ * callback arena
+ *
+ * the FE and CB tables and the FE hash table are kept in a memory
+ * mapped file (cbstate.dat), laid out as this header, the region
+ * checksums, FE[1..nblks], CB[1..nblks] and the hash buckets, each
+ * starting on a CALLBACK_ARENA_ALIGN boundary.  all links within
+ * them are indices, so the file can be mapped anywhere.  at shutdown
+ * the dirty pages are synced and the header marked clean, and if the
+ * next fileserver finds it clean and it matches fsstate.dat, it uses
+ * the tables as they are instead of rebuilding them.
+ */
+#define CALLBACK_ARENA_ALIGN (64 * 1024)        /* alignment of each table */
+#define CALLBACK_ARENA_REGION (1024 * 1024)     /* bytes covered by a checksum */
+#define CALLBACK_ARENA_MAX_THREADS 8            /* threads to checksum with */
+
+/* 256 byte header */
+struct callback_arena_header {
+    struct disk_version_stamp stamp;  /* arena version stamp */
+    byte clean;                       /* synced at shutdown, not touched since */
+    byte verified;                    /* tables passed the checks before save */
+    byte padding1[2];                 /* padding */
+    afs_uint32 generation;            /* bumped by each save */
+    afs_uint32 timestamp;             /* timestamp of the last save */
+    afs_uint32 nblks;                 /* entries in each of the FE and CB tables */
+    afs_uint32 fe_size;               /* sizeof(struct FileEntry) */
+    afs_uint32 cb_size;               /* sizeof(struct CallBack) */
+    afs_uint32 fehash_max;            /* hash buckets in the file */
+    afs_uint32 fehash_size;           /* hash buckets in use */
+    afs_uint32 fe_free;               /* head of the FE free list */
+    afs_uint32 cb_free;               /* head of the CB free list */
+    afs_uint32 nFEs;                  /* FEs in use */
+    afs_uint32 nCBs;                  /* CBs in use */
+    afs_uint32 nregions;              /* number of region checksums */
+    afs_uint32 sums_sum;              /* checksum of the region checksums */
+    afs_uint32 hdr_sum;               /* checksum of this header */
+    afs_uint32 reserved1[15];         /* for expansion */
+    afs_uint64 sums_offset;           /* offset of the region checksums */
+    afs_uint64 fe_offset;             /* offset of FE[1] */
+    afs_uint64 cb_offset;             /* offset of CB[1] */
+    afs_uint64 fehash_offset;         /* offset of the hash buckets */
+    afs_uint64 size;                  /* size of the file */
+    afs_uint32 reserved2[22];         /* for expansion */
+};
+
 /*
  * active volumes state serialization
  *
@@ -237,6 +288,8 @@ struct fs_dump_state {
 	byte do_host_restore;              /* whether host restore should be done */
 	byte some_steps_skipped;           /* whether some steps were skipped */
 	byte warnings_generated;           /* whether any warnings were generated during restore */
+	byte verified;                     /* whether the checks before save passed */
+	byte cb_arena;                     /* whether callbacks are restored from the arena */
     } flags;
     afs_fsize_t file_len;
     int fd;                                /* fd of the current dump file */
@@ -305,6 +358,8 @@ extern int cb_stateRestore(struct fs_dump_state * state);
 extern int cb_stateRestoreIndices(struct fs_dump_state * state);
 extern int cb_stateVerify(struct fs_dump_state * state);
 extern int cb_stateVerifyHCBList(struct fs_dump_state * state, struct host * host);
+extern int cb_stateCheckArena(struct fs_dump_state * state);
+extern void cb_stateResetArena(void);
 extern int fe_OldToNew(struct fs_dump_state * state, afs_uint32 old, afs_uint32 * new);
 extern int cb_OldToNew(struct fs_dump_state * state, afs_uint32 old, afs_uint32 * new);
 
@@ -838,6 +838,9 @@ dump_cb_hdr(void)
     DPFV1("fe_max", "u", hdrs.cb_hdr.fe_max);
     DPFV1("cb_max", "u", hdrs.cb_hdr.cb_max);
     DPFV1("tfirst", "d", hdrs.cb_hdr.tfirst);
+    DPFV1("arena", "u", hdrs.cb_hdr.arena);
+    DPFV1("arena_generation", "u", hdrs.cb_hdr.arena_generation);
+    DPFV1("arena_timestamp", "u", hdrs.cb_hdr.arena_timestamp);
 
     SplitInt64(hdrs.cb_hdr.timeout_offset, hi, lo);
     DPFSO1("timeout_offset");
@@ -862,9 +865,13 @@ dump_cb_hdr(void)
     if (hdrs.cb_hdr.stamp.magic != CALLBACK_STATE_MAGIC) {
 	fprintf(stderr, "* magic check failed\n");
     }
-    if (hdrs.cb_hdr.stamp.version != CALLBACK_STATE_VERSION) {
+    if (hdrs.cb_hdr.stamp.version != CALLBACK_STATE_VERSION &&
+	hdrs.cb_hdr.stamp.version != 1) {
 	fprintf(stderr, "* version check failed\n");
     }
+    if (hdrs.cb_hdr.arena) {
+	fprintf(stderr, "* FEs, CBs and FE hash are in the callback arena, not this file\n");
+    }
 }
 
 static void
@@ -1583,6 +1590,11 @@ get_cb_fehash_hdr(void)
     if (get_cb_hdr())
 	return 1;
 
+    if (hdrs.cb_hdr.arena) {
+	fprintf(stderr, "FE hash is in the callback arena; can't get callback_state_fehash_header\n");
+	return 1;
+    }
+
     SplitInt64(hdrs.cb_hdr.fehash_offset, hi, lo);
 
     if (hi) {
@@ -138,6 +138,11 @@ int stackSize = 24000;
 int fiveminutes = 300;		/* 5 minutes.  Change this for debugging only */
 int CurrentConnections = 0;
 int hostaclRefresh = 7200;	/* refresh host clients' acls every 2 hrs */
+static int cpsCacheTTL = 0;	/* seconds to cache user CPSs; 0 = don't */
+static int admitSlots = 0;	/* RPCs run at once; 0 = no admission control */
+static int admitQueue = -1;	/* RPCs waiting for admission; -1 = default */
+static int admitWait = 30;	/* seconds an RPC may wait for admission */
+static int uringDepth = 0;	/* io_uring queue depth; 0 = use syscalls */
 #if defined(AFS_SGI_ENV)
 int SawLock;
 #endif
@@ -159,12 +164,16 @@ int nSmallVns = 400;		/* 200 */
 int large = 400;		/* 200 */
 int volcache = 400;		/* 400 */
 int numberofcbs = 60000;	/* 60000 */
+static int cbBreakThreads = 0;	/* threads to break callbacks; 0 = inline */
+static int bulkPrefetchThreads = 0; /* bulk status prefetch threads; 0 = none */
 int lwps = 9;			/* 6 */
 int buffs = 90;			/* 70 */
 int novbc = 0;			/* Enable Volume Break calls */
 int busy_threshold = 600;
 int abort_threshold = 10;
 int udpBufSize = 0;		/* UDP buffer size for receive */
+static int rxIOBatch = 0;	/* datagrams per socket system call */
+static int rxListeners = 1;	/* listener sockets on the fileserver port */
 int sendBufSize = 16384;	/* send buffer size */
 int saneacls = 0;		/* Sane ACLs Flag */
 static int unsafe_attach = 0;   /* avoid inUse check on vol attach? */
@@ -661,6 +670,7 @@ PrintCounters(void)
     VPrintExtendedCacheStats(stats_flags);
 #endif
     VPrintCacheStats();
+    ih_PrintStats();
     VPrintDiskStats();
     DStat(&dirbuff, &dircall, &dirio);
     ViceLog(0,
@@ -762,9 +772,16 @@ ShutDownAndCore(int dopanic)
     if (!dopanic)
 	PrintCounters();
 
+    /* stop reading vnodes on behalf of bulk status requests */
+    ShutDownBulkPrefetch();
+
     /* shut down volume package */
     VShutdown();
 
+    /* send the callback breaks still queued */
+    if (!dopanic)
+	ShutDownCallBackBreaks();
+
 #ifdef AFS_DEMAND_ATTACH_FS
     if (fs_state.options.fs_state_save) {
 	/*
@@ -928,6 +945,7 @@ enum optionsList {
     OPT_saneacls,
     OPT_buffers,
     OPT_callbacks,
+    OPT_cbbreakthreads,
     OPT_vcsize,
     OPT_lvnodes,
     OPT_svnodes,
@@ -936,15 +954,20 @@ enum optionsList {
     OPT_spare,
     OPT_pctspare,
     OPT_hostcpsrefresh,
+    OPT_cpscachettl,
     OPT_vattachthreads,
     OPT_abortthreshold,
     OPT_busyat,
     OPT_nobusy,
+    OPT_admitslots,
+    OPT_admitqueue,
+    OPT_admitwait,
     OPT_offline_timeout,
     OPT_offline_shutdown_timeout,
     OPT_vhandle_setaside,
     OPT_vhandle_max_cachesize,
     OPT_vhandle_initial_cachesize,
+    OPT_uring_depth,
     OPT_fs_state_dont_save,
     OPT_fs_state_dont_restore,
     OPT_fs_state_verify,
@@ -954,6 +977,7 @@ enum optionsList {
     OPT_vlruinterval,
     OPT_vlrumax,
     OPT_unsafe_nosalvage,
+    OPT_bulkprefetchthreads,
     OPT_cbwait,
     OPT_novbc,
     OPT_auditlog,
@@ -974,6 +998,8 @@ enum optionsList {
     OPT_rxpck,
     OPT_rxmaxmtu,
     OPT_udpsize,
+    OPT_rxbatch,
+    OPT_rxlisteners,
     OPT_dotted,
     OPT_realm,
     OPT_sync
@@ -1022,6 +1048,9 @@ ParseArgs(int argc, char *argv[])
 			CMD_OPTIONAL, "buffers");
     cmd_AddParmAtOffset(opts, OPT_callbacks, "-cb", CMD_SINGLE,
 			CMD_OPTIONAL, "number of callbacks");
+    cmd_AddParmAtOffset(opts, OPT_cbbreakthreads, "-cbbreakthreads",
+			CMD_SINGLE, CMD_OPTIONAL,
+			"number of callback break threads");
     cmd_AddParmAtOffset(opts, OPT_vcsize, "-vc", CMD_SINGLE,
 			CMD_OPTIONAL, "volume cachesize");
     cmd_AddParmAtOffset(opts, OPT_lvnodes, "-l", CMD_SINGLE,
@@ -1043,6 +1072,8 @@ ParseArgs(int argc, char *argv[])
 
     cmd_AddParmAtOffset(opts, OPT_hostcpsrefresh, "-hr", CMD_SINGLE,
 			CMD_OPTIONAL, "hours between host CPS refreshes");
+    cmd_AddParmAtOffset(opts, OPT_cpscachettl, "-cpscachettl", CMD_SINGLE,
+			CMD_OPTIONAL, "seconds to cache user CPSs");
 
     cmd_AddParmAtOffset(opts, OPT_vattachthreads, "-vattachpar", CMD_SINGLE,
 			CMD_OPTIONAL, "# of volume attachment threads");
@@ -1054,6 +1085,12 @@ ParseArgs(int argc, char *argv[])
 			"# of queued entries after which server is busy");
     cmd_AddParmAtOffset(opts, OPT_nobusy, "-nobusy", CMD_FLAG, CMD_OPTIONAL,
 			"send VRESTARTING while restarting the server");
+    cmd_AddParmAtOffset(opts, OPT_admitslots, "-admitslots", CMD_SINGLE,
+			CMD_OPTIONAL, "# of RPCs run at once");
+    cmd_AddParmAtOffset(opts, OPT_admitqueue, "-admitqueue", CMD_SINGLE,
+			CMD_OPTIONAL, "# of RPCs waiting to run");
+    cmd_AddParmAtOffset(opts, OPT_admitwait, "-admitwait", CMD_SINGLE,
+			CMD_OPTIONAL, "seconds an RPC may wait to run");
 
     cmd_AddParmAtOffset(opts, OPT_offline_timeout, "-offline-timeout",
 			CMD_SINGLE, CMD_OPTIONAL,
@@ -1071,6 +1108,8 @@ ParseArgs(int argc, char *argv[])
     cmd_AddParmAtOffset(opts, OPT_vhandle_initial_cachesize,
 			"-vhandle-initial-cachesize", CMD_SINGLE,
 			CMD_OPTIONAL, "# fds reserved for cache IO");
+    cmd_AddParmAtOffset(opts, OPT_uring_depth, "-uring-depth", CMD_SINGLE,
+			CMD_OPTIONAL, "io_uring queue depth for file IO");
 
 #ifdef AFS_DEMAND_ATTACH_FS
     /* dafs options */
@@ -1097,6 +1136,9 @@ ParseArgs(int argc, char *argv[])
     cmd_AddParmAtOffset(opts, OPT_unsafe_nosalvage, "-unsafe-nosalvage",
 			CMD_FLAG, CMD_OPTIONAL,
 			"bybass safety checks on volume attach");
+    cmd_AddParmAtOffset(opts, OPT_bulkprefetchthreads,
+			"-bulkprefetchthreads", CMD_SINGLE, CMD_OPTIONAL,
+			"number of bulk status prefetch threads");
 #endif
 
     /* unrecommend options - should perhaps be CMD_HIDE */
@@ -1142,6 +1184,10 @@ ParseArgs(int argc, char *argv[])
 			CMD_OPTIONAL, "maximum MTU for RX");
     cmd_AddParmAtOffset(opts, OPT_udpsize, "-udpsize", CMD_SINGLE,
 			CMD_OPTIONAL, "size of socket buffer in bytes");
+    cmd_AddParmAtOffset(opts, OPT_rxbatch, "-rxbatch", CMD_SINGLE,
+			CMD_OPTIONAL, "datagrams per socket system call");
+    cmd_AddParmAtOffset(opts, OPT_rxlisteners, "-rxlisteners", CMD_SINGLE,
+			CMD_OPTIONAL, "number of rx listener sockets");
 
     /* rxkad options */
     cmd_AddParmAtOffset(opts, OPT_dotted, "-allow-dotted-principals",
@@ -1150,7 +1196,8 @@ ParseArgs(int argc, char *argv[])
     cmd_AddParmAtOffset(opts, OPT_realm, "-realm",
 			CMD_LIST, CMD_OPTIONAL, "local realm");
     cmd_AddParmAtOffset(opts, OPT_sync, "-sync",
-			CMD_SINGLE, CMD_OPTIONAL, "always | onclose | never");
+			CMD_SINGLE, CMD_OPTIONAL,
+			"always | onclose | group | never");
 
     /* testing options */
     cmd_AddParmAtOffset(opts, OPT_logfile, "-logfile", CMD_SINGLE,
@@ -1225,6 +1272,14 @@ ParseArgs(int argc, char *argv[])
 	}
     }
 
+    if (cmd_OptionAsInt(opts, OPT_cbbreakthreads, &cbBreakThreads) == 0) {
+	if (cbBreakThreads < 0 || cbBreakThreads > 64) {
+	    printf("number of callback break threads %d invalid; "
+		   "must be between 0 and 64\n", cbBreakThreads);
+	    return -1;
+	}
+    }
+
     cmd_OptionAsInt(opts, OPT_vcsize, &volcache);
     cmd_OptionAsInt(opts, OPT_lvnodes, &large);
     cmd_OptionAsInt(opts, OPT_svnodes, &nSmallVns);
@@ -1260,6 +1315,14 @@ ParseArgs(int argc, char *argv[])
 	hostaclRefresh = optval * 60 * 60;
     }
 
+    if (cmd_OptionAsInt(opts, OPT_cpscachettl, &cpsCacheTTL) == 0) {
+	if (cpsCacheTTL < 0 || cpsCacheTTL > 86400) {
+	    printf("CPS cache lifetime of %d seconds is invalid; "
+		   "must be between 0 and 86400\n", cpsCacheTTL);
+	    return -1;
+	}
+    }
+
     cmd_OptionAsInt(opts, OPT_vattachthreads, &vol_attach_threads);
 
     cmd_OptionAsInt(opts, OPT_abortthreshold, &abort_threshold);
@@ -1268,6 +1331,26 @@ ParseArgs(int argc, char *argv[])
     if (cmd_OptionPresent(opts, OPT_nobusy))
 	busyonrst = 0;
 
+    if (cmd_OptionAsInt(opts, OPT_admitslots, &admitSlots) == 0) {
+	if (admitSlots < 0) {
+	    printf("Invalid -admitslots value %d\n", admitSlots);
+	    return -1;
+	}
+    }
+    if (cmd_OptionAsInt(opts, OPT_admitqueue, &admitQueue) == 0) {
+	if (admitQueue < 0) {
+	    printf("Invalid -admitqueue value %d\n", admitQueue);
+	    return -1;
+	}
+    }
+    if (cmd_OptionAsInt(opts, OPT_admitwait, &admitWait) == 0) {
+	if (admitWait < 1 || admitWait > 3600) {
+	    printf("Admission wait of %d seconds is invalid; "
+		   "must be between 1 and 3600\n", admitWait);
+	    return -1;
+	}
+    }
+
     if (cmd_OptionAsInt(opts, OPT_offline_timeout, &offline_timeout) == 0) {
 	if (offline_timeout < -1) {
 	    printf("Invalid -offline-timeout value %d; the only valid "
@@ -1291,6 +1374,19 @@ ParseArgs(int argc, char *argv[])
 		    &vol_io_params.fd_max_cachesize);
     cmd_OptionAsUint(opts, OPT_vhandle_initial_cachesize,
 		    &vol_io_params.fd_initial_cachesize);
+    if (cmd_OptionAsInt(opts, OPT_uring_depth, &uringDepth) == 0) {
+#ifdef AFS_IH_URING_ENV
+	if (uringDepth < 0 || uringDepth > 4096) {
+	    printf("Invalid -uring-depth value %d; "
+		   "must be between 0 and 4096\n", uringDepth);
+	    return -1;
+	}
+#else
+	printf("Warning: -uring-depth is not supported on this platform; "
+	       "ignored\n");
+	uringDepth = 0;
+#endif
+    }
     if (cmd_OptionAsString(opts, OPT_sync, &sync_behavior) == 0) {
 	if (ih_SetSyncBehavior(sync_behavior)) {
 	    printf("Invalid -sync value %s\n", sync_behavior);
@@ -1334,6 +1430,14 @@ ParseArgs(int argc, char *argv[])
     if (cmd_OptionAsInt(opts, OPT_vlrumax, &optval) == 0)
 	VLRU_SetOptions(VLRU_SET_MAX, optval);
     cmd_OptionAsFlag(opts, OPT_unsafe_nosalvage, &unsafe_attach);
+    if (cmd_OptionAsInt(opts, OPT_bulkprefetchthreads,
+			&bulkPrefetchThreads) == 0) {
+	if (bulkPrefetchThreads < 0 || bulkPrefetchThreads > 64) {
+	    printf("number of bulk status prefetch threads %d invalid; "
+		   "must be between 0 and 64\n", bulkPrefetchThreads);
+	    return -1;
+	}
+    }
 #endif /* AFS_DEMAND_ATTACH_FS */
 
     cmd_OptionAsInt(opts, OPT_cbwait, &fiveminutes);
@@ -1391,6 +1495,8 @@ ParseArgs(int argc, char *argv[])
 	} else
 	    udpBufSize = optval;
     }
+    cmd_OptionAsInt(opts, OPT_rxbatch, &rxIOBatch);
+    cmd_OptionAsInt(opts, OPT_rxlisteners, &rxListeners);
 
     /* rxkad options */
     cmd_OptionAsFlag(opts, OPT_dotted, &rxkadDisableDotCheck);
@@ -1968,6 +2074,22 @@ main(int argc, char *argv[])
 		 curLimit, lwps, vol_io_params.fd_max_cachesize));
     }
 
+    /*
+     * Calls waiting for admission hold server threads, so there must be
+     * threads to spare; keep one free to turn calls away when the queue is
+     * full.
+     */
+    if (admitSlots) {
+	if (admitSlots >= lwps - 1) {
+	    ViceLog(0, ("-admitslots %d leaves no room to queue calls among "
+			"%d threads; admission control disabled\n",
+			admitSlots, lwps));
+	    admitSlots = 0;
+	} else if (admitQueue < 0 || admitQueue > lwps - admitSlots - 1) {
+	    admitQueue = lwps - admitSlots - 1;
+	}
+    }
+
     /* Initialize volume support */
     if (!novbc) {
 	V_BreakVolumeCallbacks = BreakVolumeCallBacksLater;
@@ -2003,6 +2125,13 @@ main(int argc, char *argv[])
 	rx_SetUdpBufSize(udpBufSize);	/* set the UDP buffer size for receive */
     rx_bindhost = SetupVL();
 
+    if (rxListeners != 1) {
+	if (rx_SetListenerSockets(rxListeners) != 0) {
+	    ViceLog(0, ("rxlisteners %d is invalid or not supported\n",
+			rxListeners));
+	    exit(1);
+	}
+    }
     if (rx_InitHost(rx_bindhost, (int)htons(7000)) < 0) {
 	ViceLog(0, ("Cannot initialize RX\n"));
 	exit(1);
@@ -2017,6 +2146,13 @@ main(int argc, char *argv[])
 	    exit(1);
 	}
     }
+    if (rxIOBatch) {
+	if (rx_SetIOBatchSize(rxIOBatch) != 0) {
+	    ViceLog(0, ("rxbatch %d is invalid or not supported\n",
+			rxIOBatch));
+	    exit(1);
+	}
+    }
     rx_GetIFInfo();
     rx_SetRxDeadTime(30);
     afsconf_SetSecurityFlags(confDir, AFSCONF_SECOPTS_ALWAYSENCRYPT);
@@ -2039,6 +2175,8 @@ main(int argc, char *argv[])
     rx_SetMinProcs(tservice, 3);
     rx_SetMaxProcs(tservice, lwps);
     rx_SetCheckReach(tservice, 1);
+    if (admitSlots)
+	rx_SetAfterProc(tservice, h_SchedDone);
 
     tservice =
 	rx_NewService(0, RX_STATS_SERVICE_ID, "rpcstats", securityClasses,
@@ -2061,6 +2199,7 @@ main(int argc, char *argv[])
 
     init_sys_error_to_et();	/* Set up error table translation */
     h_InitHostPackage(host_thread_quota); /* set up local cellname and realmname */
+    h_InitSched(admitSlots, admitQueue, admitWait);
     InitCallBack(numberofcbs);
     ClearXStatValues();
 
@@ -2101,8 +2240,9 @@ main(int argc, char *argv[])
      ** is three ( "link" uses three vnodes simultaneously, one vLarge and
      ** two vSmall for linking files and two vLarge and one vSmall for linking
      ** files  ) : dhruba
+     ** bulk status prefetch threads hold one vnode at a time.
      */
-    minVnodesRequired = 2 * lwps + 1;
+    minVnodesRequired = 2 * lwps + 1 + bulkPrefetchThreads;
     if (minVnodesRequired > nSmallVns) {
 	nSmallVns = minVnodesRequired;
 	ViceLog(0,
@@ -2175,6 +2315,17 @@ main(int argc, char *argv[])
      * of the file descriptor cache.
      */
     ih_UseLargeCache();
+#ifdef AFS_IH_URING_ENV
+    if (uringDepth > 0) {
+	code = ih_uring_init(uringDepth);
+	if (code)
+	    ViceLog(0, ("Cannot set up io_uring (errno %d); "
+			"using synchronous file IO\n", code));
+	else
+	    ViceLog(0, ("Using io_uring for file IO, queue depth %d\n",
+			uringDepth));
+    }
+#endif
 
     ViceLog(5, ("Starting pthreads\n"));
     opr_Verify(pthread_attr_init(&tattr) == 0);
@@ -2187,6 +2338,9 @@ main(int argc, char *argv[])
 			      &fiveminutes) == 0);
     opr_Verify(pthread_create(&serverPid, &tattr, FsyncCheckLWP,
 			      &fiveminutes) == 0);
+    InitCallBackBreakers(cbBreakThreads);
+    h_InitCPSCache(cpsCacheTTL);
+    InitBulkPrefetch(bulkPrefetchThreads);
 
     gettimeofday(&tp, 0);
 
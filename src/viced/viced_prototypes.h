@@ -18,9 +18,13 @@ void init_sys_error_to_et(void);
 extern int LogLevel;
 extern afs_int32 BlocksSpare;
 extern afs_int32 PctSpare;
+extern int InitBulkPrefetch(int);
+extern void ShutDownBulkPrefetch(void);
 
 /* callback.c */
 extern int InitCallBack(int);
+extern int InitCallBackBreakers(int);
+extern void ShutDownCallBackBreaks(void);
 extern int BreakLaterCallBacks(void);
 extern int BreakVolumeCallBacksLater(VolumeId);
 
@@ -20,6 +20,8 @@
 
 #include <roken.h>
 
+#include <afs/opr.h>
+
 #ifdef AFS_NT40_ENV
 #include <windows.h>
 #include <winbase.h>
@@ -42,6 +44,7 @@
 #include "common.h"
 
 int (*vol_PollProc) (void) = 0;	/* someone must init this */
+int vol_clone_threads = 1;	/* threads to clone each vnode index with */
 
 #define ERROR_EXIT(code) do { \
     error = code; \
@@ -146,9 +149,33 @@ IDecProc(Inode adata, void *arock)
     return 0;
 }
 
-afs_int32
-DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
+/* One run of vnodes in an index, cloned by DoCloneRange */
+struct clone_range {
+    Volume *rwvp;
+    Volume *clvp;
+    VnodeClass class;
+    int reclone;
+    afs_foff_t start;		/* offset of the first vnode */
+    afs_foff_t end;		/* offset past the last one; -1 for EOF */
+    int *stop;			/* set when any range fails */
+    afs_foff_t offset;		/* out: offset past the last vnode done */
+    afs_int32 filecount;	/* out: files seen */
+    afs_int32 diskused;		/* out: blocks they use */
+    int forceOffline;		/* out: a link count could not be changed */
+    struct clone_head decHead;	/* out: old clone inodes to decrement */
+    afs_int32 error;		/* out */
+};
+
+/*
+ * Clone the vnodes from cr->start up to cr->end. The caller applies the
+ * results, so that several ranges of one index can be cloned at once.
+ */
+static void
+DoCloneRange(struct clone_range *cr)
 {
+    Volume *rwvp = cr->rwvp;
+    Volume *clvp = cr->clvp;
+    int reclone = cr->reclone;
     afs_int32 code, error = 0;
     FdHandle_t *rwFd = 0, *clFdIn = 0, *clFdOut = 0;
     StreamHandle_t *rwfile = 0, *clfilein = 0, *clfileout = 0;
@@ -158,14 +185,11 @@ DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
     struct VnodeDiskObject *clvnode = (struct VnodeDiskObject *)dbuf;
     Inode rwinode = 0;
     Inode clinode;
-    struct clone_head decHead;
-    struct clone_rock decRock;
-    afs_foff_t offset = 0;
+    afs_foff_t offset = cr->start;
     afs_int32 dircloned, inodeinced;
-    afs_int32 filecount = 0, diskused = 0;
     afs_ino_str_t stmp;
 
-    struct VnodeClassInfo *vcp = &VnodeClassInfo[class];
+    struct VnodeClassInfo *vcp = &VnodeClassInfo[cr->class];
     /*
      * The fileserver's -readonly switch should make this false, but we
      * have no useful way to know in the volserver.
@@ -173,39 +197,25 @@ DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
      */
     int ReadWriteOriginal = 1;
 
-    /* Correct number of files in volume: this assumes indexes are always
-       cloned starting with vLarge */
-    if (ReadWriteOriginal && class != vLarge) {
-	filecount = V_filecount(rwvp);
-	diskused = V_diskused(rwvp);
-    }
-
-    /* Initialize list of inodes to nuke - must do this before any calls
-     * to ERROR_EXIT, as the error handler requires an initialised list
-     */
-    ci_InitHead(&decHead);
-    decRock.h = V_linkHandle(rwvp);
-    decRock.vol = V_parentId(rwvp);
-
-    /* Open the RW volume's index file and seek to beginning */
-    IH_COPY(rwH, rwvp->vnodeIndex[class].handle);
+    /* Open the RW volume's index file and seek to our first vnode */
+    IH_COPY(rwH, rwvp->vnodeIndex[cr->class].handle);
     rwFd = IH_OPEN(rwH);
     if (!rwFd)
 	ERROR_EXIT(EIO);
     rwfile = FDH_FDOPEN(rwFd, ReadWriteOriginal ? "r+" : "r");
     if (!rwfile)
 	ERROR_EXIT(EIO);
-    STREAM_ASEEK(rwfile, vcp->diskSize);	/* Will fail if no vnodes */
+    STREAM_ASEEK(rwfile, cr->start);	/* Will fail if no vnodes */
 
-    /* Open the clone volume's index file and seek to beginning */
-    IH_COPY(clHout, clvp->vnodeIndex[class].handle);
+    /* Open the clone volume's index file and seek to the same place */
+    IH_COPY(clHout, clvp->vnodeIndex[cr->class].handle);
     clFdOut = IH_OPEN(clHout);
     if (!clFdOut)
 	ERROR_EXIT(EIO);
     clfileout = FDH_FDOPEN(clFdOut, "a");
     if (!clfileout)
 	ERROR_EXIT(EIO);
-    code = STREAM_ASEEK(clfileout, vcp->diskSize);
+    code = STREAM_ASEEK(clfileout, cr->start);
     if (code)
 	ERROR_EXIT(EIO);
 
@@ -214,22 +224,27 @@ DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
      * writing, so this all works.
      */
     if (reclone) {
-	IH_COPY(clHin, clvp->vnodeIndex[class].handle);
+	IH_COPY(clHin, clvp->vnodeIndex[cr->class].handle);
 	clFdIn = IH_OPEN(clHin);
 	if (!clFdIn)
 	    ERROR_EXIT(EIO);
 	clfilein = FDH_FDOPEN(clFdIn, "r");
 	if (!clfilein)
 	    ERROR_EXIT(EIO);
-	STREAM_ASEEK(clfilein, vcp->diskSize);	/* Will fail if no vnodes */
+	STREAM_ASEEK(clfilein, cr->start);	/* Will fail if no vnodes */
     }
 
-    /* Read each vnode in the old volume's index file */
-    for (offset = vcp->diskSize;
-	 STREAM_READ(rwvnode, vcp->diskSize, 1, rwfile) == 1;
+    /* Read each vnode in our part of the old volume's index file */
+    for (offset = cr->start;
+	 (cr->end < 0 || offset < cr->end)
+	 && STREAM_READ(rwvnode, vcp->diskSize, 1, rwfile) == 1;
 	 offset += vcp->diskSize) {
 	dircloned = inodeinced = 0;
 
+	/* Another range has failed; the clone is going to be thrown away */
+	if (cr->stop && *cr->stop)
+	    break;
+
 	/* If we are recloning the volume, read the corresponding vnode
 	 * from the clone and determine its inode number.
 	 */
@@ -246,9 +261,9 @@ DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
 	    if (rwvnode->vnodeMagic != vcp->magic)
 		ERROR_EXIT(-1);
 	    rwinode = VNDISK_GET_INO(rwvnode);
-	    filecount++;
+	    cr->filecount++;
 	    VNDISK_GET_LEN(ll, rwvnode);
-	    diskused += nBlocks(ll);
+	    cr->diskused += nBlocks(ll);
 
 	    /* Increment the inode if not already */
 	    if (clinode && (clinode == rwinode)) {
@@ -259,7 +274,7 @@ DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
 		    Log("IH_INC failed: %"AFS_PTR_FMT", %s, %" AFS_VOLID_FMT " errno %d\n",
 			V_linkHandle(rwvp), PrintInode(stmp, rwinode),
 			afs_printable_VolumeId_lu(V_parentId(rwvp)), errno);
-		    VForceOffline(rwvp);
+		    cr->forceOffline = 1;
 		    ERROR_EXIT(EIO);
 		}
 		inodeinced = 1;
@@ -312,7 +327,7 @@ DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
 		    Log("IH_DEC failed: %"AFS_PTR_FMT", %s, %" AFS_VOLID_FMT " errno %d\n",
 			V_linkHandle(rwvp), PrintInode(stmp, rwinode),
 			afs_printable_VolumeId_lu(V_parentId(rwvp)), errno);
-		    VForceOffline(rwvp);
+		    cr->forceOffline = 1;
 		    ERROR_EXIT(EIO);
 		}
 	    }
@@ -327,7 +342,7 @@ DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
 
 	/* Removal of the old cloned inode */
 	if (clinode) {
-	    ci_AddItem(&decHead, clinode);	/* just queue it */
+	    ci_AddItem(&cr->decHead, clinode);	/* just queue it */
 	}
 
 	DOPOLL;
@@ -335,20 +350,10 @@ DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
     if (STREAM_ERROR(clfileout))
 	ERROR_EXIT(EIO);
 
-    /* Clean out any junk at end of clone file */
-    if (reclone) {
-	STREAM_ASEEK(clfilein, offset);
-	while (STREAM_READ(clvnode, vcp->diskSize, 1, clfilein) == 1) {
-	    if (clvnode->type != vNull && VNDISK_GET_INO(clvnode) != 0) {
-		ci_AddItem(&decHead, VNDISK_GET_INO(clvnode));
-	    }
-	    DOPOLL;
-	}
-    }
+    /* A range short of its end means the index is shorter than it was */
+    if (cr->end >= 0 && offset < cr->end && !(cr->stop && *cr->stop))
+	ERROR_EXIT(EIO);
 
-    /* come here to finish up.  If code is non-zero, we've already run into problems,
-     * and shouldn't do the idecs.
-     */
   error_exit:
     if (rwfile)
 	STREAM_CLOSE(rwfile);
@@ -371,12 +376,183 @@ DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
     if (clHin)
 	IH_RELEASE(clHin);
 
+    cr->offset = offset;
+    cr->error = error;
+    if (error && cr->stop)
+	*cr->stop = 1;
+}
+
+#ifdef AFS_PTHREAD_ENV
+static void *
+CloneRangeThread(void *rock)
+{
+    DoCloneRange(rock);
+    return NULL;
+}
+
+/*
+ * Decide how many ranges to split an index into. Each of up to
+ * vol_clone_threads threads gets at least CLONE_MINRANGE vnodes, as
+ * small volumes are not worth the threads.
+ */
+#define CLONE_MINRANGE	4096
+
+static int
+CloneRangeCount(Volume * rwvp, VnodeClass class, afs_foff_t *anvnodes)
+{
+    struct VnodeClassInfo *vcp = &VnodeClassInfo[class];
+    FdHandle_t *fdP;
+    afs_sfsize_t size;
+    afs_foff_t nvnodes;
+    int nranges;
+
+    if (vol_clone_threads <= 1)
+	return 1;
+    fdP = IH_OPEN(rwvp->vnodeIndex[class].handle);
+    if (fdP == NULL)
+	return 1;
+    size = FDH_SIZE(fdP);
+    FDH_CLOSE(fdP);
+    if (size <= vcp->diskSize)
+	return 1;
+
+    nvnodes = (size - vcp->diskSize) / vcp->diskSize;
+    nranges = min(vol_clone_threads, VOL_MAX_CLONE_THREADS);
+    if (nvnodes / CLONE_MINRANGE < nranges)
+	nranges = nvnodes / CLONE_MINRANGE;
+    if (nranges < 1)
+	nranges = 1;
+    *anvnodes = nvnodes;
+    return nranges;
+}
+#endif /* AFS_PTHREAD_ENV */
+
+/*
+ * Clone one vnode index. With vol_clone_threads above 1, large indices
+ * are split into that many ranges which are cloned at once, each by its
+ * own thread; the volume group's link counts are expected to be in a
+ * link count batch (see CloneVolume) so that the threads don't contend
+ * for the link table.
+ */
+afs_int32
+DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
+{
+    afs_int32 code, error = 0;
+    FdHandle_t *fdP;
+    StreamHandle_t *clfilein;
+    char dbuf[SIZEOF_LARGEDISKVNODE];
+    struct VnodeDiskObject *clvnode = (struct VnodeDiskObject *)dbuf;
+    struct clone_range *ranges;
+    struct clone_rock decRock;
+    afs_foff_t offset, nvnodes = 0;
+    afs_int32 filecount = 0, diskused = 0;
+    int i, nranges = 1, stop = 0;
+
+    struct VnodeClassInfo *vcp = &VnodeClassInfo[class];
+    /*
+     * The fileserver's -readonly switch should make this false, but we
+     * have no useful way to know in the volserver.
+     * This doesn't make client data mutable.
+     */
+    int ReadWriteOriginal = 1;
+
+    /* Correct number of files in volume: this assumes indexes are always
+       cloned starting with vLarge */
+    if (ReadWriteOriginal && class != vLarge) {
+	filecount = V_filecount(rwvp);
+	diskused = V_diskused(rwvp);
+    }
+
+    decRock.h = V_linkHandle(rwvp);
+    decRock.vol = V_parentId(rwvp);
+
+#ifdef AFS_PTHREAD_ENV
+    nranges = CloneRangeCount(rwvp, class, &nvnodes);
+#endif
+    ranges = calloc(nranges, sizeof(*ranges));
+    if (ranges == NULL)
+	return ENOMEM;
+    for (i = 0; i < nranges; i++) {
+	struct clone_range *cr = &ranges[i];
+
+	cr->rwvp = rwvp;
+	cr->clvp = clvp;
+	cr->class = class;
+	cr->reclone = reclone;
+	cr->start = vcp->diskSize + (nvnodes / nranges) * i * vcp->diskSize;
+	cr->end = (i == nranges - 1) ? -1 : cr->start
+	    + (nvnodes / nranges) * vcp->diskSize;
+	cr->stop = (nranges > 1) ? &stop : NULL;
+	ci_InitHead(&cr->decHead);
+    }
+
+    if (nranges == 1) {
+	DoCloneRange(&ranges[0]);
+    }
+#ifdef AFS_PTHREAD_ENV
+    else {
+	pthread_t tids[VOL_MAX_CLONE_THREADS];
+	int started[VOL_MAX_CLONE_THREADS];
+	pthread_attr_t tattr;
+
+	opr_Verify(pthread_attr_init(&tattr) == 0);
+	opr_Verify(pthread_attr_setdetachstate(&tattr,
+					       PTHREAD_CREATE_JOINABLE) == 0);
+	/* We take the first range ourselves, and any range we can't start
+	 * a thread for after that. */
+	for (i = 1; i < nranges; i++) {
+	    started[i] = (pthread_create(&tids[i], &tattr, CloneRangeThread,
+					 &ranges[i]) == 0);
+	}
+	DoCloneRange(&ranges[0]);
+	for (i = 1; i < nranges; i++) {
+	    if (started[i])
+		opr_Verify(pthread_join(tids[i], NULL) == 0);
+	    else
+		DoCloneRange(&ranges[i]);
+	}
+	opr_Verify(pthread_attr_destroy(&tattr) == 0);
+    }
+#endif
+
+    for (i = 0; i < nranges; i++) {
+	if (!error)
+	    error = ranges[i].error;
+	filecount += ranges[i].filecount;
+	diskused += ranges[i].diskused;
+	if (ranges[i].forceOffline) {
+	    VForceOffline(rwvp);
+	    break;
+	}
+    }
+    offset = ranges[nranges - 1].offset;
+
+    /* Clean out any junk at end of clone file */
+    if (reclone && !error) {
+	fdP = IH_OPEN(clvp->vnodeIndex[class].handle);
+	if (fdP != NULL) {
+	    clfilein = FDH_FDOPEN(fdP, "r");
+	    if (clfilein != NULL) {
+		STREAM_ASEEK(clfilein, offset);
+		while (STREAM_READ(clvnode, vcp->diskSize, 1, clfilein) == 1) {
+		    if (clvnode->type != vNull && VNDISK_GET_INO(clvnode) != 0) {
+			ci_AddItem(&ranges[nranges - 1].decHead,
+				   VNDISK_GET_INO(clvnode));
+		    }
+		    DOPOLL;
+		}
+		STREAM_CLOSE(clfilein);
+	    }
+	    FDH_CLOSE(fdP);
+	}
+    }
+
     /* Next, we sync the disk. We have to reopen in case we're truncating,
      * since we were using stdio above, and don't know when the buffers
      * would otherwise be flushed.  There's no stdio fftruncate call.
      */
-    rwFd = IH_OPEN(clvp->vnodeIndex[class].handle);
-    if (rwFd == NULL) {
+    fdP = IH_OPEN(clvp->vnodeIndex[class].handle);
+    if (fdP == NULL) {
 	if (!error)
 	    error = EIO;
     } else {
@@ -385,11 +561,11 @@ DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
 	     * truncate the file to offset bytes.
 	     */
 	    if (reclone && !error) {
-		error = FDH_TRUNC(rwFd, offset);
+		error = FDH_TRUNC(fdP, offset);
 	    }
 	}
-	(void)FDH_SYNC(rwFd);
-	FDH_CLOSE(rwFd);
+	(void)FDH_SYNC(fdP);
+	FDH_CLOSE(fdP);
     }
 
     /* Now finally do the idec's.  At this point, all potential
@@ -397,10 +573,13 @@ DoCloneIndex(Volume * rwvp, Volume * clvp, VnodeClass class, int reclone)
      * (see above fclose and fsync). No matter what happens, we
      * no longer need to keep these references around.
      */
-    code = ci_Apply(&decHead, IDecProc, (char *)&decRock);
-    if (!error)
-	error = code;
-    ci_Destroy(&decHead);
+    for (i = 0; i < nranges; i++) {
+	code = ci_Apply(&ranges[i].decHead, IDecProc, (char *)&decRock);
+	if (!error)
+	    error = code;
+	ci_Destroy(&ranges[i].decHead);
+    }
+    free(ranges);
 
     if (ReadWriteOriginal && filecount > 0)
 	V_filecount(rwvp) = filecount;
@@ -415,10 +594,16 @@ CloneVolume(Error * rerror, Volume * original, Volume * new, Volume * old)
     afs_int32 code, error = 0;
     afs_int32 reclone;
     afs_int32 filecount = V_filecount(original), diskused = V_diskused(original);
+    int batched;
 
     *rerror = 0;
     reclone = ((new == old) ? 1 : 0);
 
+    /* Every file in the volume gains or loses a link; keep the link
+     * table in memory until we are done. DoCloneIndex's threads all
+     * share this batch. */
+    batched = (IH_LINKBATCH_BEGIN(V_linkHandle(original)) == 0);
+
     code = DoCloneIndex(original, new, vLarge, reclone);
     if (code)
 	ERROR_EXIT(code);
@@ -435,5 +620,7 @@ CloneVolume(Error * rerror, Volume * original, Volume * new, Volume * old)
 	ERROR_EXIT(code);
 
   error_exit:
+    if (batched && IH_LINKBATCH_END(V_linkHandle(original)) && !error)
+	error = EIO;
     *rerror = error;
 }
@@ -104,6 +104,7 @@ static int VGCScan(struct cmd_syndesc * as, void * rock);
 static int VGCScanAll(struct cmd_syndesc * as, void * rock);
 
 static void print_vol_stats_general(VolPkgStats * stats);
+static void print_vol_stats_lock(VolPkgLockStats * stats);
 static void print_vol_stats_viceP(struct DiskPartitionStats64 * stats);
 static void print_vol_stats_hash(struct VolumeHashChainStats * stats);
 #ifdef AFS_DEMAND_ATTACH_FS
@@ -671,6 +672,8 @@ vn_flags_to_string(afs_uint32 flags)
     FLAGCASE(flags, VN_ON_HASH, str, count);
     FLAGCASE(flags, VN_ON_LRU, str, count);
     FLAGCASE(flags, VN_ON_VVN, str, count);
+    FLAGCASE(flags, VN_ON_LRU_IN, str, count);
+    FLAGCASE(flags, VN_LRU_HOT, str, count);
 
     return str;
 }
@@ -1016,7 +1019,7 @@ VnQuery(struct cmd_syndesc * as, void * rock)
 	printf("\thashNext        = %p\n", v.hashNext);
 	printf("\tlruNext         = %p\n", v.lruNext);
 	printf("\tlruPrev         = %p\n", v.lruPrev);
-	printf("\thashIndex       = %hu\n", v.hashIndex);
+	printf("\thashIndex       = %u\n", v.hashIndex);
 	printf("\tchanged_newTime = %u\n", (unsigned int) v.changed_newTime);
 	printf("\tchanged_oldTime = %u\n", (unsigned int) v.changed_oldTime);
 	printf("\tdelete          = %u\n", (unsigned int) v.delete);
@@ -1111,9 +1114,12 @@ StatsQuery(struct cmd_syndesc * as, void * rock)
 #endif
 	} else if (!strcasecmp(ti->data, "pkg")) {
 	    command = FSYNC_VOL_STATS_GENERAL;
+	} else if (!strcasecmp(ti->data, "lock")) {
+	    command = FSYNC_VOL_STATS_LOCK;
 	} else if (!strcasecmp(ti->data, "help")) {
 	    fprintf(stderr, "fssync-debug stats subcommands:\n");
 	    fprintf(stderr, "\tpkg\tgeneral volume package stats\n");
+	    fprintf(stderr, "\tlock\tvolume package lock contention stats\n");
 	    fprintf(stderr, "\tvicep\tvice partition stats\n");
 	    fprintf(stderr, "\thash\tvolume hash chain stats\n");
 #ifdef AFS_DEMAND_ATTACH_FS
@@ -1186,6 +1192,13 @@ StatsQuery(struct cmd_syndesc * as, void * rock)
 		print_vol_stats_general(&vol_stats);
 		break;
 	    }
+	case FSYNC_VOL_STATS_LOCK:
+	    {
+		struct VolPkgLockStats lock_stats;
+		memcpy(&lock_stats, res_buf, sizeof(lock_stats));
+		print_vol_stats_lock(&lock_stats);
+		break;
+	    }
 	case FSYNC_VOL_STATS_VICEP:
 	    {
 		struct DiskPartitionStats64 vicep_stats;
@@ -1252,6 +1265,33 @@ print_vol_stats_general(VolPkgStats * stats)
     printf("}\n");
 }
 
+static void
+print_vol_lock_stats(const char * name, struct VLockStats * stats)
+{
+    printf("\t%s = {\n", name);
+    printf("\t\tacquires = %"AFS_INT64_FMT"\n", stats->acquires);
+    printf("\t\tcontended = %"AFS_INT64_FMT"\n", stats->contended);
+    printf("\t\twait_usecs = %"AFS_INT64_FMT"\n", stats->wait_usecs);
+    printf("\t\twait_max_usecs = %u\n", stats->wait_max_usecs);
+    printf("\t}\n");
+}
+
+static void
+print_vol_stats_lock(VolPkgLockStats * stats)
+{
+    printf("VolPkgLockStats = {\n");
+    print_vol_lock_stats("glock", &stats->glock);
+    print_vol_lock_stats("trans", &stats->trans);
+#ifdef AFS_DEMAND_ATTACH_FS
+    print_vol_lock_stats("vol_state", &stats->vol_state);
+    print_vol_lock_stats("vnode_state", &stats->vnode_state);
+    print_vol_lock_stats("vbyp", &stats->vbyp);
+    print_vol_lock_stats("hash_chain", &stats->hash_chain);
+    print_vol_lock_stats("vlru", &stats->vlru);
+#endif
+    printf("}\n");
+}
+
 static void
 print_vol_stats_viceP(struct DiskPartitionStats64 * stats)
 {
@@ -170,6 +170,7 @@ static afs_int32 FSYNC_com_VnQry(osi_socket fd, SYNC_command * com, SYNC_respons
 static afs_int32 FSYNC_com_StatsOp(osi_socket fd, SYNC_command * com, SYNC_response * res);
 
 static afs_int32 FSYNC_com_StatsOpGeneral(FSSYNC_StatsOp_command * scom, SYNC_response * res);
+static afs_int32 FSYNC_com_StatsOpLock(FSSYNC_StatsOp_command * scom, SYNC_response * res);
 
 #ifdef AFS_DEMAND_ATTACH_FS
 static afs_int32 FSYNC_com_StatsOpViceP(FSSYNC_StatsOp_command * scom, SYNC_response * res);
@@ -529,6 +530,7 @@ FSYNC_com(osi_socket fd)
     case FSYNC_VOL_STATS_HASH:
     case FSYNC_VOL_STATS_HDR:
     case FSYNC_VOL_STATS_VLRU:
+    case FSYNC_VOL_STATS_LOCK:
 	res.hdr.response = FSYNC_com_StatsOp(fd, &com, &res);
 	break;
     case FSYNC_VOL_QUERY_VNODE:
@@ -1827,6 +1829,9 @@ FSYNC_com_StatsOp(osi_socket fd, SYNC_command * com, SYNC_response * res)
     case FSYNC_VOL_STATS_GENERAL:
 	code = FSYNC_com_StatsOpGeneral(&scom, res);
 	break;
+    case FSYNC_VOL_STATS_LOCK:
+	code = FSYNC_com_StatsOpLock(&scom, res);
+	break;
 #ifdef AFS_DEMAND_ATTACH_FS
 	/* statistics for the following subsystems are only tracked
 	 * for demand attach fileservers */
@@ -1861,6 +1866,17 @@ FSYNC_com_StatsOpGeneral(FSSYNC_StatsOp_command * scom, SYNC_response * res)
     return code;
 }
 
+static afs_int32
+FSYNC_com_StatsOpLock(FSSYNC_StatsOp_command * scom, SYNC_response * res)
+{
+    afs_int32 code = SYNC_OK;
+
+    memcpy(res->payload.buf, &VLockStats, sizeof(VLockStats));
+    res->hdr.response_len += sizeof(VLockStats);
+
+    return code;
+}
+
 #ifdef AFS_DEMAND_ATTACH_FS
 static afs_int32
 FSYNC_com_StatsOpViceP(FSSYNC_StatsOp_command * scom, SYNC_response * res)
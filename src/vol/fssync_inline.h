@@ -44,6 +44,7 @@ FSYNC_com2string(afs_int32 command)
 	FSYNC_ENUMCASE(FSYNC_VG_DEL);
 	FSYNC_ENUMCASE(FSYNC_VG_SCAN);
 	FSYNC_ENUMCASE(FSYNC_VG_SCAN_ALL);
+	FSYNC_ENUMCASE(FSYNC_VOL_STATS_LOCK);
 
     default:
 	return "**UNKNOWN**";
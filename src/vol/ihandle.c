@@ -26,6 +26,7 @@
 #ifdef AFS_PTHREAD_ENV
 # include <opr/lock.h>
 #endif
+#include <opr/jhash.h>
 #include <afs/afsint.h>
 #include <afs/afssyscalls.h>
 #include <afs/afsutil.h>
@@ -33,28 +34,58 @@
 #include "nfs.h"
 #include "ihandle.h"
 #include "viceinode.h"
+#include "common.h"
 
 #ifdef AFS_PTHREAD_ENV
 pthread_once_t ih_glock_once = PTHREAD_ONCE_INIT;
 pthread_mutex_t ih_glock_mutex;
 #endif /* AFS_PTHREAD_ENV */
 
-/* Linked list of available inode handles */
-IHandle_t *ihAvailHead;
-IHandle_t *ihAvailTail;
+/*
+ * The inode handle hash table, the handle free lists and the file
+ * descriptor LRU are split into IH_NSHARDS shards, so that threads working
+ * on different files do not all serialize on one lock.  An inode handle
+ * belongs to the shard picked by its hash bucket, and its FdHandle_t's are
+ * always taken from and returned to that same shard, so everything
+ * reachable from one IHandle_t is protected by a single shard lock.
+ * IH_LOCK now only covers package initialization and the stream handles.
+ *
+ * Lock order: IH_LOCK, then a shard lock, then the close queue lock.
+ */
+typedef struct ihShard {
+#ifdef AFS_PTHREAD_ENV
+    pthread_mutex_t lock;
+#endif
+    IHandle_t *ihAvailHead;	/* available inode handles */
+    IHandle_t *ihAvailTail;
+    FdHandle_t *fdAvailHead;	/* available file descriptor handles */
+    FdHandle_t *fdAvailTail;
+    FdHandle_t *fdLruHead;	/* open descriptors nobody is using */
+    FdHandle_t *fdLruTail;
+    int fdInUseCount;		/* descriptors open in this shard */
+    int fdCacheSize;		/* this shard's share of fdCacheSize */
+    afs_uint64 hits;		/* ih_open found an open descriptor */
+    afs_uint64 misses;		/* ih_open had to open the file */
+    afs_uint64 evictions;	/* cached descriptors closed to make room */
+    afs_uint64 emfileEvictions;	/* ...because an open failed with EMFILE */
+} ihShard_t;
+
+static ihShard_t ihShards[IH_NSHARDS];
 
-/* Linked list of available file descriptor handles */
-FdHandle_t *fdAvailHead;
-FdHandle_t *fdAvailTail;
+#ifdef AFS_PTHREAD_ENV
+# define IH_SHARD_LOCK(sp) opr_mutex_enter(&(sp)->lock)
+# define IH_SHARD_UNLOCK(sp) opr_mutex_exit(&(sp)->lock)
+#else
+# define IH_SHARD_LOCK(sp)
+# define IH_SHARD_UNLOCK(sp)
+#endif
+
+#define IH_SHARD(ihP) (&ihShards[(ihP)->ih_bucket & (IH_NSHARDS - 1)])
 
 /* Linked list of available stream descriptor handles */
 StreamHandle_t *streamAvailHead;
 StreamHandle_t *streamAvailTail;
 
-/* LRU list for file descriptor handles */
-FdHandle_t *fdLruHead;
-FdHandle_t *fdLruTail;
-
 int ih_Inited = 0;
 int ih_PkgDefaultsSet = 0;
 
@@ -69,14 +100,107 @@ int ih_PkgDefaultsSet = 0;
 int fdMaxCacheSize = 0;
 int fdCacheSize = 0;
 
-/* Number of in use file descriptors */
-int fdInUseCount = 0;
+/* Hash table for inode handles, sized by ih_Initialize */
+static IHashBucket_t *ihashTable;
+static afs_uint32 ihashMask;
 
-/* Hash table for inode handles */
-IHashBucket_t ihashTable[I_HANDLE_HASH_SIZE];
+/* Upper bound on the hash table size, in buckets */
+#define IH_MAX_HASH_SIZE	(1024 * 1024)
+
+/*
+ * Descriptors evicted to make room in a full cache are handed to a closer
+ * thread instead of being closed by the thread that wanted the slot, so a
+ * burst of cold opens does not also pay for a burst of close(2)s, which
+ * can be slow when the kernel has dirty pages to write back.  The queue is
+ * bounded; when it is full, or there is no closer thread, descriptors are
+ * closed inline as before.  Explicit closes (fd_reallyclose, and
+ * IH_REALLYCLOSE or the last IH_RELEASE of a handle) are always
+ * synchronous, since callers depend on the file really being closed.
+ */
+#ifdef AFS_PTHREAD_ENV
+#define IH_CLOSEQ_SIZE	1024
+#define IH_CLOSE_BATCH	64
+
+struct ihCloseEntry {
+    FD_t fd;
+    ihShard_t *shard;		/* shard whose fdInUseCount to drop */
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cv;
+    struct ihCloseEntry q[IH_CLOSEQ_SIZE];
+    int head;			/* oldest queued entry */
+    int count;			/* number of queued entries */
+    int running;		/* closer thread has been started */
+    int maxDepth;		/* most entries ever queued at once */
+    afs_uint64 deferred;	/* closes handed to the closer thread */
+    afs_uint64 overflows;	/* closes done inline on a full queue */
+} ihCloseQ;
+#endif /* AFS_PTHREAD_ENV */
+
+#ifdef AFS_PTHREAD_ENV
+/*
+ * Group commit, for IH_SYNC_GROUP. FDH_SYNC queues the file on the
+ * committer thread for its partition and waits. The committer takes
+ * everything queued as one batch, syncs each file in it once, and wakes
+ * the batch's waiters. Whatever is queued meanwhile makes up the next
+ * batch, so the busier the partition, the more FDH_SYNCs each fdatasync
+ * covers.
+ */
+struct ihCommitWait {
+    FdHandle_t *fdP;		/* held open by the waiter until woken */
+    int code;			/* result of the sync */
+    struct ihCommitWait *next;
+};
+
+typedef struct ihCommitter {
+    int dev;			/* ih_dev of the partition */
+    pthread_mutex_t lock;
+    pthread_cond_t work_cv;	/* signalled when a sync is queued */
+    pthread_cond_t done_cv;	/* broadcast when a batch is synced */
+    struct ihCommitWait *queue;	/* the next batch */
+    afs_uint64 epoch;		/* batches taken */
+    afs_uint64 committed;	/* batches synced */
+    afs_uint64 requests;	/* FDH_SYNCs queued */
+    afs_uint64 syncs;		/* files synced */
+    int maxBatch;		/* most FDH_SYNCs in one batch */
+    struct ihCommitter *next;
+} ihCommitter_t;
+
+static pthread_mutex_t ihCommitLock;	/* protects ihCommitters */
+static ihCommitter_t *ihCommitters;
+#endif /* AFS_PTHREAD_ENV */
+
+/* A second with at least this many closes counts as a close storm */
+#define IH_CLOSE_STORM	1000
+
+static struct {
+#ifdef AFS_PTHREAD_ENV
+    pthread_mutex_t lock;
+#endif
+    afs_uint64 closes;		/* descriptors closed by the cache */
+    time_t second;		/* second thisSecond is counting */
+    afs_uint32 thisSecond;	/* closes during that second */
+    afs_uint32 peak;		/* most closes in any one second */
+    afs_uint32 storms;		/* seconds with IH_CLOSE_STORM closes */
+    afs_uint32 maxBatch;	/* most descriptors closed in one batch */
+} ihCloseStats;
 
 static int _ih_release_r(IHandle_t * ihP);
 
+#ifdef AFS_IH_URING_ENV
+# define IH_FSYNC(fd) (ih_uring_depth ? ih_uring_fsync(fd) : OS_SYNC(fd))
+#else
+# define IH_FSYNC(fd) OS_SYNC(fd)
+#endif
+
+#ifdef HAVE_FDATASYNC
+# define IH_DATASYNC(fd) fdatasync(fd)
+#else
+# define IH_DATASYNC(fd) IH_FSYNC(fd)
+#endif
+
 /* start-time configurable I/O limits */
 ih_init_params vol_io_params;
 
@@ -95,7 +219,8 @@ void ih_PkgDefaults(void)
     vol_io_params.fd_initial_cachesize = FD_DEFAULT_CACHESIZE;
 
     /* fd cache size that will be used if/when ih_UseLargeCache()
-     * is called */
+     * is called.  ih_Initialize caps this at what RLIMIT_NOFILE
+     * actually allows. */
     vol_io_params.fd_max_cachesize = FD_MAX_CACHESIZE;
 
     vol_io_params.sync_behavior = IH_SYNC_ONCLOSE;
@@ -115,6 +240,9 @@ ih_SetSyncBehavior(const char *behavior)
     } else if (strcmp(behavior, "never") == 0) {
 	val = IH_SYNC_NEVER;
 
+    } else if (strcmp(behavior, "group") == 0) {
+	val = IH_SYNC_GROUP;
+
     } else {
 	/* invalid behavior name */
 	return -1;
@@ -133,19 +261,71 @@ ih_glock_init(void)
 }
 #endif /* AFS_PTHREAD_ENV */
 
+/* Hash an inode handle to its bucket in ihashTable */
+static_inline afs_uint32
+ih_Hash(int dev, VolumeId vid, Inode ino)
+{
+    afs_uint32 key[4];
+
+    key[0] = dev;
+    key[1] = vid;
+    key[2] = (afs_uint32)((afs_uint64)ino & 0xffffffff);
+    key[3] = (afs_uint32)((afs_uint64)ino >> 32);
+    return opr_jhash(key, 4, 0) & ihashMask;
+}
+
+/* Account for n descriptors closed in one go */
+static void
+ih_CountCloses(int n)
+{
+    time_t now = time(NULL);
+
+#ifdef AFS_PTHREAD_ENV
+    opr_mutex_enter(&ihCloseStats.lock);
+#endif
+    ihCloseStats.closes += n;
+    if (n > ihCloseStats.maxBatch)
+	ihCloseStats.maxBatch = n;
+    if (now != ihCloseStats.second) {
+	ihCloseStats.second = now;
+	ihCloseStats.thisSecond = 0;
+    }
+    if (ihCloseStats.thisSecond < IH_CLOSE_STORM
+	&& ihCloseStats.thisSecond + n >= IH_CLOSE_STORM)
+	ihCloseStats.storms++;
+    ihCloseStats.thisSecond += n;
+    if (ihCloseStats.thisSecond > ihCloseStats.peak)
+	ihCloseStats.peak = ihCloseStats.thisSecond;
+#ifdef AFS_PTHREAD_ENV
+    opr_mutex_exit(&ihCloseStats.lock);
+#endif
+}
+
+/* Divide the descriptor cache evenly among the shards.  Called with
+ * IH_LOCK held. */
+static void
+ih_SetCacheSize_r(int size)
+{
+    int i;
+
+    fdCacheSize = size;
+    for (i = 0; i < IH_NSHARDS; i++) {
+	ihShard_t *sp = &ihShards[i];
+
+	IH_SHARD_LOCK(sp);
+	sp->fdCacheSize = size / IH_NSHARDS + (i < size % IH_NSHARDS);
+	IH_SHARD_UNLOCK(sp);
+    }
+}
+
 /* Initialize the file descriptor cache */
 void
 ih_Initialize(void)
 {
     int i;
+    afs_uint32 hashSize;
+
     opr_Assert(!ih_Inited);
-    ih_Inited = 1;
-    DLL_INIT_LIST(ihAvailHead, ihAvailTail);
-    DLL_INIT_LIST(fdAvailHead, fdAvailTail);
-    DLL_INIT_LIST(fdLruHead, fdLruTail);
-    for (i = 0; i < I_HANDLE_HASH_SIZE; i++) {
-	DLL_INIT_LIST(ihashTable[i].ihash_head, ihashTable[i].ihash_tail);
-    }
 #if defined(AFS_NT40_ENV)
     fdMaxCacheSize = vol_io_params.fd_max_cachesize;
 #elif defined(AFS_SUN5_ENV) || defined(AFS_NBSD_ENV)
@@ -174,14 +354,110 @@ ih_Initialize(void)
     fdMaxCacheSize = 0;
 #else
     {
+	/* _SC_OPEN_MAX follows the RLIMIT_NOFILE soft limit */
 	long fdMax = max(sysconf(_SC_OPEN_MAX) - vol_io_params.fd_handle_setaside,
 					 0);
 	fdMaxCacheSize = (int)min(fdMax, vol_io_params.fd_max_cachesize);
     }
 #endif
-    fdCacheSize = min(fdMaxCacheSize, vol_io_params.fd_initial_cachesize);
+
+    /* Every cached descriptor pins an inode handle, so size the hash
+     * table for the largest cache we may be asked to use. */
+    hashSize = I_HANDLE_HASH_SIZE;
+    while (hashSize < fdMaxCacheSize && hashSize < IH_MAX_HASH_SIZE)
+	hashSize <<= 1;
+    ihashTable = calloc(hashSize, sizeof(IHashBucket_t));
+    opr_Assert(ihashTable != NULL);
+    ihashMask = hashSize - 1;
+
+    for (i = 0; i < IH_NSHARDS; i++) {
+	ihShard_t *sp = &ihShards[i];
+
+#ifdef AFS_PTHREAD_ENV
+	opr_mutex_init(&sp->lock);
+#endif
+	DLL_INIT_LIST(sp->ihAvailHead, sp->ihAvailTail);
+	DLL_INIT_LIST(sp->fdAvailHead, sp->fdAvailTail);
+	DLL_INIT_LIST(sp->fdLruHead, sp->fdLruTail);
+    }
+#ifdef AFS_PTHREAD_ENV
+    opr_mutex_init(&ihCloseQ.lock);
+    opr_cv_init(&ihCloseQ.cv);
+    opr_mutex_init(&ihCloseStats.lock);
+    opr_mutex_init(&ihCommitLock);
+#endif
+    ih_SetCacheSize_r(min(fdMaxCacheSize, vol_io_params.fd_initial_cachesize));
+    ih_Inited = 1;
+}
+
+#ifdef AFS_PTHREAD_ENV
+/* Close everything on the close queue.  Returns the number of
+ * descriptors closed. */
+static int
+ih_DrainCloses(void)
+{
+    struct ihCloseEntry batch[IH_CLOSE_BATCH];
+    int i, n, total = 0;
+
+    for (;;) {
+	opr_mutex_enter(&ihCloseQ.lock);
+	for (n = 0; n < IH_CLOSE_BATCH && ihCloseQ.count > 0; n++) {
+	    batch[n] = ihCloseQ.q[ihCloseQ.head];
+	    ihCloseQ.head = (ihCloseQ.head + 1) % IH_CLOSEQ_SIZE;
+	    ihCloseQ.count--;
+	}
+	opr_mutex_exit(&ihCloseQ.lock);
+	if (n == 0)
+	    break;
+
+	for (i = 0; i < n; i++)
+	    OS_CLOSE(batch[i].fd);
+	for (i = 0; i < n; i++) {
+	    IH_SHARD_LOCK(batch[i].shard);
+	    batch[i].shard->fdInUseCount--;
+	    IH_SHARD_UNLOCK(batch[i].shard);
+	}
+	ih_CountCloses(n);
+	total += n;
+    }
+    return total;
 }
 
+static void *
+ih_CloserThread(void *unused)
+{
+    afs_pthread_setname_self("ih closer");
+    for (;;) {
+	opr_mutex_enter(&ihCloseQ.lock);
+	while (ihCloseQ.count == 0)
+	    opr_cv_wait(&ihCloseQ.cv, &ihCloseQ.lock);
+	opr_mutex_exit(&ihCloseQ.lock);
+	ih_DrainCloses();
+    }
+    return NULL;
+}
+
+/* Start the closer thread, once.  Called with IH_LOCK held. */
+static void
+ih_StartCloser_r(void)
+{
+    pthread_t tid;
+    pthread_attr_t tattr;
+
+    opr_mutex_enter(&ihCloseQ.lock);
+    if (ihCloseQ.running) {
+	opr_mutex_exit(&ihCloseQ.lock);
+	return;
+    }
+    opr_Verify(pthread_attr_init(&tattr) == 0);
+    opr_Verify(pthread_attr_setdetachstate(&tattr,
+					   PTHREAD_CREATE_DETACHED) == 0);
+    opr_Verify(pthread_create(&tid, &tattr, ih_CloserThread, NULL) == 0);
+    ihCloseQ.running = 1;
+    opr_mutex_exit(&ihCloseQ.lock);
+}
+#endif /* AFS_PTHREAD_ENV */
+
 /* Make the file descriptor cache as big as possible. Don't this call
  * if the program uses fopen or fdopen, if fd_max_cachesize cannot be
  * represented in the fileno member of the system FILE structure (or
@@ -200,24 +476,28 @@ ih_UseLargeCache(void)
         ih_Initialize();
     }
 
-    fdCacheSize = fdMaxCacheSize;
+    ih_SetCacheSize_r(fdMaxCacheSize);
+#ifdef AFS_PTHREAD_ENV
+    ih_StartCloser_r();
+#endif
 
     IH_UNLOCK;
 }
 
-/* Allocate a chunk of inode handles */
-void
-iHandleAllocateChunk(void)
+/* Allocate a chunk of inode handles for a shard */
+static void
+iHandleAllocateChunk(ihShard_t *sp)
 {
     int i;
     IHandle_t *ihP;
 
-    opr_Assert(ihAvailHead == NULL);
+    opr_Assert(sp->ihAvailHead == NULL);
     ihP = malloc(I_HANDLE_MALLOCSIZE * sizeof(IHandle_t));
     opr_Assert(ihP != NULL);
     for (i = 0; i < I_HANDLE_MALLOCSIZE; i++) {
 	ihP[i].ih_refcnt = 0;
-	DLL_INSERT_TAIL(&ihP[i], ihAvailHead, ihAvailTail, ih_next, ih_prev);
+	DLL_INSERT_TAIL(&ihP[i], sp->ihAvailHead, sp->ihAvailTail, ih_next,
+			ih_prev);
     }
 }
 
@@ -225,44 +505,53 @@ iHandleAllocateChunk(void)
 IHandle_t *
 ih_init(int dev, int vid, Inode ino)
 {
-    int ihash = IH_HASH(dev, vid, ino);
+    afs_uint32 ihash;
+    ihShard_t *sp;
     IHandle_t *ihP;
 
     if (!ih_PkgDefaultsSet) {
         ih_PkgDefaults();
     }
 
-    IH_LOCK;
     if (!ih_Inited) {
-        ih_Initialize();
+	IH_LOCK;
+	if (!ih_Inited) {
+	    ih_Initialize();
+	}
+	IH_UNLOCK;
     }
 
+    ihash = ih_Hash(dev, vid, ino);
+    sp = &ihShards[ihash & (IH_NSHARDS - 1)];
+    IH_SHARD_LOCK(sp);
+
     /* Do we already have a handle for this Inode? */
     for (ihP = ihashTable[ihash].ihash_head; ihP; ihP = ihP->ih_next) {
 	if (ihP->ih_ino == ino && ihP->ih_vid == vid && ihP->ih_dev == dev) {
 	    ihP->ih_refcnt++;
-	    IH_UNLOCK;
+	    IH_SHARD_UNLOCK(sp);
 	    return ihP;
 	}
     }
 
     /* Allocate and initialize a new Inode handle */
-    if (ihAvailHead == NULL) {
-	iHandleAllocateChunk();
+    if (sp->ihAvailHead == NULL) {
+	iHandleAllocateChunk(sp);
     }
-    ihP = ihAvailHead;
+    ihP = sp->ihAvailHead;
     opr_Assert(ihP->ih_refcnt == 0);
-    DLL_DELETE(ihP, ihAvailHead, ihAvailTail, ih_next, ih_prev);
+    DLL_DELETE(ihP, sp->ihAvailHead, sp->ihAvailTail, ih_next, ih_prev);
     ihP->ih_dev = dev;
     ihP->ih_vid = vid;
     ihP->ih_ino = ino;
     ihP->ih_flags = 0;
     ihP->ih_synced = 0;
     ihP->ih_refcnt = 1;
+    ihP->ih_bucket = ihash;
     DLL_INIT_LIST(ihP->ih_fdhead, ihP->ih_fdtail);
     DLL_INSERT_TAIL(ihP, ihashTable[ihash].ihash_head,
 		    ihashTable[ihash].ihash_tail, ih_next, ih_prev);
-    IH_UNLOCK;
+    IH_SHARD_UNLOCK(sp);
     return ihP;
 }
 
@@ -270,22 +559,25 @@ ih_init(int dev, int vid, Inode ino)
 IHandle_t *
 ih_copy(IHandle_t * ihP)
 {
-    IH_LOCK;
+    ihShard_t *sp;
+
     opr_Assert(ih_Inited);
+    sp = IH_SHARD(ihP);
+    IH_SHARD_LOCK(sp);
     opr_Assert(ihP->ih_refcnt > 0);
     ihP->ih_refcnt++;
-    IH_UNLOCK;
+    IH_SHARD_UNLOCK(sp);
     return ihP;
 }
 
-/* Allocate a chunk of file descriptor handles */
-void
-fdHandleAllocateChunk(void)
+/* Allocate a chunk of file descriptor handles for a shard */
+static void
+fdHandleAllocateChunk(ihShard_t *sp)
 {
     int i;
     FdHandle_t *fdP;
 
-    opr_Assert(fdAvailHead == NULL);
+    opr_Assert(sp->fdAvailHead == NULL);
     fdP = malloc(FD_HANDLE_MALLOCSIZE * sizeof(FdHandle_t));
     opr_Assert(fdP != NULL);
     for (i = 0; i < FD_HANDLE_MALLOCSIZE; i++) {
@@ -295,7 +587,8 @@ fdHandleAllocateChunk(void)
 	fdP[i].fd_fd = INVALID_FD;
         fdP[i].fd_ihnext = NULL;
         fdP[i].fd_ihprev = NULL;
-	DLL_INSERT_TAIL(&fdP[i], fdAvailHead, fdAvailTail, fd_next, fd_prev);
+	DLL_INSERT_TAIL(&fdP[i], sp->fdAvailHead, sp->fdAvailTail, fd_next,
+			fd_prev);
     }
 }
 
@@ -317,56 +610,77 @@ streamHandleAllocateChunk(void)
     }
 }
 
+/*
+ * Close a descriptor evicted from a shard's LRU.  Called with the shard
+ * lock held.  The close is queued for the closer thread if there is room;
+ * otherwise it is done here, dropping and reacquiring the shard lock.
+ */
+static void
+ih_CloseEvicted_r(ihShard_t *sp, FD_t fd)
+{
+#ifdef AFS_PTHREAD_ENV
+    opr_mutex_enter(&ihCloseQ.lock);
+    if (ihCloseQ.running) {
+	if (ihCloseQ.count < IH_CLOSEQ_SIZE) {
+	    struct ihCloseEntry *ep;
+
+	    ep = &ihCloseQ.q[(ihCloseQ.head + ihCloseQ.count) % IH_CLOSEQ_SIZE];
+	    ep->fd = fd;
+	    ep->shard = sp;
+	    if (ihCloseQ.count++ == 0)
+		opr_cv_signal(&ihCloseQ.cv);
+	    if (ihCloseQ.count > ihCloseQ.maxDepth)
+		ihCloseQ.maxDepth = ihCloseQ.count;
+	    ihCloseQ.deferred++;
+	    opr_mutex_exit(&ihCloseQ.lock);
+	    return;
+	}
+	ihCloseQ.overflows++;
+    }
+    opr_mutex_exit(&ihCloseQ.lock);
+#endif /* AFS_PTHREAD_ENV */
+
+    IH_SHARD_UNLOCK(sp);
+    OS_CLOSE(fd);
+    ih_CountCloses(1);
+    IH_SHARD_LOCK(sp);
+    sp->fdInUseCount -= 1;
+}
+
 /*
  * Get a file descriptor handle given an Inode handle
- * Takes the given file descriptor, and creates a new FdHandle_t for it,
- * attached to the given IHandle_t. If fdLruHead is not NULL, fd can be
- * INVALID_FD, indicating that the caller failed to open the relevant file
- * because we had too many FDs open; ih_attachfd_r will then just evict/close
- * an existing fd in the cache, and return NULL. You must not call this
- * function with an invalid fd while fdLruHead is NULL; instead, error out.
+ * Takes the given, valid, file descriptor, and creates a new FdHandle_t
+ * for it, attached to the given IHandle_t. Called with the shard lock of
+ * the IHandle_t held, after counting fd in the shard's fdInUseCount. May
+ * drop and reacquire the lock.
  */
 static FdHandle_t *
-ih_attachfd_r(IHandle_t *ihP, FD_t fd)
+ih_attachfd_r(ihShard_t *sp, IHandle_t *ihP, FD_t fd)
 {
     FD_t closeFd;
     FdHandle_t *fdP;
 
-    /* If the given fd is invalid, we must have an available fd to close.
-     * Otherwise, the caller must have realized this before calling
-     * ih_attachfd_r and yielded an error before getting here. */
-    opr_Assert(fd != INVALID_FD || fdLruHead != NULL);
+    opr_Assert(fd != INVALID_FD);
 
     /* fdCacheSize limits the size of the descriptor cache, but
      * we permit the number of open files to exceed fdCacheSize.
      * We only recycle open file descriptors when the number
      * of open files reaches the size of the cache */
-    if ((fdInUseCount > fdCacheSize || fd == INVALID_FD)  && fdLruHead != NULL) {
-	fdP = fdLruHead;
+    if (sp->fdInUseCount > sp->fdCacheSize && sp->fdLruHead != NULL) {
+	fdP = sp->fdLruHead;
 	opr_Assert(fdP->fd_status == FD_HANDLE_OPEN);
-	DLL_DELETE(fdP, fdLruHead, fdLruTail, fd_next, fd_prev);
+	DLL_DELETE(fdP, sp->fdLruHead, sp->fdLruTail, fd_next, fd_prev);
 	DLL_DELETE(fdP, fdP->fd_ih->ih_fdhead, fdP->fd_ih->ih_fdtail,
 		   fd_ihnext, fd_ihprev);
 	closeFd = fdP->fd_fd;
-	if (fd == INVALID_FD) {
-	    fdCacheSize--;          /* reduce in order to not run into here too often */
-	    DLL_INSERT_TAIL(fdP, fdAvailHead, fdAvailTail, fd_next, fd_prev);
-	    fdP->fd_status = FD_HANDLE_AVAIL;
-	    fdP->fd_ih = NULL;
-	    fdP->fd_fd = INVALID_FD;
-	    IH_UNLOCK;
-	    OS_CLOSE(closeFd);
-	    IH_LOCK;
-	    fdInUseCount -= 1;
-	    return NULL;
-	}
+	sp->evictions++;
     } else {
-	if (fdAvailHead == NULL) {
-	    fdHandleAllocateChunk();
+	if (sp->fdAvailHead == NULL) {
+	    fdHandleAllocateChunk(sp);
 	}
-	fdP = fdAvailHead;
+	fdP = sp->fdAvailHead;
 	opr_Assert(fdP->fd_status == FD_HANDLE_AVAIL);
-	DLL_DELETE(fdP, fdAvailHead, fdAvailTail, fd_next, fd_prev);
+	DLL_DELETE(fdP, sp->fdAvailHead, sp->fdAvailTail, fd_next, fd_prev);
 	closeFd = INVALID_FD;
     }
 
@@ -382,10 +696,7 @@ ih_attachfd_r(IHandle_t *ihP, FD_t fd)
 		    fd_ihprev);
 
     if (closeFd != INVALID_FD) {
-	IH_UNLOCK;
-	OS_CLOSE(closeFd);
-	IH_LOCK;
-	fdInUseCount -= 1;
+	ih_CloseEvicted_r(sp, closeFd);
     }
 
     return fdP;
@@ -394,37 +705,109 @@ ih_attachfd_r(IHandle_t *ihP, FD_t fd)
 FdHandle_t *
 ih_attachfd(IHandle_t *ihP, FD_t fd)
 {
+    ihShard_t *sp;
     FdHandle_t *fdP;
 
     if (fd == INVALID_FD) {
 	return NULL;
     }
 
-    IH_LOCK;
+    sp = IH_SHARD(ihP);
+    IH_SHARD_LOCK(sp);
 
-    fdInUseCount += 1;
+    sp->fdInUseCount += 1;
 
-    fdP = ih_attachfd_r(ihP, fd);
+    fdP = ih_attachfd_r(sp, ihP, fd);
     opr_Assert(fdP);
 
-    IH_UNLOCK;
+    IH_SHARD_UNLOCK(sp);
 
     return fdP;
 }
 
+/*
+ * Close the least recently used descriptor in a shard right away, after
+ * an open failed with EMFILE. Called with the shard lock held; may drop
+ * and reacquire it. Returns 0 if the shard had nothing cached to close.
+ */
+static int
+ih_EvictEmfile_r(ihShard_t *sp)
+{
+    FdHandle_t *fdP;
+    FD_t closeFd;
+
+    fdP = sp->fdLruHead;
+    if (fdP == NULL) {
+	return 0;
+    }
+    opr_Assert(fdP->fd_status == FD_HANDLE_OPEN);
+    DLL_DELETE(fdP, sp->fdLruHead, sp->fdLruTail, fd_next, fd_prev);
+    DLL_DELETE(fdP, fdP->fd_ih->ih_fdhead, fdP->fd_ih->ih_fdtail,
+	       fd_ihnext, fd_ihprev);
+    closeFd = fdP->fd_fd;
+    DLL_INSERT_TAIL(fdP, sp->fdAvailHead, sp->fdAvailTail, fd_next, fd_prev);
+    fdP->fd_status = FD_HANDLE_AVAIL;
+    fdP->fd_ih = NULL;
+    fdP->fd_fd = INVALID_FD;
+
+    /* reduce in order to not run into here too often */
+    if (sp->fdCacheSize > 0) {
+	sp->fdCacheSize--;
+    }
+    sp->emfileEvictions++;
+
+    IH_SHARD_UNLOCK(sp);
+    OS_CLOSE(closeFd);
+    ih_CountCloses(1);
+    IH_SHARD_LOCK(sp);
+    sp->fdInUseCount -= 1;
+    return 1;
+}
+
+/*
+ * Free up a descriptor after an open failed with EMFILE: finish any queued
+ * closes or, failing that, close the least recently used descriptor in
+ * this shard or in any other. Called with no locks held. Returns 0 if
+ * there was nothing left to close.
+ */
+static int
+ih_FreeDescriptor(ihShard_t *sp)
+{
+    int i, closed;
+    ihShard_t *tp;
+
+#ifdef AFS_PTHREAD_ENV
+    if (ih_DrainCloses() > 0) {
+	return 1;
+    }
+#endif
+    for (i = 0; i < IH_NSHARDS; i++) {
+	tp = &ihShards[((sp - ihShards) + i) & (IH_NSHARDS - 1)];
+	IH_SHARD_LOCK(tp);
+	closed = ih_EvictEmfile_r(tp);
+	IH_SHARD_UNLOCK(tp);
+	if (closed) {
+	    return 1;
+	}
+    }
+    return 0;
+}
+
 /*
  * Get a file descriptor handle given an Inode handle
  */
 FdHandle_t *
 ih_open(IHandle_t * ihP)
 {
+    ihShard_t *sp;
     FdHandle_t *fdP;
     FD_t fd;
 
     if (!ihP)			/* XXX should log here in the fileserver */
 	return NULL;
 
-    IH_LOCK;
+    sp = IH_SHARD(ihP);
+    IH_SHARD_LOCK(sp);
 
     /* Do we already have an open file handle for this Inode? */
     for (fdP = ihP->ih_fdtail; fdP != NULL; fdP = fdP->fd_ihprev) {
@@ -449,35 +832,36 @@ ih_open(IHandle_t * ihP)
 	fdP->fd_refcnt++;
 	if (fdP->fd_status == FD_HANDLE_OPEN) {
 	    fdP->fd_status = FD_HANDLE_INUSE;
-	    DLL_DELETE(fdP, fdLruHead, fdLruTail, fd_next, fd_prev);
+	    DLL_DELETE(fdP, sp->fdLruHead, sp->fdLruTail, fd_next, fd_prev);
 	}
 	ihP->ih_refcnt++;
-	IH_UNLOCK;
+	sp->hits++;
+	IH_SHARD_UNLOCK(sp);
 	return fdP;
     }
 
     /*
      * Try to open the Inode, return NULL on error.
      */
-    fdInUseCount += 1;
-    IH_UNLOCK;
+    sp->fdInUseCount += 1;
+    sp->misses++;
+    IH_SHARD_UNLOCK(sp);
 ih_open_retry:
     fd = OS_IOPEN(ihP);
-    IH_LOCK;
-    if (fd == INVALID_FD && (errno != EMFILE || fdLruHead == NULL) ) {
-	fdInUseCount -= 1;
-	IH_UNLOCK;
-	return NULL;
+    if (fd == INVALID_FD && errno == EMFILE && ih_FreeDescriptor(sp)) {
+	goto ih_open_retry;
     }
 
-    fdP = ih_attachfd_r(ihP, fd);
-    if (!fdP) {
-	opr_Assert(fd == INVALID_FD);
-	IH_UNLOCK;
-	goto ih_open_retry;
+    IH_SHARD_LOCK(sp);
+    if (fd == INVALID_FD) {
+	sp->fdInUseCount -= 1;
+	IH_SHARD_UNLOCK(sp);
+	return NULL;
     }
 
-    IH_UNLOCK;
+    fdP = ih_attachfd_r(sp, ihP, fd);
+
+    IH_SHARD_UNLOCK(sp);
 
     return fdP;
 }
@@ -488,27 +872,30 @@ ih_open_retry:
 int
 fd_close(FdHandle_t * fdP)
 {
+    ihShard_t *sp;
     IHandle_t *ihP;
 
     if (!fdP)
 	return 0;
 
-    IH_LOCK;
     opr_Assert(ih_Inited);
-    opr_Assert(fdInUseCount > 0);
+    ihP = fdP->fd_ih;
+    sp = IH_SHARD(ihP);
+
+    IH_SHARD_LOCK(sp);
+    opr_Assert(sp->fdInUseCount > 0);
     opr_Assert(fdP->fd_status == FD_HANDLE_INUSE ||
                fdP->fd_status == FD_HANDLE_CLOSING);
 
-    ihP = fdP->fd_ih;
-
     /* Call fd_reallyclose to really close the unused file handles if
      * the previous attempt to close (ih_reallyclose()) all file handles
      * failed (this is determined by checking the ihandle for the flag
      * IH_REALLY_CLOSED) or we have too many open files.
      */
     if (fdP->fd_status == FD_HANDLE_CLOSING ||
-        ihP->ih_flags & IH_REALLY_CLOSED || fdInUseCount > fdCacheSize) {
-	IH_UNLOCK;
+        ihP->ih_flags & IH_REALLY_CLOSED ||
+	sp->fdInUseCount > sp->fdCacheSize) {
+	IH_SHARD_UNLOCK(sp);
 	return fd_reallyclose(fdP);
     }
 
@@ -516,7 +903,7 @@ fd_close(FdHandle_t * fdP)
     if (fdP->fd_refcnt == 0) {
 	/* Put this descriptor back into the cache */
 	fdP->fd_status = FD_HANDLE_OPEN;
-	DLL_INSERT_TAIL(fdP, fdLruHead, fdLruTail, fd_next, fd_prev);
+	DLL_INSERT_TAIL(fdP, sp->fdLruHead, sp->fdLruTail, fd_next, fd_prev);
     }
 
     /* If this is not the only reference to the Inode then we can decrement
@@ -527,7 +914,7 @@ fd_close(FdHandle_t * fdP)
     else
 	_ih_release_r(ihP);
 
-    IH_UNLOCK;
+    IH_SHARD_UNLOCK(sp);
 
     return 0;
 }
@@ -540,24 +927,28 @@ int
 fd_reallyclose(FdHandle_t * fdP)
 {
     FD_t closeFd;
+    ihShard_t *sp;
     IHandle_t *ihP;
 
     if (!fdP)
 	return 0;
 
-    IH_LOCK;
     opr_Assert(ih_Inited);
-    opr_Assert(fdInUseCount > 0);
+    ihP = fdP->fd_ih;
+    sp = IH_SHARD(ihP);
+
+    IH_SHARD_LOCK(sp);
+    opr_Assert(sp->fdInUseCount > 0);
     opr_Assert(fdP->fd_status == FD_HANDLE_INUSE ||
                fdP->fd_status == FD_HANDLE_CLOSING);
 
-    ihP = fdP->fd_ih;
     closeFd = fdP->fd_fd;
     fdP->fd_refcnt--;
 
     if (fdP->fd_refcnt == 0) {
 	DLL_DELETE(fdP, ihP->ih_fdhead, ihP->ih_fdtail, fd_ihnext, fd_ihprev);
-	DLL_INSERT_TAIL(fdP, fdAvailHead, fdAvailTail, fd_next, fd_prev);
+	DLL_INSERT_TAIL(fdP, sp->fdAvailHead, sp->fdAvailTail, fd_next,
+			fd_prev);
 
 	fdP->fd_status = FD_HANDLE_AVAIL;
 	fdP->fd_refcnt = 0;
@@ -588,10 +979,11 @@ fd_reallyclose(FdHandle_t * fdP)
     }
 
     if (fdP->fd_refcnt == 0) {
-	IH_UNLOCK;
+	IH_SHARD_UNLOCK(sp);
 	OS_CLOSE(closeFd);
-	IH_LOCK;
-	fdInUseCount -= 1;
+	ih_CountCloses(1);
+	IH_SHARD_LOCK(sp);
+	sp->fdInUseCount -= 1;
     }
 
     /* If this is not the only reference to the Inode then we can decrement
@@ -601,7 +993,7 @@ fd_reallyclose(FdHandle_t * fdP)
     else
 	_ih_release_r(ihP);
 
-    IH_UNLOCK;
+    IH_SHARD_UNLOCK(sp);
 
     return 0;
 }
@@ -842,14 +1234,15 @@ stream_close(StreamHandle_t * streamP, int reallyClose)
 }
 
 /* Close all unused file descriptors associated with the inode
- * handle. Called with IH_LOCK held. May drop and reacquire
- * IH_LOCK. Sets the IH_REALLY_CLOSED flag in the inode handle
+ * handle. Called with the handle's shard lock held. May drop and
+ * reacquire the lock. Sets the IH_REALLY_CLOSED flag in the inode handle
  * if it fails to close all file handles.
  */
 static int
 ih_fdclose(IHandle_t * ihP)
 {
     int closeCount, closedAll;
+    ihShard_t *sp = IH_SHARD(ihP);
     FdHandle_t *fdP, *head, *tail, *next;
 
     opr_Assert(ihP->ih_refcnt > 0);
@@ -876,7 +1269,7 @@ ih_fdclose(IHandle_t * ihP)
 	     * off here. */
 	    DLL_DELETE(fdP, ihP->ih_fdhead, ihP->ih_fdtail, fd_ihnext,
 		       fd_ihprev);
-	    DLL_DELETE(fdP, fdLruHead, fdLruTail, fd_next, fd_prev);
+	    DLL_DELETE(fdP, sp->fdLruHead, sp->fdLruTail, fd_next, fd_prev);
 	    DLL_INSERT_TAIL(fdP, head, tail, fd_next, fd_prev);
 	} else {
 	    closedAll = 0;
@@ -898,7 +1291,7 @@ ih_fdclose(IHandle_t * ihP)
 	return 0;		/* No file descriptors closed */
     }
 
-    IH_UNLOCK;
+    IH_SHARD_UNLOCK(sp);
     /*
      * Close the file descriptors
      */
@@ -911,21 +1304,22 @@ ih_fdclose(IHandle_t * ihP)
 	fdP->fd_ih = NULL;
 	closeCount++;
     }
+    ih_CountCloses(closeCount);
 
-    IH_LOCK;
-    opr_Assert(fdInUseCount >= closeCount);
-    fdInUseCount -= closeCount;
+    IH_SHARD_LOCK(sp);
+    opr_Assert(sp->fdInUseCount >= closeCount);
+    sp->fdInUseCount -= closeCount;
 
     /*
      * Append the temporary queue to the list of available descriptors
      */
-    if (fdAvailHead == NULL) {
-	fdAvailHead = head;
-	fdAvailTail = tail;
+    if (sp->fdAvailHead == NULL) {
+	sp->fdAvailHead = head;
+	sp->fdAvailTail = tail;
     } else {
-	fdAvailTail->fd_next = head;
-	head->fd_prev = fdAvailTail;
-	fdAvailTail = tail;
+	sp->fdAvailTail->fd_next = head;
+	head->fd_prev = sp->fdAvailTail;
+	sp->fdAvailTail = tail;
     }
 
     return 0;
@@ -935,25 +1329,34 @@ ih_fdclose(IHandle_t * ihP)
 int
 ih_reallyclose(IHandle_t * ihP)
 {
+    ihShard_t *sp;
+
     if (!ihP)
 	return 0;
 
-    IH_LOCK;
+#ifdef AFS_IH_URING_ENV
+    /* wait for any fsyncs IH_CONDSYNC left running */
+    if (ih_uring_drain() > 0)
+	Log("ih_reallyclose: deferred fsync failed\n");
+#endif
+
+    sp = IH_SHARD(ihP);
+    IH_SHARD_LOCK(sp);
     ihP->ih_refcnt++;   /* must not disappear over unlock */
     if (ihP->ih_synced) {
 	FdHandle_t *fdP;
 	opr_Assert(vol_io_params.sync_behavior != IH_SYNC_ALWAYS);
 	opr_Assert(vol_io_params.sync_behavior != IH_SYNC_NEVER);
         ihP->ih_synced = 0;
-	IH_UNLOCK;
+	IH_SHARD_UNLOCK(sp);
 
 	fdP = IH_OPEN(ihP);
 	if (fdP) {
-	    OS_SYNC(fdP->fd_fd);
+	    IH_FSYNC(fdP->fd_fd);
 	    FDH_CLOSE(fdP);
 	}
 
-	IH_LOCK;
+	IH_SHARD_LOCK(sp);
     }
 
     opr_Assert(ihP->ih_refcnt > 0);
@@ -965,17 +1368,19 @@ ih_reallyclose(IHandle_t * ihP)
     else
 	_ih_release_r(ihP);
 
-    IH_UNLOCK;
+    IH_SHARD_UNLOCK(sp);
     return 0;
 }
 
 /* Release an Inode handle. All cached file descriptors for this
- * inode are closed when the last reference to this handle is released
+ * inode are closed when the last reference to this handle is released.
+ * Called with the handle's shard lock held.
  */
 static int
 _ih_release_r(IHandle_t * ihP)
 {
-    int ihash;
+    afs_uint32 ihash;
+    ihShard_t *sp;
 
     if (!ihP)
 	return 0;
@@ -987,7 +1392,8 @@ _ih_release_r(IHandle_t * ihP)
 	return 0;
     }
 
-    ihash = IH_HASH(ihP->ih_dev, ihP->ih_vid, ihP->ih_ino);
+    ihash = ihP->ih_bucket;
+    sp = IH_SHARD(ihP);
     DLL_DELETE(ihP, ihashTable[ihash].ihash_head,
 	       ihashTable[ihash].ihash_tail, ih_next, ih_prev);
 
@@ -995,7 +1401,7 @@ _ih_release_r(IHandle_t * ihP)
 
     ihP->ih_refcnt--;
 
-    DLL_INSERT_TAIL(ihP, ihAvailHead, ihAvailTail, ih_next, ih_prev);
+    DLL_INSERT_TAIL(ihP, sp->ihAvailHead, sp->ihAvailTail, ih_next, ih_prev);
 
     return 0;
 }
@@ -1007,16 +1413,97 @@ int
 ih_release(IHandle_t * ihP)
 {
     int ret;
+    ihShard_t *sp;
 
     if (!ihP)
 	return 0;
 
-    IH_LOCK;
+    sp = IH_SHARD(ihP);
+    IH_SHARD_LOCK(sp);
     ret = _ih_release_r(ihP);
-    IH_UNLOCK;
+    IH_SHARD_UNLOCK(sp);
     return ret;
 }
 
+/* Log file descriptor cache statistics */
+void
+ih_PrintStats(void)
+{
+    int i, inUse = 0, cacheSize = 0, pct = 0;
+    afs_uint64 hits = 0, misses = 0, evictions = 0, emfile = 0;
+
+    if (!ih_Inited)
+	return;
+
+    for (i = 0; i < IH_NSHARDS; i++) {
+	ihShard_t *sp = &ihShards[i];
+
+	IH_SHARD_LOCK(sp);
+	inUse += sp->fdInUseCount;
+	cacheSize += sp->fdCacheSize;
+	hits += sp->hits;
+	misses += sp->misses;
+	evictions += sp->evictions;
+	emfile += sp->emfileEvictions;
+	IH_SHARD_UNLOCK(sp);
+    }
+    if (hits + misses > 0)
+	pct = (int)(hits * 1000 / (hits + misses));
+
+    Log("File descriptor cache, %d open, %d entries (max %d), "
+	"%"AFS_UINT64_FMT" hits, %"AFS_UINT64_FMT" misses (%d.%d%% hits), "
+	"%"AFS_UINT64_FMT" evictions, %"AFS_UINT64_FMT" on EMFILE\n",
+	inUse, cacheSize, fdMaxCacheSize, hits, misses, pct / 10, pct % 10,
+	evictions, emfile);
+
+#ifdef AFS_PTHREAD_ENV
+    opr_mutex_enter(&ihCloseStats.lock);
+#endif
+    Log("File descriptor closes, %"AFS_UINT64_FMT" total, peak %u/sec, "
+	"%u seconds over %d/sec, largest batch %u\n",
+	ihCloseStats.closes, ihCloseStats.peak, ihCloseStats.storms,
+	IH_CLOSE_STORM, ihCloseStats.maxBatch);
+#ifdef AFS_PTHREAD_ENV
+    opr_mutex_exit(&ihCloseStats.lock);
+
+    opr_mutex_enter(&ihCloseQ.lock);
+    if (ihCloseQ.running) {
+	Log("File descriptor closer, %"AFS_UINT64_FMT" deferred closes, "
+	    "%d queued (max %d of %d), %"AFS_UINT64_FMT" closed inline\n",
+	    ihCloseQ.deferred, ihCloseQ.count, ihCloseQ.maxDepth,
+	    IH_CLOSEQ_SIZE, ihCloseQ.overflows);
+    }
+    opr_mutex_exit(&ihCloseQ.lock);
+#endif
+#ifdef AFS_PTHREAD_ENV
+    {
+	ihCommitter_t *cp;
+
+	opr_mutex_enter(&ihCommitLock);
+	for (cp = ihCommitters; cp != NULL; cp = cp->next) {
+	    opr_mutex_enter(&cp->lock);
+	    Log("Group commit, device %d, %"AFS_UINT64_FMT" syncs requested, "
+		"%"AFS_UINT64_FMT" files synced in %"AFS_UINT64_FMT" batches, "
+		"largest batch %d\n", cp->dev, cp->requests, cp->syncs,
+		cp->committed, cp->maxBatch);
+	    opr_mutex_exit(&cp->lock);
+	}
+	opr_mutex_exit(&ihCommitLock);
+    }
+#endif
+#ifdef AFS_IH_URING_ENV
+    if (ih_uring_depth) {
+	struct ih_uring_stats us;
+
+	ih_uring_GetStats(&us);
+	Log("io_uring, queue depth %d, %d rings, %"AFS_UINT64_FMT" ops in "
+	    "%"AFS_UINT64_FMT" submissions, %"AFS_UINT64_FMT" async fsyncs "
+	    "(%"AFS_UINT64_FMT" failed)\n", ih_uring_depth, us.rings, us.ops,
+	    us.enters, us.asyncFsyncs, us.asyncErrors);
+    }
+#endif
+}
+
 /* Sync an inode to disk if its handle isn't NULL */
 int
 ih_condsync(IHandle_t * ihP)
@@ -1031,6 +1518,25 @@ ih_condsync(IHandle_t * ihP)
     if (fdP == NULL)
 	return -1;
 
+#ifdef AFS_IH_URING_ENV
+    /*
+     * Start the fsync now and leave the next IH_REALLYCLOSE to wait for
+     * it, instead of syncing here or (for IH_SYNC_ONCLOSE) at that close.
+     * Callers condsync all of a volume's files before closing any of
+     * them, so this way their fsyncs proceed together.
+     */
+    if (ih_uring_depth && vol_io_params.sync_behavior != IH_SYNC_NEVER) {
+	ihShard_t *sp = IH_SHARD(ihP);
+
+	IH_SHARD_LOCK(sp);
+	ihP->ih_synced = 0;
+	IH_SHARD_UNLOCK(sp);
+	code = ih_uring_fsync_async(fdP->fd_fd);
+	FDH_CLOSE(fdP);
+	return code;
+    }
+#endif
+
     code = FDH_SYNC(fdP);
     FDH_CLOSE(fdP);
 
@@ -1129,12 +1635,118 @@ ih_isunlinked(int fd)
 }
 #endif /* !AFS_NT40_ENV */
 
+#ifdef AFS_PTHREAD_ENV
+static void *
+ih_CommitterThread(void *arg)
+{
+    ihCommitter_t *cp = arg;
+    struct ihCommitWait *batch, *w, *o;
+    afs_uint64 syncs;
+    int n;
+
+    afs_pthread_setname_self("ih committer");
+    opr_mutex_enter(&cp->lock);
+    for (;;) {
+	while (cp->queue == NULL)
+	    opr_cv_wait(&cp->work_cv, &cp->lock);
+	batch = cp->queue;
+	cp->queue = NULL;
+	cp->epoch++;
+	opr_mutex_exit(&cp->lock);
+
+	n = 0;
+	syncs = 0;
+	for (w = batch; w != NULL; w = w->next) {
+	    n++;
+	    /* Any descriptor for the file will do; sync each file once. */
+	    for (o = batch; o != w; o = o->next) {
+		if (o->fdP->fd_ih == w->fdP->fd_ih)
+		    break;
+	    }
+	    if (o != w) {
+		w->code = o->code;
+	    } else {
+		w->code = IH_DATASYNC(w->fdP->fd_fd);
+		syncs++;
+	    }
+	}
+
+	opr_mutex_enter(&cp->lock);
+	cp->committed = cp->epoch;
+	cp->syncs += syncs;
+	if (n > cp->maxBatch)
+	    cp->maxBatch = n;
+	opr_cv_broadcast(&cp->done_cv);
+    }
+    return NULL;
+}
+
+/* Find the committer for a partition, starting it if need be. */
+static ihCommitter_t *
+ih_GetCommitter(int dev)
+{
+    ihCommitter_t *cp;
+    pthread_t tid;
+    pthread_attr_t tattr;
+
+    opr_mutex_enter(&ihCommitLock);
+    for (cp = ihCommitters; cp != NULL; cp = cp->next) {
+	if (cp->dev == dev)
+	    break;
+    }
+    if (cp == NULL) {
+	cp = calloc(1, sizeof(*cp));
+	opr_Assert(cp != NULL);
+	cp->dev = dev;
+	opr_mutex_init(&cp->lock);
+	opr_cv_init(&cp->work_cv);
+	opr_cv_init(&cp->done_cv);
+	opr_Verify(pthread_attr_init(&tattr) == 0);
+	opr_Verify(pthread_attr_setdetachstate(&tattr,
+					       PTHREAD_CREATE_DETACHED) == 0);
+	opr_Verify(pthread_create(&tid, &tattr, ih_CommitterThread, cp) == 0);
+	cp->next = ihCommitters;
+	ihCommitters = cp;
+    }
+    opr_mutex_exit(&ihCommitLock);
+    return cp;
+}
+
+/* Have the partition's committer sync the file, and wait until it has. */
+static int
+ih_groupsync(FdHandle_t *fdP)
+{
+    ihCommitter_t *cp = ih_GetCommitter(fdP->fd_ih->ih_dev);
+    struct ihCommitWait w;
+    afs_uint64 epoch;
+
+    w.fdP = fdP;
+    w.code = 0;
+    opr_mutex_enter(&cp->lock);
+    w.next = cp->queue;
+    cp->queue = &w;
+    cp->requests++;
+    epoch = cp->epoch + 1;	/* the batch we just joined */
+    opr_cv_signal(&cp->work_cv);
+    while (cp->committed < epoch)
+	opr_cv_wait(&cp->done_cv, &cp->lock);
+    opr_mutex_exit(&cp->lock);
+    return w.code;
+}
+#endif /* AFS_PTHREAD_ENV */
+
 int
 ih_fdsync(FdHandle_t *fdP)
 {
     switch (vol_io_params.sync_behavior) {
     case IH_SYNC_ALWAYS:
-	return OS_SYNC(fdP->fd_fd);
+	return IH_FSYNC(fdP->fd_fd);
+    case IH_SYNC_GROUP:
+#ifdef AFS_PTHREAD_ENV
+	if (fdP->fd_ih)
+	    return ih_groupsync(fdP);
+#endif
+	return IH_DATASYNC(fdP->fd_fd);
     case IH_SYNC_ONCLOSE:
 	if (fdP->fd_ih) {
 	    fdP->fd_ih->ih_synced = 1;
@@ -1147,3 +1759,13 @@ ih_fdsync(FdHandle_t *fdP)
 	opr_Assert(0);
     }
 }
+
+/* Sync a vnode index or volume header just written, when syncs are grouped.
+ * Otherwise such writes are left to IH_CONDSYNC as before. */
+int
+ih_metasync(FdHandle_t *fdP)
+{
+    if (vol_io_params.sync_behavior != IH_SYNC_GROUP)
+	return 0;
+    return ih_fdsync(fdP);
+}
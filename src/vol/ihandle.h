@@ -56,6 +56,8 @@
  *	file descriptor.
  * IH_IREAD/IH_IWRITE - read/write an Inode.
  * IH_INC/IH_DEC - increment/decrement the link count.
+ * IH_LINKBATCH_BEGIN/IH_LINKBATCH_END - hold link count changes to a
+ *	volume group in memory across many IH_INC/IH_DEC calls.
  *
  * Replacements for C runtime file operations
  * FDH_READ/FDH_WRITE - read/write using the file descriptor.
@@ -64,6 +66,7 @@
  * FDH_CLOSE - return a file descriptor to the cache
  * FDH_REALLYCLOSE - Close a file descriptor, do not return to the cache
  * FDH_SYNC - Unconditionally sync an open file.
+ * FDH_METASYNC - Sync volume metadata just written, if syncs are grouped.
  * FDH_TRUNC - Truncate a file
  * FDH_LOCKFILE - Lock a whole file
  * FDH_UNLOCKFILE - Unlock a whole file
@@ -224,6 +227,12 @@ typedef struct StreamHandle_s {
                              * our data hits the disk eventually, depending on
                              * the platform and various OS-specific tuning
                              * parameters. */
+#define IH_SYNC_GROUP   (4) /* This makes FDH_SYNCs wait for a committer
+                             * thread, which syncs each file once for all of
+                             * the FDH_SYNCs that arrived while it was busy.
+                             * Vnode index and volume header writes are synced
+                             * this way too (FDH_METASYNC), so volume metadata
+                             * is durable when each operation completes. */
 
 
 /* READ THIS.
@@ -262,9 +271,15 @@ typedef struct ih_init_params
 
 /* We need some limit on the number of files open at once. Some systems
  * say we can open lots of files, but when we do they run out of slots
- * in the file table.
+ * in the file table.  Elsewhere the limit that matters is RLIMIT_NOFILE,
+ * which ih_Initialize also honours, so the default is set high enough
+ * not to get in the way of a server with many hot files.
  */
-#define FD_MAX_CACHESIZE (2000 - FD_HANDLE_SETASIDE)
+#ifdef AFS_NT40_ENV
+# define FD_MAX_CACHESIZE (2000 - FD_HANDLE_SETASIDE)
+#else
+# define FD_MAX_CACHESIZE (262144 - FD_HANDLE_SETASIDE)
+#endif
 
 /* On modern platforms, this is sized higher than the note implies.
  * For HP, see http://forums11.itrc.hp.com/service/forums/questionanswer.do?admit=109447626+1242508538748+28353475&threadId=302950
@@ -289,16 +304,19 @@ typedef struct IHandle_s {
     struct FdHandle_s *ih_fdtail;
     struct IHandle_s *ih_next;	/* Links for avail list/hash chains */
     struct IHandle_s *ih_prev;
+    afs_uint32 ih_bucket;	/* hash bucket; also selects the shard */
 } IHandle_t;
 
 /* Flags for the Inode handle */
 #define IH_REALLY_CLOSED		1
 
-/* Hash function for inode handles */
+/* Minimum size of the inode handle hash table; ih_Initialize grows it
+ * to match the largest descriptor cache. */
 #define I_HANDLE_HASH_SIZE	2048	/* power of 2 */
 
-/* The casts to int's ensure NT gets the xor operation correct. */
-#define IH_HASH(D, V, I) ((int)(((D)^(V)^((int)(I)))&(I_HANDLE_HASH_SIZE-1)))
+/* Number of independently locked shards the handle and descriptor caches
+ * are split into. */
+#define IH_NSHARDS		16	/* power of 2 */
 
 /*
  * Hash buckets for inode handles
@@ -348,6 +366,7 @@ extern int ih_reallyclose(IHandle_t * ihP);
 extern int ih_release(IHandle_t * ihP);
 extern int ih_condsync(IHandle_t * ihP);
 extern FdHandle_t *ih_attachfd(IHandle_t * ihP, FD_t fd);
+extern void ih_PrintStats(void);
 
 /* Macros common to user space and inode API's. */
 #define IH_INIT(H, D, V, I) ((H) = ih_init((D), (V), (I)))
@@ -507,6 +526,8 @@ extern int OS_TRUNC(FD_t FD, OFFT L);
 # endif /* AFS_NT40_ENV */
 # define IH_INC(H, I, P) namei_inc(H, I, P)
 # define IH_DEC(H, I, P) namei_dec(H, I, P)
+# define IH_LINKBATCH_BEGIN(H) namei_BeginLinkBatch(H)
+# define IH_LINKBATCH_END(H) namei_EndLinkBatch(H)
 # define IH_IREAD(H, O, B, S) namei_iread(H, O, B, S)
 # define IH_IWRITE(H, O, B, S) namei_iwrite(H, O, B, S)
 # define IH_CREATE(H, D, P, N, P1, P2, P3, P4) \
@@ -559,6 +580,9 @@ extern Inode ih_icreate(IHandle_t * ih, int dev, char *part, Inode nI, int p1,
           inode_write((H)->ih_dev, (H)->ih_ino, (H)->ih_vid, O, B, S)
 # endif /* AFS_LINUX22_ENV */
 
+# define IH_LINKBATCH_BEGIN(H) (-1)
+# define IH_LINKBATCH_END(H) 0
+
 #endif /* AFS_NAMEI_ENV */
 
 #define OS_SIZE(FD) ih_size(FD)
@@ -569,23 +593,86 @@ extern afs_sfsize_t ih_size(FD_t);
 # define FDH_WRITEV(H, I, N) writev((H)->fd_fd, I, N)
 #endif
 
+/*
+ * io_uring backend, see ihuring.c. Only threaded servers can use it,
+ * since each thread drives its own ring.
+ */
+#if defined(HAVE_IO_URING) && defined(AFS_PTHREAD_ENV)
+# define AFS_IH_URING_ENV 1
+
+/* Most operations ih_uring_submitv takes at once */
+# define IH_URING_MAXOPS	64
+
+struct ih_uring_op {
+    int op;			/* IORING_OP_READ, _WRITE, _READV, _WRITEV
+				 * or _FSYNC */
+    FD_t fd;
+    void *buf;			/* buffer, or iovec array for READV/WRITEV */
+    size_t len;			/* bytes, or iovec count for READV/WRITEV */
+    afs_foff_t offset;
+    ssize_t res;		/* result: bytes transferred, or -1 */
+    int err;			/* errno when res is -1 */
+};
+
+struct ih_uring_stats {
+    int rings;			/* threads with a ring */
+    afs_uint64 ops;		/* operations completed */
+    afs_uint64 enters;		/* io_uring_enter calls that submitted */
+    afs_uint64 asyncFsyncs;	/* fsyncs started without waiting */
+    afs_uint64 asyncErrors;	/* ...that failed */
+};
+
+extern int ih_uring_depth;
+extern int ih_uring_init(int depth);
+extern int ih_uring_submitv(struct ih_uring_op *ops, int nops);
+extern ssize_t ih_uring_pread(FD_t fd, void *buf, size_t len,
+			      afs_foff_t offset);
+extern ssize_t ih_uring_pwrite(FD_t fd, const void *buf, size_t len,
+			       afs_foff_t offset);
+extern ssize_t ih_uring_preadv(FD_t fd, const struct iovec *iov, int iovcnt,
+			       afs_foff_t offset);
+extern ssize_t ih_uring_pwritev(FD_t fd, const struct iovec *iov, int iovcnt,
+				afs_foff_t offset);
+extern int ih_uring_fsync(FD_t fd);
+extern int ih_uring_fsync_async(FD_t fd);
+extern int ih_uring_drain(void);
+extern void ih_uring_GetStats(struct ih_uring_stats *stats);
+#endif /* HAVE_IO_URING && AFS_PTHREAD_ENV */
+
 #ifdef HAVE_PIOV
 # ifdef O_LARGEFILE
-#  define FDH_PREADV(H, I, N, O) preadv64((H)->fd_fd, I, N, O)
-#  define FDH_PWRITEV(H, I, N, O) pwritev64((H)->fd_fd, I, N, O)
+#  define OS_PREADV(FD, I, N, O) preadv64(FD, I, N, O)
+#  define OS_PWRITEV(FD, I, N, O) pwritev64(FD, I, N, O)
 # else /* !O_LARGEFILE */
-#  define FDH_PREADV(H, I, N, O) preadv((H)->fd_fd, I, N, O)
-#  define FDH_PWRITEV(H, I, N, O) pwritev((H)->fd_fd, I, N, O)
+#  define OS_PREADV(FD, I, N, O) preadv(FD, I, N, O)
+#  define OS_PWRITEV(FD, I, N, O) pwritev(FD, I, N, O)
 # endif /* !O_LARGEFILE */
+# ifdef AFS_IH_URING_ENV
+#  define FDH_PREADV(H, I, N, O) (ih_uring_depth ? \
+	ih_uring_preadv((H)->fd_fd, I, N, O) : OS_PREADV((H)->fd_fd, I, N, O))
+#  define FDH_PWRITEV(H, I, N, O) (ih_uring_depth ? \
+	ih_uring_pwritev((H)->fd_fd, I, N, O) : OS_PWRITEV((H)->fd_fd, I, N, O))
+# else
+#  define FDH_PREADV(H, I, N, O) OS_PREADV((H)->fd_fd, I, N, O)
+#  define FDH_PWRITEV(H, I, N, O) OS_PWRITEV((H)->fd_fd, I, N, O)
+# endif
 #endif
 
-#define FDH_PREAD(H, B, S, O) OS_PREAD((H)->fd_fd, B, S, O)
-#define FDH_PWRITE(H, B, S, O) OS_PWRITE((H)->fd_fd, B, S, O)
+#ifdef AFS_IH_URING_ENV
+# define FDH_PREAD(H, B, S, O) (ih_uring_depth ? \
+	ih_uring_pread((H)->fd_fd, B, S, O) : OS_PREAD((H)->fd_fd, B, S, O))
+# define FDH_PWRITE(H, B, S, O) (ih_uring_depth ? \
+	ih_uring_pwrite((H)->fd_fd, B, S, O) : OS_PWRITE((H)->fd_fd, B, S, O))
+#else
+# define FDH_PREAD(H, B, S, O) OS_PREAD((H)->fd_fd, B, S, O)
+# define FDH_PWRITE(H, B, S, O) OS_PWRITE((H)->fd_fd, B, S, O)
+#endif
 #define FDH_READ(H, B, S) OS_READ((H)->fd_fd, B, S)
 #define FDH_WRITE(H, B, S) OS_WRITE((H)->fd_fd, B, S)
 #define FDH_SEEK(H, O, F) OS_SEEK((H)->fd_fd, O, F)
 
 #define FDH_SYNC(H) ih_fdsync(H)
+#define FDH_METASYNC(H) ih_metasync(H)
 #define FDH_TRUNC(H, L) OS_TRUNC((H)->fd_fd, L)
 #define FDH_SIZE(H) OS_SIZE((H)->fd_fd)
 #define FDH_LOCKFILE(H, O) OS_LOCKFILE((H)->fd_fd, O)
@@ -593,6 +680,7 @@ extern afs_sfsize_t ih_size(FD_t);
 #define FDH_ISUNLINKED(H) OS_ISUNLINKED((H)->fd_fd)
 
 extern int ih_fdsync(FdHandle_t *fdP);
+extern int ih_metasync(FdHandle_t *fdP);
 
 #ifdef AFS_NT40_ENV
 # define afs_stat_st     __stat64
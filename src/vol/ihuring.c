@@ -0,0 +1,635 @@
+/*
+ * Copyright 2026, OpenAFS contributors.
+ * All Rights Reserved.
+ *
+ * This software has been released under the terms of the IBM Public
+ * License.  For details, see the LICENSE file in the top-level source
+ * directory or online at http://www.openafs.org/dl/license10.html
+ */
+
+/*
+ * ihuring.c - io_uring backend for the FDH_* I/O macros.
+ *
+ * When a server calls ih_uring_init, FDH_PREAD, FDH_PWRITE, FDH_PREADV,
+ * FDH_PWRITEV and synchronous FDH_SYNCs are issued through an io_uring
+ * owned by the calling thread instead of through the plain system calls.
+ * Each thread gets its own ring the first time it does I/O, so submission
+ * and completion need no locking.  The rings are driven through the raw
+ * system calls, so only the kernel headers are needed, not liburing.
+ *
+ * The FDH_* operations keep their synchronous semantics: each one is
+ * submitted and waited for.  The backend adds two things that can't be
+ * had from pread and friends:
+ *
+ * - ih_uring_submitv runs a whole vector of operations with a single
+ *   io_uring_enter, letting the kernel work on all of them at once.
+ *
+ * - ih_uring_fsync_async starts an fsync and returns without waiting for
+ *   it.  IH_CONDSYNC uses this, so the fsyncs of the several files of a
+ *   volume being detached run concurrently; ih_uring_drain, called from
+ *   IH_REALLYCLOSE, waits for them.
+ *
+ * If a thread cannot set up a ring (for instance because it has run out
+ * of file descriptors), its I/O simply falls back to the system calls.
+ */
+
+#include <afsconfig.h>
+#include <afs/param.h>
+
+#include <roken.h>
+
+#ifdef HAVE_IO_URING
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include <afs/opr.h>
+#include <opr/lock.h>
+#include <afs/afsint.h>
+#include <afs/afssyscalls.h>
+
+#include "nfs.h"
+#include "ihandle.h"
+
+/* Zero means the backend is disabled */
+int ih_uring_depth = 0;
+
+/* A thread's ring */
+struct ih_uring {
+    int fd;
+    unsigned int entries;	/* submission queue size */
+    unsigned int queued;	/* SQEs filled in but not yet submitted */
+    unsigned int inflight;	/* submitted but not yet reaped */
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    afs_uint64 ops;		/* operations completed */
+    afs_uint64 enters;		/* io_uring_enter calls that submitted */
+    afs_uint64 asyncFsyncs;	/* fsyncs started by ih_uring_fsync_async */
+    afs_uint64 asyncErrors;	/* ...that failed */
+    struct ih_uring *next;	/* all rings, for ih_uring_GetStats */
+};
+
+static pthread_key_t ih_uring_key;
+static pthread_mutex_t ih_uring_lock;	/* protects the list and totals */
+static struct ih_uring *ih_uring_list;
+static struct ih_uring_stats ih_uring_totals;	/* from rings now gone */
+
+/* Operations every ring must support */
+static const int ih_uring_needed_ops[] = {
+    IORING_OP_READ, IORING_OP_WRITE, IORING_OP_READV, IORING_OP_WRITEV,
+    IORING_OP_FSYNC
+};
+
+static int
+sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+		   unsigned int flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+		   NULL, 0);
+}
+
+static int
+sys_io_uring_register(int fd, unsigned int opcode, void *arg,
+		      unsigned int nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void
+ih_uring_unmap(struct ih_uring *ring)
+{
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+	munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != NULL && ring->cq_ring != MAP_FAILED
+	&& ring->cq_ring != ring->sq_ring)
+	munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring != NULL && ring->sq_ring != MAP_FAILED)
+	munmap(ring->sq_ring, ring->sq_ring_size);
+}
+
+/* Check that the kernel supports everything we issue */
+static int
+ih_uring_probe(int fd)
+{
+    struct io_uring_probe *probe;
+    size_t len;
+    int i, op, code = 0;
+
+    len = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+    probe = calloc(1, len);
+    if (probe == NULL)
+	return ENOMEM;
+    if (sys_io_uring_register(fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+	code = errno;
+	goto done;
+    }
+    for (i = 0; i < sizeof(ih_uring_needed_ops) / sizeof(int); i++) {
+	op = ih_uring_needed_ops[i];
+	if (op > probe->last_op
+	    || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+	    code = EOPNOTSUPP;
+	    goto done;
+	}
+    }
+  done:
+    free(probe);
+    return code;
+}
+
+/*
+ * Set up a ring with the given number of entries. Each ring is only ever
+ * used by the thread that made it, so ask the kernel to defer completion
+ * work to our io_uring_enter calls where it can; older kernels reject
+ * those flags, so fall back to a plain ring.
+ */
+static int
+ih_uring_create(unsigned int entries, struct ih_uring **aring)
+{
+    struct io_uring_params p;
+    struct ih_uring *ring;
+    int code;
+
+    ring = calloc(1, sizeof(*ring));
+    if (ring == NULL)
+	return ENOMEM;
+
+    memset(&p, 0, sizeof(p));
+#if defined(IORING_SETUP_SINGLE_ISSUER) && defined(IORING_SETUP_DEFER_TASKRUN)
+    p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    ring->fd = sys_io_uring_setup(entries, &p);
+    if (ring->fd < 0 && errno == EINVAL) {
+	memset(&p, 0, sizeof(p));
+	ring->fd = sys_io_uring_setup(entries, &p);
+    }
+#else
+    ring->fd = sys_io_uring_setup(entries, &p);
+#endif
+    if (ring->fd < 0) {
+	code = errno;
+	free(ring);
+	return code;
+    }
+
+    ring->entries = p.sq_entries;
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    ring->cq_ring_size = p.cq_off.cqes
+	+ p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+	if (ring->cq_ring_size > ring->sq_ring_size)
+	    ring->sq_ring_size = ring->cq_ring_size;
+	ring->cq_ring_size = ring->sq_ring_size;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, ring->fd,
+			 IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED)
+	goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+	ring->cq_ring = ring->sq_ring;
+    } else {
+	ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+			     MAP_SHARED | MAP_POPULATE, ring->fd,
+			     IORING_OFF_CQ_RING);
+	if (ring->cq_ring == MAP_FAILED)
+	    goto fail;
+    }
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+	goto fail;
+
+    ring->sq_head = (unsigned int *)((char *)ring->sq_ring + p.sq_off.head);
+    ring->sq_tail = (unsigned int *)((char *)ring->sq_ring + p.sq_off.tail);
+    ring->sq_mask = (unsigned int *)((char *)ring->sq_ring
+				     + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *)((char *)ring->sq_ring + p.sq_off.array);
+    ring->cq_head = (unsigned int *)((char *)ring->cq_ring + p.cq_off.head);
+    ring->cq_tail = (unsigned int *)((char *)ring->cq_ring + p.cq_off.tail);
+    ring->cq_mask = (unsigned int *)((char *)ring->cq_ring
+				     + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ring
+					 + p.cq_off.cqes);
+
+    code = ih_uring_probe(ring->fd);
+    if (code) {
+	ih_uring_unmap(ring);
+	close(ring->fd);
+	free(ring);
+	return code;
+    }
+
+    *aring = ring;
+    return 0;
+
+  fail:
+    code = errno;
+    ih_uring_unmap(ring);
+    close(ring->fd);
+    free(ring);
+    return code;
+}
+
+/* Completion slot for an operation someone is waiting on */
+struct ih_uring_wait {
+    int res;
+    int done;
+};
+
+/* Reap whatever completions are available */
+static void
+ih_uring_reap(struct ih_uring *ring)
+{
+    unsigned int head, tail;
+    struct io_uring_cqe *cqe;
+    struct ih_uring_wait *wp;
+
+    head = *ring->cq_head;
+    tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+	cqe = &ring->cqes[head & *ring->cq_mask];
+	wp = (struct ih_uring_wait *)(uintptr_t)cqe->user_data;
+	if (wp != NULL) {
+	    wp->res = cqe->res;
+	    wp->done = 1;
+	} else if (cqe->res < 0) {
+	    /* an fsync nobody waits for */
+	    ring->asyncErrors++;
+	}
+	ring->inflight--;
+	ring->ops++;
+	head++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/*
+ * Submit everything queued and wait until at least min_complete more
+ * operations have completed. Returns an errno value if io_uring_enter
+ * failed in a way that retrying won't fix.
+ */
+static int
+ih_uring_enter(struct ih_uring *ring, unsigned int min_complete)
+{
+    unsigned int flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    int code;
+
+    for (;;) {
+	code = sys_io_uring_enter(ring->fd, ring->queued, min_complete, flags);
+	if (code >= 0) {
+	    if (ring->queued)
+		ring->enters++;
+	    ring->queued -= code;
+	    ring->inflight += code;
+	    break;
+	}
+	if (errno == EINTR)
+	    continue;
+	if (errno == EAGAIN || errno == EBUSY) {
+	    /* the completion queue is backed up; make room and retry */
+	    ih_uring_reap(ring);
+	    continue;
+	}
+	return errno;
+    }
+    ih_uring_reap(ring);
+    return 0;
+}
+
+/* Get a free SQE, making room by waiting for completions if needed */
+static struct io_uring_sqe *
+ih_uring_get_sqe(struct ih_uring *ring)
+{
+    unsigned int tail, index;
+    struct io_uring_sqe *sqe;
+
+    while (ring->queued + ring->inflight >= ring->entries) {
+	if (ih_uring_enter(ring, 1) != 0)
+	    return NULL;
+    }
+    tail = *ring->sq_tail;
+    index = tail & *ring->sq_mask;
+    sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->queued++;
+    return sqe;
+}
+
+static void
+ih_uring_destroy(void *arg)
+{
+    struct ih_uring *ring = arg;
+    struct ih_uring **rpp;
+
+    /* don't leave fsyncs behind */
+    while (ring->queued + ring->inflight > 0) {
+	if (ih_uring_enter(ring, 1) != 0)
+	    break;
+    }
+
+    opr_mutex_enter(&ih_uring_lock);
+    for (rpp = &ih_uring_list; *rpp != NULL; rpp = &(*rpp)->next) {
+	if (*rpp == ring) {
+	    *rpp = ring->next;
+	    break;
+	}
+    }
+    ih_uring_totals.ops += ring->ops;
+    ih_uring_totals.enters += ring->enters;
+    ih_uring_totals.asyncFsyncs += ring->asyncFsyncs;
+    ih_uring_totals.asyncErrors += ring->asyncErrors;
+    opr_mutex_exit(&ih_uring_lock);
+
+    ih_uring_unmap(ring);
+    close(ring->fd);
+    free(ring);
+}
+
+/* Get the calling thread's ring, setting one up if need be. Returns NULL
+ * if the backend is off or the thread can't have a ring. */
+static struct ih_uring *
+ih_uring_get(void)
+{
+    struct ih_uring *ring;
+
+    if (ih_uring_depth == 0)
+	return NULL;
+    ring = pthread_getspecific(ih_uring_key);
+    if (ring != NULL)
+	return ring;
+
+    if (ih_uring_create(ih_uring_depth, &ring) != 0)
+	return NULL;
+    opr_Verify(pthread_setspecific(ih_uring_key, ring) == 0);
+
+    opr_mutex_enter(&ih_uring_lock);
+    ring->next = ih_uring_list;
+    ih_uring_list = ring;
+    opr_mutex_exit(&ih_uring_lock);
+    return ring;
+}
+
+/*
+ * Turn the backend on, with rings of the given queue depth. Returns 0, or
+ * an errno value if the kernel cannot give us a usable ring, in which case
+ * the backend stays off.
+ */
+int
+ih_uring_init(int depth)
+{
+    struct ih_uring *ring;
+    int code;
+
+    opr_Assert(depth > 0);
+    if (ih_uring_depth > 0)
+	return 0;
+
+    /* try it before committing every thread to it */
+    code = ih_uring_create(depth, &ring);
+    if (code)
+	return code;
+
+    opr_mutex_init(&ih_uring_lock);
+    opr_Verify(pthread_key_create(&ih_uring_key, ih_uring_destroy) == 0);
+    opr_Verify(pthread_setspecific(ih_uring_key, ring) == 0);
+    ring->next = ih_uring_list;
+    ih_uring_list = ring;
+    ih_uring_depth = depth;
+    return 0;
+}
+
+/*
+ * Run a vector of operations, all submitted with one io_uring_enter, and
+ * wait for all of them. Each operation's result is left in its res field:
+ * a byte count, or -1 with the error number in err. Returns 0, or -1 if
+ * the backend isn't available to this thread, in which case none of the
+ * operations was started.
+ */
+int
+ih_uring_submitv(struct ih_uring_op *ops, int nops)
+{
+    struct ih_uring *ring;
+    struct ih_uring_wait waits[IH_URING_MAXOPS];
+    struct io_uring_sqe *sqe;
+    int i, n, done, code;
+
+    opr_Assert(nops <= IH_URING_MAXOPS);
+    ring = ih_uring_get();
+    if (ring == NULL)
+	return -1;
+
+    for (i = 0; i < nops; i++) {
+	sqe = ih_uring_get_sqe(ring);
+	if (sqe == NULL) {
+	    /* nothing from i on was queued */
+	    for (n = i; n < nops; n++) {
+		ops[n].res = -1;
+		ops[n].err = EIO;
+	    }
+	    nops = i;
+	    break;
+	}
+	waits[i].done = 0;
+	sqe->opcode = ops[i].op;
+	sqe->fd = ops[i].fd;
+	sqe->off = ops[i].offset;
+	sqe->addr = (uintptr_t)ops[i].buf;
+	sqe->len = ops[i].len;
+	sqe->user_data = (uintptr_t)&waits[i];
+    }
+
+    for (;;) {
+	for (done = 0, i = 0; i < nops; i++)
+	    done += waits[i].done;
+	if (done == nops)
+	    break;
+	code = ih_uring_enter(ring, 1);
+	opr_Assert(code == 0);	/* we have SQEs in the kernel we must wait for */
+    }
+
+    for (i = 0; i < nops; i++) {
+	if (waits[i].res < 0) {
+	    ops[i].res = -1;
+	    ops[i].err = -waits[i].res;
+	} else {
+	    ops[i].res = waits[i].res;
+	    ops[i].err = 0;
+	}
+    }
+    return 0;
+}
+
+/* Run one operation. Falls back to the system call when the thread has
+ * no ring. */
+static ssize_t
+ih_uring_one(int op, FD_t fd, void *buf, size_t len, afs_foff_t offset)
+{
+    struct ih_uring_op uop;
+
+    uop.op = op;
+    uop.fd = fd;
+    uop.buf = buf;
+    uop.len = len;
+    uop.offset = offset;
+    if (ih_uring_submitv(&uop, 1) == 0) {
+	if (uop.res < 0)
+	    errno = uop.err;
+	return uop.res;
+    }
+
+    switch (op) {
+    case IORING_OP_READ:
+	return OS_PREAD(fd, buf, len, offset);
+    case IORING_OP_WRITE:
+	return OS_PWRITE(fd, buf, len, offset);
+#ifdef HAVE_PIOV
+    case IORING_OP_READV:
+# ifdef O_LARGEFILE
+	return preadv64(fd, buf, len, offset);
+# else
+	return preadv(fd, buf, len, offset);
+# endif
+    case IORING_OP_WRITEV:
+# ifdef O_LARGEFILE
+	return pwritev64(fd, buf, len, offset);
+# else
+	return pwritev(fd, buf, len, offset);
+# endif
+#endif
+    case IORING_OP_FSYNC:
+	return fsync(fd);
+    }
+    opr_abort();
+}
+
+ssize_t
+ih_uring_pread(FD_t fd, void *buf, size_t len, afs_foff_t offset)
+{
+    return ih_uring_one(IORING_OP_READ, fd, buf, len, offset);
+}
+
+ssize_t
+ih_uring_pwrite(FD_t fd, const void *buf, size_t len, afs_foff_t offset)
+{
+    return ih_uring_one(IORING_OP_WRITE, fd, (void *)buf, len, offset);
+}
+
+ssize_t
+ih_uring_preadv(FD_t fd, const struct iovec *iov, int iovcnt,
+		afs_foff_t offset)
+{
+    return ih_uring_one(IORING_OP_READV, fd, (void *)iov, iovcnt, offset);
+}
+
+ssize_t
+ih_uring_pwritev(FD_t fd, const struct iovec *iov, int iovcnt,
+		 afs_foff_t offset)
+{
+    return ih_uring_one(IORING_OP_WRITEV, fd, (void *)iov, iovcnt, offset);
+}
+
+int
+ih_uring_fsync(FD_t fd)
+{
+    return ih_uring_one(IORING_OP_FSYNC, fd, NULL, 0, 0);
+}
+
+/*
+ * Start an fsync of fd without waiting for it. The kernel holds its own
+ * reference to the file, so fd may be closed at once. Returns 0 if the
+ * fsync was started, or the result of a synchronous fsync if it couldn't
+ * be.
+ */
+int
+ih_uring_fsync_async(FD_t fd)
+{
+    struct ih_uring *ring;
+    struct io_uring_sqe *sqe;
+    int code;
+
+    ring = ih_uring_get();
+    if (ring == NULL || (sqe = ih_uring_get_sqe(ring)) == NULL)
+	return ih_uring_fsync(fd);
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = fd;
+    sqe->user_data = 0;
+    ring->asyncFsyncs++;
+
+    /* start it now rather than with our next operation */
+    code = ih_uring_enter(ring, 0);
+    if (code) {
+	errno = code;
+	return -1;
+    }
+    return 0;
+}
+
+/*
+ * Wait for every fsync this thread has started with ih_uring_fsync_async.
+ * Returns the number of them that have failed since the last drain.
+ */
+int
+ih_uring_drain(void)
+{
+    struct ih_uring *ring;
+    afs_uint64 errors;
+
+    if (ih_uring_depth == 0)
+	return 0;
+    ring = pthread_getspecific(ih_uring_key);
+    if (ring == NULL)
+	return 0;
+
+    errors = ring->asyncErrors;
+    while (ring->queued + ring->inflight > 0) {
+	if (ih_uring_enter(ring, 1) != 0)
+	    break;
+    }
+    return (int)(ring->asyncErrors - errors);
+}
+
+/* Sum the counters of all rings, live and gone */
+void
+ih_uring_GetStats(struct ih_uring_stats *stats)
+{
+    struct ih_uring *ring;
+
+    memset(stats, 0, sizeof(*stats));
+    if (ih_uring_depth == 0)
+	return;
+
+    opr_mutex_enter(&ih_uring_lock);
+    *stats = ih_uring_totals;
+    stats->rings = 0;
+    for (ring = ih_uring_list; ring != NULL; ring = ring->next) {
+	stats->rings++;
+	stats->ops += ring->ops;
+	stats->enters += ring->enters;
+	stats->asyncFsyncs += ring->asyncFsyncs;
+	stats->asyncErrors += ring->asyncErrors;
+    }
+    opr_mutex_exit(&ih_uring_lock);
+}
+
+#endif /* HAVE_IO_URING */
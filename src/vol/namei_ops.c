@@ -30,6 +30,7 @@
 #endif
 
 #include <afs/opr.h>
+#include <opr/jhash.h>
 #include <rx/rx_queue.h>
 #ifdef AFS_PTHREAD_ENV
 # include <opr/lock.h>
@@ -72,6 +73,20 @@ int Testing=0;
 
 static void namei_UnlockLinkCount(FdHandle_t * fdP, Inode ino);
 
+#if defined(AFS_PTHREAD_ENV) && !defined(AFS_NT40_ENV)
+/* IH_LINKBATCH_BEGIN and friends; see namei_BeginLinkBatch */
+# define NAMEI_LINKBATCH_ENV 1
+struct namei_linkbatch;
+static struct namei_linkbatch *namei_GetLinkBatch(IHandle_t * lh);
+static int namei_PutLinkBatch(struct namei_linkbatch *lb);
+static int namei_LinkBatchAdjust(struct namei_linkbatch *lb, Inode ino,
+				 int delta, int *acount);
+#endif
+#ifndef AFS_NT40_ENV
+static void namei_RemoveLinkJournal(IHandle_t * ih);
+static void namei_RecoverLinkTable(IHandle_t * ih);
+#endif
+
 afs_sfsize_t
 namei_iread(IHandle_t * h, afs_foff_t offset, char *buf, afs_fsize_t size)
 {
@@ -1197,40 +1212,50 @@ namei_dec(IHandle_t * ih, Inode ino, int p1)
 		    /* avoid an rmdir() on the file we just unlinked */
 		    *slash = '\0';
 		}
+#ifndef AFS_NT40_ENV
+		namei_RemoveLinkJournal(ih);
+#endif
 		(void)namei_RemoveDataDirectories(&name);
 	    }
 	}
     } else {
-	/* Get a file descriptor handle for this Inode */
-	fdP = IH_OPEN(ih);
-	if (fdP == NULL) {
-	    return -1;
-	}
+#ifdef NAMEI_LINKBATCH_ENV
+	struct namei_linkbatch *lb = namei_GetLinkBatch(ih);
+
+	if (lb != NULL) {
+	    fdP = NULL;
+	    code = namei_LinkBatchAdjust(lb, ino, -1, &count);
+	    namei_PutLinkBatch(lb);
+	    if (code)
+		return -1;
+	} else
+#endif
+	{
+	    /* Get a file descriptor handle for this Inode */
+	    fdP = IH_OPEN(ih);
+	    if (fdP == NULL) {
+		return -1;
+	    }
 
-	if ((count = namei_GetLinkCount(fdP, ino, 1, 0, 1)) < 0) {
-	    FDH_REALLYCLOSE(fdP);
-	    return -1;
-	}
+	    if ((count = namei_GetLinkCount(fdP, ino, 1, 0, 1)) < 0) {
+		FDH_REALLYCLOSE(fdP);
+		return -1;
+	    }
 
-	count--;
-	if (count >= 0) {
-	    if (namei_SetLinkCount(fdP, ino, count, 1) < 0) {
+	    /* If we go below 0, someone presumably unlinked; don't bother
+	     * setting count to 0, but we need to drop a lock */
+	    count--;
+	    if (namei_SetLinkCount(fdP, ino, count < 0 ? 0 : count, 1) < 0) {
 		FDH_REALLYCLOSE(fdP);
 		return -1;
 	    }
-	} else {
+	}
+	if (count < 0) {
 	    IHandle_t *th;
 	    IH_INIT(th, ih->ih_dev, ih->ih_vid, ino);
 	    Log("Warning: Lost ref on ihandle dev %d vid %" AFS_VOLID_FMT " ino %lld\n",
 		th->ih_dev, afs_printable_VolumeId_lu(th->ih_vid), (afs_int64)th->ih_ino);
 	    IH_RELEASE(th);
-
-	    /* If we're less than 0, someone presumably unlinked;
-	       don't bother setting count to 0, but we need to drop a lock */
-	    if (namei_SetLinkCount(fdP, ino, 0, 1) < 0) {
-		FDH_REALLYCLOSE(fdP);
-		return -1;
-	    }
 	}
 	if (count == 0) {
 	    IHandle_t *th;
@@ -1240,7 +1265,8 @@ namei_dec(IHandle_t * ih, Inode ino, int p1)
 	    IH_RELEASE(th);
 	    code = OS_UNLINK(name.n_path);
 	}
-	FDH_CLOSE(fdP);
+	if (fdP != NULL)
+	    FDH_CLOSE(fdP);
     }
 
     return code;
@@ -1260,6 +1286,18 @@ namei_inc(IHandle_t * h, Inode ino, int p1)
 	ino = (Inode) 0;
     }
 
+#ifdef NAMEI_LINKBATCH_ENV
+    {
+	struct namei_linkbatch *lb = namei_GetLinkBatch(h);
+
+	if (lb != NULL) {
+	    code = namei_LinkBatchAdjust(lb, ino, 1, &count);
+	    namei_PutLinkBatch(lb);
+	    return code;
+	}
+    }
+#endif
+
     /* Get a file descriptor handle for this Inode */
     fdP = IH_OPEN(h);
     if (fdP == NULL) {
@@ -1733,6 +1771,504 @@ namei_UnlockLinkCount(FdHandle_t * fdP, Inode ino)
     FDH_UNLOCKFILE(fdP, offset);
 }
 
+#ifndef AFS_NT40_ENV
+/*
+ * Link count journal.
+ *
+ * Link count batches (below) write the rows they have changed to a journal
+ * in the volume group's special directory before writing them to the link
+ * table, so a crash while the rows are being written leaves either an
+ * untouched table or a complete journal. A journal is only acted on while
+ * the link table lock is held, by the next batch on the volume group or
+ * when the salvager lists the volume group's inodes. The name starts with
+ * a dot so that namei_ListAFSSubDirs passes over it.
+ */
+#define NAMEI_LINKJOURNAL	".linkjournal"
+#define NAMEI_LINKJOURNAL_MAGIC	0x4c4b4a4e
+
+struct namei_linkjournal_header {
+    afs_uint32 magic;		/* 0 once the journal has been applied */
+    afs_uint32 nruns;
+    afs_uint32 length;		/* bytes of runs following the header */
+    afs_uint32 checksum;	/* opr_jhash_opaque of the runs */
+};
+
+/* A run of consecutive rows, followed by the rows themselves */
+struct namei_linkjournal_run {
+    afs_uint32 first;		/* row number; row n is at offset 8 + 2n */
+    afs_uint32 nrows;
+};
+
+static void
+namei_LinkJournalName(IHandle_t * ih, char *dir, size_t dirlen, char *path,
+		      size_t pathlen)
+{
+    namei_t name;
+
+    namei_HandleToVolDir(&name, ih);
+    snprintf(dir, dirlen, "%s" OS_DIRSEP NAMEI_SPECDIR, name.n_path);
+    snprintf(path, pathlen, "%s" OS_DIRSEP NAMEI_LINKJOURNAL, dir);
+}
+
+static void
+namei_RemoveLinkJournal(IHandle_t * ih)
+{
+    char dir[MAXPATHLEN], path[MAXPATHLEN];
+
+    namei_LinkJournalName(ih, dir, sizeof(dir), path, sizeof(path));
+    (void)unlink(path);
+}
+
+/* Write the rows in buf to the link table. */
+static int
+namei_ApplyLinkRuns(FdHandle_t * fdP, char *buf, afs_uint32 length)
+{
+    struct namei_linkjournal_run run;
+    char *end = buf + length;
+    size_t size;
+
+    while (buf < end) {
+	if (end - buf < sizeof(run))
+	    return -1;
+	memcpy(&run, buf, sizeof(run));
+	buf += sizeof(run);
+	size = (size_t)run.nrows << LINKTABLE_SHIFT;
+	if (end - buf < size)
+	    return -1;
+	if (FDH_PWRITE(fdP, buf, size,
+		       ((afs_foff_t)run.first << LINKTABLE_SHIFT) + 8) != size)
+	    return -1;
+	buf += size;
+    }
+    return OS_SYNC(fdP->fd_fd);
+}
+
+/* Mark the journal as applied. */
+static int
+namei_ClearLinkJournal(FD_t fd)
+{
+    afs_uint32 magic = 0;
+
+    if (pwrite(fd, &magic, sizeof(magic), 0) != sizeof(magic))
+	return -1;
+    return fsync(fd);
+}
+
+/*
+ * Apply a leftover journal to the link table fdP, which the caller has
+ * locked. A journal that was not completely written is discarded, since
+ * its rows never reached the table.
+ */
+static void
+namei_ReplayLinkJournal(FdHandle_t * fdP, IHandle_t * ih)
+{
+    struct namei_linkjournal_header hdr;
+    char dir[MAXPATHLEN], path[MAXPATHLEN];
+    struct afs_stat_st st;
+    char *buf = NULL;
+    FD_t fd;
+
+    namei_LinkJournalName(ih, dir, sizeof(dir), path, sizeof(path));
+    fd = open(path, O_RDWR);
+    if (fd < 0)
+	return;
+
+    if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)
+	|| hdr.magic != NAMEI_LINKJOURNAL_MAGIC)
+	goto done;
+    if (afs_fstat(fd, &st) < 0 || st.st_size != sizeof(hdr) + hdr.length)
+	goto discard;
+    buf = malloc(hdr.length ? hdr.length : 1);
+    if (buf == NULL)
+	goto done;
+    if (pread(fd, buf, hdr.length, sizeof(hdr)) != hdr.length
+	|| opr_jhash_opaque(buf, hdr.length, 0) != hdr.checksum)
+	goto discard;
+
+    if (namei_ApplyLinkRuns(fdP, buf, hdr.length) != 0) {
+	Log("namei: failed to replay link count journal %s, errno %d\n",
+	    path, errno);
+	goto done;
+    }
+    Log("namei: replayed %u runs of link counts from %s\n", hdr.nruns,
+	path);
+
+  discard:
+    (void)namei_ClearLinkJournal(fd);
+  done:
+    free(buf);
+    close(fd);
+}
+
+/*
+ * Replay any journal left for the volume group of ih. Called before the
+ * volume group's link counts are read for a salvage.
+ */
+static void
+namei_RecoverLinkTable(IHandle_t * ih)
+{
+    char dir[MAXPATHLEN], path[MAXPATHLEN];
+    struct afs_stat_st st;
+    IHandle_t *lh;
+    FdHandle_t *fdP;
+
+    namei_LinkJournalName(ih, dir, sizeof(dir), path, sizeof(path));
+    if (afs_stat(path, &st) < 0)
+	return;
+
+    IH_INIT(lh, ih->ih_dev, ih->ih_vid,
+	    namei_MakeSpecIno(ih->ih_vid, VI_LINKTABLE));
+    fdP = IH_OPEN(lh);
+    if (fdP != NULL) {
+	if (FDH_LOCKFILE(fdP, 0) == 0) {
+	    namei_ReplayLinkJournal(fdP, lh);
+	    FDH_UNLOCKFILE(fdP, 0);
+	}
+	FDH_CLOSE(fdP);
+    }
+    IH_RELEASE(lh);
+}
+#endif /* !AFS_NT40_ENV */
+
+#ifdef NAMEI_LINKBATCH_ENV
+/*
+ * Link count batches.
+ *
+ * Each IH_INC and IH_DEC locks the link table, reads and rewrites one row,
+ * and unlocks it again. Cloning or purging a volume does that for every
+ * file in it, so those operations open a batch on the volume group first.
+ * For as long as the batch is open this process holds the link table
+ * lock and a copy of the whole table, and IH_INC and IH_DEC from any of
+ * its threads just update the copy. Other processes wait for the lock as
+ * they would for any other update. The changed rows are written back,
+ * through the journal, when the batch is closed or when many of them have
+ * built up.
+ */
+
+/* Write back once this many rows have changed */
+#define NAMEI_LINKBATCH_FLUSH	65536
+/* Rows between changed rows that are rewritten rather than starting a
+ * new run */
+#define NAMEI_LINKBATCH_GAP	16
+
+struct namei_linkbatch {
+    int dev;			/* the link table's ih_dev and ih_vid */
+    VolumeId vid;
+    int refcnt;			/* holders, including adjusters */
+    IHandle_t *lh;
+    FdHandle_t *fdP;		/* holds the link table lock */
+    pthread_mutex_t lock;	/* protects what follows */
+    unsigned short *rows;	/* the table; row n is at offset 8 + 2n */
+    unsigned char *dirty;	/* a bit for each row changed */
+    afs_uint32 nrows;
+    afs_uint32 ndirty;
+    struct namei_linkbatch *next;
+};
+
+static pthread_mutex_t namei_lb_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct namei_linkbatch *namei_lb_list;
+
+#define LB_ISDIRTY(lb, n) ((lb)->dirty[(n) >> 3] & (1 << ((n) & 7)))
+
+/* Write the changed rows through the journal. Called with lb->lock held. */
+static int
+namei_FlushLinkBatch(struct namei_linkbatch *lb)
+{
+    struct namei_linkjournal_header hdr;
+    struct namei_linkjournal_run run;
+    char dir[MAXPATHLEN], path[MAXPATHLEN];
+    afs_uint32 n, last, nruns = 0, nrows = 0;
+    char *buf, *bp;
+    size_t size;
+    FD_t fd, dfd;
+    int code;
+
+    if (lb->ndirty == 0)
+	return 0;
+
+    /* Find the runs, then copy them out behind a header */
+    for (n = 0; n < lb->nrows; n++) {
+	afs_uint32 first = n;
+
+	if (!LB_ISDIRTY(lb, n))
+	    continue;
+	for (last = n; n < lb->nrows && n - last <= NAMEI_LINKBATCH_GAP; n++) {
+	    if (LB_ISDIRTY(lb, n))
+		last = n;
+	}
+	nruns++;
+	nrows += last - first + 1;
+	n = last;
+    }
+    size = sizeof(hdr) + nruns * sizeof(run) + (nrows << LINKTABLE_SHIFT);
+    buf = malloc(size);
+    if (buf == NULL)
+	return -1;
+    bp = buf + sizeof(hdr);
+    for (n = 0; n < lb->nrows; n++) {
+	afs_uint32 first = n;
+
+	if (!LB_ISDIRTY(lb, n))
+	    continue;
+	for (last = n; n < lb->nrows && n - last <= NAMEI_LINKBATCH_GAP; n++) {
+	    if (LB_ISDIRTY(lb, n))
+		last = n;
+	}
+	run.first = first;
+	run.nrows = last - first + 1;
+	memcpy(bp, &run, sizeof(run));
+	bp += sizeof(run);
+	memcpy(bp, &lb->rows[first], run.nrows << LINKTABLE_SHIFT);
+	bp += run.nrows << LINKTABLE_SHIFT;
+	n = last;
+    }
+    hdr.magic = NAMEI_LINKJOURNAL_MAGIC;
+    hdr.nruns = nruns;
+    hdr.length = size - sizeof(hdr);
+    hdr.checksum = opr_jhash_opaque(buf + sizeof(hdr), hdr.length, 0);
+    memcpy(buf, &hdr, sizeof(hdr));
+
+    /* The journal and its directory entry must be on disk before the
+     * table is touched. If it can't be written, write the table anyway;
+     * that is no worse than unbatched updates. */
+    namei_LinkJournalName(lb->lh, dir, sizeof(dir), path, sizeof(path));
+    fd = open(path, O_CREAT | O_WRONLY, 0600);
+    if (fd >= 0) {
+	if (pwrite(fd, buf, size, 0) != size || ftruncate(fd, size) < 0
+	    || fsync(fd) < 0) {
+	    Log("namei: cannot write link count journal %s, errno %d\n",
+		path, errno);
+	    close(fd);
+	    fd = INVALID_FD;
+	} else if ((dfd = open(dir, O_RDONLY)) >= 0) {
+	    (void)fsync(dfd);
+	    close(dfd);
+	}
+    } else {
+	Log("namei: cannot create link count journal %s, errno %d\n", path,
+	    errno);
+    }
+
+    code = namei_ApplyLinkRuns(lb->fdP, buf + sizeof(hdr), hdr.length);
+    if (code == 0 && fd >= 0)
+	code = namei_ClearLinkJournal(fd);
+    if (fd >= 0)
+	close(fd);
+    free(buf);
+    if (code) {
+	Log("namei: cannot write link counts for volume group %"
+	    AFS_VOLID_FMT ", errno %d\n", afs_printable_VolumeId_lu(lb->vid),
+	    errno);
+	return -1;
+    }
+
+    memset(lb->dirty, 0, (lb->nrows + 7) / 8);
+    lb->ndirty = 0;
+    return 0;
+}
+
+/* Find the open batch for a link table, if any, and hold it. */
+static struct namei_linkbatch *
+namei_GetLinkBatch(IHandle_t * lh)
+{
+    struct namei_linkbatch *lb;
+
+    opr_mutex_enter(&namei_lb_lock);
+    for (lb = namei_lb_list; lb != NULL; lb = lb->next) {
+	if (lb->dev == lh->ih_dev && lb->vid == lh->ih_vid) {
+	    lb->refcnt++;
+	    break;
+	}
+    }
+    opr_mutex_exit(&namei_lb_lock);
+    return lb;
+}
+
+/* Drop a hold on a batch. The last one writes it back and closes it. */
+static int
+namei_PutLinkBatch(struct namei_linkbatch *lb)
+{
+    struct namei_linkbatch **lbp;
+    int code;
+
+    opr_mutex_enter(&namei_lb_lock);
+    if (--lb->refcnt > 0) {
+	opr_mutex_exit(&namei_lb_lock);
+	return 0;
+    }
+    for (lbp = &namei_lb_list; *lbp != lb; lbp = &(*lbp)->next)
+	;
+    *lbp = lb->next;
+    opr_mutex_exit(&namei_lb_lock);
+
+    opr_mutex_enter(&lb->lock);
+    code = namei_FlushLinkBatch(lb);
+    opr_mutex_exit(&lb->lock);
+
+    FDH_UNLOCKFILE(lb->fdP, 0);
+    if (code)
+	FDH_REALLYCLOSE(lb->fdP);
+    else
+	FDH_CLOSE(lb->fdP);
+    IH_RELEASE(lb->lh);
+    opr_mutex_destroy(&lb->lock);
+    free(lb->rows);
+    free(lb->dirty);
+    free(lb);
+    return code;
+}
+
+/*
+ * Add delta to the link count of ino. The new count is returned in acount
+ * before a negative one is stored as 0. Returns -1, changing nothing, if
+ * ino is past the end of the link table, as namei_GetLinkCount would, or
+ * if the count would overflow, as namei_inc would.
+ */
+static int
+namei_LinkBatchAdjust(struct namei_linkbatch *lb, Inode ino, int delta,
+		      int *acount)
+{
+    afs_foff_t offset;
+    afs_uint32 n;
+    int index, count, code = 0;
+
+    namei_GetLCOffsetAndIndexFromIno(ino, &offset, &index);
+    n = (afs_uint32)((offset - 8) >> LINKTABLE_SHIFT);
+
+    opr_mutex_enter(&lb->lock);
+    if (n >= lb->nrows) {
+	errno = OS_ERROR(EIO);
+	opr_mutex_exit(&lb->lock);
+	return -1;
+    }
+    count = ((lb->rows[n] >> index) & NAMEI_TAGMASK) + delta;
+    *acount = count;
+    if (count > 7) {
+	errno = OS_ERROR(EINVAL);
+	opr_mutex_exit(&lb->lock);
+	return -1;
+    }
+    if (count < 0)
+	count = 0;
+    lb->rows[n] &= (unsigned short)~(NAMEI_TAGMASK << index);
+    lb->rows[n] |= (unsigned short)(count << index);
+    if (!LB_ISDIRTY(lb, n)) {
+	lb->dirty[n >> 3] |= 1 << (n & 7);
+	lb->ndirty++;
+    }
+    if (lb->ndirty >= NAMEI_LINKBATCH_FLUSH)
+	code = namei_FlushLinkBatch(lb);
+    opr_mutex_exit(&lb->lock);
+    return code;
+}
+#endif /* NAMEI_LINKBATCH_ENV */
+
+/**
+ * open a link count batch on a volume group.
+ *
+ * Until the matching namei_EndLinkBatch, IH_INC and IH_DEC on the link
+ * table lh by any thread in this process only change a copy of the table
+ * in memory. Batches nest; the outermost one writes the table back. The
+ * caller must not remove or create volumes in the volume group while it
+ * has a batch open, since that takes the link table lock itself.
+ *
+ * @param[in] lh  the volume group's link table handle
+ *
+ * @return operation status
+ *    @retval 0 batch opened
+ *    @retval -1 batches are not available, or the link table could not
+ *               be read; IH_INC and IH_DEC go straight to the table
+ */
+int
+namei_BeginLinkBatch(IHandle_t * lh)
+{
+#ifdef NAMEI_LINKBATCH_ENV
+    struct namei_linkbatch *lb;
+    afs_sfsize_t size;
+    size_t bytes;
+
+    if (namei_GetLinkBatch(lh) != NULL)
+	return 0;
+
+    lb = calloc(1, sizeof(*lb));
+    if (lb == NULL)
+	return -1;
+    lb->fdP = IH_OPEN(lh);
+    if (lb->fdP == NULL) {
+	free(lb);
+	return -1;
+    }
+    if (FDH_LOCKFILE(lb->fdP, 0) != 0) {
+	FDH_REALLYCLOSE(lb->fdP);
+	free(lb);
+	return -1;
+    }
+    namei_ReplayLinkJournal(lb->fdP, lh);
+
+    size = FDH_SIZE(lb->fdP);
+    if (size < 8)
+	goto fail;
+    lb->nrows = (afs_uint32)((size - 8) >> LINKTABLE_SHIFT);
+    bytes = (size_t)lb->nrows << LINKTABLE_SHIFT;
+    lb->rows = malloc(bytes ? bytes : 1);
+    lb->dirty = calloc((lb->nrows + 7) / 8 + 1, 1);
+    if (lb->rows == NULL || lb->dirty == NULL)
+	goto fail;
+    if (FDH_PREAD(lb->fdP, lb->rows, bytes, 8) != bytes)
+	goto fail;
+
+    lb->dev = lh->ih_dev;
+    lb->vid = lh->ih_vid;
+    lb->refcnt = 1;
+    IH_COPY(lb->lh, lh);
+    opr_mutex_init(&lb->lock);
+
+    opr_mutex_enter(&namei_lb_lock);
+    lb->next = namei_lb_list;
+    namei_lb_list = lb;
+    opr_mutex_exit(&namei_lb_lock);
+    return 0;
+
+  fail:
+    FDH_UNLOCKFILE(lb->fdP, 0);
+    FDH_CLOSE(lb->fdP);
+    free(lb->rows);
+    free(lb->dirty);
+    free(lb);
+    return -1;
+#else
+    return -1;
+#endif
+}
+
+/**
+ * close a link count batch opened by namei_BeginLinkBatch.
+ *
+ * @param[in] lh  the volume group's link table handle
+ *
+ * @return operation status
+ *    @retval 0 success
+ *    @retval -1 the link counts could not be written back
+ */
+int
+namei_EndLinkBatch(IHandle_t * lh)
+{
+#ifdef NAMEI_LINKBATCH_ENV
+    struct namei_linkbatch *lb;
+
+    lb = namei_GetLinkBatch(lh);
+    if (lb == NULL)
+	return -1;
+    /* drop our lookup's hold and the one from namei_BeginLinkBatch */
+    opr_mutex_enter(&namei_lb_lock);
+    lb->refcnt--;
+    opr_mutex_exit(&namei_lb_lock);
+    return namei_PutLinkBatch(lb);
+#else
+    return -1;
+#endif
+}
+
 
 /* ListViceInodes - write inode data to a results file. */
 static int DecodeInode(char *dpath, char *name, struct ViceInodeInfo *info,
@@ -2511,6 +3047,11 @@ namei_ListAFSSubDirs(IHandle_t * dirIH,
     (void)strcat(path1, OS_DIRSEP);
     (void)strcat(path1, NAMEI_SPECDIR);
 
+#ifndef AFS_NT40_ENV
+    /* Finish any link count updates a batch left half written. */
+    namei_RecoverLinkTable(&myIH);
+#endif
+
     linkHandle.fd_fd = INVALID_FD;
 #ifdef AFS_SALSRV_ENV
     opr_Verify(pthread_once(&wq_once, _namei_wq_keycreate) == 0);
@@ -2687,6 +3228,9 @@ namei_ListAFSSubDirs(IHandle_t * dirIH,
 
     if (!ninodes) {
 	/* Then why does this directory exist? Blow it away. */
+#ifndef AFS_NT40_ENV
+	namei_RemoveLinkJournal(dirIH);
+#endif
 	namei_HandleToVolDir(&name, dirIH);
 	namei_RemoveDataDirectories(&name);
     }
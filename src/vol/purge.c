@@ -63,6 +63,7 @@ VPurgeVolume(Error * ec, Volume * vp)
     struct DiskPartition64 *tpartp = vp->partition;
     VolumeId volid, parent;
     afs_int32 code;
+    int batched;
 
     volid = V_id(vp);
     parent = V_parentId(vp);
@@ -75,8 +76,14 @@ VPurgeVolume(Error * ec, Volume * vp)
      * volume header. This routine can, under some circumstances, be called
      * when two volumes with the same id exist on different partitions.
      */
+    batched = (IH_LINKBATCH_BEGIN(V_linkHandle(vp)) == 0);
     PurgeIndex_r(vp, vLarge);
     PurgeIndex_r(vp, vSmall);
+    /* the batch must be written back before the header goes, since that
+     * may remove the link table itself */
+    if (batched && IH_LINKBATCH_END(V_linkHandle(vp)))
+	Log("VPurgeVolume: Error writing link counts for volume %lu\n",
+	    afs_printable_uint32_lu(volid));
     PurgeHeader_r(vp);
 
     code = VDestroyVolumeDiskHeader(tpartp, volid, parent);
@@ -89,7 +96,8 @@ VPurgeVolume(Error * ec, Volume * vp)
     /*
      * Call the fileserver to break all call backs for that volume
      */
-    FSYNC_VolOp(V_id(vp), tpartp->name, FSYNC_VOL_BREAKCBKS, 0, NULL);
+    if (VCanUseFSSYNC())
+	FSYNC_VolOp(V_id(vp), tpartp->name, FSYNC_VOL_BREAKCBKS, 0, NULL);
 }
 
 #define MAXOBLITATONCE	200
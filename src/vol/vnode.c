@@ -30,6 +30,7 @@
 #ifdef AFS_PTHREAD_ENV
 #include <opr/lock.h>
 #endif
+#include <opr/jhash.h>
 #include "rx/rx_queue.h"
 #include <afs/afsint.h>
 #include "nfs.h"
@@ -134,11 +135,44 @@ VolumeHashOffset_r(void)
     return offset;
 }
 
-/* Change hashindex (above) if you change this constant */
-#define VNODE_HASH_TABLE_SIZE 256
-private Vnode *VnodeHashTable[VNODE_HASH_TABLE_SIZE];
+/*
+ * the vnode hash table is sized when the vnode caches are set up, to
+ * about one bucket per cached vnode.  Both limits must be powers of 2.
+ */
+#define VNODE_HASH_TABLE_MIN 256
+#define VNODE_HASH_TABLE_MAX (1 << 22)
+private Vnode **VnodeHashTable;
+private afs_uint32 VnodeHashMask;
 #define VNODE_HASH(volumeptr,vnodenumber)\
-    ((volumeptr->vnodeHashOffset + vnodenumber)&(VNODE_HASH_TABLE_SIZE-1))
+    (opr_jhash_int2((volumeptr)->vnodeHashOffset, (vnodenumber), 0) & VnodeHashMask)
+
+/**
+ * size the vnode hash table for a vnode cache of the given size.
+ *
+ * @param[in] nVnodes  number of vnodes being added to the cache
+ *
+ * @pre no vnode is on the hash table
+ *
+ * @internal vnode package internal use only
+ */
+static void
+VInitVnodeHash(int nVnodes)
+{
+    static int nCached = 0;
+    afs_uint32 size = VNODE_HASH_TABLE_MIN;
+
+    nCached += nVnodes;
+    while (size < nCached && size < VNODE_HASH_TABLE_MAX)
+	size <<= 1;
+
+    if (VnodeHashTable != NULL && size <= VnodeHashMask + 1)
+	return;
+
+    free(VnodeHashTable);
+    VnodeHashTable = calloc(size, sizeof(Vnode *));
+    opr_Assert(VnodeHashTable != NULL);
+    VnodeHashMask = size - 1;
+}
 
 
 /**
@@ -188,11 +222,63 @@ DeleteFromVVnList(Vnode * vnp)
 }
 
 /**
- * add a vnode to the end of the lru.
+ * insert a vnode at the head of one of the lru lists.
+ *
+ * @param[inout] head  lru list head pointer
+ * @param[in]    vnp   vnode object pointer
+ *
+ * @internal vnode package internal use only
+ */
+static void
+VnLRUInsert(Vnode ** head, Vnode * vnp)
+{
+    if (*head == NULL) {
+	vnp->lruNext = vnp->lruPrev = vnp;
+    } else {
+	vnp->lruNext = *head;
+	vnp->lruPrev = (*head)->lruPrev;
+	(*head)->lruPrev = vnp;
+	vnp->lruPrev->lruNext = vnp;
+    }
+    *head = vnp;
+}
+
+/**
+ * remove a vnode from one of the lru lists.
+ *
+ * @param[inout] head  lru list head pointer
+ * @param[in]    vnp   vnode object pointer
+ *
+ * @internal vnode package internal use only
+ */
+static void
+VnLRURemove(Vnode ** head, Vnode * vnp)
+{
+    if (*head == NULL)
+	Abort("DeleteFromVnLRU: lru chain addled!\n");
+
+    if (vnp->lruNext == vnp) {
+	if (vnp != *head)
+	    Abort("DeleteFromVnLRU: lru chain addled!\n");
+	*head = NULL;
+	return;
+    }
+
+    if (vnp == *head)
+	*head = vnp->lruNext;
+    vnp->lruPrev->lruNext = vnp->lruNext;
+    vnp->lruNext->lruPrev = vnp->lruPrev;
+}
+
+/**
+ * add a vnode to the lru.
  *
  * @param[in] vcp  vnode class info object pointer
  * @param[in] vnp  vnode object pointer
  *
+ * @post vnodes which have been reused go to the head of the protected
+ *       list; others go to the head of the probationary list.
+ *
  * @internal vnode package internal use only
  */
 void
@@ -202,22 +288,22 @@ AddToVnLRU(struct VnodeClassInfo * vcp, Vnode * vnp)
 	return;
     }
 
-    /* Add it to the circular LRU list */
-    if (vcp->lruHead == NULL)
-	Abort("VPutVnode: vcp->lruHead==NULL");
-    else {
-	vnp->lruNext = vcp->lruHead;
-	vnp->lruPrev = vcp->lruHead->lruPrev;
-	vcp->lruHead->lruPrev = vnp;
-	vnp->lruPrev->lruNext = vnp;
-	vcp->lruHead = vnp;
+    if (vnp->delete) {
+	/* If the vnode was just deleted, put it at the end of the
+	 * probationary chain so it will be reused immediately */
+	Vn_stateFlags(vnp) &= ~(VN_LRU_HOT);
+	VnLRUInsert(&vcp->inHead, vnp);
+	vcp->inHead = vnp->lruNext;
+	vcp->nIn++;
+	Vn_stateFlags(vnp) |= VN_ON_LRU_IN;
+    } else if (Vn_stateFlags(vnp) & VN_LRU_HOT) {
+	VnLRUInsert(&vcp->lruHead, vnp);
+    } else {
+	VnLRUInsert(&vcp->inHead, vnp);
+	vcp->nIn++;
+	Vn_stateFlags(vnp) |= VN_ON_LRU_IN;
     }
 
-    /* If the vnode was just deleted, put it at the end of the chain so it
-     * will be reused immediately */
-    if (vnp->delete)
-	vcp->lruHead = vnp->lruNext;
-
     Vn_stateFlags(vnp) |= VN_ON_LRU;
 }
 
@@ -236,17 +322,14 @@ DeleteFromVnLRU(struct VnodeClassInfo * vcp, Vnode * vnp)
 	return;
     }
 
-    if (vnp == vcp->lruHead)
-	vcp->lruHead = vcp->lruHead->lruNext;
-
-    if ((vnp == vcp->lruHead) ||
-	(vcp->lruHead == NULL))
-	Abort("DeleteFromVnLRU: lru chain addled!\n");
-
-    vnp->lruPrev->lruNext = vnp->lruNext;
-    vnp->lruNext->lruPrev = vnp->lruPrev;
+    if (Vn_stateFlags(vnp) & VN_ON_LRU_IN) {
+	VnLRURemove(&vcp->inHead, vnp);
+	vcp->nIn--;
+    } else {
+	VnLRURemove(&vcp->lruHead, vnp);
+    }
 
-    Vn_stateFlags(vnp) &= ~(VN_ON_LRU);
+    Vn_stateFlags(vnp) &= ~(VN_ON_LRU | VN_ON_LRU_IN);
 }
 
 /**
@@ -357,8 +440,14 @@ VInitVnodes(VnodeClass class, int nVnodes)
     byte *va;
     struct VnodeClassInfo *vcp = &VnodeClassInfo[class];
 
+    VInitVnodeHash(nVnodes);
+
     vcp->allocs = vcp->gets = vcp->reads = vcp->writes = 0;
+    vcp->evictions = vcp->promotions = 0;
     vcp->cacheSize = nVnodes;
+    vcp->inHead = NULL;
+    vcp->nIn = 0;
+    vcp->inMax = nVnodes / 4;
     switch (class) {
     case vSmall:
 	opr_Assert(CHECKSIZE_SMALLVNODE);
@@ -390,7 +479,6 @@ VInitVnodes(VnodeClass class, int nVnodes)
     while (nVnodes--) {
 	Vnode *vnp = (Vnode *) va;
 	Vn_refcount(vnp) = 0;	/* no context switches */
-	Vn_stateFlags(vnp) |= VN_ON_LRU;
 #ifdef AFS_DEMAND_ATTACH_FS
 	CV_INIT(&Vn_stateCV(vnp), "vnode state", CV_DEFAULT, 0);
 	Vn_state(vnp) = VN_STATE_INVALID;
@@ -411,15 +499,7 @@ VInitVnodes(VnodeClass class, int nVnodes)
 	vnp->hashIndex = 0;
 	vnp->handle = NULL;
 	Vn_class(vnp) = vcp;
-	if (vcp->lruHead == NULL)
-	    vcp->lruHead = vnp->lruNext = vnp->lruPrev = vnp;
-	else {
-	    vnp->lruNext = vcp->lruHead;
-	    vnp->lruPrev = vcp->lruHead->lruPrev;
-	    vcp->lruHead->lruPrev = vnp;
-	    vnp->lruPrev->lruNext = vnp;
-	    vcp->lruHead = vnp;
-	}
+	AddToVnLRU(vcp, vnp);
 	va += vcp->residentSize;
     }
     return 0;
@@ -427,7 +507,7 @@ VInitVnodes(VnodeClass class, int nVnodes)
 
 
 /**
- * allocate an unused vnode from the lru chain.
+ * allocate an unused vnode from the lru chains.
  *
  * @param[in] vcp  vnode class info object pointer
  * @param[in] vp   volume pointer
@@ -444,7 +524,9 @@ VInitVnodes(VnodeClass class, int nVnodes)
  *       inode handle is released.
  *       a reservation is held on the vnode object
  *
- * @note we traverse backwards along the lru circlist.  It shouldn't
+ * @note we take the tail of the probationary list while it is longer
+ *       than vcp->inMax (or the protected list is empty), and the tail
+ *       of the protected list otherwise.  It shouldn't
  *       be necessary to specify that nUsers == 0 since if it is in the list,
  *       nUsers should be 0.  Things shouldn't be in lruq unless no one is
  *       using them.
@@ -461,8 +543,16 @@ VGetFreeVnode_r(struct VnodeClassInfo * vcp, struct Volume *vp,
                 VnodeId vnodeNumber)
 {
     Vnode *vnp;
+    Volume *ovp;
 
-    vnp = vcp->lruHead->lruPrev;
+    if (vcp->inHead != NULL &&
+	(vcp->nIn > vcp->inMax || vcp->lruHead == NULL)) {
+	vnp = vcp->inHead->lruPrev;
+    } else if (vcp->lruHead != NULL) {
+	vnp = vcp->lruHead->lruPrev;
+    } else {
+	Abort("VGetFreeVnode_r: no free vnodes in lruq");
+    }
 #ifdef AFS_DEMAND_ATTACH_FS
     if (Vn_refcount(vnp) != 0 || VnIsExclusiveState(Vn_state(vnp)) ||
 	Vn_readers(vnp) != 0)
@@ -481,9 +571,16 @@ VGetFreeVnode_r(struct VnodeClassInfo * vcp, struct Volume *vp,
      */
     DeleteFromVnLRU(vcp, vnp);
     DeleteFromVnHash(vnp);
-    if (Vn_volume(vnp)) {
+    ovp = Vn_volume(vnp);
+    if (ovp) {
+	if (Vn_cacheCheck(vnp) && Vn_cacheCheck(vnp) == ovp->cacheCheck) {
+	    /* a usable cache entry is being thrown out */
+	    vcp->evictions++;
+	    ovp->vnode_stats.evictions++;
+	}
 	DeleteFromVVnList(vnp);
     }
+    Vn_stateFlags(vnp) &= ~(VN_LRU_HOT);
 
     /* we must re-hash the vnp _before_ we drop the glock again; otherwise,
      * someone else might try to grab the same vnode id, and we'll both alloc
@@ -1122,6 +1219,7 @@ VnStore(Error * ec, Volume * vp, Vnode * vnp,
 	}
 	return;
     } else {
+	(void)FDH_METASYNC(fdP);
 	FDH_CLOSE(fdP);
     }
 
@@ -1246,6 +1344,12 @@ VGetVnode_r(Error * ec, Volume * vp, VnodeId vnodeNumber, int locktype)
 
 	VNLog(101, 2, vnodeNumber, (intptr_t)vnp, 0, 0);
 	VnCreateReservation_r(vnp);
+	vp->vnode_stats.hits++;
+	if (!(Vn_stateFlags(vnp) & VN_LRU_HOT)) {
+	    /* reused; move to the protected list when it is put back */
+	    Vn_stateFlags(vnp) |= VN_LRU_HOT;
+	    vcp->promotions++;
+	}
 
 #ifdef AFS_DEMAND_ATTACH_FS
 	/*
@@ -1280,6 +1384,7 @@ VGetVnode_r(Error * ec, Volume * vp, VnodeId vnodeNumber, int locktype)
 	/* Not in cache; tentatively grab most distantly used one from the LRU
 	 * chain */
 	vcp->reads++;
+	vp->vnode_stats.misses++;
 	vnp = VGetFreeVnode_r(vcp, vp, vnodeNumber);
 
 	/* Initialize */
@@ -1804,3 +1909,76 @@ VReleaseVnodeFiles_r(Volume * vp)
     VChangeState_r(vp, vol_state_save);
 #endif /* AFS_DEMAND_ATTACH_FS */
 }
+
+/**
+ * gather vnode cache statistics for xstat.
+ *
+ * @param[out] buf  buffer to fill
+ * @param[in]  len  size of buf, in afs_int32 units
+ *
+ * @return number of afs_int32s written to buf
+ *
+ * @note the layout is the number of vnode classes, followed by
+ *       (cacheSize, gets, reads, evictions, promotions, probationary
+ *       length) for each class, followed by a count of volumes and a
+ *       (volume id, hits, misses, evictions) record for each of them.
+ *       When not every volume with vnode cache activity fits, the
+ *       busiest ones are reported.
+ */
+int
+VCollectVnodeCacheStats(afs_int32 * buf, int len)
+{
+    int class, i, j, n, nvols, maxvols;
+    afs_int32 *vols;
+    afs_uint32 activity;
+    Volume *vp, *np;
+    struct VnodeClassInfo *vcp;
+
+    n = 0;
+    if (len < 2 + nVNODECLASSES * 6)
+	return 0;
+
+    VOL_LOCK;
+    buf[n++] = nVNODECLASSES;
+    for (class = 0; class < nVNODECLASSES; class++) {
+	vcp = &VnodeClassInfo[class];
+	buf[n++] = vcp->cacheSize;
+	buf[n++] = vcp->gets;
+	buf[n++] = vcp->reads;
+	buf[n++] = vcp->evictions;
+	buf[n++] = vcp->promotions;
+	buf[n++] = vcp->nIn;
+    }
+
+    /* keep the volume records sorted by activity, busiest first */
+    vols = &buf[n + 1];
+    maxvols = (len - n - 1) / 4;
+    nvols = 0;
+    for (i = 0; i < VolumeHashTable.Size; i++) {
+	for (queue_Scan(&VolumeHashTable.Table[i], vp, np, Volume)) {
+	    activity = vp->vnode_stats.hits + vp->vnode_stats.misses;
+	    if (activity == 0)
+		continue;
+	    for (j = nvols; j > 0; j--) {
+		if ((afs_uint32)vols[(j - 1) * 4 + 1] +
+		    (afs_uint32)vols[(j - 1) * 4 + 2] >= activity)
+		    break;
+		if (j < maxvols)
+		    memcpy(&vols[j * 4], &vols[(j - 1) * 4],
+			   4 * sizeof(afs_int32));
+	    }
+	    if (j >= maxvols)
+		continue;
+	    vols[j * 4] = vp->hashid;
+	    vols[j * 4 + 1] = vp->vnode_stats.hits;
+	    vols[j * 4 + 2] = vp->vnode_stats.misses;
+	    vols[j * 4 + 3] = vp->vnode_stats.evictions;
+	    if (nvols < maxvols)
+		nvols++;
+	}
+    }
+    VOL_UNLOCK;
+
+    buf[n++] = nvols;
+    return n + nvols * 4;
+}
@@ -48,8 +48,21 @@ typedef int VnodeClass;
 #define VNODECLASSMASK	((1<<VNODECLASSWIDTH)-1)
 #define nVNODECLASSES	(VNODECLASSMASK+1)
 
+/*
+ * unused vnodes of a class are kept on two lists, as in 2Q: vnodes
+ * which have not been asked for again since they were read in sit on
+ * the probationary list, and are recycled first; vnodes which have been
+ * reused move to the protected list.  a volume scan can then only churn
+ * the probationary list, instead of flushing every other volume's
+ * working set.
+ */
 struct VnodeClassInfo {
-    struct Vnode *lruHead;	/* Head of list of vnodes of this class */
+    struct Vnode *lruHead;	/* Head of protected list of vnodes of this
+				 * class */
+    struct Vnode *inHead;	/* Head of probationary list */
+    int nIn;			/* Number of vnodes on probationary list */
+    int inMax;			/* Probationary list length above which we
+				 * recycle from it in preference */
     int diskSize;		/* size of vnode disk object, power of 2 */
     int logSize;		/* log 2 diskSize */
     int residentSize;		/* resident size of vnode */
@@ -63,6 +76,9 @@ struct VnodeClassInfo {
     int gets, reads;		/* Number of VGetVnodes and corresponding
 				 * reads */
     int writes;			/* Number of vnode writes */
+    int evictions;		/* Number of cached vnodes recycled for
+				 * another vnode */
+    int promotions;		/* Number of vnodes moved to protected list */
 };
 
 extern struct VnodeClassInfo VnodeClassInfo[nVNODECLASSES];
@@ -155,6 +171,9 @@ enum VnFlags {
     VN_ON_HASH            = 0x1,        /**< vnode is on hash table */
     VN_ON_LRU             = 0x2,        /**< vnode is on lru list */
     VN_ON_VVN             = 0x4,        /**< vnode is on volume vnode list */
+    VN_ON_LRU_IN          = 0x8,        /**< vnode is on probationary lru list */
+    VN_LRU_HOT            = 0x10,       /**< vnode has been reused since it
+					 *   was read in */
     VN_FLAGS_END
 };
 
@@ -166,7 +185,7 @@ typedef struct Vnode {
     struct Vnode *lruPrev;	/* More recently used vnode than this one */
     /* The lruNext, lruPrev fields are not
      * meaningful if the vnode is in use */
-    bit16 hashIndex;		/* Hash table index */
+    bit32 hashIndex;		/* Hash table index */
 #ifdef	AFS_AIX_ENV
     unsigned changed_newTime:1;	/* 1 if vnode changed, write time */
     unsigned changed_oldTime:1;	/* 1 changed, don't update time. */
@@ -285,6 +304,7 @@ extern void AddToVVnList(struct Volume * vp, Vnode * vnp);
 extern void DeleteFromVVnList(Vnode * vnp);
 extern void AddToVnLRU(struct VnodeClassInfo * vcp, Vnode * vnp);
 extern void DeleteFromVnLRU(struct VnodeClassInfo * vcp, Vnode * vnp);
+extern int VCollectVnodeCacheStats(afs_int32 * buf, int len);
 extern void AddToVnHash(Vnode * vnp);
 extern void DeleteFromVnHash(Vnode * vnp);
 
@@ -280,9 +280,16 @@ VnWaitStateChange_r(Vnode * vnp)
 static_inline void
 VnWaitExclusiveState_r(Vnode * vnp)
 {
+    struct timeval start;
+
     opr_Assert(Vn_refcount(vnp));
-    while (VnIsExclusiveState(Vn_state(vnp))) {
-	VOL_CV_WAIT(&Vn_stateCV(vnp));
+    IncUInt64(&VLockStats.vnode_state.acquires);
+    if (VnIsExclusiveState(Vn_state(vnp))) {
+	gettimeofday(&start, NULL);
+	do {
+	    VOL_CV_WAIT(&Vn_stateCV(vnp));
+	} while (VnIsExclusiveState(Vn_state(vnp)));
+	VLockStatsWaited(&VLockStats.vnode_state, &start);
     }
     opr_Assert(!(Vn_stateFlags(vnp) & VN_ON_LRU));
 }
@@ -183,6 +183,9 @@ static VolumePackageOptions vol_opts;
 /* extended volume package statistics */
 VolPkgStats VStats;
 
+/* volume package lock contention statistics */
+VolPkgLockStats VLockStats;
+
 #ifdef VOL_LOCK_DEBUG
 pthread_t vol_glock_holder = 0;
 #endif
@@ -219,6 +222,32 @@ pthread_t vol_glock_holder = 0;
  */
 #define VOLUME_HASH_REORDER_CHAIN_THRESH (VOLUME_HASH_REORDER_THRESHOLD / 2)
 
+#if defined(AFS_DEMAND_ATTACH_FS) && defined(HAVE_SYNC_FETCH_AND_ADD)
+/*
+ * lockless volume hash lookups.
+ *
+ * the fileserver walks the volume hash chains without holding VOL_LOCK.
+ * writers still hold VOL_LOCK (or own the chain exclusively), and bump
+ * the per-chain sequence number around every modification, so a reader
+ * which observes a change simply gives up and falls back to the locked
+ * lookup.  volume objects which have ever been visible in the hash are
+ * not handed back to the heap until no lockless reader could still be
+ * looking at them; readers announce themselves in one of a set of
+ * cache line padded counters picked by thread.
+ */
+#define AFS_VOL_HASH_LOCKLESS 1
+#define VOL_HASH_READER_SLOTS 64	/* Must be a power of 2!! */
+#define VOL_HASH_READER_RETRIES 4
+
+static struct {
+    volatile afs_int32 count;
+    char pad[64 - sizeof(afs_int32)];
+} VolHashReaders[VOL_HASH_READER_SLOTS];
+
+/* volumes awaiting reclamation */
+static struct rx_queue volume_retired;
+#endif /* AFS_DEMAND_ATTACH_FS && HAVE_SYNC_FETCH_AND_ADD */
+
 /*
  * The per volume uniquifier is bumped by 200 and and written to disk
  * every 200 file creates.
@@ -387,6 +416,14 @@ static void VReorderHash_r(VolumeHashChainHead * head, Volume * pp, Volume * vp)
 static void VHashBeginExclusive_r(VolumeHashChainHead * head);
 static void VHashEndExclusive_r(VolumeHashChainHead * head);
 static void VHashWait_r(VolumeHashChainHead * head);
+#ifdef AFS_VOL_HASH_LOCKLESS
+static_inline void VHashWriteBegin(VolumeHashChainHead * head);
+static_inline void VHashWriteEnd(VolumeHashChainHead * head);
+static int VHashReadBegin(void);
+static void VHashReadEnd(int slot);
+static Volume * VLookupVolumeLockless(VolumeId volumeId);
+static void VReclaimVolumes_r(void);
+#endif
 
 /* shutdown */
 static int ShutdownVByPForPass_r(struct DiskPartition64 * dp, int pass);
@@ -448,6 +485,55 @@ bit32 VolumeCacheCheck;		/* Incremented everytime a volume goes on line--
 
 
 
+#ifdef AFS_PTHREAD_ENV
+/**
+ * take a volume package mutex which another thread holds.
+ *
+ * @param[in] lock   mutex to acquire
+ * @param[in] stats  contention statistics for lock
+ *
+ * @post lock held; time spent waiting for it is recorded in stats.
+ *
+ * @see _VOL_MUTEX_ENTER
+ */
+void
+VLockContended(pthread_mutex_t * lock, struct VLockStats * stats)
+{
+    struct timeval start;
+
+    gettimeofday(&start, NULL);
+    opr_mutex_enter(lock);
+    VLockStatsWaited(stats, &start);
+}
+
+/**
+ * record a wait for a volume package lock or exclusive state.
+ *
+ * @param[in] stats  contention statistics for the lock or state
+ * @param[in] start  time at which the wait began
+ *
+ * @pre the lock protecting stats is held.
+ */
+void
+VLockStatsWaited(struct VLockStats * stats, struct timeval * start)
+{
+    struct timeval now;
+    afs_int64 usecs;
+
+    gettimeofday(&now, NULL);
+    usecs = (afs_int64)(now.tv_sec - start->tv_sec) * 1000000 +
+	(now.tv_usec - start->tv_usec);
+    if (usecs < 0)
+	usecs = 0;
+
+    IncUInt64(&stats->contended);
+    AddUInt64(stats->wait_usecs, usecs, &stats->wait_usecs);
+    if (usecs > stats->wait_max_usecs)
+	stats->wait_max_usecs = usecs;
+}
+#endif /* AFS_PTHREAD_ENV */
+
+
 /***************************************************/
 /* Startup routines                                */
 /***************************************************/
@@ -1999,6 +2085,7 @@ WriteVolumeHeader_r(Error * ec, Volume * vp)
 	FDH_REALLYCLOSE(fdP);
 	return;
     }
+    (void)FDH_METASYNC(fdP);
     FDH_CLOSE(fdP);
 }
 
@@ -3972,8 +4059,26 @@ VGetVolumeWithCall(Error * ec, Error * client_ec, VolumeId volumeId,
                    const struct timespec *ts, struct VCallByVol *cbv)
 {
     Volume *retVal;
+#ifdef AFS_VOL_HASH_LOCKLESS
+    Volume *hint;
+    int slot;
+
+    /* find the volume without VOL_LOCK, and only take the lock to vet
+     * and reserve what we found.  the read-side section keeps hint from
+     * being freed until we hold VOL_LOCK */
+    slot = VHashReadBegin();
+    hint = VLookupVolumeLockless(volumeId);
+    VOL_LOCK;
+    if (hint && !((V_attachFlags(hint) & VOL_IN_HASH) &&
+		  hint->hashid == volumeId)) {
+	hint = NULL;
+    }
+    VHashReadEnd(slot);
+    retVal = GetVolume(ec, client_ec, volumeId, hint, ts);
+#else
     VOL_LOCK;
     retVal = GetVolume(ec, client_ec, volumeId, NULL, ts);
+#endif
     VRegisterCall_r(ec, client_ec, retVal, cbv);
     VOL_UNLOCK;
     return retVal;
@@ -5052,7 +5157,15 @@ ReallyFreeVolume(Volume * vp)
 #ifndef AFS_DEMAND_ATTACH_FS
     DeleteVolumeFromHashTable(vp);
 #endif /* AFS_DEMAND_ATTACH_FS */
+#ifdef AFS_VOL_HASH_LOCKLESS
+    /* a lockless hash reader may still hold a pointer to vp, so leave
+     * it for VReclaimVolumes_r to free */
+    DeleteVolumeFromHashTable(vp);
+    queue_Append(&volume_retired, vp);
+    VReclaimVolumes_r();
+#else
     free(vp);
+#endif
 }
 
 /* check to see if we should shutdown this volume
@@ -7939,8 +8052,15 @@ VLRU_EndExclusive_r(struct VLRU_q * q)
 static void
 VLRU_Wait_r(struct VLRU_q * q)
 {
-    while(q->busy) {
-	VOL_CV_WAIT(&q->cv);
+    struct timeval start;
+
+    IncUInt64(&VLockStats.vlru.acquires);
+    if (q->busy) {
+	gettimeofday(&start, NULL);
+	do {
+	    VOL_CV_WAIT(&q->cv);
+	} while (q->busy);
+	VLockStatsWaited(&VLockStats.vlru, &start);
     }
 }
 
@@ -8451,6 +8571,9 @@ VInitVolumeHash(void)
 	opr_cv_init(&VolumeHashTable.Table[i].chain_busy_cv);
 #endif /* AFS_DEMAND_ATTACH_FS */
     }
+#ifdef AFS_VOL_HASH_LOCKLESS
+    queue_Init(&volume_retired);
+#endif
 }
 
 /**
@@ -8489,7 +8612,13 @@ AddVolumeToHashTable(Volume * vp, VolumeId hashid)
 
     head->len++;
     vp->hashid = hashid;
+#ifdef AFS_VOL_HASH_LOCKLESS
+    VHashWriteBegin(head);
+    queue_Append(head, vp);
+    VHashWriteEnd(head);
+#else
     queue_Append(head, vp);
+#endif
     vp->vnodeHashOffset = VolumeHashOffset_r();
 }
 
@@ -8527,7 +8656,13 @@ DeleteVolumeFromHashTable(Volume * vp)
 #endif /* AFS_DEMAND_ATTACH_FS */
 
     head->len--;
+#ifdef AFS_VOL_HASH_LOCKLESS
+    VHashWriteBegin(head);
     queue_Remove(vp);
+    VHashWriteEnd(head);
+#else
+    queue_Remove(vp);
+#endif
     /* do NOT reset hashid to zero, as the online
      * salvager package may need to know the volume id
      * after the volume is removed from the hash */
@@ -8562,7 +8697,8 @@ DeleteVolumeFromHashTable(Volume * vp)
  *
  * @note For DAFS, the hint parameter allows us to short-circuit if the
  *       cacheCheck fields match between the hash chain head and the
- *       hint volume object.
+ *       hint volume object, or if the hint is still hashed under
+ *       volumeId.
  */
 Volume *
 VLookupVolume_r(Error * ec, VolumeId volumeId, Volume * hint)
@@ -8582,7 +8718,9 @@ VLookupVolume_r(Error * ec, VolumeId volumeId, Volume * hint)
     VHashWait_r(head);
 
     /* check to see if we can short circuit without walking the hash chain */
-    if (hint && (hint->chainCacheCheck == head->cacheCheck)) {
+    if (hint && ((hint->chainCacheCheck == head->cacheCheck) ||
+		 ((V_attachFlags(hint) & VOL_IN_HASH) &&
+		  hint->hashid == volumeId))) {
 	IncUInt64(&hint->stats.hash_short_circuits);
 	return hint;
     }
@@ -8678,7 +8816,13 @@ VReorderHash_r(VolumeHashChainHead * head, Volume * pp, Volume * vp)
     tp = queue_Next(tp, Volume);
 
     /* rebalance chain(vp,...,lp) ahead of chain(tp,...,pp) */
+#ifdef AFS_VOL_HASH_LOCKLESS
+    VHashWriteBegin(head);
+    queue_MoveChainBefore(tp,vp,lp);
+    VHashWriteEnd(head);
+#else
     queue_MoveChainBefore(tp,vp,lp);
+#endif
 
     VOL_LOCK;
     IncUInt64(&VStats.hash_reorders);
@@ -8773,12 +8917,194 @@ VHashEndExclusive_r(VolumeHashChainHead * head)
 static void
 VHashWait_r(VolumeHashChainHead * head)
 {
-    while (head->busy) {
-	VOL_CV_WAIT(&head->chain_busy_cv);
+    struct timeval start;
+
+    IncUInt64(&VLockStats.hash_chain.acquires);
+    if (head->busy) {
+	gettimeofday(&start, NULL);
+	do {
+	    VOL_CV_WAIT(&head->chain_busy_cv);
+	} while (head->busy);
+	VLockStatsWaited(&VLockStats.hash_chain, &start);
     }
 }
 #endif /* AFS_DEMAND_ATTACH_FS */
 
+#ifdef AFS_VOL_HASH_LOCKLESS
+/**
+ * mark the start of a modification to a volume hash chain.
+ *
+ * @param[in] head   pointer to volume hash chain head object
+ *
+ * @pre VOL_LOCK held, or thread owns the hash chain exclusively.
+ *
+ * @post chain sequence number is odd.  lockless readers which observe
+ *       this will abandon their walk of the chain.
+ *
+ * @see VHashWriteEnd
+ *
+ * @internal volume package internal use only.
+ */
+static_inline void
+VHashWriteBegin(VolumeHashChainHead * head)
+{
+    head->seq++;
+    __sync_synchronize();
+}
+
+/**
+ * mark the end of a modification to a volume hash chain.
+ *
+ * @param[in] head   pointer to volume hash chain head object
+ *
+ * @post chain sequence number is even, and differs from the value any
+ *       lockless reader saw before the modification began.
+ *
+ * @see VHashWriteBegin
+ *
+ * @internal volume package internal use only.
+ */
+static_inline void
+VHashWriteEnd(VolumeHashChainHead * head)
+{
+    __sync_synchronize();
+    head->seq++;
+}
+
+/**
+ * enter a lockless volume hash read-side section.
+ *
+ * @return reader slot to be handed to VHashReadEnd
+ *
+ * @post no volume object reachable from the hash will be freed until
+ *       VHashReadEnd is called.
+ *
+ * @internal volume package internal use only.
+ */
+static int
+VHashReadBegin(void)
+{
+    afs_uint32 h = (afs_uint32)(uintptr_t)pthread_self();
+    int slot;
+
+    /* scatter page aligned thread ids across the reader slots */
+    h *= 2654435761U;
+    slot = (h >> 24) & (VOL_HASH_READER_SLOTS - 1);
+
+    (void)__sync_add_and_fetch(&VolHashReaders[slot].count, 1);
+    return slot;
+}
+
+/**
+ * leave a lockless volume hash read-side section.
+ *
+ * @param[in] slot  reader slot returned by VHashReadBegin
+ *
+ * @note volume object pointers found inside the section must not be
+ *       dereferenced afterwards unless VOL_LOCK is held and the object
+ *       has been found to still be in the hash.
+ *
+ * @internal volume package internal use only.
+ */
+static void
+VHashReadEnd(int slot)
+{
+    (void)__sync_sub_and_fetch(&VolHashReaders[slot].count, 1);
+}
+
+/**
+ * lookup a volume object in the hash table without VOL_LOCK.
+ *
+ * @param[in] volumeId  volume id
+ *
+ * @return volume object pointer
+ *    @retval NULL  volume not found, or the hash chain changed while we
+ *                  were walking it
+ *
+ * @pre caller is inside a VHashReadBegin/VHashReadEnd section.
+ *
+ * @post returned volume object was hashed under volumeId at some point
+ *       during the call.  the result is only a hint; it must be checked
+ *       under VOL_LOCK before use.
+ *
+ * @note no statistics are kept and no reordering is done.  a NULL
+ *       return means the caller should fall back to VLookupVolume_r.
+ *
+ * @internal volume package internal use only.
+ */
+static Volume *
+VLookupVolumeLockless(VolumeId volumeId)
+{
+    VolumeHashChainHead * head;
+    Volume *vp;
+    afs_uint32 seq;
+    int tries;
+
+    head = &VolumeHashTable.Table[VOLUME_HASH(volumeId)];
+
+    for (tries = 0; tries < VOL_HASH_READER_RETRIES; tries++) {
+	seq = head->seq;
+	if (seq & 1)
+	    continue;
+	__sync_synchronize();
+
+	/* every link is checked against the chain sequence number before
+	 * it is followed, so that we never chase a pointer read from a
+	 * chain in the middle of being modified */
+	vp = queue_First(head, Volume);
+	for (;;) {
+	    __sync_synchronize();
+	    if (head->seq != seq || vp == NULL)
+		break;
+	    if (queue_IsEnd(head, vp))
+		return NULL;
+	    if (vp->hashid == volumeId) {
+		__sync_synchronize();
+		if (head->seq != seq)
+		    break;
+		return vp;
+	    }
+	    vp = queue_Next(vp, Volume);
+	}
+    }
+    return NULL;
+}
+
+/**
+ * free retired volume objects once no lockless reader can reach them.
+ *
+ * @pre VOL_LOCK held.
+ *
+ * @post if no lockless hash reader is active, all retired volume objects
+ *       are freed.  otherwise they are left for a later call.
+ *
+ * @internal volume package internal use only.
+ */
+static void
+VReclaimVolumes_r(void)
+{
+    Volume *vp, *np;
+    int i;
+
+    if (queue_IsEmpty(&volume_retired))
+	return;
+
+    /* the retired objects are already off their hash chains; any reader
+     * which started after that cannot find them, so we only have to wait
+     * for readers active right now */
+    __sync_synchronize();
+    for (i = 0; i < VOL_HASH_READER_SLOTS; i++) {
+	if (VolHashReaders[i].count)
+	    return;
+    }
+
+    for (queue_Scan(&volume_retired, vp, np, Volume)) {
+	queue_Remove(vp);
+	free(vp);
+    }
+}
+#endif /* AFS_VOL_HASH_LOCKLESS */
+
 
 /***************************************************/
 /* Volume by Partition List routines               */
@@ -8937,8 +9263,15 @@ VVByPListEndExclusive_r(struct DiskPartition64 * dp)
 static void
 VVByPListWait_r(struct DiskPartition64 * dp)
 {
-    while (dp->vol_list.busy) {
-	VOL_CV_WAIT(&dp->vol_list.cv);
+    struct timeval start;
+
+    IncUInt64(&VLockStats.vbyp.acquires);
+    if (dp->vol_list.busy) {
+	gettimeofday(&start, NULL);
+	do {
+	    VOL_CV_WAIT(&dp->vol_list.cv);
+	} while (dp->vol_list.busy);
+	VLockStatsWaited(&VLockStats.vbyp, &start);
     }
 }
 #endif /* AFS_DEMAND_ATTACH_FS */
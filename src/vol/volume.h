@@ -61,20 +61,59 @@ typedef bit32 FileOffset;	/* Offset in this file */
 #endif
 
 
+/**
+ * volume package lock contention statistics.
+ *
+ * each set of counters is only updated by a thread holding the lock it
+ * describes (VOL_LOCK for the exclusive states it protects).
+ */
+struct VLockStats {
+    afs_uint64 acquires;        /**< times the lock or state was entered */
+    afs_uint64 contended;       /**< entries which had to wait */
+    afs_uint64 wait_usecs;      /**< total time spent waiting */
+    afs_uint32 wait_max_usecs;  /**< longest single wait */
+};
+
+typedef struct VolPkgLockStats {
+    struct VLockStats glock;      /**< VOL_LOCK */
+    struct VLockStats trans;      /**< VTRANS_LOCK */
+#ifdef AFS_DEMAND_ATTACH_FS
+    /* waits for the exclusive states which subdivide VOL_LOCK */
+    struct VLockStats vol_state;  /**< per-volume exclusive states */
+    struct VLockStats vnode_state;/**< per-vnode exclusive states */
+    struct VLockStats vbyp;       /**< per-partition volume lists */
+    struct VLockStats hash_chain; /**< volume hash chains */
+    struct VLockStats vlru;       /**< VLRU generation queues */
+#endif /* AFS_DEMAND_ATTACH_FS */
+} VolPkgLockStats;
+extern VolPkgLockStats VLockStats;
+
 #ifdef AFS_PTHREAD_ENV
 #include <pthread.h>
 extern pthread_mutex_t vol_glock_mutex;
 extern pthread_mutex_t vol_trans_mutex;
+extern void VLockContended(pthread_mutex_t * lock, struct VLockStats * stats);
+extern void VLockStatsWaited(struct VLockStats * stats, struct timeval * start);
+
+/* take a volume package mutex, accounting for the time spent waiting */
+#define _VOL_MUTEX_ENTER(lock, stats) \
+    do { \
+	if (pthread_mutex_trylock(lock) != 0) \
+	    VLockContended((lock), (stats)); \
+	IncUInt64(&(stats)->acquires); \
+    } while (0)
 extern pthread_cond_t vol_put_volume_cond;
 extern pthread_cond_t vol_sleep_cond;
 extern pthread_cond_t vol_vinit_cond;
 extern ih_init_params vol_io_params;
 extern int vol_attach_threads;
+extern int vol_clone_threads;
+#define VOL_MAX_CLONE_THREADS 32
 #ifdef VOL_LOCK_DEBUG
 extern pthread_t vol_glock_holder;
 #define VOL_LOCK \
     do { \
-	opr_mutex_enter(&vol_glock_mutex); \
+	_VOL_MUTEX_ENTER(&vol_glock_mutex, &VLockStats.glock); \
 	VOL_LOCK_ASSERT_UNHELD; \
 	_VOL_LOCK_SET_HELD; \
     } while (0)
@@ -91,14 +130,14 @@ extern pthread_t vol_glock_holder;
         VOL_LOCK_DBG_CV_WAIT_END; \
     } while (0)
 #else /* !VOL_LOCK_DEBUG */
-#define VOL_LOCK opr_mutex_enter(&vol_glock_mutex)
+#define VOL_LOCK _VOL_MUTEX_ENTER(&vol_glock_mutex, &VLockStats.glock)
 #define VOL_UNLOCK opr_mutex_exit(&vol_glock_mutex)
 #define VOL_CV_WAIT(cv) opr_cv_wait((cv), &vol_glock_mutex)
 #endif /* !VOL_LOCK_DEBUG */
 
 #define VSALVSYNC_LOCK opr_mutex_enter(&vol_salvsync_mutex)
 #define VSALVSYNC_UNLOCK opr_mutex_exit(&vol_salvsync_mutex)
-#define VTRANS_LOCK opr_mutex_enter(&vol_trans_mutex)
+#define VTRANS_LOCK _VOL_MUTEX_ENTER(&vol_trans_mutex, &VLockStats.trans)
 #define VTRANS_UNLOCK opr_mutex_exit(&vol_trans_mutex)
 #else /* AFS_PTHREAD_ENV */
 #define VOL_LOCK
@@ -539,6 +578,8 @@ typedef struct VolumeHashChainHead {
 #ifdef AFS_DEMAND_ATTACH_FS
     int busy;
     int cacheCheck;
+    volatile afs_uint32 seq;    /**< chain sequence number; odd while the
+				 *   chain is being modified */
 
     /* per-chain statistics */
     afs_uint64 looks;
@@ -642,6 +683,15 @@ struct VCallByVol {
     struct rx_call *call;
 };
 
+/**
+ * per-volume vnode cache statistics.
+ */
+typedef struct VolumeVnodeCacheStats {
+    afs_uint32 hits;            /**< vnode gets satisfied from the cache */
+    afs_uint32 misses;          /**< vnode gets which had to read the vnode */
+    afs_uint32 evictions;       /**< cached vnodes recycled for another vnode */
+} VolumeVnodeCacheStats;
+
 typedef struct Volume {
     struct rx_queue q;          /* Volume hash chain pointers */
     VolumeId hashid;		/* Volume number -- for hash table lookup */
@@ -693,6 +743,7 @@ typedef struct Volume {
     struct rx_queue vnode_list; /**< linked list of cached vnodes for this volume */
     struct rx_queue rx_call_list; /**< linked list of split RX calls using this
                                    *   volume (fileserver only) */
+    VolumeVnodeCacheStats vnode_stats; /**< vnode cache statistics */
 #ifdef AFS_DEMAND_ATTACH_FS
     VolState attach_state;      /* what stage of attachment has been completed */
     afs_uint32 attach_flags;    /* flags related to attachment state */
@@ -527,9 +527,16 @@ VTimedWaitStateChange_r(Volume * vp, const struct timespec *ts, int *atimedout)
 static_inline void
 VWaitExclusiveState_r(Volume * vp)
 {
+    struct timeval start;
+
     opr_Assert(vp->nWaiters || vp->nUsers);
-    while (VIsExclusiveState(V_attachState(vp))) {
-	VOL_CV_WAIT(&V_attachCV(vp));
+    IncUInt64(&VLockStats.vol_state.acquires);
+    if (VIsExclusiveState(V_attachState(vp))) {
+	gettimeofday(&start, NULL);
+	do {
+	    VOL_CV_WAIT(&V_attachCV(vp));
+	} while (VIsExclusiveState(V_attachState(vp)));
+	VLockStatsWaited(&VLockStats.vol_state, &start);
     }
     opr_Assert(V_attachState(vp) != VOL_STATE_FREED);
 }
@@ -237,7 +237,8 @@ enum optionsList {
     OPT_syslog,
     OPT_logfile,
     OPT_config,
-    OPT_restricted_query
+    OPT_restricted_query,
+    OPT_clone_threads
 };
 
 static int
@@ -286,13 +287,17 @@ ParseArgs(int argc, char **argv) {
 	    CMD_OPTIONAL, "log to syslog");
 #endif
     cmd_AddParmAtOffset(opts, OPT_sync, "-sync",
-	    CMD_SINGLE, CMD_OPTIONAL, "always | onclose | never");
+	    CMD_SINGLE, CMD_OPTIONAL, "always | onclose | group | never");
     cmd_AddParmAtOffset(opts, OPT_logfile, "-logfile", CMD_SINGLE,
 	   CMD_OPTIONAL, "location of log file");
     cmd_AddParmAtOffset(opts, OPT_config, "-config", CMD_SINGLE,
 	   CMD_OPTIONAL, "configuration location");
     cmd_AddParmAtOffset(opts, OPT_restricted_query, "-restricted_query",
 	    CMD_SINGLE, CMD_OPTIONAL, "anyuser | admin");
+#ifdef AFS_PTHREAD_ENV
+    cmd_AddParmAtOffset(opts, OPT_clone_threads, "-clone-threads",
+	    CMD_SINGLE, CMD_OPTIONAL, "threads to clone each volume with");
+#endif
 
     code = cmd_Parse(argc, argv, &opts);
     if (code == CMD_HELP) {
@@ -368,6 +373,16 @@ ParseArgs(int argc, char **argv) {
 	}
 	free(restricted_query_parameter);
     }
+#ifdef AFS_PTHREAD_ENV
+    if (cmd_OptionAsInt(opts, OPT_clone_threads, &vol_clone_threads) == 0) {
+	if (vol_clone_threads < 1
+	    || vol_clone_threads > VOL_MAX_CLONE_THREADS) {
+	    printf("Invalid -clone-threads value %d; must be 1 to %d\n",
+		   vol_clone_threads, VOL_MAX_CLONE_THREADS);
+	    return -1;
+	}
+    }
+#endif
 
     return 0;
 }
@@ -475,7 +475,11 @@ static char *CbCounterStrings[] = {
     "nFEs", "nCBs", "nblks",
     "CBsTimedOut",
     "nbreakers",
-    "GSS1", "GSS2", "GSS3", "GSS4", "GSS5"
+    "GSS1", "GSS2", "GSS3", "GSS4", "GSS5",
+    "nBreakQueued", "BreakQueueHigh",
+    "BreakRPCs", "BreakFids",
+    "BreakRetries", "BreakDelayed", "BreakStalls",
+    "BreakLatency", "BreakLatencyMax"
 };
 
 
@@ -494,6 +498,75 @@ PrintCbCounters(void) {
 }
 
 
+void
+PrintVnodeCacheInfo(void)
+{
+    static char *classNames[] = { "large", "small" };
+    afs_int32 *val = xstat_fs_Results.data.AFS_CollData_val;
+    int len = xstat_fs_Results.data.AFS_CollData_len;
+    int numClasses, numVols, i, n;
+
+    if (len < 1)
+	return;
+    numClasses = val[0];
+    n = 1;
+    for (i = 0; i < numClasses && n + 6 <= len; i++, n += 6) {
+	printf("\t%s vnode cache:\n", i < 2 ? classNames[i] : "unknown");
+	printf("\t\t%10u cacheSize\n", val[n]);
+	printf("\t\t%10u gets\n", val[n + 1]);
+	printf("\t\t%10u reads\n", val[n + 2]);
+	printf("\t\t%10u evictions\n", val[n + 3]);
+	printf("\t\t%10u promotions\n", val[n + 4]);
+	printf("\t\t%10u probationary\n", val[n + 5]);
+    }
+    if (n >= len)
+	return;
+
+    numVols = val[n++];
+    printf("\t%d volumes with vnode cache activity:\n", numVols);
+    printf("\t\t%10s %10s %10s %10s\n", "volume", "hits", "misses",
+	   "evictions");
+    for (i = 0; i < numVols && n + 4 <= len; i++, n += 4) {
+	printf("\t\t%10u %10u %10u %10u\n", val[n], val[n + 1], val[n + 2],
+	       val[n + 3]);
+    }
+}
+
+
+void
+PrintAdmitInfo(void)
+{
+    static char *classNames[] = { "metadata", "bulk" };
+    afs_int32 *val = xstat_fs_Results.data.AFS_CollData_val;
+    int len = xstat_fs_Results.data.AFS_CollData_len;
+    int numClasses, i, n;
+
+    if (len < 8)
+	return;
+    printf("\t%10u slots\n", val[0]);
+    printf("\t%10u bulk slots\n", val[1]);
+    printf("\t%10u queue limit\n", val[2]);
+    printf("\t%10u wait limit (seconds)\n", val[3]);
+    printf("\t%10u hosts waiting\n", val[4]);
+    printf("\t%10u users waiting\n", val[5]);
+    printf("\t%10u most calls waiting\n", val[6]);
+    numClasses = val[7];
+    n = 8;
+    for (i = 0; i < numClasses && n + 9 <= len; i++, n += 9) {
+	printf("\t%s calls:\n", i < 2 ? classNames[i] : "unknown");
+	printf("\t\t%10u running\n", val[n]);
+	printf("\t\t%10u waiting\n", val[n + 1]);
+	printf("\t\t%10u admitted\n", val[n + 2]);
+	printf("\t\t%10u admitted after waiting\n", val[n + 3]);
+	printf("\t\t%10u busy\n", val[n + 4]);
+	printf("\t\t%10u pushed out\n", val[n + 5]);
+	printf("\t\t%10u timed out\n", val[n + 6]);
+	printf("\t\t%10u total wait (ms)\n", val[n + 7]);
+	printf("\t\t%10u longest wait (ms)\n", val[n + 8]);
+    }
+}
+
+
 /*------------------------------------------------------------------------
  * FS_Handler
  *
@@ -566,6 +639,14 @@ FS_Handler(void)
 	PrintCbCounters();
 	break;
 
+    case AFS_XSTATSCOLL_VNODE_INFO:
+	PrintVnodeCacheInfo();
+	break;
+
+    case AFS_XSTATSCOLL_ADMIT_INFO:
+	PrintAdmitInfo();
+	break;
+
     default:
 	printf("** Unknown collection: %d\n",
 	       xstat_fs_Results.collectionNumber);
@@ -0,0 +1,203 @@
+/* A microbenchmark for the rx event layer
+ *
+ * Each thread keeps a ring of outstanding events, and repeatedly cancels
+ * the oldest of them and posts a replacement, much as every call does with
+ * its resend, delayed ack and keepalive timers. A separate thread raises
+ * events as they come due, so that firing competes with posting and
+ * cancelling. The aggregate rate of post/cancel pairs is reported.
+ *
+ * usage: event-bench [-t threads] [-e events per thread] [-s seconds]
+ */
+
+#include <afsconfig.h>
+#include <afs/param.h>
+
+#include <roken.h>
+#include <pthread.h>
+
+#include "rx/rx_event.h"
+#include "rx/rx_clock.h"
+
+struct benchThread {
+    pthread_t thread;
+    int nevents;
+    struct rxevent **events;
+    unsigned int seed;
+    afs_uint64 ops;
+};
+
+static int rescheduled = 0;
+static int finished = 0;
+static pthread_mutex_t eventMutex;
+static pthread_cond_t eventCond;
+static volatile int stop = 0;
+static afs_uint64 fired = 0;
+
+static void
+reschedule(void)
+{
+    pthread_mutex_lock(&eventMutex);
+    pthread_cond_signal(&eventCond);
+    rescheduled = 1;
+    pthread_mutex_unlock(&eventMutex);
+}
+
+static void
+eventSub(struct rxevent *event, void *arg, void *arg1, int arg2)
+{
+    /* Only the event thread fires events, so this needs no lock */
+    fired++;
+}
+
+static void *
+eventHandler(void *dummy)
+{
+    struct timespec nextEvent;
+    struct clock cv;
+    struct clock next;
+
+    pthread_mutex_lock(&eventMutex);
+    while (!finished) {
+	pthread_mutex_unlock(&eventMutex);
+
+	next.sec = 30;
+	next.usec = 0;
+	clock_GetTime(&cv);
+	rxevent_RaiseEvents(&next);
+
+	pthread_mutex_lock(&eventMutex);
+	if (rescheduled) {
+	    rescheduled = 0;
+	    continue;
+	}
+
+	clock_Add(&cv, &next);
+	nextEvent.tv_sec = cv.sec;
+	nextEvent.tv_nsec = cv.usec * 1000;
+	pthread_cond_timedwait(&eventCond, &eventMutex, &nextEvent);
+    }
+    pthread_mutex_unlock(&eventMutex);
+
+    return NULL;
+}
+
+static void *
+benchThread(void *arg)
+{
+    struct benchThread *bt = arg;
+    struct clock now, when;
+    int i = 0;
+
+    while (!stop) {
+	if (bt->events[i] != NULL)
+	    rxevent_Cancel(&bt->events[i]);
+
+	/* Most events are timers a few RTTs out, some are seconds away */
+	clock_GetTime(&now);
+	when = now;
+	if (rand_r(&bt->seed) % 8 == 0)
+	    clock_Addmsec(&when, 1000 + rand_r(&bt->seed) % 30000);
+	else
+	    clock_Addmsec(&when, 5 + rand_r(&bt->seed) % 200);
+	bt->events[i] = rxevent_Post(&when, &now, eventSub, &bt->events[i],
+				     NULL, 0);
+	bt->ops++;
+
+	if (++i == bt->nevents)
+	    i = 0;
+    }
+
+    for (i = 0; i < bt->nevents; i++) {
+	if (bt->events[i] != NULL)
+	    rxevent_Cancel(&bt->events[i]);
+    }
+
+    return NULL;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+	    "usage: event-bench [-t threads] [-e events] [-s seconds]\n");
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct benchThread *threads;
+    struct timeval start, end;
+    pthread_t handler;
+    afs_uint64 total = 0;
+    double elapsed;
+    int nthreads = 4, nevents = 10000, seconds = 5;
+    int ch, i;
+
+    while ((ch = getopt(argc, argv, "t:e:s:")) != -1) {
+	switch (ch) {
+	case 't':
+	    nthreads = atoi(optarg);
+	    break;
+	case 'e':
+	    nevents = atoi(optarg);
+	    break;
+	case 's':
+	    seconds = atoi(optarg);
+	    break;
+	default:
+	    usage();
+	}
+    }
+    if (nthreads < 1 || nevents < 1 || seconds < 1)
+	usage();
+
+    pthread_mutex_init(&eventMutex, NULL);
+    pthread_cond_init(&eventCond, NULL);
+
+    rxevent_Init(20, reschedule);
+    if (pthread_create(&handler, NULL, eventHandler, NULL) != 0) {
+	fprintf(stderr, "Unable to create event thread\n");
+	exit(1);
+    }
+
+    threads = calloc(nthreads, sizeof(struct benchThread));
+    for (i = 0; i < nthreads; i++) {
+	threads[i].nevents = nevents;
+	threads[i].events = calloc(nevents, sizeof(struct rxevent *));
+	threads[i].seed = i + 1;
+    }
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < nthreads; i++) {
+	if (pthread_create(&threads[i].thread, NULL, benchThread,
+			   &threads[i]) != 0) {
+	    fprintf(stderr, "Unable to create benchmark thread\n");
+	    exit(1);
+	}
+    }
+
+    sleep(seconds);
+    stop = 1;
+
+    for (i = 0; i < nthreads; i++) {
+	pthread_join(threads[i].thread, NULL);
+	total += threads[i].ops;
+    }
+    gettimeofday(&end, NULL);
+
+    pthread_mutex_lock(&eventMutex);
+    finished = 1;
+    pthread_cond_signal(&eventCond);
+    pthread_mutex_unlock(&eventMutex);
+    pthread_join(handler, NULL);
+
+    elapsed = (end.tv_sec - start.tv_sec)
+	      + (end.tv_usec - start.tv_usec) / 1000000.0;
+    printf("%d threads, %d events each: %llu post/cancel pairs in %.2fs, "
+	   "%.0f per second, %llu fired\n",
+	   nthreads, nevents, (unsigned long long)total, elapsed,
+	   total / elapsed, (unsigned long long)fired);
+
+    return 0;
+}
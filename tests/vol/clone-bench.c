@@ -0,0 +1,209 @@
+/* A benchmark for volume cloning
+ *
+ * Creates a scratch volume on a vice partition with a given number of
+ * files, then clones it and removes the clone once for each number of
+ * clone threads asked for (see vol_clone_threads), timing each step.
+ * The partition must not be in use by a fileserver or volserver while
+ * this runs, since nothing here asks them for the volumes. Volume
+ * package messages go to the log named by -l.
+ *
+ * usage: clone-bench -p partition [-n files] [-t threads[,threads...]]
+ *                    [-v volume id] [-l log]
+ */
+
+#include <afsconfig.h>
+#include <afs/param.h>
+
+#include <roken.h>
+
+#include <afs/opr.h>
+#include <rx/rx_queue.h>
+#include <afs/afsint.h>
+#include <afs/afssyscalls.h>
+#include <afs/afsutil.h>
+#include <lwp.h>
+#include <lock.h>
+#include "vol/nfs.h"
+#include "vol/ihandle.h"
+#include "vol/vnode.h"
+#include "vol/volume.h"
+#include "vol/partition.h"
+#include "vol/vol_prototypes.h"
+
+/* stdout, before OpenLog takes it over */
+static FILE *out;
+
+static double
+since(struct timeval *start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec)
+	   + (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: clone-bench -p partition [-n files] "
+	    "[-t threads[,threads...]] [-v volume id] [-l log]\n");
+    exit(1);
+}
+
+/* Give the volume nfiles empty files, each with its own inode. */
+static void
+fillVolume(Volume *vp, int nfiles)
+{
+    struct VnodeClassInfo *vcp = &VnodeClassInfo[vSmall];
+    char buf[SIZEOF_SMALLDISKVNODE];
+    struct VnodeDiskObject *vnode = (struct VnodeDiskObject *)buf;
+    FdHandle_t *fdP;
+    Inode ino;
+    VnodeId vnodeNumber;
+    int i;
+
+    fdP = IH_OPEN(vp->vnodeIndex[vSmall].handle);
+    if (fdP == NULL) {
+	fprintf(out, "Cannot open the small vnode index\n");
+	exit(1);
+    }
+    for (i = 0; i < nfiles; i++) {
+	vnodeNumber = bitNumberToVnodeNumber(i, vSmall);
+	ino = IH_CREATE(V_linkHandle(vp), V_device(vp),
+			VPartitionPath(V_partition(vp)), 0, V_id(vp),
+			vnodeNumber, 1, 1);
+	if (!VALID_INO(ino)) {
+	    fprintf(out, "Cannot create inode for vnode %u: %s\n",
+		    vnodeNumber, strerror(errno));
+	    exit(1);
+	}
+	memset(buf, 0, sizeof(buf));
+	vnode->type = vFile;
+	vnode->vnodeMagic = vcp->magic;
+	vnode->linkCount = 1;
+	vnode->uniquifier = 1;
+	vnode->dataVersion = 1;
+	vnode->modeBits = 0644;
+	VNDISK_SET_INO(vnode, ino);
+	if (FDH_PWRITE(fdP, buf, vcp->diskSize,
+		       vnodeIndexOffset(vcp, vnodeNumber)) != vcp->diskSize) {
+	    fprintf(out, "Cannot write vnode %u: %s\n", vnodeNumber,
+		    strerror(errno));
+	    exit(1);
+	}
+    }
+    FDH_SYNC(fdP);
+    FDH_CLOSE(fdP);
+}
+
+/* Destroy a volume we created. */
+static void
+removeVolume(Volume *vp)
+{
+    Error ec;
+
+    VPurgeVolume(&ec, vp);
+    V_destroyMe(vp) = DESTROY_ME;
+    VDetachVolume(&ec, vp);
+}
+
+int
+main(int argc, char **argv)
+{
+    VolumePackageOptions opts;
+    struct timeval start;
+    char *partition = NULL, *threadList = "1,2,4,8", *tl, *t;
+    char *logFile = "clone-bench.log";
+    VolumeId volid = 2000000000, cloneid;
+    Volume *vp, *clvp;
+    Error ec;
+    int nfiles = 100000, threads;
+    int ch;
+
+    while ((ch = getopt(argc, argv, "p:n:t:v:l:")) != -1) {
+	switch (ch) {
+	case 'p':
+	    partition = optarg;
+	    break;
+	case 'n':
+	    nfiles = atoi(optarg);
+	    break;
+	case 't':
+	    threadList = optarg;
+	    break;
+	case 'v':
+	    volid = strtoul(optarg, NULL, 10);
+	    break;
+	case 'l':
+	    logFile = optarg;
+	    break;
+	default:
+	    usage();
+	}
+    }
+    if (partition == NULL || nfiles < 1 || volid == 0)
+	usage();
+
+    /* Log() writes nowhere until a log is opened */
+    out = fdopen(dup(fileno(stdout)), "w");
+    if (out == NULL || OpenLog(logFile) != 0) {
+	fprintf(stderr, "Cannot open log %s\n", logFile);
+	exit(1);
+    }
+    setvbuf(out, NULL, _IOLBF, 0);
+
+    /* Like the salvager, we neither lock the partition nor ask a
+     * fileserver for the volumes. */
+    VOptDefaults(salvager, &opts);
+    if (VInitVolumePackage2(salvager, &opts)) {
+	fprintf(out, "Cannot initialize the volume package\n");
+	exit(1);
+    }
+
+    vp = VCreateVolume(&ec, partition, volid, volid);
+    if (vp == NULL) {
+	fprintf(out, "Cannot create volume %lu on %s: %d\n",
+		afs_printable_uint32_lu(volid), partition, ec);
+	exit(1);
+    }
+    gettimeofday(&start, NULL);
+    fillVolume(vp, nfiles);
+    fprintf(out, "created %d files in %.3fs\n", nfiles, since(&start));
+
+    cloneid = volid + 1;
+    tl = strdup(threadList);
+    for (t = strtok(tl, ","); t != NULL; t = strtok(NULL, ",")) {
+	threads = atoi(t);
+	if (threads < 1 || threads > VOL_MAX_CLONE_THREADS) {
+	    fprintf(out, "Skipping bad thread count %s\n", t);
+	    continue;
+	}
+	vol_clone_threads = threads;
+
+	clvp = VCreateVolume(&ec, partition, cloneid, volid);
+	if (clvp == NULL) {
+	    fprintf(out, "Cannot create clone %lu: %d\n",
+		    afs_printable_uint32_lu(cloneid), ec);
+	    break;
+	}
+	gettimeofday(&start, NULL);
+	CloneVolume(&ec, vp, clvp, NULL);
+	fprintf(out, "%2d threads: clone %8.3fs", threads, since(&start));
+	if (ec) {
+	    fprintf(out, " failed: %d\n", ec);
+	    removeVolume(clvp);
+	    break;
+	}
+	gettimeofday(&start, NULL);
+	removeVolume(clvp);
+	fprintf(out, ", remove %8.3fs\n", since(&start));
+    }
+    free(tl);
+
+    gettimeofday(&start, NULL);
+    removeVolume(vp);
+    fprintf(out, "removed volume in %.3fs\n", since(&start));
+    VShutdown();
+    return 0;
+}
@@ -0,0 +1,269 @@
+/* A microbenchmark for the ihandle io_uring backend
+ *
+ * Reads random blocks of a file, first one pread at a time as the
+ * fileserver normally does, and then through ih_uring_submitv with
+ * increasing numbers of reads in flight. Then it rewrites a block of each
+ * of a set of files and syncs them, first one fsync after another and
+ * then with ih_uring_fsync_async, as IH_CONDSYNC does when a volume is
+ * detached. Unless -f names a file on the storage of interest, the reads
+ * come from a scratch file that is likely to be in the page cache, and so
+ * mostly measure the system call overhead.
+ *
+ * usage: uring-bench [-f file] [-b blocksize] [-n reads] [-s files]
+ */
+
+#include <afsconfig.h>
+#include <afs/param.h>
+
+#include <roken.h>
+
+#ifdef HAVE_IO_URING
+
+#include <linux/io_uring.h>
+
+#include <afs/afsint.h>
+#include <afs/afssyscalls.h>
+#include "vol/nfs.h"
+#include "vol/ihandle.h"
+
+static const int depths[] = { 1, 4, 16, IH_URING_MAXOPS };
+
+static double
+since(struct timeval *start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec)
+	   + (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+static void
+report(const char *what, int n, double elapsed)
+{
+    printf("%-28s %8d in %7.3fs, %10.0f per second\n", what, n, elapsed,
+	   n / elapsed);
+}
+
+static FD_t
+makeFile(char *path, off_t size, int blocksize, char *buf)
+{
+    FD_t fd;
+    off_t off;
+
+    fd = mkstemp(path);
+    if (fd < 0) {
+	perror(path);
+	exit(1);
+    }
+    unlink(path);
+    for (off = 0; off < size; off += blocksize) {
+	if (pwrite(fd, buf, blocksize, off) != blocksize) {
+	    perror("pwrite");
+	    exit(1);
+	}
+    }
+    return fd;
+}
+
+static void
+benchReads(FD_t fd, off_t size, int blocksize, int nreads)
+{
+    struct ih_uring_op ops[IH_URING_MAXOPS];
+    struct timeval start;
+    char label[64];
+    off_t nblocks = size / blocksize;
+    off_t *offsets;
+    char *bufs;
+    int i, j, d, depth;
+
+    offsets = malloc(nreads * sizeof(off_t));
+    bufs = malloc((size_t)IH_URING_MAXOPS * blocksize);
+    if (offsets == NULL || bufs == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	exit(1);
+    }
+    srandom(1);
+    for (i = 0; i < nreads; i++)
+	offsets[i] = (random() % nblocks) * blocksize;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < nreads; i++) {
+	if (OS_PREAD(fd, bufs, blocksize, offsets[i]) != blocksize) {
+	    perror("pread");
+	    exit(1);
+	}
+    }
+    report("pread", nreads, since(&start));
+
+    for (d = 0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+	depth = depths[d];
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nreads; i += depth) {
+	    int n = (nreads - i < depth) ? nreads - i : depth;
+
+	    for (j = 0; j < n; j++) {
+		ops[j].op = IORING_OP_READ;
+		ops[j].fd = fd;
+		ops[j].buf = bufs + (size_t)j * blocksize;
+		ops[j].len = blocksize;
+		ops[j].offset = offsets[i + j];
+	    }
+	    if (ih_uring_submitv(ops, n) != 0) {
+		fprintf(stderr, "ih_uring_submitv failed\n");
+		exit(1);
+	    }
+	    for (j = 0; j < n; j++) {
+		if (ops[j].res != blocksize) {
+		    fprintf(stderr, "read failed: %s\n", strerror(ops[j].err));
+		    exit(1);
+		}
+	    }
+	}
+	snprintf(label, sizeof(label), "io_uring, %d in flight", depth);
+	report(label, nreads, since(&start));
+    }
+
+    free(bufs);
+    free(offsets);
+}
+
+static void
+benchSyncs(const char *dir, int nfiles, int blocksize, char *buf)
+{
+    struct timeval start;
+    char path[MAXPATHLEN];
+    FD_t *fds;
+    int i, pass;
+
+    fds = malloc(nfiles * sizeof(FD_t));
+    if (fds == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	exit(1);
+    }
+    for (i = 0; i < nfiles; i++) {
+	snprintf(path, sizeof(path), "%s/uring-bench.XXXXXX", dir);
+	fds[i] = makeFile(path, blocksize, blocksize, buf);
+    }
+
+    for (pass = 0; pass < 2; pass++) {
+	for (i = 0; i < nfiles; i++) {
+	    if (pwrite(fds[i], buf, blocksize, 0) != blocksize) {
+		perror("pwrite");
+		exit(1);
+	    }
+	}
+	gettimeofday(&start, NULL);
+	if (pass == 0) {
+	    for (i = 0; i < nfiles; i++)
+		fsync(fds[i]);
+	    report("fsync", nfiles, since(&start));
+	} else {
+	    for (i = 0; i < nfiles; i++)
+		ih_uring_fsync_async(fds[i]);
+	    if (ih_uring_drain() != 0)
+		fprintf(stderr, "Some fsyncs failed\n");
+	    report("io_uring async fsync", nfiles, since(&start));
+	}
+    }
+
+    for (i = 0; i < nfiles; i++)
+	close(fds[i]);
+    free(fds);
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: uring-bench [-f file] [-b blocksize] "
+	    "[-n reads] [-s files]\n");
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    char path[MAXPATHLEN];
+    const char *dir, *file = NULL;
+    struct stat st;
+    int blocksize = 4096, nreads = 100000, nfiles = 16;
+    off_t size = 64 * 1024 * 1024;
+    char *buf;
+    FD_t fd;
+    int ch, code;
+
+    while ((ch = getopt(argc, argv, "f:b:n:s:")) != -1) {
+	switch (ch) {
+	case 'f':
+	    file = optarg;
+	    break;
+	case 'b':
+	    blocksize = atoi(optarg);
+	    break;
+	case 'n':
+	    nreads = atoi(optarg);
+	    break;
+	case 's':
+	    nfiles = atoi(optarg);
+	    break;
+	default:
+	    usage();
+	}
+    }
+    if (blocksize < 1 || nreads < 1 || nfiles < 1)
+	usage();
+
+    code = ih_uring_init(IH_URING_MAXOPS);
+    if (code) {
+	fprintf(stderr, "Cannot set up io_uring: %s\n", strerror(code));
+	exit(1);
+    }
+
+    buf = malloc(blocksize);
+    if (buf == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	exit(1);
+    }
+    memset(buf, 'x', blocksize);
+
+    dir = getenv("TMPDIR");
+    if (dir == NULL)
+	dir = "/tmp";
+    if (file != NULL) {
+	fd = open(file, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+	    perror(file);
+	    exit(1);
+	}
+	size = st.st_size;
+	if (size < blocksize) {
+	    fprintf(stderr, "%s is smaller than one block\n", file);
+	    exit(1);
+	}
+    } else {
+	snprintf(path, sizeof(path), "%s/uring-bench.XXXXXX", dir);
+	fd = makeFile(path, size, blocksize, buf);
+    }
+
+    printf("%d random %d byte reads of a %lld byte file\n", nreads,
+	   blocksize, (long long)size);
+    benchReads(fd, size, blocksize, nreads);
+    close(fd);
+
+    printf("%d files rewritten and synced in %s\n", nfiles, dir);
+    benchSyncs(dir, nfiles, blocksize, buf);
+
+    free(buf);
+    return 0;
+}
+
+#else /* !HAVE_IO_URING */
+
+int
+main(int argc, char **argv)
+{
+    fprintf(stderr, "uring-bench: io_uring is not supported here\n");
+    return 1;
+}
+
+#endif /* !HAVE_IO_URING */